@@ -0,0 +1,65 @@
+#include "arena.h"
+#include <cstdlib>
+
+static const size_t block_size = 64 * 1024;
+
+static void free_blocks(void *&blocks)
+{
+   while (blocks != nullptr)
+   {
+      void *next = *(void **)blocks;
+      free(blocks);
+      blocks = next;
+   }
+}
+
+//Every block starts with a link to the one allocated before it.
+void *Arena::allocate(size_t size, size_t align)
+{
+   char *p = (char *)(((size_t)pos_ + align - 1) & ~(align - 1));
+   if (pos_ == nullptr || p + size > end_)
+   {
+      //Large objects get a block of their own and leave the current one open.
+      size_t n = sizeof(void *) + align + size;
+      bool large = n > block_size / 4;
+      char *block;
+      if (!large && free_ != nullptr)
+      {
+         block = (char *)free_;
+         free_ = *(void **)block;
+      }
+      else if ((block = (char *)malloc(large ? n : block_size)) == nullptr)
+         throw std::bad_alloc();
+      void *&chain = large ? large_ : blocks_;
+      *(void **)block = chain;
+      chain = block;
+      p = (char *)(((size_t)(block + sizeof(void *)) + align - 1) & ~(align - 1));
+      if (large)
+         return p;
+      end_ = block + block_size;
+   }
+   pos_ = p + size;
+   return p;
+}
+
+void Arena::reset()
+{
+   for (Cleanup *c = cleanups_; c != nullptr; c = c->next)
+      c->destroy(c->object);
+   cleanups_ = nullptr;
+   free_blocks(large_);
+   while (blocks_ != nullptr)
+   {
+      void *next = *(void **)blocks_;
+      *(void **)blocks_ = free_;
+      free_ = blocks_;
+      blocks_ = next;
+   }
+   pos_ = end_ = nullptr;
+}
+
+Arena::~Arena()
+{
+   reset();
+   free_blocks(free_);
+}
@@ -0,0 +1,65 @@
+#pragma once
+#ifndef COMPILER_ARENA_H_
+#define COMPILER_ARENA_H_
+#include <cstddef>
+#include <new>
+#include <utility>
+#include <type_traits>
+#include <vector>
+#include <algorithm>
+
+//A fixed run of child pointers laid out in an arena, e.g. the statements of a block.
+template <class T> class NodeList
+{
+   T *first_;
+   size_t size_;
+public:
+   NodeList(): first_(nullptr), size_(0) {}
+   NodeList(T *first, size_t size): first_(first), size_(size) {}
+   T *begin() const { return first_; }
+   T *end() const { return first_ + size_; }
+   size_t size() const { return size_; }
+   bool empty() const { return size_ == 0; }
+   T &operator [](size_t i) const { return first_[i]; }
+};
+
+//Bump allocator for the tree, symbols and types of one compilation. Nothing is freed
+//until the arena goes or is reset; objects with a destructor are chained so that it still
+//runs. A reset arena keeps its blocks for the next compilation.
+class Arena
+{
+   struct Cleanup
+   {
+      Cleanup *next;
+      void (*destroy)(void *);
+      void *object;
+   };
+   char *pos_, *end_;
+   void *blocks_, *large_, *free_;
+   Cleanup *cleanups_;
+   void *allocate(size_t size, size_t align);
+   template <class T> static void destroy(void *p) { static_cast<T *>(p)->~T(); }
+public:
+   Arena(): pos_(nullptr), end_(nullptr), blocks_(nullptr), large_(nullptr), free_(nullptr), cleanups_(nullptr) {}
+   Arena(const Arena &) = delete;
+   Arena &operator =(const Arena &) = delete;
+   ~Arena();
+   void reset();
+   template <class T, class... Args> T *make(Args&&... args)
+   {
+      if (std::is_trivially_destructible<T>::value)
+         return new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+      void *c = allocate(sizeof(Cleanup), alignof(Cleanup));
+      T *object = new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+      cleanups_ = new (c) Cleanup{cleanups_, &destroy<T>, object};
+      return object;
+   }
+   template <class T> NodeList<T> list(const std::vector<T> &items)
+   {
+      T *first = static_cast<T *>(allocate(items.size() * sizeof(T), alignof(T)));
+      std::copy(items.begin(), items.end(), first);
+      return NodeList<T>(first, items.size());
+   }
+};
+
+#endif
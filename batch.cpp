@@ -0,0 +1,103 @@
+#include "batch.h"
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <iomanip>
+#include <thread>
+
+static const std::string ext = "asm";
+
+std::string output_name(const std::string &input)
+{
+   std::string out_name = input;
+   for(size_t i = out_name.size() - 1, j = ext.size() - 1; i > out_name.size() - 4; --i, --j)
+      out_name[i] = ext[j];
+   return out_name;
+}
+
+//An argument is an input, or @name for a file that lists one input a line.
+bool Batch::add(const std::string &arg)
+{
+   if (arg.empty() || arg[0] != '@')
+   {
+      inputs_.push_back(arg);
+      return true;
+   }
+   std::ifstream list(arg.substr(1));
+   if (!list)
+      return false;
+   for (std::string line; std::getline(list, line);)
+   {
+      while (!line.empty() && isspace((unsigned char)line.back()))
+         line.pop_back();
+      if (!line.empty())
+         inputs_.push_back(line);
+   }
+   return true;
+}
+
+struct BatchJob
+{
+   bool opened, failed;
+   double ms;
+};
+
+static BatchJob compile_job(Compiler &compiler, CompileMode mode, CodeCache *cache, const std::string &input)
+{
+   BatchJob job = {false, false, 0};
+   auto start = std::chrono::steady_clock::now();
+   std::string source;
+   if (!read_source(input, source))
+      return job;
+   job.opened = true;
+   CompileOptions options(mode);
+   options.name = input;
+   options.cache = cache;
+   CompileResult result = compiler.compile(source, options);
+   job.failed = !result.ok;
+   std::ofstream output(output_name(input), std::ios::out);
+   output << result.output;
+   output.close();
+   job.ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+   return job;
+}
+
+//Reports each file in the order given once all are done, then the totals.
+void Batch::run(unsigned threads)
+{
+   auto start = std::chrono::steady_clock::now();
+   std::vector<BatchJob> jobs(inputs_.size());
+   std::atomic<size_t> next(0);
+   auto work = [&]()
+   {
+      Compiler compiler;
+      for (size_t i; (i = next++) < inputs_.size();)
+         jobs[i] = compile_job(compiler, mode_, cache_, inputs_[i]);
+   };
+   std::vector<std::thread> workers;
+   for (unsigned t = 1; t < threads && t < inputs_.size(); ++t)
+      workers.emplace_back(work);
+   work();
+   for each (auto &w in workers)
+      w.join();
+   double wall = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+   size_t failed = 0, missing = 0;
+   double total = 0;
+   std::cout << std::fixed << std::setprecision(1);
+   for (size_t i = 0; i < inputs_.size(); ++i)
+   {
+      if (!jobs[i].opened)
+      {
+         ++missing;
+         std::cout << inputs_[i] << ": error opening file" << std::endl;
+         continue;
+      }
+      failed += jobs[i].failed;
+      total += jobs[i].ms;
+      std::cout << output_name(inputs_[i]) << (jobs[i].failed ? ": error in " : ": compiled in ") << jobs[i].ms << " ms" << std::endl;
+   }
+   std::cout << inputs_.size() << " files, " << failed << " with errors, " << missing << " not opened: " << wall << " ms on "
+      << std::max(std::min<size_t>(threads, inputs_.size()), (size_t)1) << " threads, " << total << " ms in all" << std::endl;
+}
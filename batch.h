@@ -0,0 +1,25 @@
+#pragma once
+#ifndef COMPILER_BATCH_H_
+#define COMPILER_BATCH_H_
+#include "compiler.h"
+
+//The name of the .asm written next to an input.
+std::string output_name(const std::string &input);
+
+//Compiles many files at once on a pool of threads, each thread with a compiler of its own.
+//An error is written to the file's output and the batch goes on.
+class Batch
+{
+   CompileMode mode_;
+   CodeCache *cache_;
+   std::vector<std::string> inputs_;
+public:
+   Batch(CompileMode mode, CodeCache *cache = nullptr): mode_(mode), cache_(cache) {}
+   ~Batch() {}
+   bool add(const std::string &arg);
+   size_t size() const { return inputs_.size(); }
+   const std::string &input(size_t i) const { return inputs_[i]; }
+   void run(unsigned threads);
+};
+
+#endif
@@ -0,0 +1,231 @@
+#include "charscan.h"
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define CHARSCAN_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define TARGET_SSE2
+#define TARGET_AVX2
+#else
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+static inline unsigned bit_count(unsigned m)
+{
+   m = m - ((m >> 1) & 0x55555555);
+   m = (m & 0x33333333) + ((m >> 2) & 0x33333333);
+   return (((m + (m >> 4)) & 0x0F0F0F0F) * 0x01010101) >> 24;
+}
+
+static inline unsigned lowest_bit(unsigned m)
+{
+#ifdef _MSC_VER
+   unsigned long i;
+   _BitScanForward(&i, m);
+   return i;
+#else
+   return __builtin_ctz(m);
+#endif
+}
+
+static inline unsigned highest_bit(unsigned m)
+{
+#ifdef _MSC_VER
+   unsigned long i;
+   _BitScanReverse(&i, m);
+   return i;
+#else
+   return 31 - __builtin_clz(m);
+#endif
+}
+
+//Folds the newline mask of one block (limited to the bits before the stop) into the counters.
+static inline void add_newlines(const char *block, unsigned nl, size_t &newlines, const char *&line_start)
+{
+   if (nl)
+   {
+      newlines += bit_count(nl);
+      line_start = block + highest_bit(nl) + 1;
+   }
+}
+
+static const char *skip_blanks_scalar(const char *p, const char *end, size_t &newlines, const char *&line_start)
+{
+   for (; p < end; ++p)
+   {
+      if (*p == '\n')
+      {
+         ++newlines;
+         line_start = p + 1;
+      }
+      else if (*p != ' ' && *p != '\t')
+         break;
+   }
+   return p;
+}
+
+static const char *find_char_scalar(const char *p, const char *end, char c)
+{
+   while (p < end && *p != c)
+      ++p;
+   return p;
+}
+
+static size_t count_char_scalar(const char *p, const char *end, char c)
+{
+   size_t n = 0;
+   for (; p < end; ++p)
+      n += *p == c;
+   return n;
+}
+
+#ifdef CHARSCAN_X86
+TARGET_SSE2 static const char *skip_blanks_sse2(const char *p, const char *end, size_t &newlines, const char *&line_start)
+{
+   const __m128i space = _mm_set1_epi8(' '), tab = _mm_set1_epi8('\t'), newline = _mm_set1_epi8('\n');
+   for (; end - p >= 16; p += 16)
+   {
+      __m128i v = _mm_loadu_si128((const __m128i *)p);
+      unsigned nl = _mm_movemask_epi8(_mm_cmpeq_epi8(v, newline));
+      unsigned blank = nl | _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, space), _mm_cmpeq_epi8(v, tab)));
+      if (blank != 0xFFFF)
+      {
+         unsigned i = lowest_bit(~blank);
+         add_newlines(p, nl & ((1u << i) - 1), newlines, line_start);
+         return p + i;
+      }
+      add_newlines(p, nl, newlines, line_start);
+   }
+   return skip_blanks_scalar(p, end, newlines, line_start);
+}
+
+TARGET_SSE2 static const char *find_char_sse2(const char *p, const char *end, char c)
+{
+   const __m128i key = _mm_set1_epi8(c);
+   for (; end - p >= 16; p += 16)
+   {
+      unsigned m = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)p), key));
+      if (m)
+         return p + lowest_bit(m);
+   }
+   return find_char_scalar(p, end, c);
+}
+
+TARGET_SSE2 static size_t count_char_sse2(const char *p, const char *end, char c)
+{
+   const __m128i key = _mm_set1_epi8(c);
+   size_t n = 0;
+   for (; end - p >= 16; p += 16)
+      n += bit_count(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)p), key)));
+   return n + count_char_scalar(p, end, c);
+}
+
+TARGET_AVX2 static const char *skip_blanks_avx2(const char *p, const char *end, size_t &newlines, const char *&line_start)
+{
+   const __m256i space = _mm256_set1_epi8(' '), tab = _mm256_set1_epi8('\t'), newline = _mm256_set1_epi8('\n');
+   for (; end - p >= 32; p += 32)
+   {
+      __m256i v = _mm256_loadu_si256((const __m256i *)p);
+      unsigned nl = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, newline));
+      unsigned blank = nl | _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, space), _mm256_cmpeq_epi8(v, tab)));
+      if (blank != 0xFFFFFFFF)
+      {
+         unsigned i = lowest_bit(~blank);
+         add_newlines(p, nl & ((1u << i) - 1), newlines, line_start);
+         return p + i;
+      }
+      add_newlines(p, nl, newlines, line_start);
+   }
+   return skip_blanks_sse2(p, end, newlines, line_start);
+}
+
+TARGET_AVX2 static const char *find_char_avx2(const char *p, const char *end, char c)
+{
+   const __m256i key = _mm256_set1_epi8(c);
+   for (; end - p >= 32; p += 32)
+   {
+      unsigned m = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)p), key));
+      if (m)
+         return p + lowest_bit(m);
+   }
+   return find_char_sse2(p, end, c);
+}
+
+TARGET_AVX2 static size_t count_char_avx2(const char *p, const char *end, char c)
+{
+   const __m256i key = _mm256_set1_epi8(c);
+   size_t n = 0;
+   for (; end - p >= 32; p += 32)
+      n += bit_count(_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)p), key)));
+   return n + count_char_sse2(p, end, c);
+}
+
+static bool has_sse2()
+{
+#ifdef _MSC_VER
+   int info[4];
+   __cpuid(info, 1);
+   return (info[3] & (1 << 26)) != 0;
+#else
+   return __builtin_cpu_supports("sse2");
+#endif
+}
+
+static bool has_avx2()
+{
+#ifdef _MSC_VER
+   int info[4];
+   __cpuid(info, 0);
+   if (info[0] < 7)
+      return false;
+   __cpuid(info, 1);
+   if (!(info[2] & (1 << 27)) || (_xgetbv(0) & 6) != 6)
+      return false;
+   __cpuidex(info, 7, 0);
+   return (info[1] & (1 << 5)) != 0;
+#else
+   return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif
+
+struct CharScanKernels
+{
+   const char *(*skip_blanks)(const char *p, const char *end, size_t &newlines, const char *&line_start);
+   const char *(*find_char)(const char *p, const char *end, char c);
+   size_t (*count_char)(const char *p, const char *end, char c);
+};
+
+static CharScanKernels select_kernels()
+{
+#ifdef CHARSCAN_X86
+#ifndef _MSC_VER
+   __builtin_cpu_init();
+#endif
+   if (has_avx2())
+      return CharScanKernels{skip_blanks_avx2, find_char_avx2, count_char_avx2};
+   if (has_sse2())
+      return CharScanKernels{skip_blanks_sse2, find_char_sse2, count_char_sse2};
+#endif
+   return CharScanKernels{skip_blanks_scalar, find_char_scalar, count_char_scalar};
+}
+
+static const CharScanKernels kernels = select_kernels();
+
+const char *skip_blanks(const char *p, const char *end, size_t &newlines, const char *&line_start)
+{
+   return kernels.skip_blanks(p, end, newlines, line_start);
+}
+
+const char *find_char(const char *p, const char *end, char c)
+{
+   return kernels.find_char(p, end, c);
+}
+
+size_t count_char(const char *p, const char *end, char c)
+{
+   return kernels.count_char(p, end, c);
+}
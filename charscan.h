@@ -0,0 +1,16 @@
+#pragma once
+#ifndef COMPILER_CHARSCAN_H_
+#define COMPILER_CHARSCAN_H_
+#include <cstddef>
+
+//Block scans over the source buffer. An SSE2 or AVX2 version is picked at startup
+//when the processor has it, otherwise a plain loop is used.
+
+//Skips ' ', '\t' and '\n'. Counts the newlines passed and, if any, sets line_start
+//to the character after the last one.
+const char *skip_blanks(const char *p, const char *end, size_t &newlines, const char *&line_start);
+//First occurrence of c, or end.
+const char *find_char(const char *p, const char *end, char c);
+size_t count_char(const char *p, const char *end, char c);
+
+#endif
@@ -0,0 +1,130 @@
+#include "codecache.h"
+#include "hash.h"
+#include <random>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#define make_dir(name) _mkdir(name)
+#else
+#define make_dir(name) mkdir(name, 0777)
+#endif
+
+//Changes whenever the code generated for the same procedure may change.
+static const std::string format = "notFreePascal code 8";
+
+CodeCache::CodeCache(const std::string &dir, bool check): dir_(dir), check_(check), hits_(0), misses_(0), mismatches_(0),
+   written_(0), writer_(boost::lexical_cast<std::string>(std::random_device()()))
+{
+   make_dir(dir_.c_str());
+}
+
+static bool read_file(const std::string &name, std::string &data)
+{
+   FILE *input = _fsopen(name.c_str(), "rb", _SH_DENYWR);
+   if (input == nullptr)
+      return false;
+   _fseeki64(input, 0, SEEK_END);
+   data.resize((size_t)_ftelli64(input));
+   _fseeki64(input, 0, SEEK_SET);
+   data.resize(fread(&data[0], 1, data.size(), input));
+   fclose(input);
+   return true;
+}
+
+std::string CodeCache::path(unsigned long long key) const
+{
+   char name[32];
+   sprintf(name, "/%016llx.code", key);
+   return dir_ + name;
+}
+
+bool CodeCache::load(unsigned long long key, Generator &part)
+{
+   std::string code;
+   size_t head = format.size() + 1;
+   if (!read_file(path(key), code) || code.compare(0, head, format + '\n') != 0 || !part.load(code.data() + head, code.data() + code.size()))
+   {
+      ++misses_;
+      return false;
+   }
+   ++hits_;
+   return true;
+}
+
+//Written under a name of its own and renamed, so a reader never sees half a file. When
+//two writers race, either file will do.
+void CodeCache::store(unsigned long long key, const Generator &part)
+{
+   std::ostringstream code;
+   code << format << '\n';
+   part.save(code);
+   std::string text = code.str(), name = path(key);
+   std::string temp = name + "." + writer_ + "." + boost::lexical_cast<std::string>(written_++);
+   FILE *output = fopen(temp.c_str(), "wb");
+   if (output == nullptr)
+      return;
+   bool written = fwrite(text.data(), 1, text.size(), output) == text.size();
+   if (fclose(output) != 0 || !written || rename(temp.c_str(), name.c_str()) != 0)
+      remove(temp.c_str());
+}
+
+void CodeCache::compare(const std::string &name, const Generator &cached, const Generator &fresh)
+{
+   if (cached.text() == fresh.text())
+      return;
+   ++mismatches_;
+   std::lock_guard<std::mutex> lock(report_mutex_);
+   std::cout << "code cache: " << name << " differs from its cached code" << std::endl;
+}
+
+void CodeCache::report(std::ostream &output) const
+{
+   output << "code cache: " << hits_ << " hits, " << misses_ << " misses";
+   if (check_)
+      output << ", " << mismatches_ << " mismatches";
+   output << std::endl;
+}
+
+static unsigned long long hash_string(const std::string &s, unsigned long long hash)
+{
+   return fnv1a(s.c_str(), s.size() + 1, hash);
+}
+
+static unsigned long long hash_number(long long n, unsigned long long hash)
+{
+   return fnv1a(&n, sizeof(n), hash);
+}
+
+static unsigned long long hash_type(SymType *t, unsigned long long hash)
+{
+   hash = hash_string(t->get_name(), hash_number(t->get_sym_type(), hash));
+   hash = hash_number(t->get_right(), hash_number(t->get_left(), hash_number(t->get_size(), hash)));
+   if (t->get_sym_type() == sym_array)
+      hash = hash_type(t->get_type(), hash);
+   else if (t->get_sym_type() == sym_record)
+      for each(const auto& it in t->get_sub_table()->in_order())
+         hash = hash_signature(it.second, hash_string(*it.first, hash));
+   return hash;
+}
+
+unsigned long long hash_signature(Symbol *s, unsigned long long hash)
+{
+   hash = hash_string(s->get_name(), hash);
+   if (auto var = dynamic_cast<SymVar *>(s))
+   {
+      hash = hash_number(var->get_offset(), hash_number(var->is_global() * 2 + var->is_var_arg(), hash));
+      return hash_type(var->get_type(), hash);
+   }
+   if (auto proc = dynamic_cast<SymProc *>(s))
+   {
+      hash = hash_type(proc->get_type(), hash_number(proc->get_size_local_args(), hash));
+      for each(auto arg in proc->get_arg_list())
+         hash = hash_signature(arg->get_sym_var(), hash);
+      return hash;
+   }
+   if (auto c = dynamic_cast<SymConst *>(s))
+      return hash_type(c->get_type(), hash_number(c->get_number(), hash));
+   if (auto type = dynamic_cast<SymType *>(s))
+      return hash_type(type, hash);
+   return hash;
+}
@@ -0,0 +1,34 @@
+#pragma once
+#ifndef COMPILER_CODECACHE_H_
+#define COMPILER_CODECACHE_H_
+#include "statement.h"
+#include <atomic>
+#include <mutex>
+
+//The generated code of procedures kept in a directory between runs, a file for each one
+//named by a hash of all its code depends on (see Parser::code_key). In check mode the
+//code found is generated again all the same, and the two are compared.
+class CodeCache
+{
+   std::string dir_;
+   bool check_;
+   std::atomic<size_t> hits_, misses_, mismatches_, written_;
+   std::string writer_;
+   std::mutex report_mutex_;
+   std::string path(unsigned long long key) const;
+public:
+   CodeCache(const std::string &dir, bool check = false);
+   ~CodeCache() {}
+   bool checking() const { return check_; }
+   bool load(unsigned long long key, Generator &part);
+   void store(unsigned long long key, const Generator &part);
+   void compare(const std::string &name, const Generator &cached, const Generator &fresh);
+   size_t mismatches() const { return mismatches_; }
+   void report(std::ostream &output) const;
+};
+
+//Carries a hash on over what code that uses a symbol depends on: its kind and place, the
+//layout of its type, and the frame and parameters of a procedure.
+unsigned long long hash_signature(Symbol *s, unsigned long long hash);
+
+#endif
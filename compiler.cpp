@@ -0,0 +1,104 @@
+#include "compiler.h"
+
+bool compile_mode(const std::string &flag, CompileMode &mode)
+{
+   static const std::string flags[] = {"-l", "-p", "-g", "-o", "-i"};
+   for (int i = 0; i < 5; ++i)
+      if (flag == flags[i])
+      {
+         mode = (CompileMode)i;
+         return true;
+      }
+   return false;
+}
+
+static void run(Scanner &scanner, std::ostream &output, const CompileOptions &options, Arena *arena)
+{
+   if (options.mode == mode_lex)
+   {
+      output << options.name;
+      while (!scanner.is_eof())
+      {
+         Token token(scanner.next());
+         token.print(output);
+      }
+   }
+   else if (options.mode == mode_parse)
+   {
+      Parser par(scanner, output, false, options.threads, arena);
+      par.parse()->print(output);
+      par.print_table();
+   }
+   else if (options.mode == mode_ir)
+      Parser(scanner, output, false, options.threads, arena).print_ir(output);
+   else
+   {
+      Parser par(scanner, output, false, options.threads, arena);
+      if (options.cache)
+      {
+         if (!scanner.is_batched())
+            scanner.tokenize();
+         par.set_cache(options.cache);
+      }
+      auto gen = std::make_shared<Generator>();
+      par.generate(gen, options.mode == mode_optimize);
+      gen->write_to_file(output, false);
+   }
+}
+
+void compile(Scanner &scanner, std::ostream &output, const CompileOptions &options)
+{
+   run(scanner, output, options, nullptr);
+}
+
+bool read_source(const std::string &name, std::string &source)
+{
+   FILE *file = _fsopen(name.c_str(), "r", _SH_DENYWR);
+   if (file == nullptr)
+      return false;
+   _fseeki64(file, 0, SEEK_END);
+   source.resize((size_t)_ftelli64(file));
+   _fseeki64(file, 0, SEEK_SET);
+   source.resize(fread(&source[0], 1, source.size(), file));
+   fclose(file);
+   return true;
+}
+
+CompileResult Compiler::compile(const char *begin, const char *end, const CompileOptions &options)
+{
+   CompileResult result;
+   result.ok = true;
+   std::ostringstream output;
+   try
+   {
+      Scanner scanner(begin, end);
+      if (options.threads > 1)
+         scanner.tokenize(options.threads);
+      else if (options.tokenize)
+         scanner.tokenize();
+      else if (options.pipeline && !options.cache)
+         scanner.pipeline();
+      run(scanner, output, options, &arena_);
+   }
+   catch (const CompileError &e)
+   {
+      output << e.message;
+      result.ok = false;
+      result.diagnostics.push_back(e.where);
+   }
+   catch (const std::exception &e)
+   {
+      Diagnostic where = {0, 0, e.what()};
+      output << "Error: " << e.what();
+      result.ok = false;
+      result.diagnostics.push_back(where);
+   }
+   arena_.reset();
+   result.output = output.str();
+   return result;
+}
+
+CompileResult Compiler::compile(const std::string &source, const CompileOptions &options)
+{
+   return compile(source.data(), source.data() + source.size(), options);
+}
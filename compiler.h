@@ -0,0 +1,58 @@
+#pragma once
+#ifndef COMPILER_COMPILER_H_
+#define COMPILER_COMPILER_H_
+#include "parser.h"
+
+enum CompileMode
+{
+   mode_lex,
+   mode_parse,
+   mode_generate,
+   mode_optimize,
+   mode_ir,
+};
+
+struct CompileOptions
+{
+   CompileMode mode;
+   //Threads to lex, parse and generate with; tokenize lexes the whole source up front
+   //even on one thread, and pipeline lexes it on a thread of its own as the parser reads.
+   unsigned threads;
+   bool tokenize, pipeline;
+   //The name a token listing starts with.
+   std::string name;
+   //Where generated procedures are kept between compilations, if anywhere.
+   CodeCache *cache;
+   CompileOptions(CompileMode m = mode_generate): mode(m), threads(1), tokenize(false), pipeline(false), cache(nullptr) {}
+};
+
+//The output is what the compiler writes for the source: a token listing, the tree,
+//asm or the IR of -o. On an error it ends with the message, which is also in diagnostics.
+struct CompileResult
+{
+   bool ok;
+   std::string output;
+   std::vector<Diagnostic> diagnostics;
+};
+
+//The mode of a command line flag: -l, -p, -g, -o or -i.
+bool compile_mode(const std::string &flag, CompileMode &mode);
+//Lexes, parses or generates what the scanner reads into output. Errors are thrown.
+void compile(Scanner &scanner, std::ostream &output, const CompileOptions &options);
+//Reads a source file the way the compiler does.
+bool read_source(const std::string &name, std::string &source);
+
+//Compiles sources held in memory, one after another. The arena of one compilation is
+//reset and reused by the next, so a long-lived compiler allocates little once warm.
+//A compiler is used by one thread at a time; threads that compile at once each have one.
+class Compiler
+{
+   Arena arena_;
+public:
+   Compiler() {}
+   ~Compiler() {}
+   CompileResult compile(const char *begin, const char *end, const CompileOptions &options);
+   CompileResult compile(const std::string &source, const CompileOptions &options);
+};
+
+#endif
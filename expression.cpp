@@ -1,167 +1,357 @@
 #include "expression.h"
 
-std::shared_ptr<SymType> choose_expr_type(const std::shared_ptr<Expr> &e1, const std::shared_ptr<Expr> &e2, bool is_arithmetic)
+SymType *choose_expr_type(Expr *e1, Expr *e2, bool is_arithmetic)
 {
    return e1->get_type()->get_sym_type() == sym_double ? e1->get_type() : e2->get_type();
 }
 
-inline void print_obj(std::ofstream &output, int depth, const std::string &str)
+inline void print_obj(std::ostream &output, int depth, const std::string &str)
 {
    for(int i = 0; i < depth; ++i) 
       output << " ";
    output << str << std::endl;
 }
 
+struct WalkFrame
+{
+   SynObj *node;
+   int step, depth;
+};
+
+//A chain of 10^5 operators is parsed in a loop, and its tree is as deep as it is long.
+void SynObj::print(std::ostream &output, int depth)
+{
+   std::vector<WalkFrame> stack(1, WalkFrame{this, 0, depth});
+   while (!stack.empty())
+   {
+      WalkFrame &frame = stack.back();
+      int child_depth = frame.depth;
+      SynObj *child = frame.node->print_step(output, frame.depth, frame.step, child_depth);
+      if (child)
+         stack.push_back(WalkFrame{child, 0, child_depth});
+      else
+         stack.pop_back();
+   }
+}
+
+void SynObj::generate(const std::shared_ptr<Generator> &gen)
+{
+   int step = 0;
+   SynObj *child = generate_step(gen, step);
+   if (!child)
+      return;
+   std::vector<WalkFrame> stack(1, WalkFrame{this, step, 0});
+   stack.push_back(WalkFrame{child, 0, 0});
+   while (!stack.empty())
+   {
+      WalkFrame &frame = stack.back();
+      child = frame.node->generate_step(gen, frame.step);
+      if (child)
+         stack.push_back(WalkFrame{child, 0, 0});
+      else
+         stack.pop_back();
+   }
+}
+
 void Expr::pop_val(const std::shared_ptr<Generator> &gen)
 {
    if (expr_type_->get_sym_type() == sym_int)
-      gen->push(Instruction(cmd_pop, op_register, "eax"));
+      gen->pop_value(op_register, "eax");
 }
 
-void BinaryOp::print(std::ofstream &output, int depth)
+SynObj *BinaryOp::print_step(std::ostream &output, int depth, int &step, int &child_depth)
 {
-   if (left_)
-      left_->print(output, depth + 5);
-   for(int i = 0; i < depth; ++i) 
-      output << " ";
-   output << token_.get_string() << std::endl;
-   if (right_) 
-      right_->print(output, depth + 5);
+   child_depth = depth + 5;
+   if (step == 0)
+   {
+      step = 1;
+      if (left_)
+         return left_;
+   }
+   if (step == 1)
+   {
+      step = 2;
+      for(int i = 0; i < depth; ++i) 
+         output << " ";
+      output << token_.get_string() << std::endl;
+      if (right_) 
+         return right_;
+   }
+   return nullptr;
 }
 
-void BinaryOp::generate(const std::shared_ptr<Generator> &gen)
+SynObj *BinaryOp::generate_step(const std::shared_ptr<Generator> &gen, int &step)
 {
-   switch(token_.type())
+   if (token_.type() != assignment)
+      return generate_operation(gen, step);
+   if (step == 0)
+   {
+      step = 1;
+      return right_;
+   }
+   left_->generate_lvalue(gen);
+   left_->generate_arg_rec(gen);         
+   switch(get_type()->get_sym_type())
    {
-      case assignment:
-         right_->generate(gen);
-         left_->generate_lvalue(gen);
-         left_->generate_arg_rec(gen);         
-         switch(get_type()->get_sym_type())
+      case sym_int:
+         gen->pop_value(op_register, "esi");
+         gen->pop_value(op_memory, "dword ptr [esi]");
+         break;
+      case sym_double:
+         gen->push(Instruction(cmd_pop, op_register, "esi"));
+         if (right_->get_type()->get_sym_type() == sym_int)
          {
-            case sym_int:
-               gen->push(Instruction(cmd_pop, op_register, "esi"));
-               gen->push(Instruction(cmd_pop, op_memory, "dword ptr [esi]"));
-               break;
-            case sym_double:
-               gen->push(Instruction(cmd_pop, op_register, "esi"));
-               if (right_->get_type()->get_sym_type() == sym_int)
-               {
-                  gen->push(Instruction(cmd_fild, op_memory, "dword ptr [esp]"));
-                  gen->push(Instruction(cmd_add, op_register, "esp", op_immediate, "4"));
-               }
-               else
-               {
-                  gen->push(Instruction(cmd_fld, op_memory, "qword ptr [esp]"));
-                  gen->push(Instruction(cmd_add, op_register, "esp", op_immediate, "8"));
-               }
-               gen->push(Instruction(cmd_fstp, op_memory, "qword ptr [esi]"));
-               break;
+            gen->push(Instruction(cmd_fild, op_memory, "dword ptr [esp]"));
+            gen->push(Instruction(cmd_add, op_register, "esp", op_immediate, "4"));
+         }
+         else
+         {
+            gen->push(Instruction(cmd_fld, op_memory, "qword ptr [esp]"));
+            gen->push(Instruction(cmd_add, op_register, "esp", op_immediate, "8"));
          }
+         gen->push(Instruction(cmd_fstp, op_memory, "qword ptr [esi]"));
          break;
+   }
+   return nullptr;
+}
+
+bool BinaryOp::is_relation() const
+{
+   switch(token_.type())
+   {
       case lesser_equal:
       case greater_equal:
       case equal:
       case not_equal:
       case greater:
       case lesser:
-         left_->generate(gen);
-         right_->generate(gen);
-         
-         switch(get_type()->get_sym_type())
+         return true;
+   }
+   return false;
+}
+
+//Multiplying or dividing an integer by a constant power of two becomes a shift by
+//the returned amount; -1 when it does not.
+int BinaryOp::get_shift() const
+{
+   if (get_type()->get_sym_type() == sym_int && right_->is_const() && (token_.type() == mul_op || token_.type() == div_op))
+   {
+      int i = boost::lexical_cast<int>(right_->get_string());
+      if (!(i & (i - 1)))
+      {
+         int j = 1, k = 0;
+         while (j < i)
          {
-            case sym_int:
-               gen->push(Instruction(cmd_pop, op_register, "eax"));
-               gen->push(Instruction(cmd_pop, op_register, "ecx"));
-               gen->push(Instruction(cmd_cmp, op_register, "ecx", op_register, "eax"));
-               gen->generate_setcc(token_.type());
-               gen->push(Instruction(cmd_push, op_register, "eax"));
-               break;
-            case sym_double:
-               gen->push(Instruction(cmd_fld, op_memory, "qword ptr [esp]"));
-               gen->push(Instruction(cmd_add, op_register, "esp", op_immediate, "8"));
-               gen->push(Instruction(cmd_fld, op_memory, "qword ptr [esp]"));
-               gen->push(Instruction(cmd_add, op_register, "esp", op_immediate, "8"));
-               gen->push(Instruction(cmd_fcompp));
-               gen->push(Instruction(cmd_fstsw, op_register, "ax"));
-               gen->push(Instruction(cmd_sahf));
-               gen->generate_setcc(token_.type(), true);
-               gen->push(Instruction(cmd_push, op_register, "eax"));
-               break;
+            j *= 2;
+            ++k;
          }
-         break;
-      default:
+         return k;
+      }
+   }
+   return -1;
+}
+
+//Both operands get registers when they need as many, else the needier one is generated
+//first and its result takes one while the other is.
+void BinaryOp::count_need()
+{
+   int l = left_->get_need(), r = right_->get_need();
+   need_ = l == r ? l + 1 : std::max(l, r);
+}
+
+//Whether the integer operand the operation takes first is generated second: it needs fewer
+//registers than the other one. Operands with a call are generated in their own order.
+bool BinaryOp::is_swapped() const
+{
+   int l = left_->get_need(), r = right_->get_need();
+   if (token_.type() == assignment || get_type()->get_sym_type() != sym_int || get_shift() >= 0 || l >= call_need || r >= call_need)
+      return false;
+   return is_relation() ? r > l : l > r;
+}
+
+//The comparison that holds with the operands exchanged.
+static LexemeType mirror(LexemeType t)
+{
+   switch(t)
+   {
+      case lesser:
+         return greater;
+      case greater:
+         return lesser;
+      case lesser_equal:
+         return greater_equal;
+      case greater_equal:
+         return lesser_equal;
+   }
+   return t;
+}
+
+//An operand the last instruction moved out of eax is used in eax.
+static void take_from_eax(const std::shared_ptr<Generator> &gen, Operand &op)
+{
+   if (op.get_operand_type() != op_register)
+      return;
+   const Instruction &last = gen->get_last_instr();
+   if (last == cmd_mov && last.get_first() == op.get_name() && last.get_second() == "eax")
+   {
+      gen->pop_last_instr();
+      op = Operand(op_register, "eax");
+   }
+}
+
+//Compares integers for a branch, which takes the flags: an immediate is compared on the
+//right, and a register is loaded only when neither operand can stay where it is.
+void BinaryOp::generate_compare(const std::shared_ptr<Generator> &gen)
+{
+   LexemeType t = token_.type();
+   Operand right = gen->pop_operand("eax");
+   take_from_eax(gen, right);
+   Operand left = gen->pop_operand(right.get_name() == "ecx" ? "eax" : "ecx");
+   if (right.get_name() != "eax")
+      take_from_eax(gen, left);
+   if (left.get_operand_type() == op_immediate)
+   {
+      std::swap(left, right);
+      t = mirror(t);
+   }
+   if (left.get_operand_type() == op_immediate || (left.get_operand_type() == op_memory && right.get_operand_type() == op_memory))
+   {
+      Operand &loaded = left.get_operand_type() == op_immediate ? left : right;
+      gen->emit(Instruction(cmd_mov, op_register, "eax", loaded.get_operand_type(), loaded.get_name()));
+      loaded = Operand(op_register, "eax");
+   }
+   gen->emit(Instruction(cmd_cmp, left.get_operand_type(), left.get_name(), right.get_operand_type(), right.get_name()));
+   gen->set_flags(t);
+}
+
+//Comparisons put the left operand on the stack first, arithmetic the right one (or
+//none, when the right one is a shift count); swapped, the other one goes first, and the
+//two are exchanged afterwards, which costs nothing while both are in registers.
+SynObj *BinaryOp::generate_operation(const std::shared_ptr<Generator> &gen, int &step)
+{
+   int shift = get_shift();
+   bool swapped = is_swapped();
+   if (step == 0)
+   {
+      step = 1;
+      if (is_relation() != swapped)
+         return left_;
+      if (shift < 0)
+         return right_;
+   }
+   if (step == 1)
+   {
+      step = 2;
+      return is_relation() != swapped ? right_ : left_;
+   }
+   if (swapped)
+      gen->swap_top();
+   if (is_relation())
+   {
+      switch(get_type()->get_sym_type())
       {
-         int i = 0;
-         bool use_bitwise_op = false;
-         if (get_type()->get_sym_type() == sym_int && right_->is_const() && (token_.type() == mul_op || token_.type() == div_op))
+         case sym_int:
          {
-            i = boost::lexical_cast<int>(right_->get_string());
-            use_bitwise_op = !(i & (i - 1));
-            if (use_bitwise_op)
+            if (condition_)
             {
-               int j = 1, k = 0;
-               while (j < i)
-               {
-                  j *= 2;
-                  ++k;
-               }
-               i = k;
+               generate_compare(gen);
+               break;
+            }
+            gen->pop_value(op_register, "eax");
+            Operand left = gen->pop_operand("ecx");
+            if (left.get_operand_type() == op_immediate)
+            {
+               gen->reserve("ecx");
+               gen->emit(Instruction(cmd_mov, op_register, "ecx", op_immediate, left.get_name()));
+               left = Operand(op_register, "ecx");
             }
-            else
-               right_->generate(gen);
+            gen->emit(Instruction(cmd_cmp, left.get_operand_type(), left.get_name(), op_register, "eax"));
+            gen->generate_setcc(token_.type());
+            gen->push_value(op_register, "eax");
+            break;
          }
-         else 
-               right_->generate(gen);
-         left_->generate(gen);
-         switch(get_type()->get_sym_type())
-         {
-            case sym_int:
-               gen->push(Instruction(cmd_pop, op_register, "eax"));               
-               if (!use_bitwise_op)
-                  gen->push(Instruction(cmd_pop, op_register, "ecx"));
-               gen->push(Instruction(cmd_push, op_register, gen->generate_int_arithmetic(token_.type(), use_bitwise_op, i) ? "eax" : "edx"));
-               break;
-            case sym_double:
-               gen->push(Instruction(cmd_fld, op_memory, "qword ptr [esp]"));
-               gen->push(Instruction(cmd_add, op_register, "esp", op_immediate, "8"));
-               gen->push(Instruction(cmd_fld, op_memory, "qword ptr [esp]"));
-               gen->generate_double_arithmetic(token_.type());
-               gen->push(Instruction(cmd_fstp, op_memory, "qword ptr [esp]"));
+         case sym_double:
+            gen->push(Instruction(cmd_fld, op_memory, "qword ptr [esp]"));
+            gen->push(Instruction(cmd_add, op_register, "esp", op_immediate, "8"));
+            gen->push(Instruction(cmd_fld, op_memory, "qword ptr [esp]"));
+            gen->push(Instruction(cmd_add, op_register, "esp", op_immediate, "8"));
+            gen->push(Instruction(cmd_fcompp));
+            gen->push(Instruction(cmd_fstsw, op_register, "ax"));
+            gen->push(Instruction(cmd_sahf));
+            if (condition_)
+            {
+               gen->set_flags(token_.type(), true);
                break;
+            }
+            gen->generate_setcc(token_.type(), true);
+            gen->push_value(op_register, "eax");
+            break;
+      }
+      return nullptr;
+   }
+   bool use_bitwise_op = shift >= 0;
+   switch(get_type()->get_sym_type())
+   {
+      case sym_int:
+      {
+         //Division takes edx and a divisor in a register.
+         bool divides = !use_bitwise_op && (token_.type() == div_op || token_.type() == mod_op);
+         gen->pop_value(op_register, "eax");
+         if (divides)
+            gen->reserve("ecx", "edx");
+         Operand right;
+         if (!use_bitwise_op)
+            right = gen->pop_operand("ecx");
+         if (divides && right.get_operand_type() == op_immediate)
+         {
+            gen->emit(Instruction(cmd_mov, op_register, "ecx", op_immediate, right.get_name()));
+            right = Operand(op_register, "ecx");
          }
+         gen->push_value(op_register, gen->generate_int_arithmetic(token_.type(), use_bitwise_op, shift, right) ? "eax" : "edx");
          break;
       }
+      case sym_double:
+         gen->push(Instruction(cmd_fld, op_memory, "qword ptr [esp]"));
+         gen->push(Instruction(cmd_add, op_register, "esp", op_immediate, "8"));
+         gen->push(Instruction(cmd_fld, op_memory, "qword ptr [esp]"));
+         gen->generate_double_arithmetic(token_.type());
+         gen->push(Instruction(cmd_fstp, op_memory, "qword ptr [esp]"));
+         break;
    }
+   return nullptr;
 }
 
-void UnaryOp::print(std::ofstream &output, int depth)
+SynObj *UnaryOp::print_step(std::ostream &output, int depth, int &step, int &child_depth)
 {
+   if (step++)
+      return nullptr;
    for(int i = 0; i < depth; i++) 
       output << " ";
    output << sign_.get_string() << std::endl;
-   expr_->print(output, depth + 5);
+   child_depth = depth + 5;
+   return expr_;
 }
 
-void UnaryOp::generate(const std::shared_ptr<Generator> &gen)
+SynObj *UnaryOp::generate_step(const std::shared_ptr<Generator> &gen, int &step)
 {
-   expr_->generate(gen);
+   if (step++ == 0)
+      return expr_;
    switch(get_type()->get_sym_type())
    {
       case sym_int:
-         gen->push(Instruction(cmd_pop, op_register, "eax"));
+         gen->pop_value(op_register, "eax");
          switch(sign_.type())
          {
             case plus_op:
                break;
             case minus_op:
-               gen->push(Instruction(cmd_neg, op_register, "eax"));
-               gen->push(Instruction(cmd_push, op_register, "eax"));
+               gen->emit(Instruction(cmd_neg, op_register, "eax"));
+               gen->push_value(op_register, "eax");
                break;
             case not_op:
-               gen->push(Instruction(cmd_test, op_register, "al", op_register, "al"));
-               gen->push(Instruction(cmd_setz, op_register, "al"));
-               gen->push(Instruction(cmd_push, op_register, "eax"));
+               gen->emit(Instruction(cmd_test, op_register, "al", op_register, "al"));
+               gen->emit(Instruction(cmd_setz, op_register, "al"));
+               gen->push_value(op_register, "eax");
                break;
          }
          break;
@@ -179,10 +369,26 @@ void UnaryOp::generate(const std::shared_ptr<Generator> &gen)
          gen->push(Instruction(cmd_fstp, op_memory, "qword ptr [esp]"));
          break;
    }
+   return nullptr;
 }
 
-void SynVar::generate(const std::shared_ptr<Generator> &gen)
+//An integer is loaded straight from where the variable is.
+SynObj *SynVar::generate_step(const std::shared_ptr<Generator> &gen, int &step)
 {
+   if (var_->get_type()->get_sym_type() == sym_int)
+   {
+      std::string offset = boost::lexical_cast<std::string>(var_->get_offset());
+      if (var_->is_global())
+         gen->push_value(op_memory, "dword ptr v_" + str_);
+      else if (!var_->is_var_arg())
+         gen->push_value(op_memory, "dword ptr [" + offset + " + ebp]");
+      else
+      {
+         gen->emit(Instruction(cmd_mov, op_register, "esi", op_memory, "[" + offset + " + ebp]"));
+         gen->push_value(op_memory, "dword ptr [esi]");
+      }
+      return nullptr;
+   }
    generate_base(gen);
    gen->push(Instruction(cmd_pop, op_register, "esi"));
    if(var_->get_type()->get_sym_type() == sym_array || var_->get_type()->get_sym_type() == sym_record)
@@ -200,27 +406,30 @@ void SynVar::generate(const std::shared_ptr<Generator> &gen)
        else
          gen->push(Instruction(cmd_push, op_memory, "qword ptr [esi]"));
    }
+   return nullptr;
+}
+
+//An integer variable that is not an argument by reference is a memory operand.
+int SynVar::get_need() const
+{
+   return var_->get_type()->get_sym_type() == sym_int && !var_->is_var_arg() ? 0 : 1;
 }
 
 void SynVar::generate_base(const std::shared_ptr<Generator> &gen, bool flag)
 {
    if(var_->is_global())
-      gen->push(Instruction(cmd_push, op_memory, "offset v_" + str_));
+      gen->push_value(op_immediate, "offset v_" + str_);
    else
    {
       std::string tmp = boost::lexical_cast<std::string>(var_->get_offset());
-      if(var_->is_var_arg())
-         gen->push(Instruction(cmd_mov, op_register, "esi", op_memory, "[" + tmp + " + ebp]"));
-      else
-         gen->push(Instruction(cmd_lea, op_register, "esi", op_memory, "[" + tmp + " + ebp]"));
-      gen->push(Instruction(cmd_push, op_register, "esi"));
+      gen->push_value(op_memory, "[" + tmp + " + ebp]", var_->is_var_arg() ? cmd_mov : cmd_lea);
    }
 }
 
 void SynVar::pop_val(const std::shared_ptr<Generator> &gen)
 {
    if(var_->get_type()->get_sym_type() == sym_int)
-      gen->push(Instruction(cmd_pop, op_register, "eax"));
+      gen->pop_value(op_register, "eax");
 }
 
 void SynVar::generate_arg_rec(const std::shared_ptr<Generator> &gen)
@@ -240,32 +449,40 @@ void SynVar::generate_lvalue(const std::shared_ptr<Generator> &gen)
    generate_base(gen);
 }
 
-void SynArray::print(std::ofstream &output, int depth)
+//Step k > 0 closes index k - 2 and opens index k - 1.
+SynObj *SynArray::print_step(std::ostream &output, int depth, int &step, int &child_depth)
 {
-   lp_->print(output, depth);
-   for each(const auto& it in indexes_)
+   if (step == 0)
+   {
+      step = 1;
+      return lp_;
+   }
+   if (step >= 2)
    {
-      for(int i = 0; i < depth; ++i) 
-         output << ' ';
-      output << "[\n";
-      it->print(output, depth + 5);
       for(int i = 0; i < depth; ++i) 
          output << ' ';
       output << "]\n";
    }
+   if ((size_t)step > indexes_.size())
+      return nullptr;
+   for(int i = 0; i < depth; ++i) 
+      output << ' ';
+   output << "[\n";
+   child_depth = depth + 5;
+   return indexes_[step++ - 1];
 }
 
-SynArray::SynArray(const std::string &nm, const std::shared_ptr<SynVar> &e, const std::list<std::shared_ptr<Expr>> &l,
-   const std::shared_ptr<SymVar> &sv, const std::shared_ptr<SymType> &st): SynVar(nm, sv), lp_(e), el_type_(st)
+SynArray::SynArray(const std::string &nm, SynVar *e, const NodeList<Expr *> &l,
+   SymVar *sv, SymType *st): SynVar(nm, sv), lp_(e), el_type_(st), indexes_(l)
 {
    dim_ = l.size();
-   auto it = --l.end();
-   for(size_t k = dim_; k > 0; --k)
-   {
-      indexes_.push_back(*it);
-      if(it != l.begin())
-         --it;
-   }
+   std::reverse(indexes_.begin(), indexes_.end());
+   //The address of a local array and the indexes generated before take a register each
+   //while an index is generated.
+   need_ = 1;
+   int taken = sv->is_global() ? 0 : 1;
+   for each(const auto &it in indexes_)
+      need_ = std::max(need_, it->get_need() + taken++);
 }
 
 size_t SynArray::get_size_k(size_t k)
@@ -276,48 +493,44 @@ size_t SynArray::get_size_k(size_t k)
 void SynArray::generate_base(const std::shared_ptr<Generator> &gen, bool flag)
 {
    if(var_->is_global())
-      gen->push(Instruction(cmd_push, op_memory, "offset v_" + str_));
+      gen->push_value(op_immediate, "offset v_" + str_);
    else
    {
       std::string tmp = boost::lexical_cast<std::string>(var_->get_offset());
-      if(var_->is_var_arg())
-         gen->push(Instruction(cmd_mov, op_register, "esi", op_memory, "[" + tmp + " + ebp]"));
-      else
-         gen->push(Instruction(cmd_lea, op_register, "esi", op_memory, "[" + tmp + " + ebp]"));
-      gen->push(Instruction(cmd_push, op_register, "esi"));
+      gen->push_value(op_memory, "[" + tmp + " + ebp]", var_->is_var_arg() ? cmd_mov : cmd_lea);
    }
    generate_index(gen);
-   gen->push(Instruction(cmd_push, op_register, "esi"));
+   gen->push_value(op_register, "esi");
 }
 
 void SynArray::generate_index(const std::shared_ptr<Generator> &gen)
 {
    for each(const auto& it in indexes_)
       it->generate(gen);
-   gen->push(Instruction(cmd_xor, op_register, "esi", op_register, "esi"));
+   gen->emit(Instruction(cmd_xor, op_register, "esi", op_register, "esi"));
    for (size_t i = 1; i <= dim_; ++i)
    {
-      gen->push(Instruction(cmd_pop, op_register, "eax"));
-      gen->push(Instruction(cmd_sub, op_register, "eax", op_immediate, "1"));
-      gen->push(Instruction(cmd_imul, op_register, "eax", op_immediate, get_size_k(i)));
-      gen->push(Instruction(cmd_add, op_register, "esi", op_register, "eax"));
+      gen->pop_value(op_register, "eax");
+      gen->emit(Instruction(cmd_sub, op_register, "eax", op_immediate, "1"));
+      gen->emit(Instruction(cmd_imul, op_register, "eax", op_immediate, get_size_k(i)));
+      gen->emit(Instruction(cmd_add, op_register, "esi", op_register, "eax"));
       //gen->push(Instruction(cmd_lea, op_register, "esi", op_memory, "[(eax-1)*" + boost::lexical_cast<std::string>(get_size_k(i)) + "]"));
    }
-   gen->push(Instruction(cmd_pop, op_register, "edi"));
-   gen->push(Instruction(cmd_add, op_register, "esi", op_register, "edi"));
+   gen->pop_value(op_register, "edi");
+   gen->emit(Instruction(cmd_add, op_register, "esi", op_register, "edi"));
 }
 
-void SynArray::generate(const std::shared_ptr<Generator> &gen)
+SynObj *SynArray::generate_step(const std::shared_ptr<Generator> &gen, int &step)
 {
    generate_base(gen);
-   gen->push(Instruction(cmd_pop, op_register, "esi"));
+   gen->pop_value(op_register, "esi");
    switch(el_type_->get_sym_type())
    {
       case sym_double:
          gen->push(Instruction(cmd_push, op_memory, "qword ptr [esi]"));
          break;
       case sym_int:
-         gen->push(Instruction(cmd_push, op_memory, "dword ptr [esi]"));
+         gen->push_value(op_memory, "dword ptr [esi]");
          break;
       case sym_array:
       case sym_record:
@@ -328,12 +541,13 @@ void SynArray::generate(const std::shared_ptr<Generator> &gen)
          gen->push(Instruction(cmd_movsd));
          break;
    }
+   return nullptr;
 }
 
 void SynArray::pop_val(const std::shared_ptr<Generator> &gen)
 {
    if (el_type_->get_sym_type() == sym_int)
-      gen->push(Instruction(cmd_pop, op_register, "eax"));
+      gen->pop_value(op_register, "eax");
 }
 
 void SynArray::generate_lvalue(const std::shared_ptr<Generator> &gen)
@@ -350,30 +564,39 @@ void SynArray::generate_lvalue(const std::shared_ptr<Generator> &gen)
    }
 }
 
-void SynConstStr::print(std::ofstream &output, int depth)
+SynObj *SynConstStr::print_step(std::ostream &output, int depth, int &step, int &child_depth)
 {
    for(int i = 0; i < depth; ++i)
       output << ' ';
    output << str_ << '\n';
+   return nullptr;
 }
 
-void SynConstStr::generate(const std::shared_ptr<Generator> &gen)
+SynObj *SynConstStr::generate_step(const std::shared_ptr<Generator> &gen, int &step)
 {
-   gen->push(Instruction(cmd_mov, op_register, "esi", op_memory, "offset s_" + boost::lexical_cast<std::string>(num_)));
+   gen->push(Instruction(cmd_mov, op_register, "esi", op_memory, "offset s_" + boost::lexical_cast<std::string>(const_->get_number())));
    /*gen->push(Instruction(cmd_mov, op_register, "edi", op_immediate, boost::lexical_cast<std::string>(len_)));*/
+   return nullptr;
 }
 
-SynConstStr::SynConstStr(const std::string &s, size_t n): Expr(std::make_shared<SymType>()), str_(s), num_(n)
+SynConstStr::SynConstStr(const std::string &s, SymConst *c): Expr(no_type()), str_(s), const_(c)
 {
    len_ = str_.length() - 2;
 }
 
-void SynRec::print(std::ofstream &output, int depth)
+SynObj *SynRec::print_step(std::ostream &output, int depth, int &step, int &child_depth)
 {
-   recn_->print(output, depth + 5);
-   for(int i = 0; i < depth; ++i) output << ' ';
-   output << '.' << std::endl;
-   field_->print(output, depth + 5);
+   child_depth = depth + 5;
+   switch (step++)
+   {
+      case 0:
+         return recn_;
+      case 1:
+         for(int i = 0; i < depth; ++i) output << ' ';
+         output << '.' << std::endl;
+         return field_;
+   }
+   return nullptr;
 }
 
 void SynRec::generate_base(const std::shared_ptr<Generator> &gen, bool flag)
@@ -392,7 +615,7 @@ void SynRec::generate_base(const std::shared_ptr<Generator> &gen, bool flag)
 
    if (field_->get_syn_type() == syn_array)
    {
-      auto sar = std::static_pointer_cast<SynArray> (field_);
+      auto sar = static_cast<SynArray *>(field_);
       sar->generate_index(gen);
       gen->push(Instruction(cmd_push, op_memory, "esi"));
    }
@@ -400,7 +623,7 @@ void SynRec::generate_base(const std::shared_ptr<Generator> &gen, bool flag)
       field_->generate_base(gen, true);
 }
 
-void SynRec::generate(const std::shared_ptr<Generator> &gen)
+SynObj *SynRec::generate_step(const std::shared_ptr<Generator> &gen, int &step)
 {
    generate_base(gen);
    gen->push(Instruction(cmd_pop, op_register, "esi"));
@@ -417,12 +640,13 @@ void SynRec::generate(const std::shared_ptr<Generator> &gen)
          gen->push(Instruction(cmd_push, op_register, "esi"));
          break;
    }
+   return nullptr;
 }
 
 void SynRec::pop_val(const std::shared_ptr<Generator> &gen)
 {
    if (stype_->get_sym_type() == sym_int)
-      gen->push(Instruction(cmd_pop, op_register, "eax"));
+      gen->pop_value(op_register, "eax");
 }
 
 void SynRec::generate_lvalue(const std::shared_ptr<Generator> &gen)
@@ -2,56 +2,80 @@
 #ifndef COMPILER_EXPRESSION_H_
 #define COMPILER_EXPRESSION_H_
 #include "symbol.h"
+#include "arena.h"
 
 enum SynTypes 
 {
    syn_var, syn_array, syn_rec, syn_none, 
 };
 
+class IrBuilder;
+struct IrInst;
+
+//Trees are printed, generated and lowered to IR by a walk with an explicit stack. At each
+//step a node does its work up to its next child, moves step past it and returns it, or
+//returns nullptr when it is done; child_depth is the indentation the printed child gets.
+//Lowered, an expression leaves its value on the builder's stack, typed as the tree types it.
 class SynObj
 {
 public:
    SynObj() {}
    virtual ~SynObj() {}
-   virtual void print(std::ofstream &output, int depth = 0) = 0;
-   virtual void generate(const std::shared_ptr<Generator> &gen) = 0;
+   void print(std::ostream &output, int depth = 0);
+   void generate(const std::shared_ptr<Generator> &gen);
+   void lower(IrBuilder &ir);
+   virtual SynObj *print_step(std::ostream &output, int depth, int &step, int &child_depth) = 0;
+   virtual SynObj *generate_step(const std::shared_ptr<Generator> &gen, int &step) = 0;
+   virtual SynObj *lower_step(IrBuilder &ir, int &step) = 0;
 };
 
 class Expr: public SynObj
 {
 protected:
-   std::shared_ptr<SymType> expr_type_;
+   SymType *expr_type_;
 public:
-   Expr(const std::shared_ptr<SymType> &st): expr_type_(st) {}
+   Expr(SymType *st): expr_type_(st) {}
    virtual ~Expr() {}
-   virtual std::shared_ptr<SymType> get_type() const = 0;
+   virtual SymType *get_type() const = 0;
    virtual void pop_val(const std::shared_ptr<Generator> &gen);
    virtual void generate_arg_rec(const std::shared_ptr<Generator> &gen) {}
    virtual void generate_lvalue(const std::shared_ptr<Generator> &gen) {}
+   virtual IrInst *lower_address(IrBuilder &ir);
    virtual bool is_string() const { return false; }
    virtual bool is_const() const { return false; }
    virtual std::string get_string() const { return ""; };
-   virtual std::shared_ptr<Expr> get_right_expr() { return nullptr; }
-   virtual void change_right_expr(std::shared_ptr<Expr> e) {}
+   virtual Expr *get_right_expr() { return nullptr; }
+   virtual void change_right_expr(Expr *e) {}
    virtual void set_higher_priority() {}
    virtual bool is_higher_priority() const { return false; }
    virtual SynTypes get_syn_type() const { return syn_none; }
+   //How many registers of the operand stack generating the expression takes (its Sethi-Ullman
+   //number): 0 for what stays an immediate or memory operand.
+   virtual int get_need() const { return 1; }
+   //A statement branches on the expression: a comparison leaves only flags for it.
+   virtual void set_condition() {}
 };
 
-std::shared_ptr<SymType> choose_expr_type(const std::shared_ptr<Expr> &e1, const std::shared_ptr<Expr> &e2, bool is_arithmetic = false);
-void print_obj(std::ofstream &output, int depth, const std::string &str);
+//The need of an expression with a call in it: a call spills every register, and nothing is
+//moved across it.
+const int call_need = 1 << 20;
+
+SymType *choose_expr_type(Expr *e1, Expr *e2, bool is_arithmetic = false);
+void print_obj(std::ostream &output, int depth, const std::string &str);
 
 class UnaryOp: public Expr 
 {
    Token sign_;
-   std::shared_ptr<Expr> expr_;
+   Expr *expr_;
    bool is_const_;
 public:
-   UnaryOp(const std::shared_ptr<SymType> &st, const Token &t, const std::shared_ptr<Expr> &e, bool c = false): Expr(st), sign_(t), expr_(e), is_const_(c) {}
+   UnaryOp(SymType *st, const Token &t, Expr *e, bool c = false): Expr(st), sign_(t), expr_(e), is_const_(c) {}
+   int get_need() const { return std::max(1, expr_->get_need()); }
    ~UnaryOp() {}
-   void print(std::ofstream &output, int depth = 0);
-   std::shared_ptr<SymType> get_type() const { return expr_type_; }
-   void generate(const std::shared_ptr<Generator> &gen);
+   SynObj *print_step(std::ostream &output, int depth, int &step, int &child_depth);
+   SymType *get_type() const { return expr_type_; }
+   SynObj *generate_step(const std::shared_ptr<Generator> &gen, int &step);
+   SynObj *lower_step(IrBuilder &ir, int &step);
    bool is_const() const { return is_const_; }
    std::string get_string() const { return expr_->get_string(); }
 };
@@ -59,39 +83,55 @@ public:
 class BinaryOp: public Expr 
 {
    Token token_;
-   std::shared_ptr<Expr> left_, right_;
+   Expr *left_, *right_;
    bool in_brackets;
+   int need_;
+   bool condition_;
+   bool is_relation() const;
+   int get_shift() const;
+   bool is_swapped() const;
+   void count_need();
+   void generate_compare(const std::shared_ptr<Generator> &gen);
+   SynObj *generate_operation(const std::shared_ptr<Generator> &gen, int &step);
 public:
-   BinaryOp(const std::shared_ptr<SymType> &st, const Token &t, const std::shared_ptr<Expr> &e1, const std::shared_ptr<Expr> &e2):
-      Expr(st), token_(t), left_(e1), right_(e2), in_brackets(false) {}
+   BinaryOp(SymType *st, const Token &t, Expr *e1, Expr *e2):
+      Expr(st), token_(t), left_(e1), right_(e2), in_brackets(false), condition_(false) { count_need(); }
    ~BinaryOp() {}
-   void print(std::ofstream &output, int depth = 0);
-   std::shared_ptr<SymType> get_type() const { return expr_type_; }
-   void generate(const std::shared_ptr<Generator> &gen);
-   std::shared_ptr<Expr> get_right_expr() { return right_; }
-   void change_right_expr(std::shared_ptr<Expr> e) { right_ = e; expr_type_ = choose_expr_type(left_, right_); }
+   SynObj *print_step(std::ostream &output, int depth, int &step, int &child_depth);
+   SymType *get_type() const { return expr_type_; }
+   SynObj *generate_step(const std::shared_ptr<Generator> &gen, int &step);
+   SynObj *lower_step(IrBuilder &ir, int &step);
+   Expr *get_right_expr() { return right_; }
+   void change_right_expr(Expr *e) { right_ = e; expr_type_ = choose_expr_type(left_, right_); count_need(); }
    void set_higher_priority() { in_brackets = true; }
    bool is_higher_priority() const { return in_brackets; }
+   int get_need() const { return need_; }
+   void set_condition() { condition_ = is_relation(); }
 };
 
 class SynVar: public Expr
 {
 protected:
    std::string str_;
-   std::shared_ptr<SymVar> var_;
+   SymVar *var_;
 public:
-   SynVar(const std::string &s, const std::shared_ptr<SymVar> &v): Expr(std::make_shared<SymType>()), str_(s), var_(v) {}
+   SynVar(const std::string &s, SymVar *v): Expr(no_type()), str_(s), var_(v) {}
    virtual ~SynVar() {}
-   void print(std::ofstream &output, int depth = 0) { print_obj(output, depth, str_); }
-   std::shared_ptr<SymType> get_type() const { return var_->get_type(); }
-   std::shared_ptr<SymVar> get_sym_var() const { return var_; }
+   SynObj *print_step(std::ostream &output, int depth, int &step, int &child_depth) { print_obj(output, depth, str_); return nullptr; }
+   SymType *get_type() const { return var_->get_type(); }
+   SymVar *get_sym_var() const { return var_; }
    SynTypes get_syn_type() const { return syn_var; }
-   void generate(const std::shared_ptr<Generator> &gen);
+   SynObj *generate_step(const std::shared_ptr<Generator> &gen, int &step);
+   int get_need() const;
    virtual void generate_base(const std::shared_ptr<Generator> &gen, bool flag = false);
    virtual void generate_index(const std::shared_ptr<Generator> &gen) {};
    void pop_val(const std::shared_ptr<Generator> &gen);
    void generate_arg_rec(const std::shared_ptr<Generator> &gen);
    void generate_lvalue(const std::shared_ptr<Generator> &gen);
+   SynObj *lower_step(IrBuilder &ir, int &step);
+   IrInst *lower_address(IrBuilder &ir);
+   //The address of this field of a record at base.
+   virtual IrInst *lower_field(IrBuilder &ir, IrInst *base);
    std::string get_string() const { return str_; }
 };
 
@@ -99,27 +139,30 @@ class SynConstInt: public Expr
 {
    std::string str_;
 public:
-   SynConstInt(const std::string &s): Expr(std::make_shared<SymType>()), str_(s) {}
+   SynConstInt(const std::string &s): Expr(no_type()), str_(s) {}
    ~SynConstInt() {}
-   void SynConstInt::print(std::ofstream &output, int depth = 0) { print_obj(output, depth, str_); }
-   std::shared_ptr<SymType> get_type() const { return std::make_shared<Int>("integer"); }
-   void SynConstInt::pop_val(const std::shared_ptr<Generator> &gen) { gen->push(Instruction(cmd_pop, op_register, "eax")); }
-   void SynConstInt::generate(const std::shared_ptr<Generator> &gen) { gen->push(Instruction(cmd_push, op_immediate, str_)); }
+   SynObj *SynConstInt::print_step(std::ostream &output, int depth, int &step, int &child_depth) { print_obj(output, depth, str_); return nullptr; }
+   SymType *get_type() const { return literal_int_type(); }
+   void SynConstInt::pop_val(const std::shared_ptr<Generator> &gen) { gen->pop_value(op_register, "eax"); }
+   SynObj *SynConstInt::generate_step(const std::shared_ptr<Generator> &gen, int &step) { gen->push_value(op_immediate, str_); return nullptr; }
+   SynObj *lower_step(IrBuilder &ir, int &step);
    bool is_const() const { return true; }
    std::string get_string() const { return str_; }
+   int get_need() const { return 0; }
 };
 
 class SynConstDouble: public Expr 
 {
    std::string str_;
-   size_t num_;
+   SymConst *const_;
 public:
-   SynConstDouble(const std::string &s, size_t n = 0): Expr(std::make_shared<SymType>()), str_(s), num_(n) {}
+   SynConstDouble(const std::string &s, SymConst *c): Expr(no_type()), str_(s), const_(c) {}
    ~SynConstDouble() {}
-   void print(std::ofstream &output, int depth = 0) { print_obj(output, depth, str_); }
-   std::shared_ptr<SymType> get_type() const { return std::make_shared<Double>("double"); }
+   SynObj *print_step(std::ostream &output, int depth, int &step, int &child_depth) { print_obj(output, depth, str_); return nullptr; }
+   SymType *get_type() const { return literal_double_type(); }
    void pop_val(const std::shared_ptr<Generator> &gen) {}
-   void generate(const std::shared_ptr<Generator> &gen) { gen->push(Instruction(cmd_push, op_memory, "qword ptr dc_" + boost::lexical_cast<std::string>(num_))); }
+   SynObj *generate_step(const std::shared_ptr<Generator> &gen, int &step) { gen->push(Instruction(cmd_push, op_memory, "qword ptr dc_" + boost::lexical_cast<std::string>(const_->get_number()))); return nullptr; }
+   SynObj *lower_step(IrBuilder &ir, int &step);
    bool is_const() const { return true; }
    std::string get_string() const { return str_; }
 };
@@ -127,65 +170,77 @@ public:
 class SynConstStr: public Expr 
 {
    std::string str_;
-   size_t num_, len_;
+   SymConst *const_;
+   size_t len_;
 public:
-   SynConstStr(const std::string &s, size_t n = 0);
+   SynConstStr(const std::string &s, SymConst *c);
    ~SynConstStr() {}
-   void print(std::ofstream &output, int depth);
-   std::shared_ptr<SymType> get_type() const { return std::make_shared<Int>("integer"); }
+   SynObj *print_step(std::ostream &output, int depth, int &step, int &child_depth);
+   SymType *get_type() const { return literal_int_type(); }
    bool is_string() const { return true; }
    void pop_val(const std::shared_ptr<Generator> &gen) {}
-   void generate(const std::shared_ptr<Generator> &gen);
+   SynObj *generate_step(const std::shared_ptr<Generator> &gen, int &step);
+   SynObj *lower_step(IrBuilder &ir, int &step);
+   std::string get_label() const { return "s_" + boost::lexical_cast<std::string>(const_->get_number()); }
 };
 
 class SynRec: public SynVar
 {
-   std::shared_ptr<SynVar> recn_, field_;
-   std::shared_ptr<SymType> stype_;
+   SynVar *recn_, *field_;
+   SymType *stype_;
 public:
-   SynRec(const std::string &n, const std::shared_ptr<SymVar> &v, const std::shared_ptr<SynVar> &e1, const std::shared_ptr<SynVar> &e2, const std::shared_ptr<SymType> &st):
+   SynRec(const std::string &n, SymVar *v, SynVar *e1, SynVar *e2, SymType *st):
       SynVar(n, v), recn_(e1), field_(e2), stype_(st) {}
    ~SynRec() {}
-   void print(std::ofstream &output, int depth);
+   SynObj *print_step(std::ostream &output, int depth, int &step, int &child_depth);
    SynTypes get_syn_type() const { return syn_rec; }
-   std::shared_ptr<SymType> get_type() const { return stype_; }
-   void generate(const std::shared_ptr<Generator> &gen);
+   SymType *get_type() const { return stype_; }
+   int get_need() const { return 1; }
+   SynObj *generate_step(const std::shared_ptr<Generator> &gen, int &step);
    void generate_base(const std::shared_ptr<Generator> &gen, bool flag = false);
    void pop_val(const std::shared_ptr<Generator> &gen);
    void generate_arg_rec(const std::shared_ptr<Generator> &gen) {}
    void generate_lvalue(const std::shared_ptr<Generator> &gen);
+   IrInst *lower_address(IrBuilder &ir);
+   IrInst *lower_field(IrBuilder &ir, IrInst *base);
 };
 
 class SynArray: public SynVar
 {
-   std::shared_ptr<SynVar> lp_;
-   std::shared_ptr<SymType> el_type_;
+   SynVar *lp_;
+   SymType *el_type_;
    size_t dim_;
-   std::list<std::shared_ptr<Expr>> indexes_;
+   NodeList<Expr *> indexes_;
+   int need_;
+   IrInst *lower_index(IrBuilder &ir, IrInst *base);
 public:
-   SynArray(const std::string &nm, const std::shared_ptr<SynVar> &e, const std::list<std::shared_ptr<Expr>> &l,
-      const std::shared_ptr<SymVar> &v, const std::shared_ptr<SymType> &st);
+   SynArray(const std::string &nm, SynVar *e, const NodeList<Expr *> &l,
+      SymVar *v, SymType *st);
    ~SynArray() {}
-   void print(std::ofstream &output, int depth);
-   std::shared_ptr<SymType> get_type() const { return el_type_; }
+   SynObj *print_step(std::ostream &output, int depth, int &step, int &child_depth);
+   SymType *get_type() const { return el_type_; }
    size_t get_size_k(size_t k);
    SynTypes get_syn_type() const { return syn_array; }
-   void generate(const std::shared_ptr<Generator> &gen);
+   int get_need() const { return need_; }
+   SynObj *generate_step(const std::shared_ptr<Generator> &gen, int &step);
    void generate_base(const std::shared_ptr<Generator> &gen, bool flag = false);
    void generate_index(const std::shared_ptr<Generator> &gen);
    void pop_val(const std::shared_ptr<Generator> &gen);
    void generate_arg_rec(const std::shared_ptr<Generator> &gen) {}
    void generate_lvalue(const std::shared_ptr<Generator> &gen);
+   IrInst *lower_address(IrBuilder &ir);
+   IrInst *lower_field(IrBuilder &ir, IrInst *base);
 };
 
 class EmptyExpr: public Expr
 {
 public:
-   EmptyExpr(): Expr(std::make_shared<SymType>()) {}
+   EmptyExpr(): Expr(no_type()) {}
    ~EmptyExpr() {}
-   void print(std::ofstream &output, int depth) {};
-   std::shared_ptr<SymType> get_type() const { return expr_type_; }
-   void generate(const std::shared_ptr<Generator> &gen) {};
+   SynObj *print_step(std::ostream &output, int depth, int &step, int &child_depth) { return nullptr; };
+   SymType *get_type() const { return expr_type_; }
+   SynObj *generate_step(const std::shared_ptr<Generator> &gen, int &step) { return nullptr; };
+   SynObj *lower_step(IrBuilder &ir, int &step);
 };
 
 #endif
\ No newline at end of file
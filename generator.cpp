@@ -1,6 +1,7 @@
 #include "generator.h"
+#include <sstream>
 
-std::string commands[] = 
+static const std::string commands[] = 
 {
    "push", "pop", "add", "sub", "mul", "div", "mov", "idiv",
    "ret", "faddp", "fsubp", "fdivp", "fmulp", "fxch", "fabs", "fchs",
@@ -9,10 +10,11 @@ std::string commands[] =
    "invoke", "movsd", "or", "xor", "and", "imul", "neg", "inc",
    "dec", "fcompp", "sahf", "setg", "setl", "sete", "setne", "setle",
    "setge", "cdq", "fild", "sal", "sar", "seta", "setb", "setae",
-   "setbe", "setz",
+   "setbe", "setz", "ja", "jb", "jae", "jbe", "fadd", "fsub",
+   "fmul", "fdiv",
 };
 
-void Instruction::write_command(std::ofstream &output) const
+void Instruction::write_command(std::ostream &output) const
 {
    std::string str_cmd;
    switch(cmd_)
@@ -54,7 +56,7 @@ Instruction::Instruction(AsmCommands c, AsmOperands t1, const std::string &o1, A
    second_op_ = std::make_shared<Operand>(t2, boost::lexical_cast<std::string>(o2));
 }
 
-void Generator::write_to_file(std::ofstream &output, bool opt)
+void Generator::write_to_file(std::ostream &output, bool opt)
 {
    if (opt)
       optimize();
@@ -62,26 +64,110 @@ void Generator::write_to_file(std::ofstream &output, bool opt)
       it.write_command(output);
 }
 
+std::string Generator::text() const
+{
+   std::ostringstream output;
+   for each(const auto& it in commands_)
+      it.write_command(output);
+   return output.str();
+}
+
+std::string Generator::text(std::list<Instruction>::iterator first, std::list<Instruction>::iterator last) const
+{
+   std::ostringstream output;
+   for (++last; first != last; ++first)
+      first->write_command(output);
+   return output.str();
+}
+
+std::shared_ptr<Generator> Generator::copy() const
+{
+   //optimize() renames operands in place, so they are not shared with the copy
+   auto gen = std::make_shared<Generator>();
+   for each(const auto& it in commands_)
+      gen->push(Instruction(it.get_cmd(), std::make_shared<Operand>(*it.get_first()), std::make_shared<Operand>(*it.get_second())));
+   return gen;
+}
+
+//One instruction a line: the command, then each operand as its type, the length of its
+//name and the name.
+void Generator::save(std::ostream &output) const
+{
+   for each(const auto& it in commands_)
+   {
+      std::shared_ptr<Operand> ops[] = {it.get_first(), it.get_second()};
+      output << it.get_cmd();
+      for (int k = 0; k < 2; ++k)
+         output << ' ' << ops[k]->get_operand_type() << ' ' << ops[k]->get_name().size() << ' ' << ops[k]->get_name();
+      output << '\n';
+   }
+}
+
+static bool read_number(const char *&p, const char *end, size_t &n, char after)
+{
+   const char *first = p;
+   for (n = 0; p != end && *p >= '0' && *p <= '9'; ++p)
+      n = n * 10 + (*p - '0');
+   return p != first && p != end && *p++ == after;
+}
+
+//Appends the instructions saved; false, with nothing appended, if they do not read back.
+bool Generator::load(const char *begin, const char *end)
+{
+   std::list<Instruction> loaded;
+   for (const char *p = begin; p != end;)
+   {
+      size_t cmd, type[2], size;
+      std::shared_ptr<Operand> ops[2];
+      if (!read_number(p, end, cmd, ' ') || cmd > cmd_const_decl)
+         return false;
+      for (int k = 0; k < 2; ++k)
+      {
+         if (!read_number(p, end, type[k], ' ') || type[k] > op_label || !read_number(p, end, size, ' ') || (size_t)(end - p) < size)
+            return false;
+         ops[k] = std::make_shared<Operand>((AsmOperands)type[k], std::string(p, size));
+         p += size;
+         if (k == 0 && (p == end || *p++ != ' '))
+            return false;
+      }
+      if (p == end || *p++ != '\n')
+         return false;
+      loaded.push_back(Instruction((AsmCommands)cmd, ops[0], ops[1]));
+   }
+   commands_.splice(commands_.end(), loaded);
+   return true;
+}
+
+//Puts the code of another generator in place of [first, last] and leaves the two on its ends.
+void Generator::replace(std::list<Instruction>::iterator &first, std::list<Instruction>::iterator &last, Generator &with)
+{
+   auto next = commands_.erase(first, ++last);
+   first = with.commands_.begin();
+   last = --with.commands_.end();
+   commands_.splice(next, with.commands_);
+}
+
 void Generator::optimize()
 {
+   peephole();
+   merge_consts();
+}
+
+//The rules look at neighbouring instructions only and labels are not shared between the
+//code of different table entries, so the code of each entry can be optimized on its own.
+void Generator::peephole()
+{
+   if (commands_.size() < 2)
+      return;
    bool flag = true;
    std::list<std::pair<std::string, std::string>> label_list;
-   std::list<std::pair<std::string, std::string>> var_list;
    do
    {
       auto first_instr = commands_.begin();
       auto second_instr = ++commands_.begin();
-      auto decl_it = first_instr;
       flag = false;
       do
       {
-         if (*first_instr == cmd_wrlab && first_instr->get_first() == op_null && first_instr->get_first()->get_name() == "\ninclude source\\end.inc\n")
-         {
-            decl_it = first_instr;
-            ++first_instr;
-            ++second_instr;
-         }
-
 //       push a
 //       pop b
          if(*first_instr == cmd_push && *second_instr == cmd_pop)
@@ -215,41 +301,6 @@ void Generator::optimize()
          }
 
 
-//       val1 dq 1.2
-//       val2 dq 1.2
-//       -> delete val2, and use val1 instead val2
-         if (*first_instr == cmd_const_decl)
-         {
-            for (auto it = decl_it; it != commands_.end(); ++it)
-               if (*it == cmd_const_decl && first_instr->get_first()->get_name() != (*it).get_first()->get_name() &&
-                  first_instr->get_second()->get_name() == (*it).get_second()->get_name())
-               {
-                  var_list.push_back(std::make_pair(it->get_first()->get_name(), first_instr->get_first()->get_name()));
-                  if (second_instr == it)
-                     ++second_instr;
-                  it = commands_.erase(it);
-                  flag = true;
-               }
-         }
-
-         if ((*first_instr == cmd_push && first_instr->get_first() == op_memory) || 
-            (*first_instr == cmd_mov && first_instr->get_first() == op_register && first_instr->get_second() == op_memory))
-            for each(auto it in var_list)
-            {
-               if ("qword ptr " + it.first == first_instr->get_first()->get_name())
-               {
-                  first_instr->get_first()->set_name("qword ptr " + it.second);
-                  flag = true;
-                  break;
-               }
-               else if ("offset " + it.first == first_instr->get_second()->get_name())
-               {
-                  first_instr->get_second()->set_name("offset " + it.second);
-                  flag = true;
-                  break;
-               }
-            }
-
          ++first_instr;
          ++second_instr;
 
@@ -257,6 +308,47 @@ void Generator::optimize()
    } while(flag);
 }
 
+//       val1 dq 1.2
+//       val2 dq 1.2
+//       -> delete val2, and use val1 instead val2
+void Generator::merge_consts()
+{
+   std::map<std::string, std::string> first_by_value, merged;
+   for (auto it = commands_.begin(); it != commands_.end();)
+   {
+      if (*it != cmd_const_decl)
+      {
+         ++it;
+         continue;
+      }
+      const std::string &name = it->get_first()->get_name();
+      auto first = first_by_value.insert(std::make_pair(it->get_second()->get_name(), name)).first;
+      if (first->second == name)
+      {
+         ++it;
+         continue;
+      }
+      merged[name] = first->second;
+      it = commands_.erase(it);
+   }
+   if (merged.empty())
+      return;
+   for each(auto& it in commands_)
+   {
+      if (it == cmd_wrlab || it == cmd_const_decl)
+         continue;
+      std::shared_ptr<Operand> ops[] = {it.get_first(), it.get_second()};
+      for (int k = 0; k < 2; ++k)
+      {
+         const std::string name = ops[k]->get_name();
+         size_t at = name.compare(0, 10, "qword ptr ") == 0 ? 10 : name.compare(0, 7, "offset ") == 0 ? 7 : 0;
+         auto m = at ? merged.find(name.substr(at)) : merged.end();
+         if (m != merged.end())
+            ops[k]->set_name(name.substr(0, at) + m->second);
+      }
+   }
+}
+
 void Generator::delete_instr(std::list<Instruction>::iterator &it1, std::list<Instruction>::iterator &it2)
 {
    it2 = commands_.erase(it2);
@@ -282,6 +374,10 @@ bool Generator::is_jump(AsmCommands c)
    case cmd_jl:
    case cmd_jle:
    case cmd_je:
+   case cmd_ja:
+   case cmd_jb:
+   case cmd_jae:
+   case cmd_jbe:
       return true;
       break;
    default:
@@ -290,43 +386,198 @@ bool Generator::is_jump(AsmCommands c)
    }
 }
 
-int Generator::generate_int_arithmetic(LexemeType t, bool use_bitwise_op, int i)
+static const char *const cache_registers[] = {"ebx", "ecx", "edx"};
+
+//Whether a memory operand reads the same until something is stored: it names no register
+//but ebp.
+static bool is_stable(const std::string &m)
 {
+   static const char *const registers[] = {"eax", "ebx", "ecx", "edx", "esi", "edi", "esp"};
+   for each(auto r in registers)
+      if (m.find(r) != std::string::npos)
+         return false;
+   return true;
+}
+
+//Pushes the n bottom entries of the cache.
+void Generator::spill(size_t n)
+{
+   for (size_t k = 0; k < n; ++k)
+      emit(Instruction(cmd_push, cached_[k].get_operand_type(), cached_[k].get_name()));
+   cached_.erase(cached_.begin(), cached_.begin() + n);
+}
+
+std::string Generator::free_register(const std::string &except1, const std::string &except2) const
+{
+   for each(auto r in cache_registers)
+   {
+      bool used = r == except1 || r == except2;
+      for each(const auto &it in cached_)
+         used = used || it.get_name() == r;
+      if (!used)
+         return r;
+   }
+   return "";
+}
+
+//Loads the memory operands the cache holds before something is stored.
+void Generator::load_memory()
+{
+   for (size_t k = 0; k < cached_.size(); ++k)
+   {
+      if (cached_[k].get_operand_type() != op_memory)
+         continue;
+      std::string r = free_register();
+      if (r.empty())
+      {
+         spill(k + 1);
+         k = (size_t)-1;
+         continue;
+      }
+      emit(Instruction(cmd_mov, op_register, r, op_memory, cached_[k].get_name()));
+      cached_[k] = Operand(op_register, r);
+   }
+}
+
+//Puts value on top of the operand stack: an immediate or a memory operand that stays the
+//same as it is, anything else as c r, value into a free register r. The bottom of the cache
+//goes to the machine stack when no register is free.
+void Generator::push_value(AsmOperands t, const std::string &value, AsmCommands c)
+{
+   if (c == cmd_mov && (t == op_immediate || (t == op_memory && is_stable(value))))
+   {
+      cached_.push_back(Operand(t, value));
+      return;
+   }
+   std::string r = free_register();
+   while (r.empty())
+   {
+      spill(1);
+      r = free_register();
+   }
+   if (t != op_register || value != r || c != cmd_mov)
+      emit(Instruction(c, op_register, r, t, value));
+   cached_.push_back(Operand(op_register, r));
+}
+
+//Takes the top of the operand stack into a register or into memory. A register loaded by
+//the last instruction only for this is not used: that instruction loads to instead.
+void Generator::pop_value(AsmOperands t, const std::string &to)
+{
+   if (t == op_memory)
+      load_memory();
+   if (cached_.empty())
+   {
+      emit(Instruction(cmd_pop, t, to));
+      return;
+   }
+   Operand top = cached_.back();
+   cached_.pop_back();
+   if (top.get_name() == to)
+      return;
+   if (top.get_operand_type() == op_register && !commands_.empty())
+   {
+      Instruction &last = commands_.back();
+      if ((last == cmd_mov || last == cmd_lea) && last.get_first()->get_name() == top.get_name()
+         && (t == op_register || (last == cmd_mov && last.get_second() != op_memory)))
+      {
+         if (last == cmd_mov && last.get_second()->get_name() == to)
+            commands_.pop_back();
+         else
+            last = Instruction(last.get_cmd(), std::make_shared<Operand>(t, to), last.get_second());
+         return;
+      }
+   }
+   emit(Instruction(cmd_mov, t, to, top.get_operand_type(), top.get_name()));
+}
+
+//Takes the top of the operand stack where it is, into reg when it is on the machine stack.
+Operand Generator::pop_operand(const std::string &reg)
+{
+   if (cached_.empty())
+   {
+      emit(Instruction(cmd_pop, op_register, reg));
+      return Operand(op_register, reg);
+   }
+   Operand top = cached_.back();
+   cached_.pop_back();
+   return top;
+}
+
+//Moves what the cache keeps in reg1 or reg2 elsewhere, so an instruction can use them.
+void Generator::reserve(const std::string &reg1, const std::string &reg2)
+{
+   for (size_t k = 0; k < cached_.size(); ++k)
+   {
+      const std::string name = cached_[k].get_name();
+      if (cached_[k].get_operand_type() != op_register || (name != reg1 && name != reg2))
+         continue;
+      std::string r = free_register(reg1, reg2);
+      if (r.empty())
+      {
+         spill(k + 1);
+         k = (size_t)-1;
+         continue;
+      }
+      emit(Instruction(cmd_mov, op_register, r, op_register, name));
+      cached_[k] = Operand(op_register, r);
+   }
+}
+
+//Exchanges the two top entries of the operand stack, in the cache: what of them is on the
+//machine stack is popped into registers first.
+void Generator::swap_top()
+{
+   while (cached_.size() < 2)
+   {
+      std::string r = free_register();
+      emit(Instruction(cmd_pop, op_register, r));
+      cached_.insert(cached_.begin(), Operand(op_register, r));
+   }
+   std::swap(cached_[cached_.size() - 1], cached_[cached_.size() - 2]);
+}
+
+//eax op right; the result is in eax, or in edx when 0 is returned. Division needs right in
+//a register other than edx.
+int Generator::generate_int_arithmetic(LexemeType t, bool use_bitwise_op, int i, const Operand &right)
+{
+   AsmOperands rt = right.get_operand_type();
+   const std::string r = right.get_name();
    switch(t)
    {
    case plus_op:
-      push(Instruction(cmd_add, op_register, "eax", op_register, "ecx"));
+      emit(Instruction(cmd_add, op_register, "eax", rt, r));
       break;
    case minus_op:
-      push(Instruction(cmd_sub, op_register, "eax", op_register, "ecx"));
+      emit(Instruction(cmd_sub, op_register, "eax", rt, r));
       break;
    case mul_op:
       if (use_bitwise_op)
-         push(Instruction(cmd_sal, op_register, "eax", op_immediate, i));
+         emit(Instruction(cmd_sal, op_register, "eax", op_immediate, i));
       else
-         push(Instruction(cmd_mul, op_register, "ecx"));
+         emit(Instruction(cmd_imul, op_register, "eax", rt, r));
       break;
    case or_op:
-      push(Instruction(cmd_or, op_register, "eax", op_register, "ecx"));
+      emit(Instruction(cmd_or, op_register, "eax", rt, r));
       break;
    case xor_op:
-      push(Instruction(cmd_xor, op_register, "eax", op_register, "ecx"));
+      emit(Instruction(cmd_xor, op_register, "eax", rt, r));
       break;
    case and_op:
-      push(Instruction(cmd_and, op_register, "eax", op_register, "ecx"));
+      emit(Instruction(cmd_and, op_register, "eax", rt, r));
       break;
    case mod_op:
-      push(Instruction(cmd_cdq));
-      push(Instruction(cmd_idiv, op_register, "ecx"));
+      emit(Instruction(cmd_cdq));
+      emit(Instruction(cmd_idiv, rt, r));
       return 0;
       break;
    case div_op:
       if (use_bitwise_op)
-         push(Instruction(cmd_sar, op_register, "eax", op_immediate, i));
+         emit(Instruction(cmd_sar, op_register, "eax", op_immediate, i));
       else
       {
-         push(Instruction(cmd_cdq));
-         push(Instruction(cmd_idiv, op_register, "ecx"));
+         emit(Instruction(cmd_cdq));
+         emit(Instruction(cmd_idiv, rt, r));
       }
       break;
    }
@@ -358,40 +609,100 @@ void Generator::generate_setcc(LexemeType t, bool is_unsigned_cmp)
    {
    case lesser_equal:
       if (is_unsigned_cmp)
-         push(Instruction(cmd_setbe, op_register, "al"));
+         emit(Instruction(cmd_setbe, op_register, "al"));
       else
-         push(Instruction(cmd_setle, op_register, "al"));
+         emit(Instruction(cmd_setle, op_register, "al"));
       break;
    case greater_equal:
       if (is_unsigned_cmp)
-         push(Instruction(cmd_setae, op_register, "al"));
+         emit(Instruction(cmd_setae, op_register, "al"));
       else
-         push(Instruction(cmd_setge, op_register, "al"));
+         emit(Instruction(cmd_setge, op_register, "al"));
       break;
    case equal:
-      push(Instruction(cmd_sete, op_register, "al"));
+      emit(Instruction(cmd_sete, op_register, "al"));
       break;
    case not_equal:
-      push(Instruction(cmd_setne, op_register, "al"));
+      emit(Instruction(cmd_setne, op_register, "al"));
       break;
    case greater:
       if (is_unsigned_cmp)
-         push(Instruction(cmd_seta, op_register, "al"));
+         emit(Instruction(cmd_seta, op_register, "al"));
       else
-         push(Instruction(cmd_setg, op_register, "al"));
+         emit(Instruction(cmd_setg, op_register, "al"));
       break;
    case lesser:
       if (is_unsigned_cmp)
-         push(Instruction(cmd_setb, op_register, "al"));
+         emit(Instruction(cmd_setb, op_register, "al"));
       else
-         push(Instruction(cmd_setl, op_register, "al"));
+         emit(Instruction(cmd_setl, op_register, "al"));
       break;
    }
 }
 
 void Generator::generate_pop_test()
 {
-   push(Instruction(cmd_pop, op_register, "eax"));
-   push(Instruction(cmd_test, op_register, "al", op_register, "al"));
+   pop_value(op_register, "eax");
+   emit(Instruction(cmd_test, op_register, "al", op_register, "al"));
 }
 
+//Jumps to label when the condition just generated holds, or when it does not unless holds
+//is set: by the flags of its comparison, or by the value it left on the operand stack.
+void Generator::generate_branch(const std::string &label, bool holds)
+{
+   if (!has_flags_)
+   {
+      generate_pop_test();
+      push(Instruction(holds ? cmd_jnz : cmd_jz, op_label, label));
+      return;
+   }
+   has_flags_ = false;
+   LexemeType t = flags_;
+   if (!holds)
+   {
+      switch(t)
+      {
+      case lesser_equal:
+         t = greater;
+         break;
+      case greater_equal:
+         t = lesser;
+         break;
+      case equal:
+         t = not_equal;
+         break;
+      case not_equal:
+         t = equal;
+         break;
+      case greater:
+         t = lesser_equal;
+         break;
+      case lesser:
+         t = greater_equal;
+         break;
+      }
+   }
+   AsmCommands c = cmd_jmp;
+   switch(t)
+   {
+   case lesser_equal:
+      c = unsigned_flags_ ? cmd_jbe : cmd_jle;
+      break;
+   case greater_equal:
+      c = unsigned_flags_ ? cmd_jae : cmd_jge;
+      break;
+   case equal:
+      c = cmd_je;
+      break;
+   case not_equal:
+      c = cmd_jne;
+      break;
+   case greater:
+      c = unsigned_flags_ ? cmd_ja : cmd_jg;
+      break;
+   case lesser:
+      c = unsigned_flags_ ? cmd_jb : cmd_jl;
+      break;
+   }
+   push(Instruction(c, op_label, label));
+}
@@ -3,6 +3,7 @@
 #define COMPILER_GENERATOR_H_
 #include <map>
 #include <list>
+#include <vector>
 #include <iostream>
 #include <fstream>
 #include <string>
@@ -18,7 +19,8 @@ enum AsmCommands
    cmd_invoke, cmd_movsd, cmd_or, cmd_xor, cmd_and, cmd_imul, cmd_neg, cmd_inc,
    cmd_dec, cmd_fcompp, cmd_sahf, cmd_setg, cmd_setl, cmd_sete, cmd_setne, cmd_setle,
    cmd_setge, cmd_cdq, cmd_fild, cmd_sal, cmd_sar, cmd_seta, cmd_setb, cmd_setae,
-   cmd_setbe, cmd_setz, cmd_wrlab, cmd_const_decl
+   cmd_setbe, cmd_setz, cmd_ja, cmd_jb, cmd_jae, cmd_jbe, cmd_fadd, cmd_fsub,
+   cmd_fmul, cmd_fdiv, cmd_wrlab, cmd_const_decl
 };
 
 enum AsmOperands
@@ -53,7 +55,7 @@ public:
    Instruction(AsmCommands c, std::shared_ptr<Operand> op1, std::shared_ptr<Operand> op2 = nullptr);
    Instruction(AsmCommands c, AsmOperands t1, const std::string &o1, AsmOperands t2, size_t o2);
    ~Instruction() {}
-   void write_command(std::ofstream &output) const;
+   void write_command(std::ostream &output) const;
    AsmCommands get_cmd() const { return cmd_; }
    std::shared_ptr<Operand> get_first() const { return first_op_; }
    std::shared_ptr<Operand> get_second() const { return second_op_; }
@@ -64,35 +66,72 @@ public:
 class Generator
 {
    std::list<Instruction> commands_;
+   std::string label_prefix_;
    size_t label_counter_;
-   bool cycle_;
-   std::string cycle_begin_, cycle_end_;
-   void optimize();
+   //Where continue and break jump in each loop around the code being generated.
+   std::vector<std::pair<std::string, std::string>> cycles_;
+   //The top entries of the operand stack, above what is on the machine stack: registers of
+   //cache_registers, or immediates and memory operands not loaded anywhere yet.
+   std::vector<Operand> cached_;
+   //The comparison whose flags a condition left instead of a value, for the branch on it.
+   LexemeType flags_;
+   bool unsigned_flags_, has_flags_;
+   void spill(size_t n);
+   void load_memory();
+   std::string free_register(const std::string &except1 = "", const std::string &except2 = "") const;
    void delete_instr(std::list<Instruction>::iterator &it1, std::list<Instruction>::iterator &it2);
    void delete_instr(std::list<Instruction>::iterator &it1);
    bool is_jump(AsmCommands c);
 public:
-   Generator(): label_counter_(0), cycle_(false) {}
+   //Labels are named l_<prefix><n>, so code generated apart under different prefixes
+   //can be put together.
+   Generator(const std::string &prefix = ""): label_prefix_(prefix), label_counter_(0), has_flags_(false) {}
    ~Generator() {};
    void generate();
-   void write_to_file(std::ofstream &output, bool opt);
-   void push(Instruction i) { commands_.push_back(i); }
+   void write_to_file(std::ostream &output, bool opt);
+   void optimize();
+   void peephole();
+   void merge_consts();
+   void append(Generator &part) { commands_.splice(commands_.end(), part.commands_); }
+   std::shared_ptr<Generator> copy() const;
+   void save(std::ostream &output) const;
+   bool load(const char *begin, const char *end);
+   std::string text() const;
+   std::string text(std::list<Instruction>::iterator first, std::list<Instruction>::iterator last) const;
+   std::list<Instruction>::iterator last() { return --commands_.end(); }
+   void replace(std::list<Instruction>::iterator &first, std::list<Instruction>::iterator &last, Generator &with);
+   //An instruction that knows nothing of the cached operand stack gets it on the machine
+   //stack first: a call, a jump, a label or code reading [esp].
+   void push(Instruction i) { if (!cached_.empty()) flush(); commands_.push_back(i); }
+   //For an instruction leaving the cached entries where they are: it uses eax, esi and edi or
+   //a register reserved.
+   void emit(Instruction i) { commands_.push_back(i); }
+   void flush() { spill(cached_.size()); }
+   void push_value(AsmOperands t, const std::string &value, AsmCommands c = cmd_mov);
+   void pop_value(AsmOperands t, const std::string &to);
+   Operand pop_operand(const std::string &reg);
+   void reserve(const std::string &reg1, const std::string &reg2 = "");
+   void swap_top();
    void push_label(const std::string &s) { push(Instruction(cmd_wrlab, op_label, s)); }
    void push_string(const std::string &s) { push(Instruction(cmd_wrlab, op_null, s)); }
+   //The head of a loop starts on 16 bytes, so how the short loops run does not depend on
+   //where the code before them ends.
+   void push_align() { push_string("\talign 16\n"); }
    void push_const_decl(const std::string &s1, const std::string &s2) { push(Instruction(cmd_const_decl, op_null, s1, op_null, s2)); }
-   std::string generate_label() { return "l_" + boost::lexical_cast<std::string>(label_counter_++); }
-   bool is_cycle() const { return cycle_; }
-   const std::string &get_end_of_cycle() const { return cycle_end_; }
-   const std::string &get_begin_of_cycle() const { return cycle_begin_; }
-   void set_cycle(bool val) { cycle_ = val; }
-   void set_cycle_begin(const std::string &lab_beg) { cycle_begin_ = lab_beg; }
-   void set_cycle_end(const std::string &lab_end) { cycle_end_ = lab_end; }
+   std::string generate_label() { return "l_" + label_prefix_ + boost::lexical_cast<std::string>(label_counter_++); }
+   bool is_cycle() const { return !cycles_.empty(); }
+   const std::string &get_end_of_cycle() const { return cycles_.back().second; }
+   const std::string &get_begin_of_cycle() const { return cycles_.back().first; }
+   void push_cycle(const std::string &lab_beg, const std::string &lab_end) { cycles_.push_back(std::make_pair(lab_beg, lab_end)); }
+   void pop_cycle() { cycles_.pop_back(); }
    const Instruction& get_last_instr() const { return commands_.back(); }
    void pop_last_instr() { commands_.pop_back(); }
    void generate_double_arithmetic(LexemeType t);
-   int generate_int_arithmetic(LexemeType t, bool use_bitwise_op, int i);
+   int generate_int_arithmetic(LexemeType t, bool use_bitwise_op, int i, const Operand &right);
    void generate_setcc(LexemeType t, bool is_unsigned_cmp = false);
    void generate_pop_test();
+   void set_flags(LexemeType t, bool is_unsigned_cmp = false) { flags_ = t; unsigned_flags_ = is_unsigned_cmp; has_flags_ = true; }
+   void generate_branch(const std::string &label, bool holds = false);
 };
 
 #endif
\ No newline at end of file
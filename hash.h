@@ -0,0 +1,16 @@
+#pragma once
+#ifndef COMPILER_HASH_H_
+#define COMPILER_HASH_H_
+#include <cstddef>
+
+//FNV-1a, for hashes of contents; a hash can be carried on over several pieces.
+const unsigned long long fnv_basis = 14695981039346656037ull;
+
+inline unsigned long long fnv1a(const void *data, size_t size, unsigned long long hash = fnv_basis)
+{
+   for (size_t i = 0; i < size; ++i)
+      hash = (hash ^ ((const unsigned char *)data)[i]) * 1099511628211ull;
+   return hash;
+}
+
+#endif
@@ -0,0 +1,433 @@
+#include "ir.h"
+#include <algorithm>
+#include <sstream>
+#include <unordered_map>
+
+bool IrInst::has_effect() const
+{
+   switch (op)
+   {
+      case ir_store:
+      case ir_call:
+      case ir_write:
+      case ir_write_str:
+      case ir_newline:
+      case ir_jump:
+      case ir_branch:
+      case ir_ret:
+         return true;
+      default:
+         return false;
+   }
+}
+
+const std::vector<IrBlock *> &IrBlock::succs() const
+{
+   static const std::vector<IrBlock *> none;
+   IrInst *t = terminator();
+   return t ? t->targets : none;
+}
+
+size_t IrBlock::pred_index(IrBlock *b) const
+{
+   return std::find(preds.begin(), preds.end(), b) - preds.begin();
+}
+
+IrFunction::IrFunction(const std::string &n, SymProc *p): values_(0), name(n), proc(p), locals(0), args_size(0)
+{
+   if (!proc)
+      return;
+   locals = proc->get_size_local_args();
+   for each(auto it in proc->get_arg_list())
+      args_size += it->get_sym_var()->is_var_arg() ? 4 : (int)it->get_type()->get_size();
+}
+
+IrInst *IrFunction::make(IrOp op, IrType type)
+{
+   insts_.emplace_back();
+   IrInst *inst = &insts_.back();
+   inst->op = op;
+   inst->type = type;
+   inst->cond = ir_eq;
+   inst->id = type == ir_void ? 0 : ++values_;
+   inst->imm = 0;
+   inst->num = 0;
+   inst->proc = nullptr;
+   inst->block = nullptr;
+   return inst;
+}
+
+IrBlock *IrFunction::make_block()
+{
+   blocks_.emplace_back();
+   IrBlock *b = &blocks_.back();
+   b->id = (int)blocks_.size() - 1;
+   b->rpo = -1;
+   b->idom = nullptr;
+   b->dom_pre = b->dom_post = 0;
+   blocks.push_back(b);
+   return b;
+}
+
+int IrFunction::result_offset() const
+{
+   return proc && proc->get_size_ret_value() ? 8 + args_size : 0;
+}
+
+//Reverse postorder by a walk with an explicit stack, then the dominators by the iteration
+//of Cooper, Harvey and Kennedy over it, and the dominator tree numbered so that a block
+//dominates another when its interval holds the other's.
+std::vector<IrBlock *> IrFunction::order()
+{
+   for each(auto b in blocks)
+      b->rpo = -1;
+   std::vector<IrBlock *> post;
+   std::vector<std::pair<IrBlock *, size_t>> stack(1, std::make_pair(blocks[0], (size_t)0));
+   blocks[0]->rpo = 0;
+   while (!stack.empty())
+   {
+      auto &top = stack.back();
+      const auto &succs = top.first->succs();
+      if (top.second < succs.size())
+      {
+         IrBlock *next = succs[top.second++];
+         if (next->rpo < 0)
+         {
+            next->rpo = 0;
+            stack.push_back(std::make_pair(next, (size_t)0));
+         }
+         continue;
+      }
+      post.push_back(top.first);
+      stack.pop_back();
+   }
+   std::vector<IrBlock *> rpo(post.rbegin(), post.rend());
+   for (size_t k = 0; k < rpo.size(); ++k)
+      rpo[k]->rpo = (int)k;
+
+   std::vector<IrBlock *> reachable;
+   for each(auto b in blocks)
+   {
+      if (b->rpo < 0)
+         continue;
+      reachable.push_back(b);
+      for (size_t k = b->preds.size(); k-- > 0;)
+         if (b->preds[k]->rpo < 0)
+            remove_pred(b, k);
+   }
+   blocks.swap(reachable);
+
+   for each(auto b in rpo)
+      b->idom = nullptr;
+   rpo[0]->idom = rpo[0];
+   for (bool changed = true; changed;)
+   {
+      changed = false;
+      for (size_t k = 1; k < rpo.size(); ++k)
+      {
+         IrBlock *idom = nullptr;
+         for each(auto p in rpo[k]->preds)
+         {
+            if (!p->idom)
+               continue;
+            if (!idom)
+            {
+               idom = p;
+               continue;
+            }
+            IrBlock *a = p, *b = idom;
+            while (a != b)
+            {
+               while (a->rpo > b->rpo)
+                  a = a->idom;
+               while (b->rpo > a->rpo)
+                  b = b->idom;
+            }
+            idom = a;
+         }
+         if (idom != rpo[k]->idom)
+         {
+            rpo[k]->idom = idom;
+            changed = true;
+         }
+      }
+   }
+
+   std::unordered_map<IrBlock *, std::vector<IrBlock *>> children;
+   for (size_t k = 1; k < rpo.size(); ++k)
+      children[rpo[k]->idom].push_back(rpo[k]);
+   int counter = 0;
+   std::vector<std::pair<IrBlock *, size_t>> walk(1, std::make_pair(rpo[0], (size_t)0));
+   rpo[0]->dom_pre = counter++;
+   while (!walk.empty())
+   {
+      auto &top = walk.back();
+      auto &kids = children[top.first];
+      if (top.second < kids.size())
+      {
+         IrBlock *next = kids[top.second++];
+         next->dom_pre = counter++;
+         walk.push_back(std::make_pair(next, (size_t)0));
+         continue;
+      }
+      top.first->dom_post = counter++;
+      walk.pop_back();
+   }
+   return rpo;
+}
+
+bool IrFunction::dominates(const IrBlock *a, const IrBlock *b) const
+{
+   return a->dom_pre <= b->dom_pre && b->dom_post <= a->dom_post;
+}
+
+//Drops the edge from the k-th predecessor of b with the operands of the phis for it.
+void IrFunction::remove_pred(IrBlock *b, size_t k)
+{
+   b->preds.erase(b->preds.begin() + k);
+   for each(auto inst in b->insts)
+   {
+      if (inst->op != ir_phi)
+         break;
+      inst->args.erase(inst->args.begin() + k);
+   }
+}
+
+static const char *op_names[] =
+{
+   "const", "global", "frame", "param", "load", "store", "add", "sub", "mul", "div", "mod",
+   "and", "or", "xor", "neg", "cmp", "itod", "call", "write", "write", "writeln", "phi",
+   "jump", "branch", "ret",
+};
+
+static const char *type_names[] = {"void", "int", "double", "addr"};
+static const char *cond_names[] = {"eq", "ne", "lt", "le", "gt", "ge"};
+
+static std::string block_name(const IrBlock *b)
+{
+   return "b" + boost::lexical_cast<std::string>(b->id);
+}
+
+static void print_inst(std::ostream &output, const IrInst *inst)
+{
+   output << "   ";
+   if (inst->id)
+      output << '%' << inst->id << " = ";
+   output << op_names[inst->op];
+   if (inst->op == ir_cmp)
+      output << ' ' << cond_names[inst->cond];
+   if (inst->id)
+      output << ' ' << type_names[inst->type];
+   switch (inst->op)
+   {
+      case ir_const:
+         if (inst->type == ir_int)
+            output << ' ' << inst->imm;
+         else
+            output << ' ' << boost::lexical_cast<std::string>(inst->num);
+         break;
+      case ir_frame:
+      case ir_param:
+         output << ' ' << inst->imm;
+         break;
+      case ir_global:
+      case ir_write_str:
+      case ir_call:
+         output << ' ' << inst->sym;
+         break;
+   }
+   for (size_t k = 0; k < inst->args.size(); ++k)
+   {
+      output << (k ? ", " : " ");
+      if (inst->op == ir_phi)
+         output << '[';
+      output << '%' << inst->args[k]->id;
+      if (inst->op == ir_phi)
+         output << ", " << (k < inst->block->preds.size() ? block_name(inst->block->preds[k]) : "?") << ']';
+   }
+   for (size_t k = 0; k < inst->targets.size(); ++k)
+      output << (k || !inst->args.empty() ? ", " : " ") << block_name(inst->targets[k]);
+   output << '\n';
+}
+
+void IrFunction::print(std::ostream &output) const
+{
+   output << name << ":\n";
+   for each(auto b in blocks)
+   {
+      output << block_name(b) << ':';
+      for (size_t k = 0; k < b->preds.size(); ++k)
+         output << (k ? ", " : "\t\t; from ") << block_name(b->preds[k]);
+      output << '\n';
+      for each(auto inst in b->insts)
+         print_inst(output, inst);
+   }
+}
+
+static bool is_number(IrType t)
+{
+   return t == ir_int || t == ir_double;
+}
+
+//Whether the operands and the value of an instruction have the types it takes.
+static bool check_types(const IrInst *inst)
+{
+   const auto &a = inst->args;
+   auto arity = [&](size_t n) { return a.size() == n; };
+   switch (inst->op)
+   {
+      case ir_const:
+         return arity(0) && is_number(inst->type);
+      case ir_global:
+      case ir_frame:
+         return arity(0) && inst->type == ir_addr;
+      case ir_param:
+         return arity(0) && inst->type != ir_void;
+      case ir_load:
+         return arity(1) && a[0]->type == ir_addr && inst->type != ir_void;
+      case ir_store:
+         return arity(2) && a[0]->type == ir_addr && a[1]->type != ir_void;
+      case ir_add:
+         if (inst->type == ir_addr)
+            return arity(2) && a[0]->type == ir_addr && a[1]->type == ir_int;
+         return arity(2) && is_number(inst->type) && a[0]->type == inst->type && a[1]->type == inst->type;
+      case ir_sub:
+      case ir_mul:
+      case ir_div:
+         return arity(2) && is_number(inst->type) && a[0]->type == inst->type && a[1]->type == inst->type;
+      case ir_mod:
+      case ir_and:
+      case ir_or:
+      case ir_xor:
+         return arity(2) && inst->type == ir_int && a[0]->type == ir_int && a[1]->type == ir_int;
+      case ir_neg:
+         return arity(1) && is_number(inst->type) && a[0]->type == inst->type;
+      case ir_cmp:
+         return arity(2) && inst->type == ir_int && is_number(a[0]->type) && a[1]->type == a[0]->type;
+      case ir_itod:
+         return arity(1) && inst->type == ir_double && a[0]->type == ir_int;
+      case ir_call:
+      {
+         if (!inst->proc || inst->proc->get_arg_list().size() != a.size())
+            return false;
+         for (size_t k = 0; k < a.size(); ++k)
+         {
+            SynVar *param = inst->proc->get_arg_list()[k];
+            if (a[k]->type != (param->get_sym_var()->is_var_arg() ? ir_addr : ir_type_of(param->get_type())))
+               return false;
+         }
+         return true;
+      }
+      case ir_write:
+         return arity(1) && is_number(a[0]->type);
+      case ir_write_str:
+         return arity(0) && !inst->sym.empty();
+      case ir_newline:
+      case ir_ret:
+         return arity(0) && inst->targets.empty();
+      case ir_phi:
+         return inst->type != ir_void && std::all_of(a.begin(), a.end(), [&](IrInst *v) { return v->type == inst->type; });
+      case ir_jump:
+         return arity(0) && inst->targets.size() == 1;
+      case ir_branch:
+         return arity(1) && a[0]->type == ir_int && inst->targets.size() == 2;
+   }
+   return false;
+}
+
+//Checks the form of the function: terminators, edges, phis, types, and that every
+//operand is defined where it dominates its use. Orders the blocks first.
+bool IrFunction::verify(std::string &error)
+{
+   if (blocks.empty() || !blocks[0]->preds.empty())
+   {
+      error = "the entry block has predecessors";
+      return false;
+   }
+   order();
+   std::unordered_map<const IrInst *, size_t> place;
+   for each(auto b in blocks)
+      for (size_t k = 0; k < b->insts.size(); ++k)
+         place[b->insts[k]] = k;
+   std::ostringstream what;
+   for each(auto b in blocks)
+   {
+      if (!b->terminator())
+         what << block_name(b) << " does not end with a jump or a return";
+      for (size_t k = 0; k < b->insts.size() && what.str().empty(); ++k)
+      {
+         IrInst *inst = b->insts[k];
+         if (inst->block != b)
+            what << "it is not in the block it says";
+         else if (inst->is_terminator() && k + 1 != b->insts.size())
+            what << "it ends the block before its end";
+         else if (inst->op == ir_phi && k && b->insts[k - 1]->op != ir_phi)
+            what << "a phi after other instructions";
+         else if (inst->op == ir_phi && inst->args.size() != b->preds.size())
+            what << "a phi without one operand for each predecessor";
+         else if (!check_types(inst))
+            what << "the types of its operands or value do not fit";
+         for (size_t i = 0; i < inst->args.size() && what.str().empty(); ++i)
+         {
+            IrInst *arg = inst->args[i];
+            auto at = place.find(arg);
+            if (at == place.end() || !arg->id)
+               what << "operand " << i << " is not a value of the function";
+            else if (inst->op == ir_phi ? !dominates(arg->block, b->preds[i])
+               : (arg->block == b ? at->second >= k : !dominates(arg->block, b)))
+               what << "operand %" << arg->id << " does not dominate its use";
+         }
+         for each(auto t in inst->targets)
+            if (what.str().empty() && (t->rpo < 0 || std::count(t->preds.begin(), t->preds.end(), b) != std::count(inst->targets.begin(), inst->targets.end(), t)))
+               what << "its edge to " << block_name(t) << " is not among the predecessors there";
+         if (!what.str().empty())
+         {
+            std::ostringstream text;
+            print_inst(text, inst);
+            what << " in " << block_name(b) << ":" << text.str();
+         }
+      }
+      for each(auto p in b->preds)
+         if (what.str().empty() && std::find(p->succs().begin(), p->succs().end(), b) == p->succs().end())
+            what << block_name(b) << " has " << block_name(p) << " for a predecessor without an edge from it";
+      if (!what.str().empty())
+      {
+         error = name + ": " + what.str();
+         return false;
+      }
+   }
+   return true;
+}
+
+bool generate_ir(SymProc *proc, Statement *body, Generator &gen, Generator &data)
+{
+   std::string reason;
+   auto f = lower(proc, body, reason);
+   if (!f || !f->verify(reason))
+      return false;
+   optimize(*f);
+   if (!f->verify(reason))
+      return false;
+   select(*f, gen, data);
+   return true;
+}
+
+void print_ir(SymProc *proc, Statement *body, std::ostream &output)
+{
+   std::string reason;
+   auto f = lower(proc, body, reason);
+   if (!f)
+   {
+      output << (proc ? "pr_" + proc->get_name() : "main") << ": not lowered, " << reason << "\n\n";
+      return;
+   }
+   if (f->verify(reason))
+   {
+      optimize(*f);
+      f->verify(reason);
+   }
+   f->print(output);
+   if (!reason.empty())
+      output << "; does not verify: " << reason << '\n';
+   output << '\n';
+}
@@ -0,0 +1,161 @@
+#pragma once
+#ifndef COMPILER_IR_H_
+#define COMPILER_IR_H_
+#include "statement.h"
+#include <deque>
+
+//A typed three-address code in SSA form that -o lowers procedures to before it selects
+//their instructions. Every instruction that makes a value is the value; the operands
+//of a phi come from the predecessors of its block in their order.
+enum IrType
+{
+   ir_void, ir_int, ir_double, ir_addr,
+};
+
+enum IrOp
+{
+   //const: imm or num (and sym, the data label of a double read from the source);
+   //global: the address of sym; frame: ebp + imm; param: what is in the frame at
+   //ebp + imm when the procedure starts.
+   ir_const, ir_global, ir_frame, ir_param,
+   //load [a0]; store [a0] := a1
+   ir_load, ir_store,
+   ir_add, ir_sub, ir_mul, ir_div, ir_mod, ir_and, ir_or, ir_xor, ir_neg,
+   //cmp a0 cond a1: 1 or 0, of ints or of doubles
+   ir_cmp, ir_itod,
+   //call proc with the arguments in the order it declares them; the value is its result
+   ir_call,
+   //write a0 as an int or a double; write the string sym; end the line
+   ir_write, ir_write_str, ir_newline,
+   ir_phi,
+   //jump b0; branch a0, b0 (when not 0), b1; ret
+   ir_jump, ir_branch, ir_ret,
+};
+
+enum IrCond
+{
+   ir_eq, ir_ne, ir_lt, ir_le, ir_gt, ir_ge,
+};
+
+struct IrBlock;
+
+struct IrInst
+{
+   IrOp op;
+   IrType type;
+   IrCond cond;
+   //Values are numbered from 1 in the order they are made; 0 for instructions that make none.
+   int id;
+   int imm;
+   double num;
+   std::string sym;
+   SymProc *proc;
+   std::vector<IrInst *> args;
+   std::vector<IrBlock *> targets;
+   IrBlock *block;
+   bool is_terminator() const { return op == ir_jump || op == ir_branch || op == ir_ret; }
+   bool has_effect() const;
+};
+
+struct IrBlock
+{
+   int id;
+   std::vector<IrInst *> insts;
+   std::vector<IrBlock *> preds;
+   //Set by IrFunction::order: the place in reverse postorder (-1 when unreachable), the
+   //immediate dominator and the interval of the block in the dominator tree.
+   int rpo;
+   IrBlock *idom;
+   int dom_pre, dom_post;
+   IrInst *terminator() const { return insts.empty() || !insts.back()->is_terminator() ? nullptr : insts.back(); }
+   const std::vector<IrBlock *> &succs() const;
+   size_t pred_index(IrBlock *b) const;
+};
+
+class IrFunction
+{
+   std::deque<IrInst> insts_;
+   std::deque<IrBlock> blocks_;
+   int values_;
+public:
+   //pr_<name>, or main for the main program, which has no frame of its own.
+   std::string name;
+   SymProc *proc;
+   //Bytes of locals below ebp and of arguments above the return address.
+   int locals, args_size;
+   //The blocks in the order their code is laid out; the first is the entry.
+   std::vector<IrBlock *> blocks;
+   IrFunction(const std::string &n, SymProc *p);
+   IrInst *make(IrOp op, IrType type);
+   IrBlock *make_block();
+   //The offset of the result of a function in the frame, 0 for a procedure.
+   int result_offset() const;
+   void link(IrBlock *from, IrBlock *to) { to->preds.push_back(from); }
+   void remove_pred(IrBlock *b, size_t k);
+   //Reverse postorder and dominators; unreachable blocks are dropped from blocks.
+   std::vector<IrBlock *> order();
+   bool dominates(const IrBlock *a, const IrBlock *b) const;
+   void print(std::ostream &output) const;
+   bool verify(std::string &error);
+};
+
+//What the lowering of a tree keeps as it walks it: the block code goes to, the values of
+//the expressions below the node at hand, where break and continue go and the blocks a
+//statement comes back to between its steps.
+class IrBuilder
+{
+   IrFunction &f_;
+   IrBlock *block_;
+   std::vector<IrInst *> values_;
+   std::vector<IrBlock *> marks_;
+   std::vector<std::pair<IrBlock *, IrBlock *>> loops_;
+   std::map<int, IrInst *> frame_;
+   std::string failure_;
+public:
+   //The address the last assignment stored to, for the loop variable of a for.
+   IrInst *last_store;
+   IrBuilder(IrFunction &f);
+   IrInst *emit(IrOp op, IrType type, IrInst *a0 = nullptr, IrInst *a1 = nullptr);
+   IrInst *constant(int value);
+   IrInst *constant(double value, const std::string &label = "");
+   IrInst *address(SymVar *var);
+   IrInst *convert(IrInst *v, IrType to);
+   IrBlock *block() const { return block_; }
+   IrBlock *new_block() { return f_.make_block(); }
+   void set_block(IrBlock *b);
+   void jump(IrBlock *to);
+   void branch(IrInst *cond, IrBlock *then_block, IrBlock *else_block);
+   void finish();
+   void push(IrInst *v) { values_.push_back(v); }
+   IrInst *pop();
+   void mark(IrBlock *b) { marks_.push_back(b); }
+   IrBlock *unmark() { IrBlock *b = marks_.back(); marks_.pop_back(); return b; }
+   void push_loop(IrBlock *continue_to, IrBlock *break_to) { loops_.push_back(std::make_pair(continue_to, break_to)); }
+   void pop_loop() { loops_.pop_back(); }
+   bool in_loop() const { return !loops_.empty(); }
+   IrBlock *continue_target() const { return loops_.back().first; }
+   IrBlock *break_target() const { return loops_.back().second; }
+   //What the IR cannot express stops the lowering; the first reason is kept.
+   void fail(const std::string &reason) { if (failure_.empty()) failure_ = reason; }
+   bool failed() const { return !failure_.empty(); }
+   const std::string &failure() const { return failure_; }
+};
+
+IrType ir_type_of(SymType *t);
+
+//Lowers the body of a procedure, or of the main program when proc is null; nullptr, with
+//the reason, when it uses something the IR does not cover.
+std::unique_ptr<IrFunction> lower(SymProc *proc, Statement *body, std::string &reason);
+//The passes -o runs: promoting locals to values, folding, common subexpressions, dead
+//code and the clean up of the flow graph.
+void optimize(IrFunction &f);
+//Selects the instructions of the function into gen, the frame and its epilogue included;
+//the doubles that folding made are declared in data.
+void select(IrFunction &f, Generator &gen, Generator &data);
+//Lowers, optimizes and selects a body into gen and data; false, with both untouched, when
+//the body cannot be lowered or its IR does not verify.
+bool generate_ir(SymProc *proc, Statement *body, Generator &gen, Generator &data);
+//Prints the optimized IR of a body, or why there is none.
+void print_ir(SymProc *proc, Statement *body, std::ostream &output);
+
+#endif
@@ -0,0 +1,713 @@
+#include "ir.h"
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstring>
+#include <unordered_map>
+#include <unordered_set>
+
+typedef std::unordered_map<IrInst *, IrInst *> Replacements;
+
+static IrInst *find(const Replacements &repl, IrInst *v)
+{
+   for (auto it = repl.find(v); it != repl.end(); it = repl.find(v))
+      v = it->second;
+   return v;
+}
+
+static void replace_args(const Replacements &repl, IrFunction &f)
+{
+   for each(auto b in f.blocks)
+      for each(auto inst in b->insts)
+         for each(auto &arg in inst->args)
+            arg = find(repl, arg);
+}
+
+static void erase(IrBlock *b, const std::unordered_set<IrInst *> &dead)
+{
+   b->insts.erase(std::remove_if(b->insts.begin(), b->insts.end(), [&](IrInst *i) { return dead.count(i) != 0; }), b->insts.end());
+}
+
+static IrInst *make_before(IrFunction &f, IrBlock *b, size_t at, IrOp op, IrType type)
+{
+   IrInst *inst = f.make(op, type);
+   inst->block = b;
+   b->insts.insert(b->insts.begin() + at, inst);
+   return inst;
+}
+
+//A walk of the dominator tree: enter(b) is called on the way down and leave(b) when the
+//blocks b dominates are done.
+template <class Enter, class Leave>
+static void walk_dominators(IrFunction &f, const std::vector<IrBlock *> &rpo, Enter enter, Leave leave)
+{
+   std::unordered_map<IrBlock *, std::vector<IrBlock *>> children;
+   for (size_t k = 1; k < rpo.size(); ++k)
+      children[rpo[k]->idom].push_back(rpo[k]);
+   std::vector<std::pair<IrBlock *, size_t>> stack(1, std::make_pair(rpo[0], (size_t)0));
+   enter(rpo[0]);
+   while (!stack.empty())
+   {
+      auto &top = stack.back();
+      auto &kids = children[top.first];
+      if (top.second < kids.size())
+      {
+         IrBlock *next = kids[top.second++];
+         enter(next);
+         stack.push_back(std::make_pair(next, (size_t)0));
+         continue;
+      }
+      leave(top.first);
+      stack.pop_back();
+   }
+}
+
+//Slots of the frame that are only loaded and stored, all as one type, become values: phis
+//go where the stores to a slot meet (the iterated dominance frontier) and the walk of the
+//dominator tree renames each load to the value reaching it. A parameter starts as the
+//value passed, a local as 0; the result of a function is stored back where it returns.
+static void promote(IrFunction &f)
+{
+   auto rpo = f.order();
+   IrBlock *entry = f.blocks[0];
+   std::unordered_map<IrInst *, int> slot_of;
+   std::vector<IrInst *> slots;
+   std::vector<IrType> types;
+   for each(auto inst in entry->insts)
+      if (inst->op == ir_frame)
+      {
+         slot_of[inst] = (int)slots.size();
+         slots.push_back(inst);
+         types.push_back(ir_void);
+      }
+   std::vector<bool> promotable(slots.size(), true);
+   for each(auto b in f.blocks)
+      for each(auto inst in b->insts)
+         for (size_t k = 0; k < inst->args.size(); ++k)
+         {
+            auto it = slot_of.find(inst->args[k]);
+            if (it == slot_of.end())
+               continue;
+            int s = it->second;
+            IrType type = inst->op == ir_load ? inst->type : inst->op == ir_store ? inst->args[1]->type : ir_void;
+            if (k != 0 || type == ir_void || (types[s] != ir_void && types[s] != type))
+               promotable[s] = false;
+            types[s] = type;
+         }
+
+   std::vector<std::vector<IrBlock *>> defs(slots.size());
+   for each(auto b in f.blocks)
+      for each(auto inst in b->insts)
+         if (inst->op == ir_store && slot_of.count(inst->args[0]))
+         {
+            int s = slot_of[inst->args[0]];
+            if (defs[s].empty() || defs[s].back() != b)
+               defs[s].push_back(b);
+         }
+
+   std::unordered_map<IrBlock *, std::vector<IrBlock *>> frontier;
+   for each(auto b in f.blocks)
+      if (b->preds.size() > 1)
+         for each(auto p in b->preds)
+            for (IrBlock *runner = p; runner != b->idom; runner = runner->idom)
+            {
+               auto &df = frontier[runner];
+               if (df.empty() || df.back() != b)
+                  df.push_back(b);
+            }
+
+   std::unordered_map<IrInst *, int> phi_slot;
+   std::vector<IrInst *> initial(slots.size(), nullptr);
+   int result = f.result_offset();
+   for (size_t s = 0; s < slots.size(); ++s)
+   {
+      if (!promotable[s] || types[s] == ir_void)
+      {
+         promotable[s] = false;
+         continue;
+      }
+      IrInst *init;
+      if (slots[s]->imm > 0)
+      {
+         init = make_before(f, entry, entry->insts.size() - 1, ir_param, types[s]);
+         init->imm = slots[s]->imm;
+      }
+      else
+      {
+         init = make_before(f, entry, entry->insts.size() - 1, ir_const, types[s]);
+         init->imm = 0;
+         init->num = 0;
+      }
+      initial[s] = init;
+      std::unordered_set<IrBlock *> has_phi, queued(defs[s].begin(), defs[s].end());
+      std::vector<IrBlock *> work(defs[s]);
+      while (!work.empty())
+      {
+         IrBlock *x = work.back();
+         work.pop_back();
+         for each(auto y in frontier[x])
+         {
+            if (!has_phi.insert(y).second)
+               continue;
+            IrInst *phi = make_before(f, y, 0, ir_phi, types[s]);
+            phi->args.assign(y->preds.size(), nullptr);
+            phi_slot[phi] = (int)s;
+            if (queued.insert(y).second)
+               work.push_back(y);
+         }
+      }
+   }
+
+   std::vector<std::vector<IrInst *>> current(slots.size());
+   for (size_t s = 0; s < slots.size(); ++s)
+      if (promotable[s])
+         current[s].push_back(initial[s]);
+   std::vector<int> log;
+   std::vector<size_t> marks;
+   Replacements repl;
+   std::unordered_set<IrInst *> dead;
+   auto slot = [&](IrInst *address) -> int
+   {
+      auto it = slot_of.find(address);
+      return it != slot_of.end() && promotable[it->second] ? it->second : -1;
+   };
+   walk_dominators(f, rpo, [&](IrBlock *b)
+   {
+      marks.push_back(log.size());
+      for (size_t k = 0; k < b->insts.size(); ++k)
+      {
+         IrInst *inst = b->insts[k];
+         auto p = phi_slot.find(inst);
+         if (p != phi_slot.end())
+         {
+            current[p->second].push_back(inst);
+            log.push_back(p->second);
+            continue;
+         }
+         for each(auto &arg in inst->args)
+            arg = find(repl, arg);
+         int s = inst->op == ir_load || inst->op == ir_store ? slot(inst->args[0]) : -1;
+         if (s >= 0 && inst->op == ir_load)
+         {
+            repl[inst] = current[s].back();
+            dead.insert(inst);
+         }
+         else if (s >= 0)
+         {
+            current[s].push_back(inst->args[1]);
+            log.push_back(s);
+            dead.insert(inst);
+         }
+         else if (inst->op == ir_ret && result > 0)
+            for (size_t r = 0; r < slots.size(); ++r)
+               if (promotable[r] && slots[r]->imm == result)
+               {
+                  IrInst *store = make_before(f, b, k++, ir_store, ir_void);
+                  store->args.push_back(slots[r]);
+                  store->args.push_back(current[r].back());
+               }
+      }
+      for each(auto succ in b->succs())
+         for (size_t j = 0; j < succ->preds.size(); ++j)
+            if (succ->preds[j] == b)
+               for each(auto inst in succ->insts)
+               {
+                  if (inst->op != ir_phi)
+                     break;
+                  auto p = phi_slot.find(inst);
+                  if (p != phi_slot.end())
+                     inst->args[j] = current[p->second].back();
+               }
+   }, [&](IrBlock *b)
+   {
+      for (; log.size() > marks.back(); log.pop_back())
+         current[log.back()].pop_back();
+      marks.pop_back();
+   });
+   for each(auto b in f.blocks)
+      erase(b, dead);
+   replace_args(repl, f);
+}
+
+static int wrap(long long v)
+{
+   return (int)(unsigned)(unsigned long long)v;
+}
+
+static bool is_const(IrInst *v, int value)
+{
+   return v->op == ir_const && v->type == ir_int && v->imm == value;
+}
+
+static bool compare(IrCond c, double a, double b)
+{
+   switch (c)
+   {
+      case ir_eq:
+         return a == b;
+      case ir_ne:
+         return a != b;
+      case ir_lt:
+         return a < b;
+      case ir_le:
+         return a <= b;
+      case ir_gt:
+         return a > b;
+      default:
+         return a >= b;
+   }
+}
+
+//Constants and addresses of globals hold no operands, so they all go to the entry block,
+//one of each. New ones are made there as folding needs them.
+class Folder
+{
+   IrFunction &f_;
+   IrBlock *entry_;
+   std::map<int, IrInst *> ints_;
+   std::map<unsigned long long, IrInst *> doubles_;
+   std::map<std::string, IrInst *> globals_;
+public:
+   Replacements repl;
+   std::unordered_set<IrInst *> dead;
+   Folder(IrFunction &f): f_(f), entry_(f.blocks[0]) {}
+
+   IrInst *intern(IrInst *inst)
+   {
+      IrInst **kept;
+      unsigned long long bits;
+      if (inst->op == ir_global)
+         kept = &globals_[inst->sym];
+      else if (inst->type == ir_int)
+         kept = &ints_[inst->imm];
+      else
+      {
+         memcpy(&bits, &inst->num, sizeof(bits));
+         kept = &doubles_[bits];
+      }
+      if (!*kept)
+         *kept = inst;
+      else if ((*kept)->sym.empty() && !inst->sym.empty())
+         (*kept)->sym = inst->sym;
+      return *kept;
+   }
+
+   void hoist()
+   {
+      std::vector<IrInst *> moved;
+      for each(auto b in f_.blocks)
+         for each(auto inst in b->insts)
+            if (inst->op == ir_const || inst->op == ir_global)
+            {
+               IrInst *kept = intern(inst);
+               if (kept != inst)
+                  repl[inst] = kept;
+               else if (b != entry_)
+                  moved.push_back(inst);
+               if (kept != inst || b != entry_)
+                  dead.insert(inst);
+            }
+      for each(auto b in f_.blocks)
+         erase(b, dead);
+      dead.clear();
+      for each(auto inst in moved)
+      {
+         inst->block = entry_;
+         entry_->insts.insert(entry_->insts.end() - 1, inst);
+      }
+   }
+
+   IrInst *constant(int value)
+   {
+      IrInst *&kept = ints_[value];
+      if (!kept)
+      {
+         kept = make_before(f_, entry_, entry_->insts.size() - 1, ir_const, ir_int);
+         kept->imm = value;
+      }
+      return kept;
+   }
+
+   IrInst *constant(double value)
+   {
+      unsigned long long bits;
+      memcpy(&bits, &value, sizeof(bits));
+      IrInst *&kept = doubles_[bits];
+      if (!kept)
+      {
+         kept = make_before(f_, entry_, entry_->insts.size() - 1, ir_const, ir_double);
+         kept->num = value;
+      }
+      return kept;
+   }
+
+   IrInst *fold_ints(IrInst *inst, int a, int b)
+   {
+      switch (inst->op)
+      {
+         case ir_add:
+            return constant(wrap((long long)a + b));
+         case ir_sub:
+            return constant(wrap((long long)a - b));
+         case ir_mul:
+            return constant(wrap((long long)a * b));
+         case ir_div:
+            return b == 0 || (a == INT_MIN && b == -1) ? nullptr : constant(a / b);
+         case ir_mod:
+            return b == 0 || (a == INT_MIN && b == -1) ? nullptr : constant(a % b);
+         case ir_and:
+            return constant(a & b);
+         case ir_or:
+            return constant(a | b);
+         case ir_xor:
+            return constant(a ^ b);
+         case ir_cmp:
+            return constant(compare(inst->cond, a, b) ? 1 : 0);
+      }
+      return nullptr;
+   }
+
+   IrInst *fold_doubles(IrInst *inst, double a, double b)
+   {
+      if (inst->op != ir_cmp && !std::isfinite(inst->op == ir_add ? a + b : inst->op == ir_sub ? a - b : inst->op == ir_mul ? a * b : b ? a / b : 0.0))
+         return nullptr;
+      switch (inst->op)
+      {
+         case ir_add:
+            return constant(a + b);
+         case ir_sub:
+            return constant(a - b);
+         case ir_mul:
+            return constant(a * b);
+         case ir_div:
+            return b == 0 ? nullptr : constant(a / b);
+         case ir_cmp:
+            return constant(compare(inst->cond, a, b) ? 1 : 0);
+      }
+      return nullptr;
+   }
+
+   //What inst can be replaced with, or nullptr; new instructions go before position at.
+   IrInst *fold(IrInst *inst, IrBlock *b, size_t &at)
+   {
+      auto &a = inst->args;
+      if (inst->op == ir_phi)
+      {
+         IrInst *same = nullptr;
+         for each(auto v in a)
+            if (v != inst && v != same)
+            {
+               if (same)
+                  return nullptr;
+               same = v;
+            }
+         return same;
+      }
+      if (a.empty() || std::any_of(a.begin(), a.end(), [](IrInst *v) { return v->op != ir_const; }))
+         return fold_operands(inst, b, at);
+      if (inst->op == ir_neg)
+         return a[0]->type == ir_int ? constant(wrap(-(long long)a[0]->imm)) : constant(-a[0]->num);
+      if (inst->op == ir_itod)
+         return constant((double)a[0]->imm);
+      if (a.size() != 2)
+         return nullptr;
+      return a[0]->type == ir_int ? fold_ints(inst, a[0]->imm, a[1]->imm) : fold_doubles(inst, a[0]->num, a[1]->num);
+   }
+
+   //Identities, and constants moved outwards so that addresses end as base + index * size
+   //+ offset: x - c is x + -c, (x + c) * d is x * d + c * d and a + (x + c) is (a + x) + c.
+   IrInst *fold_operands(IrInst *inst, IrBlock *b, size_t &at)
+   {
+      auto &a = inst->args;
+      if (a.size() != 2 || a[0]->type == ir_double || inst->type == ir_double)
+         return nullptr;
+      switch (inst->op)
+      {
+         case ir_add:
+            if (is_const(a[1], 0))
+               return a[0];
+            if (is_const(a[0], 0))
+               return a[1];
+            if (a[1]->op == ir_const && a[0]->op == ir_add && a[0]->args[1]->op == ir_const)
+            {
+               IrInst *sum = make_before(f_, b, at++, ir_add, inst->type);
+               sum->args.push_back(a[0]->args[0]);
+               sum->args.push_back(constant(wrap((long long)a[0]->args[1]->imm + a[1]->imm)));
+               return sum;
+            }
+            if (a[1]->op == ir_add && a[1]->args[1]->op == ir_const && (inst->type == ir_addr || a[0]->op != ir_const))
+            {
+               IrInst *inner = make_before(f_, b, at++, ir_add, inst->type);
+               inner->args.push_back(a[0]);
+               inner->args.push_back(a[1]->args[0]);
+               IrInst *sum = make_before(f_, b, at++, ir_add, inst->type);
+               sum->args.push_back(inner);
+               sum->args.push_back(a[1]->args[1]);
+               return sum;
+            }
+            if (a[0]->op == ir_const && inst->type == ir_int)
+               std::swap(a[0], a[1]);
+            return nullptr;
+         case ir_sub:
+            if (a[1]->op == ir_const)
+            {
+               IrInst *sum = make_before(f_, b, at++, ir_add, ir_int);
+               sum->args.push_back(a[0]);
+               sum->args.push_back(constant(wrap(-(long long)a[1]->imm)));
+               return sum;
+            }
+            return a[0] == a[1] ? constant(0) : nullptr;
+         case ir_mul:
+            if (a[0]->op == ir_const)
+               std::swap(a[0], a[1]);
+            if (is_const(a[1], 1))
+               return a[0];
+            if (is_const(a[1], 0))
+               return a[1];
+            if (a[1]->op == ir_const && a[0]->op == ir_add && a[0]->args[1]->op == ir_const)
+            {
+               IrInst *product = make_before(f_, b, at++, ir_mul, ir_int);
+               product->args.push_back(a[0]->args[0]);
+               product->args.push_back(a[1]);
+               IrInst *sum = make_before(f_, b, at++, ir_add, ir_int);
+               sum->args.push_back(product);
+               sum->args.push_back(constant(wrap((long long)a[0]->args[1]->imm * a[1]->imm)));
+               return sum;
+            }
+            return nullptr;
+         case ir_div:
+            return is_const(a[1], 1) ? a[0] : nullptr;
+         case ir_and:
+         case ir_or:
+         case ir_xor:
+            if (a[0]->op == ir_const)
+               std::swap(a[0], a[1]);
+            if (is_const(a[1], 0))
+               return inst->op == ir_and ? a[1] : a[0];
+            return nullptr;
+         case ir_cmp:
+            if (a[0] == a[1])
+               return constant(compare(inst->cond, 0, 0) ? 1 : 0);
+            return nullptr;
+      }
+      return nullptr;
+   }
+};
+
+//A branch on a constant becomes a jump, and the edge it no longer takes goes.
+static bool fold_branch(IrFunction &f, IrBlock *b)
+{
+   IrInst *t = b->terminator();
+   if (t->op != ir_branch || t->args[0]->op != ir_const || t->targets[0] == t->targets[1])
+      return false;
+   IrBlock *dropped = t->targets[t->args[0]->imm ? 1 : 0];
+   t->op = ir_jump;
+   t->targets.erase(std::find(t->targets.begin(), t->targets.end(), dropped));
+   t->args.clear();
+   f.remove_pred(dropped, dropped->pred_index(b));
+   return true;
+}
+
+static bool simplify(IrFunction &f)
+{
+   Folder folder(f);
+   folder.hoist();
+   bool changed = !folder.repl.empty(), again = true;
+   for (int round = 0; again && round < 8; ++round)
+   {
+      again = false;
+      for each(auto b in f.order())
+      {
+         for (size_t k = 0; k < b->insts.size(); ++k)
+         {
+            IrInst *inst = b->insts[k];
+            for each(auto &arg in inst->args)
+               arg = find(folder.repl, arg);
+            if (inst->has_effect() || inst->op == ir_load || folder.dead.count(inst))
+               continue;
+            IrInst *with = folder.fold(inst, b, k);
+            if (with && with != inst)
+            {
+               folder.repl[inst] = with;
+               folder.dead.insert(inst);
+               again = true;
+            }
+         }
+         if (fold_branch(f, b))
+            again = true;
+      }
+      for each(auto b in f.blocks)
+         erase(b, folder.dead);
+      replace_args(folder.repl, f);
+      changed = changed || again;
+   }
+   f.order();
+   return changed;
+}
+
+//Values worked out again where the same value dominates them are replaced by it; the
+//table of values is scoped to the walk of the dominator tree.
+static bool share(IrFunction &f)
+{
+   auto rpo = f.order();
+   std::unordered_map<std::string, IrInst *> seen;
+   std::vector<std::string> log;
+   std::vector<size_t> marks;
+   Replacements repl;
+   std::unordered_set<IrInst *> dead;
+   walk_dominators(f, rpo, [&](IrBlock *b)
+   {
+      marks.push_back(log.size());
+      for each(auto inst in b->insts)
+      {
+         for each(auto &arg in inst->args)
+            arg = find(repl, arg);
+         if (inst->op < ir_add || inst->op > ir_itod)
+            continue;
+         std::vector<int> ids;
+         for each(auto arg in inst->args)
+            ids.push_back(arg->id);
+         if (ids.size() == 2 && (inst->op == ir_add || inst->op == ir_mul || inst->op == ir_and || inst->op == ir_or || inst->op == ir_xor) && ids[0] > ids[1])
+            std::swap(ids[0], ids[1]);
+         std::string key = boost::lexical_cast<std::string>(inst->op * 8 + inst->type) + ":" + boost::lexical_cast<std::string>(inst->cond);
+         for each(int id in ids)
+            key += "," + boost::lexical_cast<std::string>(id);
+         auto it = seen.insert(std::make_pair(key, inst));
+         if (it.second)
+            log.push_back(key);
+         else
+         {
+            repl[inst] = it.first->second;
+            dead.insert(inst);
+         }
+      }
+   }, [&](IrBlock *b)
+   {
+      for (; log.size() > marks.back(); log.pop_back())
+         seen.erase(log.back());
+      marks.pop_back();
+   });
+   for each(auto b in f.blocks)
+      erase(b, dead);
+   replace_args(repl, f);
+   return !dead.empty();
+}
+
+//Whatever no effect needs goes.
+static bool sweep(IrFunction &f)
+{
+   std::unordered_set<IrInst *> live;
+   std::vector<IrInst *> work;
+   for each(auto b in f.blocks)
+      for each(auto inst in b->insts)
+         if (inst->has_effect() && live.insert(inst).second)
+            work.push_back(inst);
+   while (!work.empty())
+   {
+      IrInst *inst = work.back();
+      work.pop_back();
+      for each(auto arg in inst->args)
+         if (live.insert(arg).second)
+            work.push_back(arg);
+   }
+   bool changed = false;
+   for each(auto b in f.blocks)
+   {
+      size_t before = b->insts.size();
+      b->insts.erase(std::remove_if(b->insts.begin(), b->insts.end(), [&](IrInst *i) { return !live.count(i); }), b->insts.end());
+      changed = changed || b->insts.size() != before;
+   }
+   return changed;
+}
+
+//A block that only jumps on is passed by; a block the only predecessor of its only
+//successor takes its code.
+static bool clean(IrFunction &f)
+{
+   bool changed = false;
+   Replacements repl;
+   for (size_t k = 0; k < f.blocks.size(); ++k)
+   {
+      IrBlock *b = f.blocks[k];
+      while (b->rpo >= 0)
+      {
+         IrInst *t = b->terminator();
+         if (t->op == ir_branch && t->targets[0] == t->targets[1])
+         {
+            IrBlock *s = t->targets[0];
+            size_t first = s->pred_index(b), second = first + 1;
+            while (s->preds[second] != b)
+               ++second;
+            bool same = true;
+            for each(auto inst in s->insts)
+               if (inst->op == ir_phi && inst->args[first] != inst->args[second])
+                  same = false;
+            if (!same)
+               break;
+            t->op = ir_jump;
+            t->args.clear();
+            t->targets.pop_back();
+            f.remove_pred(s, second);
+            changed = true;
+         }
+         if (t->op != ir_jump)
+            break;
+         IrBlock *s = t->targets[0];
+         if (s == b || s == f.blocks[0])
+            break;
+         if (s->preds.size() == 1)
+         {
+            b->insts.pop_back();
+            for each(auto inst in s->insts)
+            {
+               if (inst->op == ir_phi)
+               {
+                  repl[inst] = inst->args[0];
+                  continue;
+               }
+               inst->block = b;
+               b->insts.push_back(inst);
+            }
+            for each(auto succ in b->succs())
+               std::replace(succ->preds.begin(), succ->preds.end(), s, b);
+            s->insts.clear();
+            s->preds.clear();
+            s->rpo = -1;
+            changed = true;
+            continue;
+         }
+         if (b->insts.size() == 1 && b != f.blocks[0] && s->insts[0]->op != ir_phi)
+         {
+            for each(auto p in b->preds)
+            {
+               IrInst *pt = p->terminator();
+               std::replace(pt->targets.begin(), pt->targets.end(), b, s);
+               s->preds.push_back(p);
+            }
+            b->preds.clear();
+            s->preds.erase(s->preds.begin() + s->pred_index(b));
+            b->rpo = -1;
+            changed = true;
+         }
+         break;
+      }
+   }
+   if (!repl.empty())
+      replace_args(repl, f);
+   f.order();
+   return changed;
+}
+
+void optimize(IrFunction &f)
+{
+   promote(f);
+   for (int round = 0; round < 4; ++round)
+   {
+      bool changed = simplify(f);
+      changed = share(f) || changed;
+      changed = sweep(f) || changed;
+      changed = clean(f) || changed;
+      if (!changed)
+         break;
+   }
+}
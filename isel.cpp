@@ -0,0 +1,924 @@
+#include "ir.h"
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <unordered_map>
+#include <unordered_set>
+
+static std::string str(long long n)
+{
+   return boost::lexical_cast<std::string>(n);
+}
+
+//A real MASM reads back to the same double: 17 digits and a point before any exponent.
+static std::string real_text(double v)
+{
+   char buf[40];
+   snprintf(buf, sizeof(buf), "%.17g", v);
+   std::string s = buf;
+   if (s.find('.') == std::string::npos)
+   {
+      size_t e = s.find('e');
+      s.insert(e == std::string::npos ? s.size() : e, ".0");
+   }
+   return s;
+}
+
+static int log2_of(int c)
+{
+   if (c <= 1 || (c & (c - 1)))
+      return 0;
+   int k = 0;
+   while ((1 << k) != c)
+      ++k;
+   return k;
+}
+
+static AsmCommands jumps[][6] =
+{
+   {cmd_je, cmd_jne, cmd_jl, cmd_jle, cmd_jg, cmd_jge},
+   {cmd_je, cmd_jne, cmd_jb, cmd_jbe, cmd_ja, cmd_jae},
+};
+
+static AsmCommands sets[][6] =
+{
+   {cmd_sete, cmd_setne, cmd_setl, cmd_setle, cmd_setg, cmd_setge},
+   {cmd_sete, cmd_setne, cmd_setb, cmd_setbe, cmd_seta, cmd_setae},
+};
+
+static const IrCond negated[] = {ir_ne, ir_eq, ir_ge, ir_gt, ir_le, ir_lt};
+
+//Every value that is not folded into the instructions using it gets a register other than
+//eax or, when the allocator finds none free, a slot of the frame below the locals: eax only
+//carries values from one instruction to the next. Constants are immediates or data, parameters
+//are read where the caller put them, the address of a global or of a local plus a constant
+//goes into the memory operand that uses it and a comparison only a branch uses is done by
+//the branch.
+class Selector
+{
+   IrFunction &f_;
+   Generator &gen_, &data_;
+   std::unordered_map<IrInst *, int> slot_, uses_;
+   std::unordered_map<IrInst *, std::string> reg_;
+   //The registers a call has to keep: those of the values live across it.
+   std::unordered_map<IrInst *, std::vector<std::string>> saved_;
+   std::unordered_set<IrInst *> folded_, fused_;
+   std::unordered_map<IrBlock *, std::string> labels_;
+   std::map<unsigned long long, std::string> reals_;
+   std::string exit_;
+   int frame_, temp_;
+   //The value eax holds, if known: what the last instruction stored from it is not loaded again.
+   IrInst *eax_, *carried_;
+
+   void emit(AsmCommands c, AsmOperands t1 = op_null, const std::string &o1 = "", AsmOperands t2 = op_null, const std::string &o2 = "")
+   {
+      gen_.push(Instruction(c, t1, o1, t2, o2));
+   }
+
+   static std::string frame_text(int off)
+   {
+      return "[" + str(off) + " + ebp]";
+   }
+
+   bool inline_value(IrInst *v) const
+   {
+      return v->op == ir_const || v->op == ir_global || v->op == ir_frame || v->op == ir_param || folded_.count(v) || fused_.count(v);
+   }
+
+   std::string register_of(IrInst *v) const
+   {
+      auto it = reg_.find(v);
+      return it == reg_.end() ? std::string() : it->second;
+   }
+
+   bool kept(IrInst *v) const
+   {
+      return slot_.count(v) || reg_.count(v);
+   }
+
+   //The register or the slot of a value, empty for what is not kept anywhere.
+   std::string home(IrInst *v) const
+   {
+      auto it = slot_.find(v);
+      return it != slot_.end() ? frame_text(it->second) : register_of(v);
+   }
+
+   //ecx or edx when an instruction may use it to work out its value.
+   std::vector<std::string> clobbered(IrInst *inst);
+   void split_edges();
+   void allocate();
+   void place();
+
+   std::string real_label(IrInst *v)
+   {
+      if (!v->sym.empty())
+         return v->sym;
+      unsigned long long bits;
+      memcpy(&bits, &v->num, sizeof(bits));
+      std::string &label = reals_[bits];
+      if (label.empty())
+      {
+         label = gen_.generate_label();
+         data_.push_const_decl(label, " dq " + real_text(v->num) + "\n");
+      }
+      return label;
+   }
+
+   //Where a value of 8 bytes is, for fld.
+   std::string real(IrInst *v)
+   {
+      if (v->op == ir_const)
+         return "qword ptr " + real_label(v);
+      return "qword ptr " + frame_text(v->op == ir_param ? v->imm : slot_[v]);
+   }
+
+   //An operand of 4 bytes for the second place of an instruction; reg is used for what
+   //cannot be one.
+   std::pair<AsmOperands, std::string> operand(IrInst *v, const std::string &reg)
+   {
+      if (v->op == ir_const)
+         return std::make_pair(op_immediate, str(v->imm));
+      if (v->op == ir_global)
+         return std::make_pair(op_immediate, "offset " + v->sym);
+      if (v->op == ir_param)
+         return std::make_pair(op_memory, "dword ptr " + frame_text(v->imm));
+      if (reg_.count(v))
+         return std::make_pair(op_register, reg_.at(v));
+      if (slot_.count(v))
+         return std::make_pair(op_memory, "dword ptr " + frame_text(slot_[v]));
+      load(reg, v);
+      return std::make_pair(op_register, reg);
+   }
+
+   void load(const std::string &reg, IrInst *v)
+   {
+      if ((reg == "eax" && eax_ == v) || register_of(v) == reg)
+         return;
+      if (v->op == ir_frame || folded_.count(v))
+         emit(cmd_lea, op_register, reg, op_memory, address(v));
+      else if (fused_.count(v))
+         compare(v, reg);
+      else
+      {
+         auto op = operand(v, reg);
+         emit(cmd_mov, op_register, reg, op.first, op.second);
+      }
+      if (reg == "eax")
+         eax_ = v;
+   }
+
+   //The memory operand for what is at address a, with edx holding it when it is worked out.
+   std::string address(IrInst *a)
+   {
+      IrInst *base = a;
+      int offset = 0;
+      if (folded_.count(a))
+      {
+         base = a->args[0];
+         offset = a->args[1]->imm;
+      }
+      if (base->op == ir_global)
+         return offset ? "[" + base->sym + " + " + str(offset) + "]" : base->sym;
+      if (base->op == ir_frame)
+         return frame_text(base->imm + offset);
+      if (reg_.count(a))
+         return "[" + reg_.at(a) + "]";
+      load("edx", a);
+      return "[edx]";
+   }
+
+   //Sets the flags for cmp; true when they are to be read as unsigned.
+   bool flags(IrInst *cmp)
+   {
+      IrInst *a = cmp->args[0], *b = cmp->args[1];
+      if (a->type == ir_double)
+      {
+         emit(cmd_fld, op_memory, real(b));
+         emit(cmd_fld, op_memory, real(a));
+         emit(cmd_fcompp);
+         emit(cmd_fstsw, op_register, "ax");
+         emit(cmd_sahf);
+         eax_ = nullptr;
+         return true;
+      }
+      std::string r = register_of(a);
+      if (r.empty())
+      {
+         load("eax", a);
+         r = "eax";
+      }
+      auto op = operand(b, "ecx");
+      emit(cmd_cmp, op_register, r, op.first, op.second);
+      return false;
+   }
+
+   void compare(IrInst *cmp, const std::string &reg)
+   {
+      emit(cmd_xor, op_register, "ecx", op_register, "ecx");
+      bool is_unsigned = flags(cmp);
+      emit(sets[is_unsigned][cmp->cond], op_register, "cl");
+      if (reg != "ecx")
+         emit(cmd_mov, op_register, reg, op_register, "ecx");
+   }
+
+   void store_int(IrInst *v, const std::string &reg)
+   {
+      if (reg == "eax")
+         carried_ = v;
+      std::string r = register_of(v);
+      if (r.empty())
+         emit(cmd_mov, op_memory, "dword ptr " + frame_text(slot_[v]), op_register, reg);
+      else if (r != reg)
+         emit(cmd_mov, op_register, r, op_register, reg);
+   }
+
+   void store_real(IrInst *v)
+   {
+      emit(cmd_fstp, op_memory, real(v));
+   }
+
+   void copy(IrInst *dst, IrInst *src, bool from_temp);
+   void arithmetic(IrInst *inst);
+   void divide(IrInst *inst);
+   void call(IrInst *inst);
+   void write(IrInst *inst);
+   void phi_moves(IrBlock *b);
+   void terminate(IrInst *t, IrBlock *next);
+   void select(IrInst *inst);
+public:
+   Selector(IrFunction &f, Generator &gen, Generator &data): f_(f), gen_(gen), data_(data), frame_(0), temp_(0), eax_(nullptr), carried_(nullptr) {}
+   void run();
+};
+
+//An edge from a block with two successors to a block with phis gets a block of its own,
+//where the copies for the phis go.
+void Selector::split_edges()
+{
+   for (size_t k = 0; k < f_.blocks.size(); ++k)
+   {
+      IrBlock *b = f_.blocks[k];
+      IrInst *t = b->terminator();
+      if (t->op != ir_branch)
+         continue;
+      for each(auto &target in t->targets)
+      {
+         if (target->insts[0]->op != ir_phi)
+            continue;
+         IrBlock *edge = f_.make_block();
+         f_.blocks.pop_back();
+         f_.blocks.insert(f_.blocks.begin() + k + 1, edge);
+         IrInst *jump = f_.make(ir_jump, ir_void);
+         jump->block = edge;
+         jump->targets.push_back(target);
+         edge->insts.push_back(jump);
+         edge->preds.push_back(b);
+         target->preds[target->pred_index(b)] = edge;
+         target = edge;
+      }
+   }
+}
+
+std::vector<std::string> Selector::clobbered(IrInst *inst)
+{
+   std::vector<std::string> both;
+   both.push_back("ecx");
+   both.push_back("edx");
+   switch (inst->op)
+   {
+      case ir_call:
+      case ir_write:
+      case ir_write_str:
+      case ir_newline:
+         return both;
+      case ir_div:
+      case ir_mod:
+         return inst->type == ir_double ? std::vector<std::string>() : both;
+      case ir_cmp:
+         return std::vector<std::string>(1, "ecx");
+      case ir_load:
+      case ir_store:
+         return std::vector<std::string>(1, "edx");
+   }
+   //An address worked out as an operand is loaded into ecx, also for the comparison a branch does.
+   for each(auto arg in inst->args)
+   {
+      std::vector<IrInst *> read = fused_.count(arg) ? arg->args : std::vector<IrInst *>(1, arg);
+      for each(auto v in read)
+         if (v->op == ir_frame || folded_.count(v))
+            return std::vector<std::string>(1, "ecx");
+   }
+   return std::vector<std::string>();
+}
+
+//Linear scan over the blocks in the order they are emitted, each instruction reading its
+//operands at an even position and writing its value at the odd one after. A value lives in
+//one interval, from the first to the last position it is live at, so a value live around a
+//loop covers all of it. An interval gets a register free over all of it and used by no
+//instruction in it; when there is none, the one of the intervals that ends last keeps a slot.
+//Calls keep ebx, esi and edi of the values live across them, printf keeps them itself.
+void Selector::allocate()
+{
+   static const char *const registers[] = {"ecx", "edx", "ebx", "esi", "edi"};
+   auto candidate = [&](IrInst *v)
+   {
+      return v->id && v->type != ir_double && !inline_value(v) && (uses_[v] || v->op == ir_phi);
+   };
+   std::unordered_map<IrInst *, int> at;
+   std::unordered_map<IrBlock *, std::pair<int, int>> span;
+   std::map<std::string, std::vector<int>> used;
+   int n = 0;
+   for each(auto b in f_.blocks)
+   {
+      int first = n;
+      for each(auto inst in b->insts)
+      {
+         for each(auto r in clobbered(inst))
+            used[r].push_back(n);
+         at[inst] = n++;
+      }
+      span[b] = std::make_pair(2 * first, 2 * n - 1);
+   }
+   //What is live into and out of each block, a phi being read at the end of the predecessor.
+   typedef std::unordered_set<IrInst *> Values;
+   std::unordered_map<IrBlock *, Values> live_in, live_out;
+   for (bool changed = true; changed;)
+   {
+      changed = false;
+      for (size_t k = f_.blocks.size(); k--;)
+      {
+         IrBlock *b = f_.blocks[k];
+         Values live;
+         for each(auto s in b->succs())
+         {
+            size_t j = s->pred_index(b);
+            live.insert(live_in[s].begin(), live_in[s].end());
+            for each(auto inst in s->insts)
+            {
+               if (inst->op != ir_phi)
+                  break;
+               if (candidate(inst->args[j]))
+                  live.insert(inst->args[j]);
+            }
+         }
+         live_out[b] = live;
+         for (size_t i = b->insts.size(); i--;)
+         {
+            IrInst *inst = b->insts[i];
+            live.erase(inst);
+            if (inst->op != ir_phi)
+               for each(auto arg in inst->args)
+                  if (candidate(arg))
+                     live.insert(arg);
+         }
+         if (live.size() != live_in[b].size())
+         {
+            live_in[b] = live;
+            changed = true;
+         }
+      }
+   }
+   std::unordered_map<IrInst *, std::pair<int, int>> interval;
+   std::vector<IrInst *> values;
+   auto cover = [&](IrInst *v, int p)
+   {
+      auto it = interval.find(v);
+      if (it == interval.end())
+         interval[v] = std::make_pair(p, p);
+      else
+      {
+         it->second.first = std::min(it->second.first, p);
+         it->second.second = std::max(it->second.second, p);
+      }
+   };
+   for each(auto b in f_.blocks)
+   {
+      for each(auto v in live_in[b])
+         cover(v, span[b].first);
+      for each(auto v in live_out[b])
+         cover(v, span[b].second);
+      for each(auto inst in b->insts)
+      {
+         if (candidate(inst))
+         {
+            values.push_back(inst);
+            cover(inst, inst->op == ir_phi ? span[b].first : 2 * at[inst] + 1);
+         }
+         if (inst->op == ir_phi)
+            continue;
+         //What a comparison done by the branch reads is read there.
+         std::vector<IrInst *> read;
+         for each(auto arg in inst->args)
+            if (fused_.count(arg))
+               read.insert(read.end(), arg->args.begin(), arg->args.end());
+            else
+               read.push_back(arg);
+         for each(auto v in read)
+            if (candidate(v))
+               cover(v, 2 * at[inst]);
+      }
+   }
+   std::stable_sort(values.begin(), values.end(), [&](IrInst *x, IrInst *y) { return interval[x].first < interval[y].first; });
+   //Whether an instruction in the interval of v uses r.
+   auto taken = [&](IrInst *v, const std::string &r)
+   {
+      const std::vector<int> &at_ = used[r];
+      auto it = std::lower_bound(at_.begin(), at_.end(), interval[v].first / 2);
+      return it != at_.end() && 2 * *it <= interval[v].second;
+   };
+   std::vector<IrInst *> active;
+   for each(auto v in values)
+   {
+      for (size_t k = 0; k < active.size();)
+         if (interval[active[k]].second < interval[v].first)
+            active.erase(active.begin() + k);
+         else
+            ++k;
+      const char *free = nullptr;
+      for (int k = 0; k < 5 && !free; ++k)
+      {
+         free = registers[k];
+         for each(auto a in active)
+            if (reg_[a] == registers[k])
+               free = nullptr;
+         if (free && taken(v, free))
+            free = nullptr;
+      }
+      if (free)
+      {
+         reg_[v] = free;
+         active.push_back(v);
+         continue;
+      }
+      size_t last = active.size();
+      for (size_t k = 0; k < active.size(); ++k)
+         if (!taken(v, reg_[active[k]]) && (last == active.size() || interval[active[k]].second > interval[active[last]].second))
+            last = k;
+      if (last == active.size() || interval[active[last]].second <= interval[v].second)
+         continue;
+      reg_[v] = reg_[active[last]];
+      reg_.erase(active[last]);
+      active[last] = v;
+   }
+   for each(auto b in f_.blocks)
+      for each(auto inst in b->insts)
+      {
+         if (inst->op != ir_call)
+            continue;
+         int p = 2 * at[inst];
+         for (int k = 2; k < 5; ++k)
+            for each(auto v in values)
+               if (register_of(v) == registers[k] && v != inst && interval[v].first <= p && interval[v].second > p + 1)
+               {
+                  saved_[inst].push_back(registers[k]);
+                  break;
+               }
+      }
+}
+
+void Selector::place()
+{
+   for each(auto b in f_.blocks)
+      for each(auto inst in b->insts)
+         for each(auto arg in inst->args)
+            ++uses_[arg];
+   for each(auto b in f_.blocks)
+      for each(auto inst in b->insts)
+      {
+         auto &a = inst->args;
+         if (inst->op == ir_add && inst->type == ir_addr && (a[0]->op == ir_global || a[0]->op == ir_frame) && a[1]->op == ir_const)
+            folded_.insert(inst);
+         if (inst->op == ir_cmp && uses_[inst] == 1 && b->terminator()->op == ir_branch && b->terminator()->args[0] == inst)
+            fused_.insert(inst);
+      }
+   //An address folded into memory operands has to be a value wherever else it is used.
+   for each(auto b in f_.blocks)
+      for each(auto inst in b->insts)
+         for (size_t k = 0; k < inst->args.size(); ++k)
+            if (folded_.count(inst->args[k]) && !((inst->op == ir_load || inst->op == ir_store) && k == 0))
+               folded_.erase(inst->args[k]);
+   allocate();
+   int below = f_.locals;
+   for each(auto b in f_.blocks)
+      for each(auto inst in b->insts)
+         if (inst->id && !inline_value(inst) && (uses_[inst] || inst->op == ir_phi) && !reg_.count(inst))
+         {
+            below += inst->type == ir_double ? 8 : 4;
+            slot_[inst] = -below;
+         }
+   below += 8;
+   temp_ = -below;
+   frame_ = below;
+   for each(auto b in f_.blocks)
+      labels_[b] = gen_.generate_label();
+   exit_ = gen_.generate_label();
+}
+
+void Selector::copy(IrInst *dst, IrInst *src, bool from_temp)
+{
+   if (dst->type == ir_double)
+   {
+      emit(cmd_fld, op_memory, from_temp ? "qword ptr " + frame_text(temp_) : real(src));
+      emit(cmd_fstp, op_memory, "qword ptr " + frame_text(slot_[dst]));
+      return;
+   }
+   auto from = from_temp ? std::make_pair(op_memory, "dword ptr " + frame_text(temp_)) : operand(src, "eax");
+   std::string r = register_of(dst);
+   if (r.empty() && from.first == op_memory)
+   {
+      emit(cmd_mov, op_register, "eax", from.first, from.second);
+      eax_ = from_temp ? nullptr : src;
+      from = std::make_pair(op_register, std::string("eax"));
+   }
+   if (r.empty())
+      emit(cmd_mov, op_memory, "dword ptr " + frame_text(slot_[dst]), from.first, from.second);
+   else
+      emit(cmd_mov, op_register, r, from.first, from.second);
+   if (eax_ == dst)
+      eax_ = nullptr;
+}
+
+//The copies into the phis of the successor, done as if at once: a copy goes when nothing
+//still to be copied reads the register or slot it writes, and a cycle is broken through
+//the temporary.
+void Selector::phi_moves(IrBlock *b)
+{
+   if (b->succs().size() != 1)
+      return;
+   IrBlock *s = b->succs()[0];
+   size_t j = s->pred_index(b);
+   struct Move
+   {
+      IrInst *dst, *src;
+      bool from_temp;
+   };
+   std::vector<Move> moves;
+   for each(auto inst in s->insts)
+   {
+      if (inst->op != ir_phi)
+         break;
+      if (kept(inst) && home(inst->args[j]) != home(inst))
+         moves.push_back(Move{inst, inst->args[j], false});
+   }
+   while (!moves.empty())
+   {
+      size_t k = 0;
+      for (; k < moves.size(); ++k)
+      {
+         bool blocked = false;
+         for (size_t n = 0; n < moves.size() && !blocked; ++n)
+            blocked = n != k && !moves[n].from_temp && home(moves[n].src) == home(moves[k].dst);
+         if (!blocked)
+            break;
+      }
+      if (k < moves.size())
+      {
+         copy(moves[k].dst, moves[k].src, moves[k].from_temp);
+         moves.erase(moves.begin() + k);
+         continue;
+      }
+      IrInst *saved = moves[0].dst;
+      if (saved->type == ir_double)
+      {
+         emit(cmd_fld, op_memory, real(saved));
+         emit(cmd_fstp, op_memory, "qword ptr " + frame_text(temp_));
+      }
+      else
+      {
+         load("eax", saved);
+         emit(cmd_mov, op_memory, "dword ptr " + frame_text(temp_), op_register, "eax");
+      }
+      for each(auto &m in moves)
+         if (!m.from_temp && home(m.src) == home(saved))
+            m.from_temp = true;
+   }
+}
+
+void Selector::arithmetic(IrInst *inst)
+{
+   IrInst *a = inst->args[0];
+   if (inst->type == ir_double)
+   {
+      emit(cmd_fld, op_memory, real(a));
+      if (inst->op == ir_neg)
+         emit(cmd_fchs);
+      else
+      {
+         static const AsmCommands ops[] = {cmd_fadd, cmd_fsub, cmd_fmul, cmd_fdiv};
+         emit(ops[inst->op - ir_add], op_memory, real(inst->args[1]));
+      }
+      store_real(inst);
+      return;
+   }
+   //The value is worked out in its own register unless that is where the second operand is.
+   std::string r = register_of(inst);
+   if (r.empty() || (inst->op != ir_neg && inst->args[1] != a && register_of(inst->args[1]) == r))
+      r = "eax";
+   load(r, a);
+   if (inst->op == ir_neg)
+      emit(cmd_neg, op_register, r);
+   else
+   {
+      IrInst *b = inst->args[1];
+      int shift = b->op == ir_const ? log2_of(b->imm) : 0;
+      if (inst->op == ir_mul && shift)
+         emit(cmd_sal, op_register, r, op_immediate, str(shift));
+      else
+      {
+         static const AsmCommands ops[] = {cmd_add, cmd_sub, cmd_imul, cmd_idiv, cmd_idiv, cmd_and, cmd_or, cmd_xor};
+         auto op = operand(b, "ecx");
+         emit(ops[inst->op - ir_add], op_register, r, op.first, op.second);
+      }
+   }
+   if (r == "eax")
+      store_int(inst, "eax");
+}
+
+//Division truncates towards zero: by a power of two the dividend is biased by the divisor
+//less one when it is negative before the shift.
+void Selector::divide(IrInst *inst)
+{
+   IrInst *a = inst->args[0], *b = inst->args[1];
+   int shift = b->op == ir_const ? log2_of(b->imm) : 0;
+   load("eax", a);
+   emit(cmd_cdq);
+   if (shift)
+   {
+      emit(cmd_and, op_register, "edx", op_immediate, str(b->imm - 1));
+      emit(cmd_add, op_register, "eax", op_register, "edx");
+      if (inst->op == ir_div)
+      {
+         emit(cmd_sar, op_register, "eax", op_immediate, str(shift));
+         store_int(inst, "eax");
+         return;
+      }
+      emit(cmd_and, op_register, "eax", op_immediate, str(-b->imm));
+      load("ecx", a);
+      emit(cmd_sub, op_register, "ecx", op_register, "eax");
+      store_int(inst, "ecx");
+      return;
+   }
+   if (b->op == ir_const)
+   {
+      emit(cmd_mov, op_register, "ecx", op_immediate, str(b->imm));
+      emit(cmd_idiv, op_register, "ecx");
+   }
+   else
+   {
+      auto op = operand(b, "ecx");
+      emit(cmd_idiv, op.first, op.second);
+   }
+   store_int(inst, inst->op == ir_div ? "eax" : "edx");
+}
+
+//The arguments go straight to the offsets the procedure reads them from, under the room
+//for its result, which is left on the top of the stack.
+void Selector::call(IrInst *inst)
+{
+   SymProc *proc = inst->proc;
+   int ret = (int)proc->get_size_ret_value(), args = 0;
+   for each(auto it in proc->get_arg_list())
+      args += it->get_sym_var()->is_var_arg() ? 4 : (int)it->get_type()->get_size();
+   const std::vector<std::string> &saved = saved_[inst];
+   for each(auto r in saved)
+      emit(cmd_push, op_register, r);
+   emit(cmd_sub, op_register, "esp", op_immediate, str(ret + args));
+   for (size_t k = 0; k < inst->args.size(); ++k)
+   {
+      IrInst *arg = inst->args[k];
+      std::string at = "[esp + " + str(proc->get_arg_list()[k]->get_sym_var()->get_offset() - 8) + "]";
+      if (arg->type == ir_double)
+      {
+         emit(cmd_fld, op_memory, real(arg));
+         emit(cmd_fstp, op_memory, "qword ptr " + at);
+      }
+      else
+      {
+         auto op = operand(arg, "eax");
+         if (op.first == op_memory)
+         {
+            load("eax", arg);
+            op = std::make_pair(op_register, std::string("eax"));
+         }
+         emit(cmd_mov, op_memory, "dword ptr " + at, op.first, op.second);
+      }
+   }
+   emit(cmd_call, op_memory, "pr_" + proc->get_name());
+   emit(cmd_add, op_register, "esp", op_immediate, str(args));
+   if (!kept(inst))
+   {
+      if (ret)
+         emit(cmd_add, op_register, "esp", op_immediate, str(ret));
+   }
+   else if (inst->type == ir_double)
+   {
+      emit(cmd_fld, op_memory, "qword ptr [esp]");
+      emit(cmd_add, op_register, "esp", op_immediate, "8");
+   }
+   else
+      emit(cmd_pop, op_register, "eax");
+   for (size_t k = saved.size(); k--;)
+      emit(cmd_pop, op_register, saved[k]);
+   if (!kept(inst))
+      return;
+   if (inst->type == ir_double)
+      store_real(inst);
+   else
+      store_int(inst, "eax");
+}
+
+void Selector::write(IrInst *inst)
+{
+   if (inst->op == ir_newline || inst->op == ir_write_str)
+   {
+      emit(cmd_push, op_immediate, inst->op == ir_newline ? "offset new_line" : "offset " + inst->sym);
+      emit(cmd_call, op_memory, "printf");
+      emit(cmd_add, op_register, "esp", op_immediate, "4");
+      return;
+   }
+   IrInst *v = inst->args[0];
+   if (v->type == ir_double)
+   {
+      emit(cmd_sub, op_register, "esp", op_immediate, "8");
+      emit(cmd_fld, op_memory, real(v));
+      emit(cmd_fstp, op_memory, "qword ptr [esp]");
+      emit(cmd_push, op_immediate, "offset double_frmt");
+      emit(cmd_call, op_memory, "printf");
+      emit(cmd_add, op_register, "esp", op_immediate, "12");
+      return;
+   }
+   auto op = operand(v, "eax");
+   emit(cmd_push, op.first, op.second);
+   emit(cmd_push, op_immediate, "offset int_frmt");
+   emit(cmd_call, op_memory, "printf");
+   emit(cmd_add, op_register, "esp", op_immediate, "8");
+}
+
+void Selector::terminate(IrInst *t, IrBlock *next)
+{
+   if (t->op == ir_ret)
+   {
+      if (next)
+         emit(cmd_jmp, op_label, exit_);
+      return;
+   }
+   if (t->op == ir_jump)
+   {
+      if (t->targets[0] != next)
+         emit(cmd_jmp, op_label, labels_[t->targets[0]]);
+      return;
+   }
+   IrInst *cond = t->args[0];
+   IrCond c = ir_ne;
+   bool is_unsigned = false;
+   if (fused_.count(cond))
+   {
+      is_unsigned = flags(cond);
+      c = cond->cond;
+   }
+   else
+   {
+      std::string r = register_of(cond);
+      if (r.empty())
+      {
+         load("eax", cond);
+         r = "eax";
+      }
+      emit(cmd_test, op_register, r, op_register, r);
+   }
+   IrBlock *then_block = t->targets[0], *else_block = t->targets[1];
+   if (then_block == next)
+   {
+      emit(jumps[is_unsigned][negated[c]], op_label, labels_[else_block]);
+      return;
+   }
+   emit(jumps[is_unsigned][c], op_label, labels_[then_block]);
+   if (else_block != next)
+      emit(cmd_jmp, op_label, labels_[else_block]);
+}
+
+void Selector::select(IrInst *inst)
+{
+   switch (inst->op)
+   {
+      case ir_load:
+      {
+         if (!kept(inst))
+            return;
+         if (inst->type == ir_double)
+         {
+            emit(cmd_fld, op_memory, "qword ptr " + address(inst->args[0]));
+            store_real(inst);
+            return;
+         }
+         std::string r = register_of(inst);
+         emit(cmd_mov, op_register, r.empty() ? "eax" : r, op_memory, "dword ptr " + address(inst->args[0]));
+         if (r.empty())
+            store_int(inst, "eax");
+         return;
+      }
+      case ir_store:
+      {
+         IrInst *v = inst->args[1];
+         std::string to = address(inst->args[0]);
+         if (v->type == ir_double)
+         {
+            emit(cmd_fld, op_memory, real(v));
+            emit(cmd_fstp, op_memory, "qword ptr " + to);
+            return;
+         }
+         if (v->op == ir_const || v->op == ir_global || reg_.count(v))
+         {
+            auto op = operand(v, "eax");
+            emit(cmd_mov, op_memory, "dword ptr " + to, op.first, op.second);
+            return;
+         }
+         load("eax", v);
+         emit(cmd_mov, op_memory, "dword ptr " + to, op_register, "eax");
+         return;
+      }
+      case ir_add:
+      case ir_sub:
+      case ir_mul:
+      case ir_and:
+      case ir_or:
+      case ir_xor:
+      case ir_neg:
+         arithmetic(inst);
+         return;
+      case ir_div:
+      case ir_mod:
+         if (inst->type == ir_double)
+            arithmetic(inst);
+         else
+            divide(inst);
+         return;
+      case ir_cmp:
+         compare(inst, "ecx");
+         store_int(inst, "ecx");
+         return;
+      case ir_itod:
+      {
+         //fild reads memory only.
+         auto op = operand(inst->args[0], "eax");
+         if (op.first != op_memory)
+         {
+            emit(cmd_mov, op_memory, "dword ptr " + frame_text(temp_), op.first, op.second);
+            op = std::make_pair(op_memory, "dword ptr " + frame_text(temp_));
+         }
+         emit(cmd_fild, op.first, op.second);
+         store_real(inst);
+         return;
+      }
+      case ir_call:
+         call(inst);
+         return;
+      case ir_write:
+      case ir_write_str:
+      case ir_newline:
+         write(inst);
+         return;
+   }
+}
+
+void Selector::run()
+{
+   split_edges();
+   place();
+   if (f_.proc)
+      gen_.push_string("\n" + f_.name + " proc near\n");
+   emit(cmd_push, op_register, "ebp");
+   emit(cmd_mov, op_register, "ebp", op_register, "esp");
+   emit(cmd_sub, op_register, "esp", op_immediate, str(frame_));
+   for (size_t k = 0; k < f_.blocks.size(); ++k)
+   {
+      IrBlock *b = f_.blocks[k];
+      if (k)
+         gen_.push_label(labels_[b]);
+      carried_ = nullptr;
+      for each(auto inst in b->insts)
+      {
+         if (inst->is_terminator())
+            break;
+         if (!kept(inst) && !inst->has_effect())
+            continue;
+         eax_ = carried_;
+         carried_ = nullptr;
+         select(inst);
+      }
+      eax_ = carried_;
+      phi_moves(b);
+      terminate(b->terminator(), k + 1 < f_.blocks.size() ? f_.blocks[k + 1] : nullptr);
+   }
+   gen_.push_label(exit_);
+   emit(cmd_mov, op_register, "esp", op_register, "ebp");
+   emit(cmd_pop, op_register, "ebp");
+   if (!f_.proc)
+      return;
+   emit(cmd_ret);
+   gen_.push_string(f_.name + " endp\n");
+}
+
+void select(IrFunction &f, Generator &gen, Generator &data)
+{
+   Selector(f, gen, data).run();
+}
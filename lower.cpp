@@ -0,0 +1,582 @@
+#include "ir.h"
+
+IrBuilder::IrBuilder(IrFunction &f): f_(f), last_store(nullptr)
+{
+   f_.make_block();
+   block_ = f_.make_block();
+}
+
+IrInst *IrBuilder::emit(IrOp op, IrType type, IrInst *a0, IrInst *a1)
+{
+   IrInst *inst = f_.make(op, type);
+   if (a0)
+      inst->args.push_back(a0);
+   if (a1)
+      inst->args.push_back(a1);
+   inst->block = block_;
+   block_->insts.push_back(inst);
+   return inst;
+}
+
+IrInst *IrBuilder::constant(int value)
+{
+   IrInst *inst = emit(ir_const, ir_int);
+   inst->imm = value;
+   return inst;
+}
+
+IrInst *IrBuilder::constant(double value, const std::string &label)
+{
+   IrInst *inst = emit(ir_const, ir_double);
+   inst->num = value;
+   inst->sym = label;
+   return inst;
+}
+
+//A slot of the frame has one address, made in the entry block, so that its uses can be
+//told apart from the uses of anything else; a var parameter holds the address of its variable.
+IrInst *IrBuilder::address(SymVar *var)
+{
+   if (var->is_global())
+   {
+      IrInst *inst = emit(ir_global, ir_addr);
+      inst->sym = "v_" + var->get_name();
+      return inst;
+   }
+   IrInst *&slot = frame_[var->get_offset()];
+   if (!slot)
+   {
+      IrBlock *entry = f_.blocks[0];
+      slot = f_.make(ir_frame, ir_addr);
+      slot->imm = var->get_offset();
+      slot->block = entry;
+      entry->insts.push_back(slot);
+   }
+   return var->is_var_arg() ? emit(ir_load, ir_addr, slot) : slot;
+}
+
+IrInst *IrBuilder::convert(IrInst *v, IrType to)
+{
+   if (v->type == to)
+      return v;
+   if (v->type == ir_int && to == ir_double)
+      return emit(ir_itod, ir_double, v);
+   fail("a value of one type used as another");
+   return v;
+}
+
+void IrBuilder::set_block(IrBlock *b)
+{
+   block_ = b;
+}
+
+void IrBuilder::jump(IrBlock *to)
+{
+   IrInst *inst = emit(ir_jump, ir_void);
+   inst->targets.push_back(to);
+   f_.link(block_, to);
+}
+
+void IrBuilder::branch(IrInst *cond, IrBlock *then_block, IrBlock *else_block)
+{
+   if (cond->type != ir_int && cond->type != ir_double)
+      fail("a condition that is not a number");
+   else if (cond->type == ir_double)
+   {
+      cond = emit(ir_cmp, ir_int, cond, constant(0.0));
+      cond->cond = ir_ne;
+   }
+   IrInst *inst = emit(ir_branch, ir_void, cond);
+   inst->targets.push_back(then_block);
+   inst->targets.push_back(else_block);
+   f_.link(block_, then_block);
+   f_.link(block_, else_block);
+}
+
+//The entry block, which holds the addresses of the frame, goes on to the body, and the
+//body returns where it ends.
+void IrBuilder::finish()
+{
+   IrBlock *body = block_;
+   block_ = f_.blocks[0];
+   jump(f_.blocks[1]);
+   block_ = body;
+   emit(ir_ret, ir_void);
+}
+
+IrInst *IrBuilder::pop()
+{
+   if (values_.empty())
+   {
+      fail("an expression without a value");
+      return constant(0);
+   }
+   IrInst *v = values_.back();
+   values_.pop_back();
+   return v;
+}
+
+IrType ir_type_of(SymType *t)
+{
+   switch (t->get_sym_type())
+   {
+      case sym_int:
+         return ir_int;
+      case sym_double:
+         return ir_double;
+      default:
+         return ir_void;
+   }
+}
+
+std::unique_ptr<IrFunction> lower(SymProc *proc, Statement *body, std::string &reason)
+{
+   std::unique_ptr<IrFunction> f(new IrFunction(proc ? "pr_" + proc->get_name() : "main", proc));
+   IrBuilder ir(*f);
+   body->lower(ir);
+   ir.finish();
+   if (ir.failed())
+   {
+      reason = ir.failure();
+      return nullptr;
+   }
+   return f;
+}
+
+void SynObj::lower(IrBuilder &ir)
+{
+   std::vector<std::pair<SynObj *, int>> stack(1, std::make_pair(this, 0));
+   while (!stack.empty() && !ir.failed())
+   {
+      auto &frame = stack.back();
+      SynObj *child = frame.first->lower_step(ir, frame.second);
+      if (child)
+         stack.push_back(std::make_pair(child, 0));
+      else
+         stack.pop_back();
+   }
+}
+
+IrInst *Expr::lower_address(IrBuilder &ir)
+{
+   ir.fail("an expression where a variable is needed");
+   return ir.constant(0);
+}
+
+static IrCond cond_of(LexemeType t)
+{
+   switch (t)
+   {
+      case lesser_equal:
+         return ir_le;
+      case greater_equal:
+         return ir_ge;
+      case equal:
+         return ir_eq;
+      case not_equal:
+         return ir_ne;
+      case greater:
+         return ir_gt;
+      default:
+         return ir_lt;
+   }
+}
+
+//An assignment leaves the value it stored, so that every expression leaves one.
+SynObj *BinaryOp::lower_step(IrBuilder &ir, int &step)
+{
+   bool assign = token_.type() == assignment;
+   switch (step++)
+   {
+      case 0:
+         return assign ? right_ : left_;
+      case 1:
+         if (!assign)
+            return right_;
+   }
+   IrType type = ir_type_of(get_type());
+   if (assign)
+   {
+      if (type == ir_void)
+      {
+         ir.fail("a whole array or record assigned");
+         return nullptr;
+      }
+      IrInst *value = ir.convert(ir.pop(), type);
+      IrInst *address = left_->lower_address(ir);
+      ir.emit(ir_store, ir_void, address, value);
+      ir.last_store = address;
+      ir.push(value);
+      return nullptr;
+   }
+   IrInst *right = ir.pop(), *left = ir.pop();
+   if (is_relation())
+   {
+      IrType operands = left->type == ir_double || right->type == ir_double ? ir_double : ir_int;
+      IrInst *c = ir.emit(ir_cmp, ir_int, ir.convert(left, operands), ir.convert(right, operands));
+      c->cond = cond_of(token_.type());
+      ir.push(type == ir_void ? c : ir.convert(c, type));
+      return nullptr;
+   }
+   IrOp op;
+   switch (token_.type())
+   {
+      case plus_op:
+         op = ir_add;
+         break;
+      case minus_op:
+         op = ir_sub;
+         break;
+      case mul_op:
+         op = ir_mul;
+         break;
+      case div_op:
+         op = ir_div;
+         break;
+      case mod_op:
+         op = ir_mod;
+         break;
+      case and_op:
+         op = ir_and;
+         break;
+      case or_op:
+         op = ir_or;
+         break;
+      default:
+         op = ir_xor;
+         break;
+   }
+   if (type == ir_void || (type == ir_double && op > ir_div))
+   {
+      ir.fail("an operator on operands it does not take");
+      return nullptr;
+   }
+   ir.push(ir.emit(op, type, ir.convert(left, type), ir.convert(right, type)));
+   return nullptr;
+}
+
+SynObj *UnaryOp::lower_step(IrBuilder &ir, int &step)
+{
+   if (step++ == 0)
+      return expr_;
+   IrType type = ir_type_of(get_type());
+   IrInst *v = ir.pop();
+   if (type == ir_void)
+   {
+      ir.fail("an operator on operands it does not take");
+      return nullptr;
+   }
+   switch (sign_.type())
+   {
+      case minus_op:
+         v = ir.emit(ir_neg, type, ir.convert(v, type));
+         break;
+      case not_op:
+         v = ir.emit(ir_cmp, ir_int, v, v->type == ir_double ? ir.constant(0.0) : ir.constant(0));
+         v->cond = ir_eq;
+         break;
+   }
+   ir.push(ir.convert(v, type));
+   return nullptr;
+}
+
+SynObj *SynVar::lower_step(IrBuilder &ir, int &step)
+{
+   IrType type = ir_type_of(get_type());
+   if (type == ir_void)
+   {
+      ir.fail("a whole array or record as a value");
+      return nullptr;
+   }
+   ir.push(ir.emit(ir_load, type, lower_address(ir)));
+   return nullptr;
+}
+
+IrInst *SynVar::lower_address(IrBuilder &ir)
+{
+   return ir.address(var_);
+}
+
+IrInst *SynVar::lower_field(IrBuilder &ir, IrInst *base)
+{
+   return ir.emit(ir_add, ir_addr, base, ir.constant(var_->get_offset()));
+}
+
+//Index k counts from 1 whatever the bounds, as the code generated always has.
+IrInst *SynArray::lower_index(IrBuilder &ir, IrInst *base)
+{
+   for each(const auto& it in indexes_)
+      it->lower(ir);
+   for (size_t k = 1; k <= dim_; ++k)
+   {
+      IrInst *index = ir.pop();
+      if (index->type != ir_int)
+         ir.fail("an index that is not an integer");
+      IrInst *offset = ir.emit(ir_mul, ir_int, ir.emit(ir_sub, ir_int, index, ir.constant(1)), ir.constant((int)get_size_k(k)));
+      base = ir.emit(ir_add, ir_addr, base, offset);
+   }
+   return base;
+}
+
+IrInst *SynArray::lower_address(IrBuilder &ir)
+{
+   return lower_index(ir, ir.address(var_));
+}
+
+IrInst *SynArray::lower_field(IrBuilder &ir, IrInst *base)
+{
+   return lower_index(ir, SynVar::lower_field(ir, base));
+}
+
+IrInst *SynRec::lower_address(IrBuilder &ir)
+{
+   return field_->lower_field(ir, recn_->lower_address(ir));
+}
+
+IrInst *SynRec::lower_field(IrBuilder &ir, IrInst *base)
+{
+   return field_->lower_field(ir, recn_->lower_field(ir, base));
+}
+
+SynObj *SynConstInt::lower_step(IrBuilder &ir, int &step)
+{
+   ir.push(ir.constant(boost::lexical_cast<int>(str_)));
+   return nullptr;
+}
+
+SynObj *SynConstDouble::lower_step(IrBuilder &ir, int &step)
+{
+   ir.push(ir.constant(boost::lexical_cast<double>(str_), "dc_" + boost::lexical_cast<std::string>(const_->get_number())));
+   return nullptr;
+}
+
+SynObj *SynConstStr::lower_step(IrBuilder &ir, int &step)
+{
+   ir.fail("a string as a value");
+   return nullptr;
+}
+
+SynObj *EmptyExpr::lower_step(IrBuilder &ir, int &step)
+{
+   ir.fail("an expression without a value");
+   return nullptr;
+}
+
+SynObj *Block::lower_step(IrBuilder &ir, int &step)
+{
+   return (size_t)step < body_.size() ? body_[step++] : nullptr;
+}
+
+SynObj *ExprStmt::lower_step(IrBuilder &ir, int &step)
+{
+   if (step++ == 0)
+      return et_;
+   ir.pop();
+   return nullptr;
+}
+
+//Code after a jump goes to a block nothing reaches, which the passes drop.
+SynObj *BreakStmt::lower_step(IrBuilder &ir, int &step)
+{
+   if (ir.in_loop())
+   {
+      ir.jump(ir.break_target());
+      ir.set_block(ir.new_block());
+   }
+   return nullptr;
+}
+
+SynObj *ContinueStmt::lower_step(IrBuilder &ir, int &step)
+{
+   if (ir.in_loop())
+   {
+      ir.jump(ir.continue_target());
+      ir.set_block(ir.new_block());
+   }
+   return nullptr;
+}
+
+SynObj *WhileStmt::lower_step(IrBuilder &ir, int &step)
+{
+   switch (step++)
+   {
+      case 0:
+      {
+         IrBlock *head = ir.new_block();
+         ir.jump(head);
+         ir.set_block(head);
+         ir.push_loop(head, ir.new_block());
+         return expr_;
+      }
+      case 1:
+      {
+         IrBlock *body = ir.new_block();
+         ir.branch(ir.pop(), body, ir.break_target());
+         ir.set_block(body);
+         return stmt_;
+      }
+   }
+   ir.jump(ir.continue_target());
+   ir.set_block(ir.break_target());
+   ir.pop_loop();
+   return nullptr;
+}
+
+//continue starts the body again without testing the condition, as the code generated does.
+SynObj *RepeatStmt::lower_step(IrBuilder &ir, int &step)
+{
+   switch (step++)
+   {
+      case 0:
+      {
+         IrBlock *body = ir.new_block();
+         ir.jump(body);
+         ir.set_block(body);
+         ir.push_loop(body, ir.new_block());
+         return stmt_;
+      }
+      case 1:
+         return expr_;
+   }
+   ir.branch(ir.pop(), ir.break_target(), ir.continue_target());
+   ir.set_block(ir.break_target());
+   ir.pop_loop();
+   return nullptr;
+}
+
+SynObj *IfStmt::lower_step(IrBuilder &ir, int &step)
+{
+   switch (step++)
+   {
+      case 0:
+         return condition_;
+      case 1:
+      {
+         IrBlock *then_block = ir.new_block(), *else_block = ir.new_block();
+         ir.mark(ir.new_block());
+         ir.mark(else_block);
+         ir.branch(ir.pop(), then_block, else_block);
+         ir.set_block(then_block);
+         return if_stmt_;
+      }
+      case 2:
+      {
+         IrBlock *else_block = ir.unmark(), *exit = ir.unmark();
+         ir.jump(exit);
+         ir.mark(exit);
+         ir.set_block(else_block);
+         if (else_stmt_)
+            return else_stmt_;
+      }
+   }
+   IrBlock *exit = ir.unmark();
+   ir.jump(exit);
+   ir.set_block(exit);
+   return nullptr;
+}
+
+//The final value is worked out once, before the loop variable is first assigned, and the
+//variable is the one the assignment stored to.
+SynObj *ForStmt::lower_step(IrBuilder &ir, int &step)
+{
+   switch (step++)
+   {
+      case 0:
+         return expr2_;
+      case 1:
+         return expr1_;
+      case 2:
+      {
+         IrInst *first = ir.pop(), *limit = ir.pop(), *var = ir.last_store;
+         if (first->type != ir_int || limit->type != ir_int)
+         {
+            ir.fail("a for loop over a variable that is not an integer");
+            return nullptr;
+         }
+         IrBlock *cond = ir.new_block(), *body = ir.new_block();
+         ir.jump(cond);
+         ir.set_block(cond);
+         IrInst *c = ir.emit(ir_cmp, ir_int, ir.emit(ir_load, ir_int, var), limit);
+         c->cond = t_.type() == to_stmt ? ir_le : ir_ge;
+         IrBlock *iter = ir.new_block(), *exit = ir.new_block();
+         ir.branch(c, body, exit);
+         ir.mark(cond);
+         ir.push_loop(iter, exit);
+         ir.push(var);
+         ir.set_block(body);
+         return stmt_;
+      }
+   }
+   IrInst *var = ir.pop();
+   IrBlock *iter = ir.continue_target();
+   ir.jump(iter);
+   ir.set_block(iter);
+   IrInst *next = ir.emit(t_.type() == to_stmt ? ir_add : ir_sub, ir_int, ir.emit(ir_load, ir_int, var), ir.constant(1));
+   ir.emit(ir_store, ir_void, var, next);
+   ir.jump(ir.unmark());
+   ir.set_block(ir.break_target());
+   ir.pop_loop();
+   return nullptr;
+}
+
+//Step 2k reaches argument k; step 2k + 1 writes it once it has been lowered.
+SynObj *WriteCall::lower_step(IrBuilder &ir, int &step)
+{
+   while ((size_t)step < 2 * args_.size())
+   {
+      Expr *it = args_[step / 2];
+      if (step % 2 == 0 && !it->is_string())
+      {
+         ++step;
+         return it;
+      }
+      if (it->is_string())
+         ir.emit(ir_write_str, ir_void)->sym = static_cast<SynConstStr *>(it)->get_label();
+      else
+      {
+         IrInst *v = ir.pop();
+         if (v->type != ir_int && v->type != ir_double)
+            ir.fail("a write of what is not a number");
+         ir.emit(ir_write, ir_void, v);
+      }
+      step = step / 2 * 2 + 2;
+   }
+   if (ln_)
+      ir.emit(ir_newline, ir_void);
+   return nullptr;
+}
+
+//Step k reaches argument k; an argument passed by reference is lowered as an address.
+SynObj *FunCall::lower_step(IrBuilder &ir, int &step)
+{
+   auto &params = type_->get_arg_list();
+   while ((size_t)step < arg_.size())
+   {
+      Expr *arg = arg_[step];
+      if (!params[step++]->get_sym_var()->is_var_arg())
+         return arg;
+      ir.push(arg->lower_address(ir));
+   }
+   std::vector<IrInst *> args(arg_.size());
+   for (size_t k = args.size(); k-- > 0;)
+   {
+      args[k] = ir.pop();
+      if (!params[k]->get_sym_var()->is_var_arg())
+      {
+         IrType type = ir_type_of(params[k]->get_type());
+         if (type == ir_void)
+            ir.fail("a whole array or record passed by value");
+         else
+            args[k] = ir.convert(args[k], type);
+      }
+   }
+   IrType result = type_->get_size_ret_value() ? ir_type_of(type_->get_type()) : ir_void;
+   if (type_->get_size_ret_value() && result == ir_void)
+      ir.fail("a function that returns an array or record");
+   IrInst *call = ir.emit(ir_call, result);
+   call->proc = type_;
+   call->sym = "pr_" + name_.get_string();
+   call->args = args;
+   ir.push(call);
+   return nullptr;
+}
@@ -1,55 +1,134 @@
 //#include <vld.h>
-#include "parser.h"
-#include "generator.h"
-
-const std::string ext = "asm";
+#include "batch.h"
+#include "watch.h"
+#include "server.h"
+#include <thread>
+#include <algorithm>
+#include <cctype>
 
 int main(int argc, char **argv)
 {
    if(argc < 2) 
       std::cout << "notFreePascal Compiler, Denis Sushko, 2011" << std::endl;
+   else if (strcmp(argv[1], "--server") == 0 && argc > 2)
+   {
+      //--server <socket> [-j N] [-c MB of cached results] [--max-source MB of a request]
+      unsigned jobs = std::thread::hardware_concurrency();
+      size_t cache_mb = 256, source_mb = 64;
+      for (int i = 3; i + 1 < argc; i += 2)
+         if (strcmp(argv[i], "-j") == 0)
+            jobs = std::max(atoi(argv[i + 1]), 1);
+         else if (strcmp(argv[i], "-c") == 0)
+            cache_mb = atoi(argv[i + 1]);
+         else if (strcmp(argv[i], "--max-source") == 0)
+            source_mb = atoi(argv[i + 1]);
+      Server(argv[2], jobs, cache_mb << 20, source_mb << 20).run();
+   }
+   else if (strcmp(argv[1], "--client") == 0 && argc > 3)
+   {
+      //--client <socket> <mode> <inputs>, or --client <socket> --stop
+      CompileMode mode;
+      if (strcmp(argv[3], "--stop") == 0)
+         run_client(argv[2], "", std::vector<std::string>());
+      else if (!compile_mode(argv[3], mode))
+         std::cout << "Unknown mode " << argv[3] << std::endl;
+      else
+         run_client(argv[2], argv[3], std::vector<std::string>(argv + 4, argv + argc));
+   }
    else
    {
-      FILE *input = _fsopen(argv[2], "r", _SH_DENYWR);
-      std::string out_name = "";
-      out_name += argv[2];
-      for(size_t i = out_name.size() - 1, j = ext.size() - 1; i > out_name.size() - 4; --i, --j)
-         out_name[i] = ext[j];
+      //Several inputs, or a response file of them, are compiled as a batch; -j N sets
+      //how many files are compiled at a time.
+      CompileMode mode;
+      if (!compile_mode(argv[1], mode))
+      {
+         std::cout << "Unknown mode " << argv[1] << std::endl;
+         return 0;
+      }
+      //--cache <dir> keeps the code of procedures there between runs, and with --check the
+      //code found there is compared with the code generated again.
+      std::unique_ptr<CodeCache> cache;
+      for (int i = 2; i + 1 < argc; ++i)
+         if (strcmp(argv[i], "--cache") == 0)
+            cache.reset(new CodeCache(argv[i + 1], std::find_if(argv + 2, argv + argc, [](const char *a) { return strcmp(a, "--check") == 0; }) != argv + argc));
+      Batch batch(mode, cache.get());
+      unsigned jobs = std::thread::hardware_concurrency();
+      for (int i = 2; i < argc; ++i)
+      {
+         if (strcmp(argv[i], "-j") == 0 && i + 1 < argc && isdigit((unsigned char)argv[i + 1][0]))
+            jobs = std::max(atoi(argv[++i]), 1);
+         else if (strcmp(argv[i], "--cache") == 0)
+            ++i;
+         else if (argv[i][0] != '-' && !batch.add(argv[i]))
+         {
+            std::cout << "Error opening file" << std::endl;
+            return 0;
+         }
+      }
+      if (batch.size() > 1 || std::find_if(argv + 2, argv + argc, [](const char *a) { return a[0] == '@'; }) != argv + argc)
+      {
+         batch.run(jobs);
+         if (cache)
+            cache->report(std::cout);
+         return 0;
+      }
+      if (batch.size() == 0)
+      {
+         std::cout << "Error opening file" << std::endl;
+         return 0;
+      }
+      //The flags of one file may come before or after it.
+      auto flag = [&](const char *f) { return std::find_if(argv + 2, argv + argc, [f](const char *a) { return strcmp(a, f) == 0; }); };
+      char **end = argv + argc, **threads = flag("-j");
+      const std::string &name = batch.input(0);
+      FILE *input = _fsopen(name.c_str(), "r", _SH_DENYWR);
+      std::string out_name = output_name(name);
+      bool generating = mode == mode_generate || mode == mode_optimize;
+      if (input != nullptr && generating && flag("--watch") != end)
+      {
+         fclose(input);
+         Watcher(name, out_name, mode == mode_optimize).run();
+         return 0;
+      }
       std::ofstream output(out_name, std::ios::out);
       if (input != nullptr)
       {
-         Scanner lexemeScanner(input, output);
-         if(strcmp(argv[1], "-l") == 0)
+         Scanner lexemeScanner(input);
+         fclose(input);
+         CompileOptions options(mode);
+         options.name = name;
+         options.cache = cache.get();
+         if (flag("-b") != end)
+            lexemeScanner.tokenize();
+         //--pipe lexes on a thread of its own while the parser reads; the code cache
+         //needs all the tokens first.
+         else if (flag("--pipe") != end && !cache)
+            lexemeScanner.pipeline();
+         else if (threads != end)
          {
-            output << argv[2];
-            while (!lexemeScanner.is_eof())
+            //-j N uses N threads and N chunks, however small the file or few the cores.
+            if (threads + 1 != end && isdigit((unsigned char)threads[1][0]))
             {
-               Token token(lexemeScanner.next());
-               token.print(output);
+               options.threads = std::max(atoi(threads[1]), 1);
+               lexemeScanner.tokenize(options.threads, 1);
+            }
+            else
+            {
+               options.threads = std::thread::hardware_concurrency();
+               lexemeScanner.tokenize(options.threads);
             }
          }
-         else if (strcmp(argv[1], "-p") == 0)
-         {
-            Parser par(lexemeScanner, output);
-            par.parse()->print(output);
-            par.print_table();
-         }
-         else if (strcmp(argv[1], "-g") == 0)
+         try
          {
-            Parser par(lexemeScanner, output);
-            auto gen = std::make_shared<Generator>();
-            par.generate(gen);
-            gen->write_to_file(output, false);
+            compile(lexemeScanner, output, options);
          }
-         else if (strcmp(argv[1], "-o") == 0)
+         catch (const CompileError &e)
          {
-            Parser par(lexemeScanner, output);
-            auto gen = std::make_shared<Generator>();
-            par.generate(gen);
-            gen->write_to_file(output, true);
+            output << e.message;
          }
-         fclose(input);
          output.close();
+         if (cache)
+            cache->report(std::cout);
       }
       else
          std::cout << "Error opening file" << std::endl;
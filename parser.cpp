@@ -1,7 +1,11 @@
 #include "parser.h"
+#include "hash.h"
+#include "ir.h"
 #include <sstream>
+#include <thread>
+#include <atomic>
 
-void Parser::is_type_equals(const std::shared_ptr<Expr> &e1, const std::shared_ptr<Expr> &e2, size_t line, bool is_arithmetic)
+void Parser::is_type_equals(Expr *e1, Expr *e2, size_t line, bool is_arithmetic)
 {
    auto t1 = e1->get_type();
    auto t2 = e2->get_type();
@@ -14,60 +18,121 @@ void Parser::is_type_equals(const std::shared_ptr<Expr> &e1, const std::shared_p
       types_eq = true;
    if (t1->get_sym_type() == sym_array)
        if(t2->get_sym_type() == sym_array)
-          types_eq = (t1.get() == t2.get());
+          types_eq = (t1 == t2);
    if (!types_eq)
       type_match_error(t1, t2, line);
    return;
 }
 
-std::shared_ptr<SynObj> Parser::parse()
+SynObj *Parser::parse()
 {
    scan_.next();
-   parse_declaration();
+   deferred_ = threads_ > 1 && !incremental_ && scan_.is_batched();
+   if (!deferred_)
+      parse_declaration();
+   else
+   {
+      //An error in the declarations is held back: the serial parse would have reported
+      //one in a body before it first.
+      bool failed = false;
+      CompileError error;
+      try
+      {
+         parse_declaration();
+      }
+      catch (const CompileError &e)
+      {
+         error = e;
+         failed = true;
+      }
+      parse_bodies();
+      if (failed)
+         throw error;
+   }
    auto obj = parse_stmt(table_);
    scan_.require_token(dot, ".");
    return obj;
 }
 
-std::shared_ptr<Expr> Parser::parse_expr(const std::shared_ptr<SymTable> &sym_table)
+//Binding levels of the binary operators, tightest last; 0 ends an expression.
+static const struct { LexemeType op; int level; } operator_levels[] =
 {
-   auto left = parse_term(sym_table);
-   while (scan_ == plus_op || scan_ == minus_op || scan_ == or_op || scan_ == xor_op)
-   {
-      Token op = scan_.get();
-      scan_.next();
-      auto right = parse_term(sym_table);
-      make_node(left, right, op);
-   }
-   return left;
+   { lesser_equal, 1 }, { greater_equal, 1 }, { equal, 1 }, { not_equal, 1 }, { greater, 1 }, { lesser, 1 },
+   { plus_op, 2 }, { minus_op, 2 }, { or_op, 2 }, { xor_op, 2 },
+   { mul_op, 3 }, { div_op, 3 }, { and_op, 3 }, { mod_op, 3 },
+};
+
+static const int relation_level = 1, sum_level = 2;
+
+static std::vector<int> make_level_table()
+{
+   std::vector<int> levels(of_decl + 1, 0);
+   for each(auto &l in operator_levels)
+      levels[l.op] = l.level;
+   return levels;
 }
 
-std::shared_ptr<Expr> Parser::parse_term(const std::shared_ptr<SymTable> &sym_table)
+static int binding_level(LexemeType t)
+{
+   static const std::vector<int> levels = make_level_table();
+   return t >= 0 && t < (int)levels.size() ? levels[t] : 0;
+}
+
+//Operators bind by level and associate to the left, so each level of nesting costs one
+//call however long the chain of operators is.
+Expr *Parser::parse_binary(SymTable *sym_table, int min_level)
 {
    auto left = parse_factor(sym_table);
-   while (scan_ == mul_op || scan_ == div_op || scan_ == and_op || scan_ == mod_op)
+   for (int level; (level = binding_level(scan_.get().type())) >= min_level;)
    {
       Token op = scan_.get();
       scan_.next();
-      auto right = parse_factor(sym_table);
-      make_node(left, right, op);
+      auto right = parse_binary(sym_table, level + 1);
+      if (level > relation_level)
+         make_node(left, right, op);
+      else if (left->is_const() && right->is_const())
+         left = constant_folding(left, right, op.type());
+      else
+      {
+         is_type_equals(left, right, op.get_line(), true);
+         left = arena_.make<BinaryOp>(choose_expr_type(right, left), op, left, right);
+      }
    }
    return left;
 }
 
-std::shared_ptr<Expr> Parser::parse_unary(const std::shared_ptr<SymTable> &sym_table)
+Expr *Parser::parse_expr(SymTable *sym_table)
 {
-   Token sgn = scan_.get();
-   scan_.next();
+   return parse_binary(sym_table, sum_level);
+}
+
+Expr *Parser::parse_rel(SymTable *sym_table)
+{
+   return parse_binary(sym_table, relation_level);
+}
+
+Expr *Parser::parse_unary(SymTable *sym_table)
+{
+   std::vector<Token> signs;
+   while (scan_ == minus_op || scan_ == plus_op || scan_ == not_op)
+   {
+      signs.push_back(scan_.get());
+      scan_.next();
+   }
    auto expr = parse_factor(sym_table);
-   if (sgn.type() == not_op && expr->get_type()->get_sym_type() != sym_int)
-      logical_op_error(sgn);
-   if (expr->is_const() && sgn.type() != plus_op)
-      return constant_folding(expr, expr, sgn.type(), true);
-   return std::make_shared<UnaryOp>(expr->get_type(), sgn, expr, expr->is_const());
+   for (auto sgn = signs.rbegin(); sgn != signs.rend(); ++sgn)
+   {
+      if (sgn->type() == not_op && expr->get_type()->get_sym_type() != sym_int)
+         logical_op_error(*sgn);
+      if (expr->is_const() && sgn->type() != plus_op)
+         expr = constant_folding(expr, expr, sgn->type(), true);
+      else
+         expr = arena_.make<UnaryOp>(expr->get_type(), *sgn, expr, expr->is_const());
+   }
+   return expr;
 }
 
-std::shared_ptr<Expr> Parser::parse_factor(const std::shared_ptr<SymTable> &sym_table)
+Expr *Parser::parse_factor(SymTable *sym_table)
 {
    switch(scan_.get().type())
    {
@@ -76,21 +141,15 @@ std::shared_ptr<Expr> Parser::parse_factor(const std::shared_ptr<SymTable> &sym_
          if(scan_.get().is_keyword())
             break;
          Token ident = scan_.get();
-         auto var = sym_table->p_find(ident);
-         auto table = sym_table;
-
+         auto var = find(sym_table, ident);
          if (!var)
-         {
-            var = table_->p_find(ident);
-            if (!var)
-               scan_.error("Undeclared identifier: ", ident);
-         }
+            scan_.error("Undeclared identifier: ", ident);
 
          scan_.next();
 
          if (scan_ == left_round_paren || var->is_proc())
             return parse_function_call(ident, sym_table);
-         return parse_ident(var, sym_table, std::make_shared<SymTable>());
+         return parse_ident(var, sym_table, nullptr);
          break;
       }
       case inum:
@@ -100,11 +159,9 @@ std::shared_ptr<Expr> Parser::parse_factor(const std::shared_ptr<SymTable> &sym_
          LexemeType type = scan_.get().type();
          scan_.next();
          if (type == inum)
-            return std::make_shared<SynConstInt>(str);
+            return arena_.make<SynConstInt>(str);
          ++double_count_;
-         table_->insert("dc_" + boost::lexical_cast<std::string>(double_count_),
-            std::make_shared<SymConst>(double_count_, str, std::static_pointer_cast<SymType>(table_->p_find("double"))));
-         return std::make_shared<SynConstDouble>(str, double_count_);
+         return arena_.make<SynConstDouble>(str, make_const(double_count_, str, double_type_));
          break;
       }
       case strng:
@@ -112,9 +169,7 @@ std::shared_ptr<Expr> Parser::parse_factor(const std::shared_ptr<SymTable> &sym_
          std::string str = scan_.get().get_string();
          scan_.next();
          ++string_count_;
-         table_->insert("s_" + boost::lexical_cast<std::string>(string_count_), 
-            std::make_shared<SymConst>(string_count_, str, std::static_pointer_cast<SymType>(table_->p_find("integer"))));
-         return std::make_shared<SynConstStr>(str, string_count_);
+         return arena_.make<SynConstStr>(str, make_const(string_count_, str, int_type_));
          break;
       }
       case left_round_paren:
@@ -132,41 +187,20 @@ std::shared_ptr<Expr> Parser::parse_factor(const std::shared_ptr<SymTable> &sym_
          return parse_unary(sym_table);
          break;
       default:
-         return std::make_shared<EmptyExpr>();
+         return arena_.make<EmptyExpr>();
          break;
    }
 }
 
-std::shared_ptr<Expr> Parser::parse_rel(const std::shared_ptr<SymTable> &sym_table)
-{
-   auto left = parse_expr(sym_table);
-   while (scan_ == lesser_equal || scan_ == greater_equal || scan_ == equal ||
-          scan_ == not_equal || scan_ == greater || scan_ == lesser)
-   {
-      Token op = scan_.get();
-      scan_.next();
-      auto right = parse_expr(sym_table);
-      if (left->is_const() && right->is_const())
-         left = constant_folding(left, right, op.type());
-      else
-      {
-         is_type_equals(left, right, op.get_line(), true);
-         left = std::make_shared<BinaryOp>(choose_expr_type(right, left), op, left, right);
-      }
-   }
-   return left;
-}
-
-std::shared_ptr<Statement> Parser::parse_block(const std::shared_ptr<SymTable> &sym_table)
+Statement *Parser::parse_block(SymTable *sym_table)
 {
    scan_.require_token(begin_stmt, "begin");
-   auto block = std::make_shared<Block>();
-   parse_stmt_and_push_to_block(sym_table, block, end_stmt);
+   auto block = parse_stmt_list(sym_table, end_stmt);
    scan_.require_token(end_stmt, "end");
    return block;
 }
 
-std::shared_ptr<Statement> Parser::parse_stmt(const std::shared_ptr<SymTable> &sym_table)
+Statement *Parser::parse_stmt(SymTable *sym_table)
 {
    switch(scan_.get().type())
    {
@@ -187,15 +221,15 @@ std::shared_ptr<Statement> Parser::parse_stmt(const std::shared_ptr<SymTable> &s
       break;
    case break_stmt:
       scan_.next();
-      return std::make_shared<BreakStmt>();
+      return arena_.make<BreakStmt>();
       break;
    case continue_stmt:
       scan_.next();
-      return std::make_shared<ContinueStmt>();
+      return arena_.make<ContinueStmt>();
       break;
    case inum:
    case dnum:
-      return std::make_shared<ExprStmt>(parse_expr(sym_table));
+      return arena_.make<ExprStmt>(parse_expr(sym_table));
       break;
    case id:
    {
@@ -204,8 +238,8 @@ std::shared_ptr<Statement> Parser::parse_stmt(const std::shared_ptr<SymTable> &s
       Token ident = scan_.get();
       scan_.next();
       if (scan_ == assignment || scan_ == left_square_paren || scan_ == dot)
-         return std::make_shared<ExprStmt>(parse_assignment(ident, sym_table));
-      return std::make_shared<ExprStmt>(parse_function_call(ident, sym_table));
+         return arena_.make<ExprStmt>(parse_assignment(ident, sym_table));
+      return arena_.make<ExprStmt>(parse_function_call(ident, sym_table));
       break;
    }
    case read_stmt:
@@ -224,10 +258,10 @@ std::shared_ptr<Statement> Parser::parse_stmt(const std::shared_ptr<SymTable> &s
    }
 }
 
-std::shared_ptr<Statement> Parser::parse_while(const std::shared_ptr<SymTable> &sym_table)
+Statement *Parser::parse_while(SymTable *sym_table)
 {
    scan_.require_token(while_stmt, "while");
-   std::shared_ptr<Expr> expr;
+   Expr *expr;
 
    if (scan_ == left_round_paren)
    {
@@ -243,23 +277,22 @@ std::shared_ptr<Statement> Parser::parse_while(const std::shared_ptr<SymTable> &
    if (expr->get_string() == "0")
    {
       parse_stmt(sym_table);
-      return std::make_shared<EmptyStmt>();
+      return arena_.make<EmptyStmt>();
    }
 
-   return std::make_shared<WhileStmt>(expr, parse_stmt(sym_table));
+   return arena_.make<WhileStmt>(expr, parse_stmt(sym_table));
 }
 
-std::shared_ptr<Statement> Parser::parse_repeat(const std::shared_ptr<SymTable> &sym_table)
+Statement *Parser::parse_repeat(SymTable *sym_table)
 {
    scan_.require_token(repeat_stmt, "repeat");
-   auto block = std::make_shared<Block>();
-   parse_stmt_and_push_to_block(sym_table, block, until_stmt);
+   auto block = parse_stmt_list(sym_table, until_stmt);
    scan_.require_token(until_stmt, "until");
    auto expr = parse_rel(sym_table);
-   return std::make_shared<RepeatStmt>(expr, block);
+   return arena_.make<RepeatStmt>(expr, block);
 }
 
-std::shared_ptr<Statement> Parser::parse_if(const std::shared_ptr<SymTable> &sym_table)
+Statement *Parser::parse_if(SymTable *sym_table)
 {
    scan_.require_token(if_stmt, "if");
    auto expr = parse_rel(sym_table);
@@ -271,16 +304,16 @@ std::shared_ptr<Statement> Parser::parse_if(const std::shared_ptr<SymTable> &sym
       scan_.require_token(else_stmt, "else");
       if (expr->get_string() == "0")
          return parse_stmt(sym_table);
-      return std::make_shared<IfStmt>(expr, if_block, parse_stmt(sym_table));
+      return arena_.make<IfStmt>(expr, if_block, parse_stmt(sym_table));
    }
 
    if (expr->get_string() == "0")
-      return std::make_shared<EmptyStmt>();
+      return arena_.make<EmptyStmt>();
 
-   return std::make_shared<IfStmt>(expr, if_block, std::make_shared<EmptyStmt>());   
+   return arena_.make<IfStmt>(expr, if_block, arena_.make<EmptyStmt>());   
 }
 
-std::shared_ptr<Statement> Parser::parse_for(const std::shared_ptr<SymTable> &sym_table)
+Statement *Parser::parse_for(SymTable *sym_table)
 {
    scan_.require_token(for_stmt, "for");
    Token loop_var = scan_.get();
@@ -304,17 +337,17 @@ std::shared_ptr<Statement> Parser::parse_for(const std::shared_ptr<SymTable> &sy
       int iv = boost::lexical_cast<int>(initial_value->get_right_expr()->get_string()),
           fv = boost::lexical_cast<int>(final_value->get_string());
       if (clue.type() == to_stmt && iv > fv)
-         return std::make_shared<EmptyStmt>();
+         return arena_.make<EmptyStmt>();
       if (clue.type() == downto_stmt && iv < fv)
-         return std::make_shared<EmptyStmt>();
+         return arena_.make<EmptyStmt>();
    }
 
-   return std::make_shared<ForStmt>(initial_value, final_value, clue, loop_var, block);
+   return arena_.make<ForStmt>(initial_value, final_value, clue, loop_var, block);
 }
 
-std::shared_ptr<Statement> Parser::parse_write_read(const Token &ident, const std::shared_ptr<SymTable> &sym_table)
+Statement *Parser::parse_write_read(const Token &ident, SymTable *sym_table)
 {
-   std::list<std::shared_ptr<Expr>> expr_list;
+   std::vector<Expr *> expr_list;
    if (scan_ == left_round_paren)
    {
       scan_.next();
@@ -324,7 +357,7 @@ std::shared_ptr<Statement> Parser::parse_write_read(const Token &ident, const st
       expr_list.push_back(par);
 
       if (type != sym_double && type != sym_int)
-         type_match_error(std::make_shared<Double>(Double("double or integer")), par->get_type(), ident.get_line());
+         type_match_error(arena_.make<Double>("double or integer"), par->get_type(), ident.get_line());
 
       while (scan_ == comma)
       {
@@ -336,56 +369,50 @@ std::shared_ptr<Statement> Parser::parse_write_read(const Token &ident, const st
    switch (ident.type())
    {
    case write_stmt:
-      return std::make_shared<WriteCall>(expr_list, false);
+      return arena_.make<WriteCall>(arena_.list(expr_list), false);
       break;
    case writeln_stmt:
-      return std::make_shared<WriteCall>(expr_list, true);
+      return arena_.make<WriteCall>(arena_.list(expr_list), true);
       break;
    case read_stmt:
-      return std::make_shared<ReadCall>(expr_list, false);
+      return arena_.make<ReadCall>(arena_.list(expr_list), false);
       break;
    case readln_stmt:
-      return std::make_shared<ReadCall>(expr_list, true);
+      return arena_.make<ReadCall>(arena_.list(expr_list), true);
       break;
    }      
 }
 
-std::shared_ptr<Expr> Parser::parse_assignment(const Token &ident, const std::shared_ptr<SymTable> &sym_table)
+Expr *Parser::parse_assignment(const Token &ident, SymTable *sym_table)
 {
-   auto var = sym_table->p_find(ident);
-   auto table = sym_table;
+   auto var = find(sym_table, ident);
    if (!var)
-   {
-      var = table_->p_find(ident);
-      if (!var)
-         scan_.error("Undeclared identifier: ", ident);
-      table = table_;
-   }
-   auto left = parse_ident(var, sym_table, std::make_shared<SymTable>()); 
+      scan_.error("Undeclared identifier: ", ident);
+   auto left = parse_ident(var, sym_table, nullptr); 
    scan_.require_token(assignment, ":=");
    auto right = parse_expr(sym_table);
 
    is_type_equals(left, right, ident.get_line());
-   return std::make_shared<BinaryOp>(choose_expr_type(right, left), Token(assignment, ":="), left, right);
+   return arena_.make<BinaryOp>(choose_expr_type(right, left), Token(assignment, scan_.intern(":=")), left, right);
 }
 
-std::shared_ptr<Expr> Parser::parse_ident(std::shared_ptr<Symbol> ident, const std::shared_ptr<SymTable> &sym_table, const std::shared_ptr<SymTable> &param_table, bool is_par)
+Expr *Parser::parse_ident(Symbol *ident, SymTable *sym_table, SymTable *param_table, bool is_par)
 {
-   ident->set_used();
+   use(ident);
    auto type = ident->get_type();
-   auto var = std::static_pointer_cast<SymVar>(ident);
-   auto expr = std::make_shared<SynVar>(ident->get_name(), var);
+   auto var = static_cast<SymVar *>(ident);
+   auto expr = arena_.make<SynVar>(ident->get_name(), var);
 
    if (scan_ == left_square_paren)
    {
       if (type->get_sym_type() != sym_array)
-         type_match_error(type->get_type(), std::shared_ptr<SymArray>(), scan_.get().get_line());
-      std::list<std::shared_ptr<Expr>> indexes;
+         type_match_error(type->get_type(), nullptr, scan_.get().get_line());
+      std::vector<Expr *> indexes;
       size_t count = 0;
       while (scan_ == left_square_paren)
       {
          scan_.next();
-         std::shared_ptr<Expr> index_expr;
+         Expr *index_expr;
 
          if (is_par)
             index_expr = parse_expr(param_table);
@@ -395,13 +422,13 @@ std::shared_ptr<Expr> Parser::parse_ident(std::shared_ptr<Symbol> ident, const s
          scan_.require_token(right_square_paren, "]");
 
          if (index_expr->get_type()->get_sym_type() != sym_int)
-            type_match_error(std::make_shared<Int>(Int("integer")), index_expr->get_type(), scan_.get().get_line());
+            type_match_error(literal_int_type(), index_expr->get_type(), scan_.get().get_line());
 
          indexes.push_back(index_expr);
          ++count;
       }
       type = var->get_element_k_type(count);
-      expr = std::make_shared<SynArray>(ident->get_name(), expr, indexes, var, type);
+      expr = arena_.make<SynArray>(ident->get_name(), expr, arena_.list(indexes), var, type);
    }
    while (scan_ == dot)
    {
@@ -418,24 +445,31 @@ std::shared_ptr<Expr> Parser::parse_ident(std::shared_ptr<Symbol> ident, const s
       else
          ident = type->get_sub_table()->p_find(tok);
 
-      std::shared_ptr<SynVar> field = std::static_pointer_cast<SynVar>(parse_ident(ident, type->get_sub_table(), sym_table, true));
-      expr = std::make_shared<SynRec>(tok.get_string(), var, expr, field, field->get_type());
+      SynVar *field = static_cast<SynVar *>(parse_ident(ident, type->get_sub_table(), sym_table, true));
+      expr = arena_.make<SynRec>(tok.get_string(), var, expr, field, field->get_type());
    }
    return expr;
 }
 
-std::shared_ptr<Expr> Parser::parse_function_call(const Token &ident, const std::shared_ptr<SymTable> &sym_table)
+Expr *Parser::parse_function_call(const Token &ident, SymTable *sym_table)
 {
-   std::list<std::shared_ptr<Expr>> args;
+   std::vector<Expr *> args;
    size_t count = 0;
-   std::shared_ptr<SymProc> st = std::static_pointer_cast<SymProc>(sym_table->p_find(ident));
-   if (!st)
+   SymTable *scope;
+   Symbol *sym = find(sym_table, ident);
+   //Inside a function its name is also the result variable; a call means the function itself.
+   if (sym && !sym->is_proc() && sym_table->lookup(&ident.get_string(), scope) && scope != table_)
    {
-      st = std::static_pointer_cast<SymProc>(table_->p_find(ident));
-      if (!st)
-         scan_.error("Undeclared identifier: ", ident);
+      Symbol *outer = find(table_, ident);
+      if (outer && outer->is_proc() && static_cast<SymProc *>(outer)->get_local_table() == scope)
+         sym = outer;
    }
-   st->set_used();
+   if (!sym)
+      scan_.error("Undeclared identifier: ", ident);
+   if (!sym->is_proc())
+      scan_.error("Not a procedure or function: ", ident);
+   SymProc *st = static_cast<SymProc *>(sym);
+   use(st);
    if (scan_ == left_round_paren)
    {
       scan_.next();
@@ -467,7 +501,7 @@ std::shared_ptr<Expr> Parser::parse_function_call(const Token &ident, const std:
    }
    else if (st->get_arg_list().size() > count)
       scan_.error("Missed arguments", ident);
-   return std::make_shared<FunCall>(args, ident, st);
+   return arena_.make<FunCall>(arena_.list(args), ident, st);
 }
 
 void Parser::parse_declaration()
@@ -492,16 +526,18 @@ void Parser::parse_declaration()
          }
          default:
          {
+            size_t head = scan_.position();
             scan_.next();
             std::string name = scan_.get().get_string();
+            const std::string *key = &scan_.get().get_string();
 
-            if (table_->find(name))
-               scan_.error("Duplicate identifier", Token(id, name));
+            if (table_->find(key))
+               scan_.error("Duplicate identifier", Token(id, key));
 
             scan_.next();
 
-            std::list<std::shared_ptr<SynVar>> params_list;
-            auto local_table = std::make_shared<SymTable>();
+            NodeList<SynVar *> params_list;
+            auto local_table = arena_.make<SymTable>(table_);
             int offset = 0;
 
             if (scan_ == left_round_paren)
@@ -511,7 +547,7 @@ void Parser::parse_declaration()
                scan_.require_token(right_round_paren, ")");
             }
 
-            std::shared_ptr<SymType> func_type;
+            SymType *func_type = nullptr;
 
             if (t == function_decl)
             {
@@ -519,13 +555,13 @@ void Parser::parse_declaration()
                func_type = parse_type();
 
                if (func_type->get_name() == "array")
-                  scan_.error("Wrong declaration function type", Token(id, name));
+                  scan_.error("Wrong declaration function type", Token(id, key));
 
                if (offset == 0)
                   offset = 8;
 
-               local_table->insert(std::make_shared<SymVar>("result", func_type, offset, false, false));
-               local_table->insert(std::make_shared<SymVar>(name, func_type, offset, false, false));
+               local_table->insert(scan_.intern("result"), arena_.make<SymVar>("result", func_type, offset, false, false));
+               local_table->insert(key, arena_.make<SymVar>(name, func_type, offset, false, false));
 
                scan_.next();
             }
@@ -539,17 +575,47 @@ void Parser::parse_declaration()
                size = parse_var_decalration(local_table, true);
             }
 
-            std::shared_ptr<SymProc> procedure;
+            SymProc *procedure;
             if (t == function_decl)
-               procedure = std::make_shared<SymFunc>(name, local_table, params_list, func_type, size);
+               procedure = arena_.make<SymFunc>(name, local_table, params_list, func_type, size);
             else
-               procedure = std::make_shared<SymProc>(name, local_table, params_list, size);
+               procedure = arena_.make<SymProc>(name, local_table, params_list, size);
 
-            table_->insert(procedure);
+            declare(table_, key, procedure);
+
+            ProcBody record(procedure, local_table);
+            record.head = head;
+            if (deferred_)
+            {
+               record.begin = scan_.position();
+               bodies_.push_back(record);
+               order_ = bodies_.size();
+               skip_body();
+               scan_.require_token(semicolon, ";");
+               bodies_.back().end = scan_.position();
+               break;
+            }
+            if (incremental_ || cache_)
+            {
+               record.begin = scan_.position();
+               record.doubles = double_count_;
+               record.strings = string_count_;
+               uses_ = &record.uses;
+            }
 
             auto body = parse_block(local_table);
             scan_.require_token(semicolon, ";");
             procedure->set_block(body);
+
+            if (incremental_ || cache_)
+            {
+               record.end = scan_.position();
+               record.doubles_end = double_count_;
+               record.strings_end = string_count_;
+               uses_ = nullptr;
+               bodies_.push_back(record);
+               order_ = bodies_.size();
+            }
             break;
          }
       }
@@ -570,20 +636,20 @@ void Parser::parse_type_declaration()
       scan_.require_token(equal, "=");
       auto type = parse_type();
       scan_.next();
-      table_->insert(ident, type);
+      declare(table_, &ident.get_string(), type);
       scan_.require_token(semicolon, ";");
    }   
 }
 
-int Parser::parse_var_decalration(const std::shared_ptr<SymTable> &sym_table, bool is_proc)
+int Parser::parse_var_decalration(SymTable *sym_table, bool is_proc)
 {
-   std::list<std::string> lst;
+   std::list<const std::string *> lst;
    int offset = sizeof(int);
    size_t size = 0;
    offset *= -1;
    while (scan_ == id && !scan_.get().is_keyword())
    {
-      lst.push_back(scan_.get().get_string());
+      lst.push_back(&scan_.get().get_string());
       scan_.next();
       if (scan_ == colon)
       {
@@ -599,9 +665,9 @@ int Parser::parse_var_decalration(const std::shared_ptr<SymTable> &sym_table, bo
                   offset = size;
                   offset *= -1;
                }
-               auto var = std::make_shared<SymVar>(k, type, offset, !is_proc);
-               if (!sym_table->find(var->get_name()))
-                  sym_table->insert(var);
+               auto var = arena_.make<SymVar>(*k, type, offset, !is_proc);
+               if (!sym_table->find(k))
+                  declare(sym_table, k, var);
                else 
                   scan_.error("Duplicate identifier: ", Token(id, k));
             }
@@ -618,9 +684,9 @@ int Parser::parse_var_decalration(const std::shared_ptr<SymTable> &sym_table, bo
                   offset = size;
                   offset *= -1;
                }
-               std::shared_ptr<SymVar> var = std::make_shared<SymVar>(k, type, offset, !is_proc);
-               if (!sym_table->find(var->get_name()))
-                  sym_table->insert(var);
+               SymVar *var = arena_.make<SymVar>(*k, type, offset, !is_proc);
+               if (!sym_table->find(k))
+                  declare(sym_table, k, var);
                else 
                   scan_.error("Duplicate identifier: ", Token(id, k));
             }
@@ -635,61 +701,61 @@ int Parser::parse_var_decalration(const std::shared_ptr<SymTable> &sym_table, bo
    return size;
 }
 
-std::shared_ptr<SymType> Parser::parse_type()
+SymType *Parser::parse_type()
 {
    switch (scan_.get().type())
    {
       case integer_decl:
       {
-         return std::static_pointer_cast<SymType>(table_->p_find("integer"));
+         return int_type_;
          break;
       }
       case double_decl:
       {
-         return std::static_pointer_cast<SymType>(table_->p_find("double"));
+         return double_type_;
          break;
       }
       case inum:
       {
-         long int lb = scan_.get().get_int_value(), rb;
+         long int lb = scan_.get_int_value(), rb;
          scan_.next(); 
          if (scan_ == dot)
          {
             scan_.require_token(dot, ".");
-            rb = scan_.get().get_int_value();
+            rb = scan_.get_int_value();
          }
-         return std::make_shared<IntRange>("range", lb, rb);
+         return arena_.make<IntRange>("range", lb, rb);
          break;
       }
       case array_decl:
       {
          scan_.next();
          scan_.require_token(left_square_paren, "[");
-         int size = scan_.get().get_int_value();
+         int size = scan_.get_int_value();
          scan_.next();
 
          if (scan_ == dot)
          {
             scan_.next();
             scan_.require_token(dot, ".");
-            size = scan_.get().get_int_value() - size + 1;
+            size = scan_.get_int_value() - size + 1;
             scan_.next();
          }
 
          scan_.require_token(right_square_paren, "]");
          scan_.require_token(of_decl, "of");
-         return std::make_shared<SymArray>("array", parse_type(), size);
+         return arena_.make<SymArray>("array", parse_type(), size);
          break;
       }
       case rec_decl:
       {
-         auto fields = std::make_shared<SymTable>();
+         auto fields = arena_.make<SymTable>();
          scan_.next();
-         std::list<std::string> lvar;
+         std::list<const std::string *> lvar;
          int offset = 0;
          while (scan_ == id && scan_ != end_stmt)
          {
-            lvar.push_back(scan_.get().get_string());
+            lvar.push_back(&scan_.get().get_string());
             scan_.next();
             if (scan_ == colon)
             {
@@ -697,7 +763,7 @@ std::shared_ptr<SymType> Parser::parse_type()
                auto type = parse_type();
                for each(const auto& k in lvar)
                {
-                  fields->insert(std::make_shared<SymVar>(k, type, offset));
+                  fields->insert(k, arena_.make<SymVar>(*k, type, offset));
                   offset += type->get_size();
                }
                lvar.clear();
@@ -705,7 +771,7 @@ std::shared_ptr<SymType> Parser::parse_type()
             }
             scan_.next();
          }
-         return std::make_shared<SymStruct>("record", fields);
+         return arena_.make<SymStruct>("record", fields);
          break;
       }
       case id:
@@ -713,7 +779,7 @@ std::shared_ptr<SymType> Parser::parse_type()
          if (!table_->find(scan_.get()))
             scan_.error("Undefined type: ", scan_.get());
 
-         std::shared_ptr<SymType> type = std::static_pointer_cast<SymType>(table_->p_find(scan_.get()));
+         SymType *type = static_cast<SymType *>(table_->p_find(scan_.get()));
          type->set_name(scan_.get().get_string());
          return type;
          break;
@@ -726,11 +792,11 @@ std::shared_ptr<SymType> Parser::parse_type()
    }
 }
 
-std::list<std::shared_ptr<SynVar>> Parser::parse_params(const std::shared_ptr<SymTable> &sym_table, int &os)
+NodeList<SynVar *> Parser::parse_params(SymTable *sym_table, int &os)
 {
-   std::list<std::shared_ptr<SynVar>> var_list;
-   auto params_table = std::make_shared<SymTable>();
-   int offset = 8, num = 0;
+   std::vector<SynVar *> var_list;
+   auto params_table = arena_.make<SymTable>();
+   int offset = 8;
    while (scan_ == id || scan_ == var_decl) 
    {
       bool is_var = false;
@@ -740,11 +806,10 @@ std::list<std::shared_ptr<SynVar>> Parser::parse_params(const std::shared_ptr<Sy
          scan_.next();
       }
       bool cond = true;
-      std::list<std::string> ls;
+      std::list<const std::string *> ls;
       while (cond) 
       {
-         ls.push_back(scan_.get().get_string());
-         ++num;
+         ls.push_back(&scan_.get().get_string());
          scan_.next();
          if (scan_ == colon)
          {
@@ -756,11 +821,11 @@ std::list<std::shared_ptr<SynVar>> Parser::parse_params(const std::shared_ptr<Sy
                scan_.require_token(semicolon, ";");
             for each(const auto& k in ls) 
             {
-               auto svar = std::make_shared<SymVar>(k, type, offset, false, is_var);
-               auto varb = std::make_shared<SynVar>(k, svar);
-               if (!params_table->find(svar->get_name()) && !sym_table->find(svar->get_name()))
+               auto svar = arena_.make<SymVar>(*k, type, offset, false, is_var);
+               auto varb = arena_.make<SynVar>(*k, svar);
+               if (!params_table->find(k) && !sym_table->find(k))
                {
-                  params_table->insert(svar);
+                  params_table->insert(k, svar);
                   var_list.push_back(varb);            
                }
                else 
@@ -771,24 +836,19 @@ std::list<std::shared_ptr<SynVar>> Parser::parse_params(const std::shared_ptr<Sy
             scan_.require_token(comma, ",");
       }
    }
-   if (!params_table->get_table().empty())
+   auto &params = params_table->by_name();
+   for (auto it = params.rbegin(); it != params.rend(); ++it)
    {
-      auto it = (*params_table).get_table().end();
-      --it;
-      for(int i = 0; i < num; ++i)
-      {
-         auto svar = std::static_pointer_cast<SymVar>((*it).second);
-         svar->set_offset(offset);
-         offset += svar->is_var_arg() ? 4 : svar->get_type()->get_size();
-         sym_table->insert(svar);
-         --it;
-      }
-   }      
+      auto svar = static_cast<SymVar *>(it->second);
+      svar->set_offset(offset);
+      offset += svar->is_var_arg() ? 4 : svar->get_type()->get_size();
+      sym_table->insert(it->first, svar);
+   }
    os = offset;
-   return var_list;
+   return arena_.list(var_list);
 }
 
-std::string Parser::get_message(const std::shared_ptr<Symbol> &t)
+std::string Parser::get_message(Symbol *t)
 {
    std::string mes = "";
    if(t->get_name() == "array")
@@ -806,34 +866,131 @@ void Parser::print_table()
    table_->print_var_table(output_);
 }
 
-void Parser::type_match_error(const std::shared_ptr<SymType> &t1, const std::shared_ptr<SymType> &t2, size_t line)
+void Parser::type_match_error(SymType *t1, SymType *t2, size_t line)
 {
    scan_.type_match_error(get_message(t1), get_message(t2), line);
 }
 
-void Parser::generate(const std::shared_ptr<Generator> &gen)
+//The main program and every used table entry are generated, and optimized when opt is
+//set, on their own on up to threads_ threads, each with labels of its own. The pieces are
+//put together in the order of the listing, so the code does not depend on the threads.
+void Parser::generate(const std::shared_ptr<Generator> &gen, bool opt)
 {
-   auto st = std::static_pointer_cast<Statement>(parse());
-   gen->push_string("include source\\start.inc\n");
-   st->generate(gen);
-   gen->push_string("\ninclude source\\end.inc\n");
-   gen->push_string("\tint_frmt db '%d', 0\n\tdouble_frmt db '%f', 0\n\tnew_line db '', 0Dh, 0Ah, 0\n\tdouble_buff dq 0.0\n");
-   table_->generate(gen);   
+   auto st = static_cast<Statement *>(parse());
+   std::vector<SymTable::Entry> entries;
+   for each(const auto& it in table_->by_name())
+      if (it.second->is_used())
+         entries.push_back(it);
+   std::vector<std::shared_ptr<Generator>> parts(entries.size() + 1);
+   std::vector<unsigned long long> keys(parts.size(), 0);
+   if (cache_ && scan_.is_batched())
+   {
+      std::unordered_map<Symbol *, const ProcBody *> procs;
+      for each (const auto &body in bodies_)
+         procs[body.proc] = &body;
+      for (size_t i = 1; i < parts.size(); ++i)
+      {
+         auto it = procs.find(entries[i - 1].second);
+         if (it != procs.end())
+            keys[i] = code_key(*it->second, opt);
+      }
+   }
+   std::atomic<size_t> next(0);
+   auto work = [&]()
+   {
+      for (size_t i; (i = next++) < parts.size();)
+      {
+         std::shared_ptr<Generator> cached;
+         Generator data;
+         bool selected = false;
+         if (i == 0)
+         {
+            parts[0] = std::make_shared<Generator>();
+            parts[0]->push_string("include source\\start.inc\n");
+            selected = opt && generate_ir(nullptr, st, *parts[0], data);
+            if (!selected)
+               st->generate(parts[0]);
+            parts[0]->push_string("\ninclude source\\end.inc\n");
+            parts[0]->push_string("\tint_frmt db '%d', 0\n\tdouble_frmt db '%f', 0\n\tnew_line db '', 0Dh, 0Ah, 0\n\talign 8\n\tdouble_buff dq 0.0\n");
+         }
+         else
+         {
+            parts[i] = std::make_shared<Generator>(*entries[i - 1].first + "_");
+            if (keys[i] && cache_->load(keys[i], *parts[i]))
+            {
+               if (!cache_->checking())
+                  continue;
+               cached = parts[i];
+               parts[i] = std::make_shared<Generator>(*entries[i - 1].first + "_");
+            }
+            Symbol *sym = entries[i - 1].second;
+            selected = opt && sym->is_proc() && generate_ir(static_cast<SymProc *>(sym), static_cast<SymProc *>(sym)->get_block(), *parts[i], data);
+            if (!selected)
+               sym->generate(parts[i]);
+         }
+         //Code selected from the IR keeps no values on the stack for the peephole rules.
+         if (opt && !selected)
+            parts[i]->peephole();
+         parts[i]->append(data);
+         if (cached)
+            cache_->compare(*entries[i - 1].first, *cached, *parts[i]);
+         else if (keys[i])
+            cache_->store(keys[i], *parts[i]);
+      }
+   };
+   std::vector<std::thread> workers;
+   for (unsigned t = 1; t < threads_ && t < parts.size(); ++t)
+      workers.emplace_back(work);
+   work();
+   for each (auto &w in workers)
+      w.join();
+
+   gen->append(*parts[0]);
+   if (incremental_)
+      head_ = gen->text();
+   for (size_t i = 1; i < parts.size(); ++i)
+   {
+      auto before = gen->last();
+      gen->append(*parts[i]);
+      if (!incremental_ || gen->last() == before)
+         continue;
+      CodeRange code;
+      code.first = ++before;
+      code.last = gen->last();
+      code.text = gen->text(code.first, code.last);
+      code_[*entries[i - 1].first] = code;
+   }
    gen->push_string("end start");
+   if (opt)
+      gen->merge_consts();
 }
 
-Parser::Parser(Scanner &s, std::ofstream &o) : scan_(s), output_(o), table_(std::make_shared<SymTable>()), double_count_(0), string_count_(0)
+void Parser::print_ir(std::ostream &output)
 {
-   table_->insert(std::make_shared<Int>("integer"));
-   table_->insert(std::make_shared<Double>("double"));
+   auto st = static_cast<Statement *>(parse());
+   ::print_ir(nullptr, st, output);
+   for each(const auto& it in table_->by_name())
+      if (it.second->is_used() && it.second->is_proc())
+         ::print_ir(static_cast<SymProc *>(it.second), static_cast<SymProc *>(it.second)->get_block(), output);
 }
 
-std::shared_ptr<Expr> Parser::constant_folding(const std::shared_ptr<Expr> &e1, const std::shared_ptr<Expr> &e2, int sign, bool is_unary)
+Parser::Parser(Scanner &s, std::ostream &o, bool incremental, unsigned threads, Arena *arena) : arena_(arena ? *arena : own_arena_), scan_(s), output_(o), table_(arena_.make<SymTable>()),
+   double_count_(0), string_count_(0), incremental_(incremental), newly_used_(false), deferred_(false), threads_(threads), order_(0),
+   uses_(nullptr), owner_(nullptr), body_(nullptr), cache_(nullptr)
+{
+   int_type_ = arena_.make<Int>("integer");
+   double_type_ = arena_.make<Double>("double");
+   table_->insert(scan_.intern("integer"), int_type_);
+   table_->insert(scan_.intern("double"), double_type_);
+}
+
+Expr *Parser::constant_folding(Expr *e1, Expr *e2, int sign, bool is_unary)
 {
    if (e1->get_type()->get_sym_type() == sym_double || e2->get_type()->get_sym_type() == sym_double)
    {
       double d1, d2;
       int i = 0;
+      bool relation = sign == lesser_equal || sign == greater_equal || sign == equal || sign == not_equal || sign == greater || sign == lesser;
       d1 = boost::lexical_cast<double>(e1->get_string());
       if (!is_unary)
          d2 = boost::lexical_cast<double>(e2->get_string());
@@ -878,22 +1035,17 @@ std::shared_ptr<Expr> Parser::constant_folding(const std::shared_ptr<Expr> &e1,
          break;
       }
       if (e1->get_type()->get_sym_type() == sym_double && e2->get_type()->get_sym_type() == sym_double && !is_unary)
+         erase_double();
+      //A comparison is an integer, also when it does not hold.
+      if (relation)
       {
-         table_->erase("dc_" + boost::lexical_cast<std::string>(double_count_));
-         --double_count_;
-      }
-      if(i)
-      {
-         table_->erase("dc_" + boost::lexical_cast<std::string>(double_count_));
-         --double_count_;
-         return std::make_shared<SynConstInt>(boost::lexical_cast<std::string>(i));;
+         erase_double();
+         return arena_.make<SynConstInt>(boost::lexical_cast<std::string>(i));
       }
       std::string val = boost::lexical_cast<std::string>(d1);
       double e;
       std::string s = std::abs(std::modf(d1, &e)) < 0.00001 ? ".0" : "";
-      table_->insert("dc_" + boost::lexical_cast<std::string>(double_count_),
-         std::make_shared<SymConst>(double_count_, val + s, std::static_pointer_cast<SymType>(table_->p_find("double"))));
-      return std::make_shared<SynConstDouble>(val + s, double_count_);
+      return arena_.make<SynConstDouble>(val + s, make_const(double_count_, val + s, double_type_));
    }
    else
    {
@@ -952,17 +1104,50 @@ std::shared_ptr<Expr> Parser::constant_folding(const std::shared_ptr<Expr> &e1,
          i1 = !i1;
          break;
       }
-      return std::make_shared<SynConstInt>(boost::lexical_cast<std::string>(i1));
+      return arena_.make<SynConstInt>(boost::lexical_cast<std::string>(i1));
    }
 }
 
+//Makes constant number num, named dc_num or s_num by its type. A helper keeps it with the
+//body it parses instead, numbered within the body.
+SymConst *Parser::make_const(int num, const std::string &value, SymType *type)
+{
+   auto c = arena_.make<SymConst>(num, value, type);
+   if (body_)
+   {
+      auto &consts = type->get_sym_type() == sym_int ? body_->string_consts : body_->double_consts;
+      if (consts.size() < (size_t)num)
+         consts.resize(num);
+      consts[num - 1] = c;
+   }
+   else
+      declare_const(c);
+   return c;
+}
+
+void Parser::declare_const(SymConst *c)
+{
+   std::string prefix = c->get_type()->get_sym_type() == sym_int ? "s_" : "dc_";
+   declare(table_, scan_.intern(prefix + boost::lexical_cast<std::string>(c->get_number())), c);
+}
+
+//Drops the last double constant made, folded into another.
+void Parser::erase_double()
+{
+   if (!body_)
+      table_->erase(scan_.intern("dc_" + boost::lexical_cast<std::string>(double_count_)));
+   else if (double_count_ > 0 && (size_t)double_count_ <= body_->double_consts.size())
+      body_->double_consts[double_count_ - 1] = nullptr;
+   --double_count_;
+}
+
 void Parser::logical_op_error(const Token &op)
 {
-   output_ << "Error at line " << op.get_line() << ": " << op.get_string() + " operation can be used with int type only";
-   exit(0);
+   Diagnostic where = {op.get_line(), op.get_col(), op.get_string() + " operation can be used with int type only"};
+   scan_.fail(where, "Error at line " + boost::lexical_cast<std::string>(where.line) + ": " + where.message);
 }
 
-void Parser::make_node(std::shared_ptr<Expr> &left, const std::shared_ptr<Expr> &right, const Token &op)
+void Parser::make_node(Expr *&left, Expr *right, const Token &op)
 {
    auto type = op.type();
    auto expr_type = choose_expr_type(right, left);
@@ -976,20 +1161,283 @@ void Parser::make_node(std::shared_ptr<Expr> &left, const std::shared_ptr<Expr>
    else
    {
       is_type_equals(left, right, op.get_line(), true);
-      left = std::make_shared<BinaryOp>(choose_expr_type(right, left), op, left, right);
+      left = arena_.make<BinaryOp>(choose_expr_type(right, left), op, left, right);
    }
 }
 
-void Parser::parse_stmt_and_push_to_block(const std::shared_ptr<SymTable> &sym_table, const std::shared_ptr<Block> &block, LexemeType type)
+Block *Parser::parse_stmt_list(SymTable *sym_table, LexemeType type)
 {
+   std::vector<Statement *> body;
    bool br = false;
    while (scan_ != type)
    {
       auto stmt = parse_stmt(sym_table);
       if (!br)
-         block->push_stmt(stmt);
+         body.push_back(stmt);
       scan_.require_token(semicolon, ";");
       if (stmt->is_break_or_continue())
          br = true;
    }
+   return arena_.make<Block>(arena_.list(body));
+}
+
+void Parser::use(Symbol *s)
+{
+   if (uses_)
+   {
+      //Symbols are shared by the threads parsing bodies; the owner marks them used.
+      if (owner_)
+      {
+         uses_->push_back(s);
+         return;
+      }
+      if (!s->is_used() && declared_.count(scan_.intern(s->get_name())))
+         newly_used_ = true;
+      uses_->push_back(s);
+   }
+   s->set_used();
+}
+
+//Global names remember which procedure body came after them, so that a body parsed
+//again does not see what is declared further down.
+void Parser::declare(SymTable *table, const std::string *key, Symbol *s)
+{
+   table->insert(key, s);
+   if ((incremental_ || deferred_) && table == table_)
+      declared_[key] = order_;
+}
+
+//Resolves an identifier through sym_table and the scopes around it.
+Symbol *Parser::find(SymTable *sym_table, const Token &ident)
+{
+   SymTable *scope;
+   auto s = sym_table->lookup(&ident.get_string(), scope);
+   if (s && (incremental_ || deferred_) && scope == table_)
+   {
+      auto &declared = owner_ ? owner_->declared_ : declared_;
+      auto it = declared.find(&ident.get_string());
+      if (it != declared.end() && it->second > order_)
+         return nullptr;
+   }
+   return s;
+}
+
+bool Parser::regenerate(const std::string &name, const std::shared_ptr<Generator> &gen)
+{
+   auto sym = table_->p_find(scan_.intern(name));
+   auto it = code_.find(name);
+   if (it == code_.end())
+      return !sym || !sym->is_used();
+   CodeRange &code = it->second;
+   auto part = std::make_shared<Generator>(name + "_");
+   sym->generate(part);
+   gen->replace(code.first, code.last, *part);
+   code.text = gen->text(code.first, code.last);
+   return true;
+}
+
+//Writes the same text as the generator would, from what is kept of each table entry.
+void Parser::write_to_file(std::ostream &output)
+{
+   output << head_;
+   for each(const auto& it in code_)
+      output << it.second.text;
+   output << "end start";
+}
+
+//Parses a procedure body again in place. The constants it made are numbered again from
+//the same point; the body has to take as many, stop where it should and leave every
+//global symbol used or unused as it was, or nothing past it could be kept.
+bool Parser::reparse(ProcBody &body, long shift)
+{
+   for (int i = body.doubles + 1; i <= body.doubles_end; ++i)
+      table_->erase(scan_.intern("dc_" + boost::lexical_cast<std::string>(i)));
+   for (int i = body.strings + 1; i <= body.strings_end; ++i)
+      table_->erase(scan_.intern("s_" + boost::lexical_cast<std::string>(i)));
+   double_count_ = body.doubles;
+   string_count_ = body.strings;
+   order_ = &body - bodies_.data();
+   newly_used_ = false;
+   std::vector<Symbol *> uses;
+   uses_ = &uses;
+
+   scan_.seek(body.begin);
+   scan_.next();
+   auto block = parse_block(body.locals);
+   scan_.require_token(semicolon, ";");
+   uses_ = nullptr;
+   order_ = bodies_.size();
+
+   if (scan_.position() != body.end + shift || double_count_ != body.doubles_end || string_count_ != body.strings_end)
+      return false;
+   bool same_use = !newly_used_;
+   for each(const auto& s in body.uses)
+   {
+      s->release();
+      if (!s->is_used() && declared_.count(scan_.intern(s->get_name())))
+         same_use = false;
+   }
+   body.uses.swap(uses);
+   body.proc->set_block(block);
+   return same_use;
+}
+
+//Takes in an edit of the token stream that falls inside one procedure body. Returns
+//false when the program has to be parsed and generated from the start instead; the
+//parser is then left in no state to be used again.
+bool Parser::update(const TokenEdit &edit, const std::shared_ptr<Generator> &gen)
+{
+   if (edit.first == edit.old_end && edit.old_end == edit.new_end)
+      return true;
+   if (!incremental_ || !scan_.lexed_clean())
+      return false;
+   size_t i = 0;
+   while (i < bodies_.size() && bodies_[i].end <= edit.first)
+      ++i;
+   if (i == bodies_.size() || edit.first <= bodies_[i].begin || edit.old_end + 2 > bodies_[i].end)
+      return false;
+
+   ProcBody &body = bodies_[i];
+   long shift = (long)edit.new_end - (long)edit.old_end;
+   try
+   {
+      if (!reparse(body, shift))
+         return false;
+   }
+   catch (const CompileError &)
+   {
+      return false;
+   }
+   body.end += shift;
+   for (size_t j = i + 1; j < bodies_.size(); ++j)
+   {
+      bodies_[j].begin += shift;
+      bodies_[j].end += shift;
+   }
+
+   if (!regenerate(body.proc->get_name(), gen))
+      return false;
+   for (int k = body.doubles + 1; k <= body.doubles_end; ++k)
+      if (!regenerate("dc_" + boost::lexical_cast<std::string>(k), gen))
+         return false;
+   for (int k = body.strings + 1; k <= body.strings_end; ++k)
+      if (!regenerate("s_" + boost::lexical_cast<std::string>(k), gen))
+         return false;
+   return true;
+}
+//A parser of procedure bodies on another thread: its own reader of the owner's tokens and
+//its own arena. The owner's global table is only read while the bodies are parsed.
+Parser::Parser(Parser &owner) : arena_(own_arena_), reader_(new Scanner(owner.scan_, 0)), scan_(*reader_), output_(owner.output_),
+   table_(owner.table_), int_type_(owner.int_type_), double_type_(owner.double_type_), double_count_(0), string_count_(0),
+   incremental_(false), newly_used_(false), deferred_(true), threads_(1), order_(0), uses_(nullptr), owner_(&owner), body_(nullptr), cache_(nullptr) {}
+
+//Moves past a procedure body to the "end" that closes its "begin". Statements nest only
+//in begin and end, so a body that parses ends there too.
+void Parser::skip_body()
+{
+   if (scan_ != begin_stmt)
+      return;
+   size_t depth = 0, k = 0;
+   for (LexemeType t = begin_stmt; t != error_lex; t = scan_.peek(++k))
+   {
+      if (t == begin_stmt)
+         ++depth;
+      else if (t == end_stmt && --depth == 0)
+         break;
+   }
+   scan_.seek(scan_.position() + k + 1);
+   scan_.next();
+}
+
+//Parses the order-th body skipped over by the owner, with constants numbered from 0.
+void Parser::parse_body(ProcBody &body, size_t order)
+{
+   order_ = order;
+   double_count_ = 0;
+   string_count_ = 0;
+   body_ = &body;
+   uses_ = &body.uses;
+   scan_.seek(body.begin);
+   scan_.next();
+   auto block = parse_block(body.locals);
+   scan_.require_token(semicolon, ";");
+   body.proc->set_block(block);
+   body.doubles_end = double_count_;
+   body.strings_end = string_count_;
+}
+
+//Parses the skipped bodies on up to threads_ threads, each taking the next body left.
+//The constants of each body are then numbered on from those before it, so the program
+//comes out as the serial parse makes it, and the first error in the source is reported.
+void Parser::parse_bodies()
+{
+   size_t n = bodies_.size();
+   std::vector<CompileError> errors(n);
+   std::vector<char> failed(n, 0);
+   std::atomic<size_t> next(0), first_error(n);
+   std::vector<std::thread> workers;
+   for (unsigned t = 0; t < threads_ && t < n; ++t)
+   {
+      helpers_.emplace_back(new Parser(*this));
+      Parser *helper = helpers_.back().get();
+      workers.emplace_back([&, helper]()
+      {
+         for (size_t i; (i = next++) < n && i < first_error;)
+         {
+            try
+            {
+               helper->parse_body(bodies_[i], i);
+            }
+            catch (const CompileError &e)
+            {
+               errors[i] = e;
+               failed[i] = 1;
+               size_t first = first_error;
+               while (i < first && !first_error.compare_exchange_weak(first, i));
+            }
+         }
+      });
+   }
+   for each (auto &w in workers)
+      w.join();
+   for (size_t i = 0; i < n; ++i)
+      if (failed[i])
+         throw errors[i];
+
+   for each (auto &body in bodies_)
+   {
+      body.doubles = double_count_;
+      body.strings = string_count_;
+      number_consts(body.double_consts, body.doubles_end, double_count_);
+      number_consts(body.string_consts, body.strings_end, string_count_);
+      body.doubles_end = double_count_;
+      body.strings_end = string_count_;
+      for each (auto s in body.uses)
+         s->set_used();
+   }
+}
+
+//What the code of a procedure depends on: its tokens from the declaration on, the numbers
+//its constants start from, and the layout of its locals and of the symbols it uses.
+unsigned long long Parser::code_key(const ProcBody &body, bool opt)
+{
+   int numbers[] = {body.doubles, body.strings, opt};
+   unsigned long long hash = scan_.hash_tokens(body.head, body.end, fnv1a(numbers, sizeof(numbers)));
+   for each (const auto &it in body.locals->in_order())
+      hash = hash_signature(it.second, hash);
+   for each (auto s in body.uses)
+      hash = hash_signature(s, hash);
+   return hash;
+}
+
+//Numbers the constants kept for a body after the total made before it and enters them.
+void Parser::number_consts(const std::vector<SymConst *> &consts, int count, int &total)
+{
+   for (size_t k = 0; k < consts.size(); ++k)
+      if (consts[k])
+      {
+         consts[k]->set_number(total + (int)k + 1);
+         declare_const(consts[k]);
+      }
+   total += count;
 }
@@ -2,53 +2,116 @@
 #ifndef COMPILER_PARSER_H_
 #define COMPILER_PARSER_H_
 #include "statement.h"
+#include "arena.h"
+#include "codecache.h"
 #include <sstream>
 
+//A procedure body kept to be parsed on its own, again in watch mode or on another thread:
+//its tokens from "begin" to just past the closing ";", where its declaration starts, the
+//constant counters around it and what it used. A body parsed on another thread holds the
+//constants it made, by their number within the body, until the bodies before it are counted.
+struct ProcBody
+{
+   SymProc *proc;
+   SymTable *locals;
+   size_t head, begin, end;
+   int doubles, strings, doubles_end, strings_end;
+   std::vector<Symbol *> uses;
+   std::vector<SymConst *> double_consts, string_consts;
+   ProcBody(SymProc *p, SymTable *l): proc(p), locals(l), head(0), begin(0), end(0), doubles(0), strings(0), doubles_end(0), strings_end(0) {}
+};
+
+//Where the code of a table entry lies in the generator and its text.
+struct CodeRange
+{
+   std::list<Instruction>::iterator first, last;
+   std::string text;
+};
+
 class Parser
 {
-   Scanner scan_;
-   std::ofstream &output_;
-   std::shared_ptr<SymTable> table_;
+   Arena own_arena_;
+   //The tree, symbols and types go to the caller's arena when there is one.
+   Arena &arena_;
+   std::unique_ptr<Scanner> reader_;
+   Scanner &scan_;
+   std::ostream &output_;
+   SymTable *table_;
+   SymType *int_type_, *double_type_;
    int double_count_, string_count_;
+   bool incremental_, newly_used_, deferred_;
+   unsigned threads_;
+   size_t order_;
+   std::vector<ProcBody> bodies_;
+   std::vector<Symbol *> *uses_;
+   std::unordered_map<const std::string *, size_t> declared_;
+   std::string head_;
+   std::map<std::string, CodeRange> code_;
+   Parser *owner_;
+   ProcBody *body_;
+   CodeCache *cache_;
+   std::vector<std::unique_ptr<Parser>> helpers_;
 
-   std::string get_message(const std::shared_ptr<Symbol> &t);
-   std::shared_ptr<Expr> constant_folding(const std::shared_ptr<Expr> &e1, const std::shared_ptr<Expr> &e2, int sign, bool is_unary = false);
-   void type_match_error(const std::shared_ptr<SymType> &t1, const std::shared_ptr<SymType> &t2, size_t line);
-   void is_type_equals(const std::shared_ptr<Expr> &e1, const std::shared_ptr<Expr> &e2, size_t line, bool is_arithmetic = false);
+   Parser(Parser &owner);
+
+   void use(Symbol *s);
+   void declare(SymTable *table, const std::string *key, Symbol *s);
+   Symbol *find(SymTable *sym_table, const Token &ident);
+   bool regenerate(const std::string &name, const std::shared_ptr<Generator> &gen);
+   bool reparse(ProcBody &body, long shift);
+   void skip_body();
+   void parse_body(ProcBody &body, size_t order);
+   void parse_bodies();
+   void number_consts(const std::vector<SymConst *> &consts, int count, int &total);
+   unsigned long long code_key(const ProcBody &body, bool opt);
+
+   std::string get_message(Symbol *t);
+   Expr *constant_folding(Expr *e1, Expr *e2, int sign, bool is_unary = false);
+   SymConst *make_const(int num, const std::string &value, SymType *type);
+   void declare_const(SymConst *c);
+   void erase_double();
+   void type_match_error(SymType *t1, SymType *t2, size_t line);
+   void is_type_equals(Expr *e1, Expr *e2, size_t line, bool is_arithmetic = false);
    void logical_op_error(const Token &op);
-   void make_node(std::shared_ptr<Expr> &left, const std::shared_ptr<Expr> &right, const Token &op);
-   void parse_stmt_and_push_to_block(const std::shared_ptr<SymTable> &sym_table, const std::shared_ptr<Block> &block, LexemeType type);
-
-   std::shared_ptr<Expr> parse_expr(const std::shared_ptr<SymTable> &sym_table);
-   std::shared_ptr<Expr> parse_term(const std::shared_ptr<SymTable> &sym_table);
-   std::shared_ptr<Expr> parse_factor(const std::shared_ptr<SymTable> &sym_table);
-   std::shared_ptr<Expr> parse_unary(const std::shared_ptr<SymTable> &sym_table);
-   std::shared_ptr<Expr> parse_rel(const std::shared_ptr<SymTable> &sym_table);
-   std::shared_ptr<Expr> parse_assignment(const Token &ident, const std::shared_ptr<SymTable> &sym_table);
-   std::shared_ptr<Expr> parse_ident(std::shared_ptr<Symbol> ident, const std::shared_ptr<SymTable> &sym_table, const std::shared_ptr<SymTable> &param_table, bool is_par = false);
-   std::shared_ptr<Expr> parse_function_call(const Token &ident, const std::shared_ptr<SymTable> &sym_table);
-
-   std::shared_ptr<Statement> parse_block(const std::shared_ptr<SymTable> &sym_table);
-   std::shared_ptr<Statement> parse_stmt(const std::shared_ptr<SymTable> &sym_table);
-   std::shared_ptr<Statement> parse_while(const std::shared_ptr<SymTable> &sym_table);
-   std::shared_ptr<Statement> parse_repeat(const std::shared_ptr<SymTable> &sym_table);
-   std::shared_ptr<Statement> parse_if(const std::shared_ptr<SymTable> &sym_table);
-   std::shared_ptr<Statement> parse_for(const std::shared_ptr<SymTable> &sym_table);   
-   std::shared_ptr<Statement> parse_write_read(const Token &ident, const std::shared_ptr<SymTable> &sym_table);
-
-   std::shared_ptr<SymType> parse_type();
+   void make_node(Expr *&left, Expr *right, const Token &op);
+
+   Expr *parse_binary(SymTable *sym_table, int min_level);
+   Expr *parse_expr(SymTable *sym_table);
+   Expr *parse_factor(SymTable *sym_table);
+   Expr *parse_unary(SymTable *sym_table);
+   Expr *parse_rel(SymTable *sym_table);
+   Expr *parse_assignment(const Token &ident, SymTable *sym_table);
+   Expr *parse_ident(Symbol *ident, SymTable *sym_table, SymTable *param_table, bool is_par = false);
+   Expr *parse_function_call(const Token &ident, SymTable *sym_table);
+
+   Statement *parse_block(SymTable *sym_table);
+   Block *parse_stmt_list(SymTable *sym_table, LexemeType type);
+   Statement *parse_stmt(SymTable *sym_table);
+   Statement *parse_while(SymTable *sym_table);
+   Statement *parse_repeat(SymTable *sym_table);
+   Statement *parse_if(SymTable *sym_table);
+   Statement *parse_for(SymTable *sym_table);   
+   Statement *parse_write_read(const Token &ident, SymTable *sym_table);
+
+   SymType *parse_type();
    void parse_declaration();
    void parse_type_declaration();
-   int parse_var_decalration(const std::shared_ptr<SymTable> &sym_table, bool is_proc);
-   std::list<std::shared_ptr<SynVar>> parse_params(const std::shared_ptr<SymTable> &sym_table, int &os);
+   int parse_var_decalration(SymTable *sym_table, bool is_proc);
+   NodeList<SynVar *> parse_params(SymTable *sym_table, int &os);
    
    
 public:
-   Parser(Scanner &s, std::ofstream &o);
+   Parser(Scanner &s, std::ostream &o, bool incremental = false, unsigned threads = 1, Arena *arena = nullptr);
    ~Parser() {}
-   std::shared_ptr<SynObj> parse();
+   //Procedure code is taken from the cache and kept in it; the source has to be lexed first.
+   void set_cache(CodeCache *cache) { cache_ = cache; }
+   SynObj *parse();
    void print_table();
-   void generate(const std::shared_ptr<Generator> &gen);
+   void generate(const std::shared_ptr<Generator> &gen, bool opt = false);
+   //The IR -o selects code from, for the main program and every used procedure.
+   void print_ir(std::ostream &output);
+   bool update(const TokenEdit &edit, const std::shared_ptr<Generator> &gen);
+   void write_to_file(std::ostream &output);
 };
 
 #endif
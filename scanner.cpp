@@ -1,5 +1,11 @@
 #include "scanner.h"
+#include "charscan.h"
+#include "hash.h"
+#include <cmath>
+#include <thread>
 #include <algorithm>
+#include <memory>
+#include <cstring>
 
 const Token &Scanner::get() const
 {
@@ -16,553 +22,952 @@ bool Scanner::operator !=(int t)
    return current_.type() != t;
 }
 
+//The lexer of a pipeline and the parser share the pool of the scanner the parser reads.
+struct Scanner::Pipe
+{
+   TokenRing ring;
+   std::unique_ptr<Scanner> lexer;
+   std::mutex strings_lock;
+   std::thread thread;
+};
+
+Scanner::Scanner(FILE *inp): eof_(false), state_(0), line_(1), col_(1), strings_(&pool_), strings_lock_(nullptr), isread_(false),
+   stream_(&tokens_), cursor_(0), batched_(false), tokenizing_(false), piped_end_(false)
+{
+   read_file(inp);
+}
+
+void Scanner::read_file(FILE *inp)
+{
+   _fseeki64(inp, 0, SEEK_END);
+   buffer_.resize((size_t)_ftelli64(inp));
+   _fseeki64(inp, 0, SEEK_SET);
+   buffer_.resize(fread(buffer_.data(), 1, buffer_.size(), inp));
+   pos_ = buffer_.data();
+   end_ = pos_ + buffer_.size();
+}
+
+Scanner::Scanner(const char *begin, const char *end):
+   pos_(begin), end_(end), eof_(false), state_(0), line_(1), col_(1), strings_(&pool_), strings_lock_(nullptr), isread_(false),
+   stream_(&tokens_), cursor_(0), batched_(false), tokenizing_(false), piped_end_(false) {}
+
+//Reads the tokens of a scanner that has lexed them all, from token position on, as one
+//parser thread among several.
+Scanner::Scanner(const Scanner &source, size_t position):
+   pos_(nullptr), end_(nullptr), eof_(true), state_(0), line_(1), col_(1), strings_(&pool_), strings_lock_(nullptr), isread_(false),
+   stream_(source.stream_), cursor_(position), batched_(true), tokenizing_(false),
+   lex_error_(source.lex_error_), lex_error_token_(source.lex_error_token_), piped_end_(false) {}
+
+Scanner::~Scanner()
+{
+   if (pipe_)
+   {
+      pipe_->ring.stop();
+      pipe_->thread.join();
+   }
+}
+
+char Scanner::read_char()
+{
+   if (pos_ == end_)
+   {
+      eof_ = true;
+      return EOF;
+   }
+   return *pos_++;
+}
+
+void Scanner::unread_char()
+{
+   if (eof_)
+      eof_ = false;
+   else
+      --pos_;
+}
+
+void Scanner::skip_blank_run()
+{
+   if (pos_ == end_ || (*pos_ != ' ' && *pos_ != '\t' && *pos_ != '\n'))
+      return;
+   size_t newlines = 0;
+   const char *line_start = nullptr;
+   const char *p = skip_blanks(pos_, end_, newlines, line_start);
+   if (newlines)
+   {
+      line_ += newlines;
+      col_ = 1 + (p - line_start);
+   }
+   else
+      col_ += p - pos_;
+   pos_ = p;
+}
+
+const std::string *Scanner::intern(const std::string &s)
+{
+   if (strings_lock_ == nullptr)
+      return strings_->intern(s);
+   std::lock_guard<std::mutex> lock(*strings_lock_);
+   return strings_->intern(s);
+}
+
 int Scanner::is_eof() const
 {
-   return feof(input_);
+   if (pipe_)
+      return piped_end_ && pipe_->lexer->lex_error_.empty();
+   if (batched_)
+      return cursor_ >= stream_->size() && lex_error_.empty();
+   return eof_;
+}
+
+struct DeferredError {};
+
+//Errors are thrown, never written out here: whoever compiles writes the text where the
+//output would have gone, or reads where and what the error is.
+void Scanner::fail(const Diagnostic &where, const std::string &text)
+{
+   CompileError e = {text, where};
+   throw e;
 }
 
 void Scanner::error(const std::string &mes, const Token &token1, const Token &token2, int code)
 {
+   if (tokenizing_)
+   {
+      lex_error_ = mes;
+      lex_error_token_ = token1;
+      throw DeferredError();
+   }
+   std::ostringstream text;
+   Diagnostic where = {0, 0, ""};
    switch (code)
    {
    case 0:
-      output_ << "Error at line " << token1.get_line() << ", col " << token1.get_col();
-      output_ << ": " << mes << "-- \"" << token1.get_string().c_str() << "\"" << std::endl;
+      where.line = token1.get_line();
+      where.col = token1.get_col();
+      where.message = mes + "-- \"" + token1.get_string().c_str() + "\"";
+      text << "Error at line " << where.line << ", col " << where.col << ": " << where.message << std::endl;
       break;
    case 1:
-      output_ << "Error at line " << token2.get_line() << ": Expected " << "\"";
-      output_ << token1.get_string().c_str() << "\" but was \"" << token2.get_string().c_str() << "\"";
+      where.line = token2.get_line();
+      where.col = token2.get_col();
+      where.message = "Expected \"" + std::string(token1.get_string().c_str()) + "\" but was \"" + token2.get_string().c_str() + "\"";
+      text << "Error at line " << where.line << ": " << where.message;
       break;
    }
-   exit(0);
+   fail(where, text.str());
 }
 
 void Scanner::type_match_error(const std::string &t1, const std::string &t2, size_t line)
 {
-   output_ << "Error at line " << line << ": impossible type conversion from " << t2 << " to " << t1;
-   exit(0);
+   Diagnostic where = {line, 0, "impossible type conversion from " + t2 + " to " + t1};
+   std::ostringstream text;
+   text << "Error at line " << line << ": " << where.message;
+   fail(where, text.str());
 }
 
 void Scanner::require_token(LexemeType t, const std::string &s)
 {
    if (*this != t)
-      error("Expected ", Token(t, s), get(), 1);
+      error("Expected ", Token(t, intern(s)), get(), 1);
    next();
 }
 
-LexemeType set_type_keyword(const std::string &s)
-{
-   if (s == "and")
-      return and_op; 
-   if (s == "or")
-      return or_op; 
-   if (s == "xor")
-      return xor_op; 
-   if (s == "div")
-      return div_op; 
-   if (s == "mod")
-      return mod_op; 
-   if (s == "not")
-      return not_op; 
-   if (s == "begin")
-      return begin_stmt;
-   if (s == "end")
-      return end_stmt;
-   if (s == "if")
-      return if_stmt;
-   if (s == "for")
-      return for_stmt;
-   if (s == "while")
-      return while_stmt;
-   if (s == "repeat")
-      return repeat_stmt;
-   if (s == "write")
-      return write_stmt;
-   if (s == "writeln")
-      return writeln_stmt;
-   if (s == "read")
-      return read_stmt;
-   if (s == "readln")
-      return readln_stmt;
-   if (s == "break")
-      return break_stmt;
-   if (s == "continue")
-      return continue_stmt;
-   if (s == "do")
-      return do_stmt;
-   if (s == "until")
-      return until_stmt;
-   if (s == "then")
-      return then_stmt;
-   if (s == "else")
-      return else_stmt;
-   if (s == "to")
-      return to_stmt;
-   if (s == "downto")
-      return downto_stmt;
-   if (s == "var")
-      return var_decl;
-   if (s == "type")
-      return type_decl;
-   if (s == "function")
-      return function_decl;
-   if (s == "procedure")
-      return procedure_decl;
-   if (s == "integer")
-      return integer_decl;
-   if (s == "double")
-      return double_decl;
-   if (s == "array")
-      return array_decl;
-   if (s == "of")
-      return of_decl;
-   if (s == "record")
-      return rec_decl;
-   return id;
+void TokenStream::reserve(size_t n)
+{
+   kinds_.reserve(n);
+   keywords_.reserve(n);
+   strings_.reserve(n);
+   lines_.reserve(n);
+   cols_.reserve(n);
+   values_.reserve(n);
 }
 
+void TokenStream::resize(size_t n)
+{
+   kinds_.resize(n);
+   keywords_.resize(n);
+   strings_.resize(n);
+   lines_.resize(n);
+   cols_.resize(n);
+   values_.resize(n);
+}
+
+void TokenStream::copy(size_t at, const TokenStream &from, size_t count, size_t line_offset,
+                       const std::unordered_map<const std::string *, const std::string *> &strings)
+{
+   std::copy(from.kinds_.begin(), from.kinds_.begin() + count, kinds_.begin() + at);
+   std::copy(from.keywords_.begin(), from.keywords_.begin() + count, keywords_.begin() + at);
+   std::copy(from.cols_.begin(), from.cols_.begin() + count, cols_.begin() + at);
+   std::copy(from.values_.begin(), from.values_.begin() + count, values_.begin() + at);
+   for (size_t i = 0; i < count; ++i)
+   {
+      lines_[at + i] = from.lines_[i] ? from.lines_[i] + (unsigned)line_offset : 0;
+      auto s = strings.empty() ? strings.end() : strings.find(from.strings_[i]);
+      strings_[at + i] = s == strings.end() ? from.strings_[i] : s->second;
+   }
+}
+
+bool TokenStream::same(size_t i, const TokenStream &other, size_t j) const
+{
+   return kinds_[i] == other.kinds_[j] && strings_[i] == other.strings_[j] && cols_[i] == other.cols_[j] &&
+          keywords_[i] == other.keywords_[j];
+}
+
+template <class T>
+static void splice_array(std::vector<T> &to, size_t first, size_t last, const std::vector<T> &from)
+{
+   size_t n = from.size(), old = last - first;
+   if (n > old)
+      to.insert(to.begin() + last, n - old, T());
+   else
+      to.erase(to.begin() + first + n, to.begin() + last);
+   std::copy(from.begin(), from.end(), to.begin() + first);
+}
+
+void TokenStream::splice(size_t first, size_t last, const TokenStream &with, long line_shift)
+{
+   size_t tail = first + with.size();
+   splice_array(kinds_, first, last, with.kinds_);
+   splice_array(keywords_, first, last, with.keywords_);
+   splice_array(strings_, first, last, with.strings_);
+   splice_array(lines_, first, last, with.lines_);
+   splice_array(cols_, first, last, with.cols_);
+   splice_array(values_, first, last, with.values_);
+   if (line_shift)
+      for (size_t i = tail; i < lines_.size(); ++i)
+         if (lines_[i])
+            lines_[i] += (unsigned)line_shift;
+}
+
+void TokenStream::push(const Token &t)
+{
+   //NaN marks tokens without a cached number; their values come from the spelling.
+   double value = NAN, number;
+   int int_value;
+   if (t.type() == inum && parse_int(t.get_string(), int_value))
+      value = int_value;
+   else if (t.type() == dnum && parse_double(t.get_string(), number))
+      value = number;
+   kinds_.push_back((signed char)t.type());
+   keywords_.push_back(t.is_keyword());
+   strings_.push_back(&t.get_string());
+   lines_.push_back((unsigned)t.get_line());
+   cols_.push_back((unsigned)t.get_col());
+   values_.push_back(value);
+}
+
+bool Scanner::ended_clean(bool last) const
+{
+   return lex_error_.empty() && (last || col_ == 2);
+}
+
+//A split point is the start of a line that follows a plain statement line: one that
+//ends in ';' and has no quote, comment bracket or '/'. Such a line is unlikely to be
+//inside a comment or string, and it cannot end in a // comment, which leaves the
+//column running.
+static const char *split_point(const char *p, const char *end)
+{
+   p = find_char(p, end, '\n');
+   while (p != end)
+   {
+      const char *next = find_char(p + 1, end, '\n');
+      if (next == end)
+         return end;
+      const char *last = nullptr;
+      for (const char *c = p + 1; c < next; ++c)
+      {
+         if (*c == '/' || *c == '{' || *c == '}' || *c == '*' || *c == '\'' || *c == '\"')
+         {
+            last = nullptr;
+            break;
+         }
+         if (*c != ' ' && *c != '\t')
+            last = c;
+      }
+      if (last && *last == ';')
+         return next + 1;
+      p = next;
+   }
+   return end;
+}
+
+static std::vector<const char *> split(const char *begin, const char *end, size_t pieces)
+{
+   std::vector<const char *> bounds(1, begin);
+   for (size_t i = 1; i < pieces; ++i)
+   {
+      const char *b = split_point(std::max(bounds.back(), begin + (end - begin) * i / pieces), end);
+      if (b != end)
+         bounds.push_back(b);
+   }
+   bounds.push_back(end);
+   return bounds;
+}
+
+void Scanner::tokenize(unsigned threads, size_t min_chunk)
+{
+   size_t size = end_ - pos_;
+   if (threads > size / min_chunk)
+      threads = (unsigned)(size / min_chunk);
+   if (threads >= 2)
+   {
+      lex_chunks(split(pos_, end_, threads), threads);
+      return;
+   }
+   tokenizing_ = true;
+   tokens_.reserve(size / 4 + 1);
+   try
+   {
+      while (lex().type() != error_lex)
+         tokens_.push(current_);
+      tokens_.push(current_);
+   }
+   catch (const DeferredError &)
+   {
+   }
+   tokenizing_ = false;
+   batched_ = true;
+   cursor_ = 0;
+   segments_.assign(1, Segment{size, tokens_.size(), line_ - 1});
+}
+
+void Scanner::tokenize_for_edits(unsigned threads)
+{
+   const size_t segment_size = 1 << 16;
+   lex_chunks(split(pos_, end_, (end_ - pos_) / segment_size + 1), std::max(threads, 1u));
+}
+
+void Scanner::lex_chunks(const std::vector<const char *> &bounds, unsigned threads)
+{
+   //Every chunk after the first is lexed on the guess that it starts outside any
+   //comment or string, at column 1, and its lines are counted from 1.
+   size_t n = bounds.size() - 1;
+   std::vector<std::unique_ptr<Scanner>> chunks(n);
+   std::vector<std::thread> workers;
+   for (unsigned t = 0; t < threads && t < n; ++t)
+      workers.emplace_back([&, t]()
+      {
+         for (size_t i = t; i < n; i += threads)
+         {
+            chunks[i].reset(new Scanner(bounds[i], bounds[i + 1]));
+            chunks[i]->tokenize();
+         }
+      });
+   for each (auto &w in workers)
+      w.join();
+
+   //The guess for chunk i + 1 holds if chunk i ended at column 1 with no error. When it
+   //does not, chunk i is lexed again from its known line with the next chunk appended.
+   //A lexical error in the last chunk is real, but is lexed again for its line number.
+   std::vector<size_t> used, offsets, at;
+   std::vector<std::unordered_map<const std::string *, const std::string *>> moved;
+   size_t line = 0, count = 0;
+   segments_.clear();
+   for (size_t i = 0, j; i < n; i = j)
+   {
+      j = i + 1;
+      size_t offset = line;
+      while (!chunks[i]->ended_clean(j == n) && (j < n || offset))
+      {
+         if (j < n)
+            ++j;
+         chunks[i].reset(new Scanner(bounds[i], bounds[j]));
+         chunks[i]->line_ = line + 1;
+         chunks[i]->tokenize();
+         offset = 0;
+      }
+      Scanner &c = *chunks[i];
+      size_t tokens = j < n ? c.tokens_.size() - 1 : c.tokens_.size();
+      segments_.push_back(Segment{(size_t)(bounds[j] - bounds[i]), tokens, offset + c.line_ - 1 - line});
+      line = offset + c.line_ - 1;
+      used.push_back(i);
+      offsets.push_back(offset);
+      at.push_back(count);
+      moved.push_back(pool_.absorb(c.pool_));
+      count += tokens;
+      if (!c.lex_error_.empty())
+      {
+         const Token &t = c.lex_error_token_;
+         lex_error_ = c.lex_error_;
+         lex_error_token_ = Token(t.type(), intern(t.get_string()), t.get_line(), t.get_col(), t.is_keyword());
+      }
+   }
+
+   tokens_.resize(count);
+   workers.clear();
+   for (unsigned t = 0; t < threads && t < used.size(); ++t)
+      workers.emplace_back([&, t]()
+      {
+         for (size_t k = t; k < used.size(); k += threads)
+         {
+            const TokenStream &from = chunks[used[k]]->tokens_;
+            size_t len = (k + 1 < used.size() ? at[k + 1] : count) - at[k];
+            tokens_.copy(at[k], from, len, offsets[k], moved[k]);
+         }
+      });
+   for each (auto &w in workers)
+      w.join();
+   pos_ = end_;
+   eof_ = true;
+   batched_ = true;
+   cursor_ = 0;
+}
+
+bool Scanner::update(FILE *inp, TokenEdit &edit)
+{
+   std::vector<char> old;
+   old.swap(buffer_);
+   read_file(inp);
+   size_t old_size = old.size(), new_size = buffer_.size();
+   const size_t block = 4096;
+   size_t prefix = 0, suffix = 0, common = std::min(old_size, new_size);
+   while (prefix + block <= common && memcmp(old.data() + prefix, buffer_.data() + prefix, block) == 0)
+      prefix += block;
+   while (prefix < common && old[prefix] == buffer_[prefix])
+      ++prefix;
+   common -= prefix;
+   while (suffix + block <= common &&
+          memcmp(old.data() + old_size - suffix - block, buffer_.data() + new_size - suffix - block, block) == 0)
+      suffix += block;
+   while (suffix < common && old[old_size - suffix - 1] == buffer_[new_size - suffix - 1])
+      ++suffix;
+   edit.first = edit.old_end = edit.new_end = 0;
+   if (prefix == old_size && prefix == new_size)
+   {
+      pos_ = end_;
+      eof_ = true;
+      return true;
+   }
+   if (segments_.empty())
+      return false;
+
+   //The segments that hold the changed bytes are lexed again from the line they start
+   //on, growing the range until it ends in the same state the following segment assumed.
+   size_t damage_end = old_size - suffix, s0 = 0, byte0 = 0, token0 = 0, line0 = 0;
+   while (s0 + 1 < segments_.size() && byte0 + segments_[s0].bytes <= prefix)
+   {
+      byte0 += segments_[s0].bytes;
+      token0 += segments_[s0].tokens;
+      line0 += segments_[s0].lines;
+      ++s0;
+   }
+   size_t s1 = s0, byte1 = byte0 + segments_[s0].bytes, token1 = token0 + segments_[s0].tokens;
+   size_t old_lines = segments_[s0].lines;
+   while (s1 + 1 < segments_.size() && byte1 < damage_end)
+   {
+      ++s1;
+      byte1 += segments_[s1].bytes;
+      token1 += segments_[s1].tokens;
+      old_lines += segments_[s1].lines;
+   }
+   std::unique_ptr<Scanner> c;
+   for (;;)
+   {
+      bool last = s1 + 1 == segments_.size();
+      const char *end = buffer_.data() + byte1 + new_size - old_size;
+      c.reset(new Scanner(buffer_.data() + byte0, end));
+      c->line_ = line0 + 1;
+      c->tokenize();
+      //A pending lexical error further on would need its line moved, so it is lexed again.
+      bool shifted = !lex_error_.empty() && c->line_ - line0 - 1 != old_lines;
+      if (last || (c->ended_clean(false) && end[-1] == '\n' && !shifted))
+         break;
+      ++s1;
+      byte1 += segments_[s1].bytes;
+      token1 += segments_[s1].tokens;
+      old_lines += segments_[s1].lines;
+   }
+   bool last = s1 + 1 == segments_.size();
+   size_t count = last ? c->tokens_.size() : c->tokens_.size() - 1;
+   TokenStream fresh;
+   fresh.resize(count);
+   fresh.copy(0, c->tokens_, count, 0, pool_.absorb(c->pool_));
+
+   size_t same = 0, old_count = token1 - token0;
+   while (same < count && same < old_count && tokens_.same(token0 + same, fresh, same))
+      ++same;
+   size_t tail = 0;
+   while (tail < count - same && tail < old_count - same && tokens_.same(token1 - tail - 1, fresh, count - tail - 1))
+      ++tail;
+   edit.first = token0 + same;
+   edit.old_end = token1 - tail;
+   edit.new_end = token0 + count - tail;
+
+   size_t new_lines = c->line_ - line0 - 1;
+   tokens_.splice(token0, token1, fresh, (long)new_lines - (long)old_lines);
+   segments_.erase(segments_.begin() + s0 + 1, segments_.begin() + s1 + 1);
+   segments_[s0] = Segment{byte1 + new_size - old_size - byte0, count, new_lines};
+   if (last)
+   {
+      const Token &t = c->lex_error_token_;
+      lex_error_ = c->lex_error_;
+      lex_error_token_ = Token(t.type(), intern(t.get_string()), t.get_line(), t.get_col(), t.is_keyword());
+   }
+   pos_ = end_;
+   eof_ = true;
+   cursor_ = 0;
+   return true;
+}
+
+//Lexes the rest of the source on a thread of its own while the parser reads the tokens
+//from a ring. A lexical error is kept and raised when the parser reaches it, as it is
+//for a batch of tokens, so diagnostics do not change. Streaming scanners only.
+void Scanner::pipeline()
+{
+   if (batched_ || pipe_)
+      return;
+   pipe_.reset(new Pipe);
+   Scanner *lexer = new Scanner(pos_, end_);
+   pipe_->lexer.reset(lexer);
+   lexer->line_ = line_;
+   lexer->col_ = col_;
+   lexer->strings_ = strings_;
+   lexer->strings_lock_ = strings_lock_ = &pipe_->strings_lock;
+   lexer->tokenizing_ = true;
+   pos_ = end_;
+   eof_ = true;
+   pipe_->thread = std::thread([lexer, this]() { lexer->feed(pipe_->ring); });
+}
+
+//Runs on the lexer thread of a pipeline, up to the end of the source, the first error,
+//or the parser giving up.
+void Scanner::feed(TokenRing &ring)
+{
+   try
+   {
+      while (ring.push(lex()) && current_.type() != error_lex)
+         ;
+   }
+   catch (const DeferredError &)
+   {
+   }
+   ring.close();
+}
+
+const Token &Scanner::take()
+{
+   if (!piped_end_ && pipe_->ring.pop(current_))
+   {
+      piped_end_ = current_.type() == error_lex;
+      return current_;
+   }
+   piped_end_ = true;
+   const Scanner &lexer = *pipe_->lexer;
+   if (!lexer.lex_error_.empty())
+      error(lexer.lex_error_, lexer.lex_error_token_);
+   return current_;
+}
+
+//Waits, as the parser, until count tokens are in the ring or no more will come.
+bool TokenRing::wait_for(size_t count)
+{
+   size_t head = head_.load(std::memory_order_relaxed);
+   for (int spins = 0; tail_.load(std::memory_order_acquire) - head < count; ++spins)
+   {
+      if (closed_.load(std::memory_order_acquire))
+         return tail_.load(std::memory_order_acquire) - head >= count;
+      if (spins > 64)
+         std::this_thread::yield();
+   }
+   return true;
+}
+
+//False once the parser has stopped reading.
+bool TokenRing::push(const Token &t)
+{
+   size_t tail = tail_.load(std::memory_order_relaxed);
+   for (int spins = 0; tail - seen_head_ == capacity; ++spins)
+   {
+      if (stopped_.load(std::memory_order_acquire))
+         return false;
+      if (spins > 64)
+         std::this_thread::yield();
+      seen_head_ = head_.load(std::memory_order_acquire);
+   }
+   slots_[tail & (capacity - 1)] = t;
+   tail_.store(tail + 1, std::memory_order_release);
+   return true;
+}
+
+void TokenRing::close()
+{
+   closed_.store(true, std::memory_order_release);
+}
+
+//False when the ring is closed and empty.
+bool TokenRing::pop(Token &t)
+{
+   if (!wait_for(1))
+      return false;
+   size_t head = head_.load(std::memory_order_relaxed);
+   t = slots_[head & (capacity - 1)];
+   head_.store(head + 1, std::memory_order_release);
+   return true;
+}
+
+//The token k places after the next one, leaving it in the ring.
+bool TokenRing::peek(size_t k, Token &t)
+{
+   if (k > max_ahead || !wait_for(k + 1))
+      return false;
+   t = slots_[(head_.load(std::memory_order_relaxed) + k) & (capacity - 1)];
+   return true;
+}
+
+void TokenRing::stop()
+{
+   stopped_.store(true, std::memory_order_release);
+}
+
+void Scanner::seek(size_t i)
+{
+   cursor_ = i;
+}
+
+size_t Scanner::position() const
+{
+   return cursor_ - 1;
+}
+
+bool Scanner::lexed_clean() const
+{
+   return lex_error_.empty();
+}
+
+//Carries a hash on over the kinds and spellings of the tokens in [first, last) of a
+//lexed stream. Where the tokens are in the source does not count.
+unsigned long long Scanner::hash_tokens(size_t first, size_t last, unsigned long long hash) const
+{
+   for (size_t i = first; i < last && i < stream_->size(); ++i)
+   {
+      char kind = (char)stream_->kind(i);
+      const std::string &s = stream_->get(i).get_string();
+      hash = fnv1a(&kind, 1, hash);
+      hash = fnv1a(s.data(), s.size() + 1, hash);
+   }
+   return hash;
+}
+
+const Token &Scanner::next()
+{
+   if (pipe_)
+      return take();
+   if (!batched_)
+      return lex();
+   if (cursor_ < stream_->size())
+      return current_ = stream_->get(cursor_++);
+   if (!lex_error_.empty())
+      error(lex_error_, lex_error_token_);
+   return current_;
+}
+
+LexemeType Scanner::peek(size_t k) const
+{
+   Token ahead;
+   if (pipe_ && k)
+      return !piped_end_ && pipe_->ring.peek(k - 1, ahead) ? ahead.type() : error_lex;
+   if (!batched_)
+      return k ? error_lex : current_.type();
+   size_t i = cursor_ + k - 1;
+   return i < stream_->size() ? stream_->kind(i) : error_lex;
+}
+
+int Scanner::get_int_value() const
+{
+   if (batched_ && cursor_ && stream_->value(cursor_ - 1) == stream_->value(cursor_ - 1))
+      return (int)stream_->value(cursor_ - 1);
+   return current_.get_int_value();
+}
+
+double Scanner::get_double_value() const
+{
+   if (batched_ && cursor_ && stream_->value(cursor_ - 1) == stream_->value(cursor_ - 1))
+      return stream_->value(cursor_ - 1);
+   return current_.get_double_value();
+}
+
+struct CharTable
+{
+   unsigned char classes[256];
+   char lower[256];
+   constexpr CharTable(): classes(), lower()
+   {
+      for (int c = 0; c < 256; ++c)
+      {
+         lower[c] = (char)(c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c);
+         classes[c] = cc_other;
+         if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'))
+            classes[c] = c == 'e' || c == 'E' ? cc_exponent : cc_letter;
+         else if (c >= '0' && c <= '9')
+            classes[c] = cc_digit;
+      }
+      classes['_'] = cc_underscore;
+      classes[' '] = classes['\t'] = cc_blank;
+      classes['\n'] = cc_newline;
+      classes['.'] = cc_dot;
+      classes['='] = cc_equal;
+      classes['>'] = cc_greater;
+      classes['<'] = cc_lesser;
+      classes[':'] = cc_colon;
+      classes['+'] = cc_plus;
+      classes['-'] = cc_minus;
+      classes['*'] = cc_star;
+      classes['/'] = cc_slash;
+      classes['{'] = cc_curly_bracket;
+      classes['('] = cc_left_round;
+      classes[')'] = cc_right_round;
+      classes['['] = cc_left_square;
+      classes[']'] = cc_right_square;
+      classes[';'] = cc_semicolon;
+      classes[','] = cc_comma;
+      classes['\"'] = classes['\''] = cc_quotation;
+   }
+};
+
+struct Transition
+{
+   unsigned char action, state;
+   signed char type;
+};
+
+struct TransitionTable
+{
+   Transition table[states_count][classes_count];
+   LexemeType accept[states_count];
+   constexpr void set(States s, CharClasses c, Actions a, States next = start, LexemeType t = error_lex)
+   {
+      table[s][c].action = a;
+      table[s][c].state = next;
+      table[s][c].type = t;
+   }
+   constexpr void set(States s, CharClasses c, LexemeType t) { set(s, c, act_shift_emit, start, t); }
+   constexpr void set_default(States s, Actions a, LexemeType t = error_lex)
+   {
+      for (int c = 0; c < classes_count; ++c)
+         set(s, (CharClasses)c, a);
+      accept[s] = t;
+   }
+   constexpr TransitionTable(): table(), accept()
+   {
+      set_default(start, act_error_symbol);
+      set(start, cc_blank, act_skip);
+      set(start, cc_eof, act_skip);
+      set(start, cc_newline, act_newline);
+      set(start, cc_letter, act_shift, id_st);
+      set(start, cc_exponent, act_shift, id_st);
+      set(start, cc_digit, act_shift, numDigit);
+      set(start, cc_greater, act_shift, greaterOperator);
+      set(start, cc_lesser, act_shift, smallerOperator);
+      set(start, cc_colon, act_shift, assignmentOperator);
+      set(start, cc_slash, act_shift, slashComment);
+      set(start, cc_left_round, act_shift, commentRoundBracketBegin);
+      set(start, cc_curly_bracket, act_curly_comment);
+      set(start, cc_quotation, act_quotation);
+      set(start, cc_equal, equal);
+      set(start, cc_plus, plus_op);
+      set(start, cc_minus, minus_op);
+      set(start, cc_star, mul_op);
+      set(start, cc_dot, dot);
+      set(start, cc_left_square, left_square_paren);
+      set(start, cc_right_square, right_square_paren);
+      set(start, cc_right_round, right_round_paren);
+      set(start, cc_semicolon, semicolon);
+      set(start, cc_comma, comma);
+
+      set_default(id_st, act_emit, id);
+      set(id_st, cc_letter, act_shift, id_st);
+      set(id_st, cc_exponent, act_shift, id_st);
+      set(id_st, cc_digit, act_shift, id_st);
+      set(id_st, cc_underscore, act_shift, id_st);
+
+      set_default(numDigit, act_emit, inum);
+      set(numDigit, cc_digit, act_shift, numDigit);
+      set(numDigit, cc_dot, act_shift, numDot);
+
+      set_default(numDot, act_dot_error);
+      set(numDot, cc_digit, act_shift, numDigitAfterDot);
+      set(numDot, cc_dot, act_dot_dot);
+
+      set_default(numDigitAfterDot, act_emit, dnum);
+      set(numDigitAfterDot, cc_digit, act_shift, numDigitAfterDot);
+      set(numDigitAfterDot, cc_exponent, act_shift, numExponent);
+
+      set_default(numExponent, act_emit, dnum);
+      set(numExponent, cc_plus, act_shift, numSign);
+      set(numExponent, cc_minus, act_shift, numSign);
+      set(numExponent, cc_digit, act_shift, numDigitAfterExp);
+
+      set_default(numSign, act_emit, dnum);
+      set(numSign, cc_digit, act_shift, numDigitAfterExp);
+
+      set_default(numDigitAfterExp, act_emit, dnum);
+      set(numDigitAfterExp, cc_digit, act_shift, numDigitAfterExp);
+
+      set_default(greaterOperator, act_emit, greater);
+      set(greaterOperator, cc_equal, greater_equal);
+
+      set_default(smallerOperator, act_emit, lesser);
+      set(smallerOperator, cc_equal, lesser_equal);
+      set(smallerOperator, cc_greater, not_equal);
+
+      set_default(assignmentOperator, act_back_emit, colon);
+      set(assignmentOperator, cc_equal, assignment);
+
+      set_default(slashComment, act_back_emit, div_op);
+      set(slashComment, cc_slash, act_slash_comment);
+
+      set_default(commentRoundBracketBegin, act_back_emit, left_round_paren);
+      set(commentRoundBracketBegin, cc_star, act_round_comment);
+   }
+};
+
+static constexpr CharTable char_table;
+static constexpr TransitionTable transitions;
+
 const Token &Scanner::output(LexemeType type, std::string &chars, bool isread)
 {
-   std::transform(chars.begin(), chars.end(), chars.begin(), ::tolower);
    isread_ = isread;
    state_ = start;
    int t = (type == id  || type == inum || type == dnum || type == and_op || type == or_op || type == xor_op ||
            (type == div_op && chars != "/") || type == mod_op || type == not_op) ? 1 : 0;
    size_t column = t ? col_ - chars.size() - 1 : col_ - chars.size();
+   bool keyword = false;
    if (type == id)
-      type = set_type_keyword(chars);
-   return current_ = Token(type, chars, line_, column);
+   {
+      const Keyword *k = find_keyword(chars.data(), chars.size());
+      if (k)
+      {
+         type = k->type;
+         keyword = k->reserved;
+      }
+   }
+   return current_ = Token(type, intern(chars), line_, column, keyword);
 }
 
-const Token &Scanner::next()
+const Token &Scanner::lex()
 {
    std::string chars;
    char local_symbol;
-   
-   LexemeType t = id;
-   while (!feof(input_))
+
+   while (!eof_)
    {
       if (!isread_)
       {
          ++col_;
-         symbol_ = fgetc(input_);
+         symbol_ = read_char();
       }
       isread_ = false;
-      switch (state_)
+      const Transition &tr = transitions.table[state_][eof_ ? (unsigned char)cc_eof : char_table.classes[(unsigned char)symbol_]];
+      switch (tr.action)
       {
-         case start:
-         {
-            if (symbol_ == ' ' || symbol_ == '\n' || symbol_ == '\t')
-            {
-               if (symbol_ == '\n')
-               {
-                  ++line_;
-                  col_ = 1;
-               }
-               state_ = start; 
-            }
-            else if (!feof(input_))
-            {
-               isread_ = true;
-               state_ = id_1;
-            }
-            break;
-         }
-         case id_1: 
-         {
-            if (isalpha(symbol_))
-               state_ = id_2;
-            else
-            {
-               isread_ = true;
-               state_ = numDigit_1;
-            }
-            break;
-         }
-         case id_2:
-         {
-            if (isdigit(symbol_) || isalpha(symbol_) || symbol_ == '_')
-               state_ = id_2;
-            else
-            {
-               isread_ = true;
-               return output(id, chars, true);
-            }
-            break;
-         }
-         case numDigit_1:
-         {
-            if (isdigit(symbol_))
-               state_ = numDigit_2;
-            else
-            {
-               isread_ = true;
-               state_ = equal_st;
-            }
-            break;
-         }
-         case numDigit_2:
-         {
-            if (isdigit(symbol_))
-               state_ = numDigit_2;
-            else if (symbol_ == '.')
-               state_ = numDot;
-            else
-               return output(inum, chars, true);
-            break;
-         }
-         case numDot:
-         {
-            if (isdigit(symbol_))
-               state_ = numDigitAfterDot;
-            else if(symbol_ == '.')
-            {
-               symbol_ = chars[chars.length() - 1];
-               chars[chars.length() - 1] = '\0';
-               _fseeki64(input_, -1, SEEK_CUR);
-               return output(inum, chars, true);
-            }
-            else
-               error("Dot after int number", Token(error_lex, ""));
-            break;
-         }
-         case numDigitAfterDot:
-         {
-            if (isdigit(symbol_))
-               state_ = numDigitAfterDot;
-            else if (symbol_ == 'e' || symbol_ == 'E')
-               state_ = numExponent;
-            else
-               return output(dnum, chars, true);
-            break;
-         }
-         case numExponent:
-         {
-            if(symbol_ == '+' || symbol_ == '-')
-               state_ = numSign;
-            else if (isdigit(symbol_))
-               state_ = numDigitAfterExp;
-            else
-               return output(dnum, chars, true);
+         case act_shift:
+            chars += char_table.lower[(unsigned char)symbol_];
+            state_ = tr.state;
             break;
-         }
-         case numSign:
-         {
-            if (isdigit(symbol_))
-               state_ = numDigitAfterExp;
-            else
-               return output(dnum, chars, true);
-            break;
-         }
-         case numDigitAfterExp:
-         {
-            if (isdigit(symbol_))
-               state_ = numDigitAfterExp;
-            else
-               return output(dnum, chars, true);
-            break;
-         }
-         case equal_st:
-         {
-            if (symbol_ == '=')
-            {
-               chars += '=';
-               return output(equal, chars, false);
-            }
-            isread_ = true;
-            state_ = greaterOperator_1;
-            break;
-         }
-         case greaterOperator_1:
-         {
-            if (symbol_ == '>')
-               state_ = greaterOperator_2;
-            else
-            {
-               isread_ = true;
-               state_ = smallerOperator_1;
-            }
-            break;
-         }
-         case greaterOperator_2:
-         {
-            if (symbol_ == '=')
-               chars += '=';
-            else
-               isread_ = true;
-            return output(chars.size() == 2 ? greater_equal : greater, chars, isread_);
+         case act_skip:
+            skip_blank_run();
             break;
-         }
-         case smallerOperator_1:
-         {
-            if (symbol_ == '<')
-               state_ = smallerOperator_2;
-            else
-            {
-               isread_ = true;
-               state_ = comment;
-            }
-            break;
-         }
-         case smallerOperator_2:
-         {
-            t = id;
-            if (symbol_ == '=')
-            {
-               chars += '=';
-               t = lesser_equal;
-            }
-            else if  (symbol_ == '>')
-            {
-               chars += '>';
-               t = not_equal;
-            }
-            else
-               isread_ = true;
-            return output(t == id ? lesser : t, chars, isread_);
+         case act_newline:
+            ++line_;
+            col_ = 1;
+            skip_blank_run();
             break;
-         }
-         case assignmentOperator:
-         {
-            if (symbol_ == '=')
-            {
-               chars += '=';
-               return output(assignment, chars, false);
-            }
+         case act_emit:
+            return output(transitions.accept[state_], chars, true);
+         case act_shift_emit:
+            chars += symbol_;
+            return output((LexemeType)tr.type, chars, false);
+         case act_back_emit:
             --col_;
-            isread_ = true;
-            _fseeki64(input_, -1, SEEK_CUR);
-            symbol_ = local_symbol;
-            state_ = divider;
-            break;
-         }
-         case comment:
-         {
-            if (symbol_ == '{')
-               state_ = commentCurlyBrackets;
-            else if (symbol_ == '(')
-               state_ = commentRoundBracketBegin;
-            else if (symbol_ == '/')
-               state_ = slashComment;
-            else
-            {
-               isread_ = true;
-               state_ = arithmeticOperator;
-            }
+            unread_char();
+            return output(transitions.accept[state_], chars, false);
+         case act_dot_dot:
+            symbol_ = chars[chars.length() - 1];
+            chars[chars.length() - 1] = '\0';
+            unread_char();
+            return output(inum, chars, true);
+         case act_dot_error:
+            error("Dot after int number", Token(error_lex, intern("")));
             break;
-         }
-         case commentCurlyBrackets:
+         case act_curly_comment:
          {
-            if(symbol_ != '}')
+            ++col_;
+            if (read_char() != '}')
             {
                size_t l = line_, c = col_ - 2;
-               local_symbol = fgetc(input_);
-               while (local_symbol != '}')
+               const char *close = find_char(pos_, end_, '}');
+               if (close == end_)
                {
-                  if (feof(input_))
-                     error("found unclosed comment ", Token(error_lex, "{", l, c));
-                  local_symbol = fgetc(input_);
-                  ++col_;
+                  pos_ = end_;
+                  eof_ = true;
+                  error("found unclosed comment ", Token(error_lex, intern("{"), l, c));
                }
+               col_ += close - pos_;
+               pos_ = close + 1;
             }
-            symbol_ = ' ';
-            isread_ = true;
-            state_ = start;
             break;
          }
-         case commentRoundBracketBegin:
+         case act_round_comment:
          {
-            if (symbol_ == '*')
-               state_ = commentRoundBracketEnd;
-            else
-            {
-               --col_;
-               _fseeki64(input_, -1, SEEK_CUR);
-               symbol_ = chars[chars.length() - 1];
-               isread_ = true;
-               state_ = divider;
-            }
-            break;
-         }
-         case commentRoundBracketEnd:
-         {
-            char local_chars[2];
-            size_t l = line_, c = col_ - 3;
-            local_chars[0] = symbol_;
-            local_chars[1] = fgetc(input_);
-            ++col_;
-            if (local_chars[0] == '\n')
-               ++line_;
-            if (local_chars[1] == '\n')
-               ++line_;
-            while (local_chars[0] != '*' || local_chars[1] != ')')
+            size_t l = line_, c = col_ - 2;
+            const char *close = pos_;
+            do
+               close = find_char(close, end_, ')') + 1;
+            while (close <= end_ && (close - pos_ < 2 || close[-2] != '*'));
+            if (close > end_)
             {
-               if(feof(input_))
-                  error("found unclosed comment", Token(error_lex, "(*", l, c));
-               local_chars[0] = local_chars[1];
-               local_chars[1] = fgetc(input_);
-               ++col_;
-               if (local_chars[1] == '\n')
-                  ++line_;
+               pos_ = end_;
+               eof_ = true;
+               error("found unclosed comment", Token(error_lex, intern("(*"), l, c));
             }
+            line_ += count_char(pos_, close, '\n');
+            col_ += close - pos_;
+            pos_ = close;
+            chars.clear();
             state_ = start;
             break;
          }
-         case slashComment:
-         {
-            if (symbol_ == '/')
-            {
-               local_symbol = fgetc(input_);
-
-               while(local_symbol != '\n' && !feof(input_))
-               {
-                  local_symbol = fgetc(input_);
-                  ++col_;
-               }
-               ++line_;
-               state_ = start;
-            }
-            else
-            {
-               --col_;
-               _fseeki64(input_, -1, SEEK_CUR);
-               symbol_ = chars[chars.length() - 1];
-               isread_ = true;
-               state_ = arithmeticOperator;
-            }
-            break;
-         }
-         case arithmeticOperator:
+         case act_slash_comment:
          {
-            if (symbol_ == '+' || symbol_ == '-' || symbol_ == '*' || symbol_ == '/')
-            {
-               chars += symbol_;
-               t = id;
-               switch (symbol_)
-               {
-                  case '+': 
-                  {
-                     t = plus_op;
-                     break;
-                  }
-                  case '-': 
-                  {
-                     t = minus_op;
-                     break;
-                  }
-                  case '*': 
-                  {
-                     t = mul_op;
-                     break;
-                  }
-                  case '/': 
-                  {
-                     t = div_op;
-                     break;
-                  }
-               }
-               return output(t, chars, false);
-            }
-            if (symbol_ == ':')
+            const char *eol = find_char(pos_, end_, '\n');
+            col_ += eol - pos_;
+            if (eol == end_)
             {
-               local_symbol = symbol_;
-               state_ = assignmentOperator;
+               pos_ = end_;
+               eof_ = true;
             }
             else
-            {
-               isread_ = true;
-               state_ = divider;
-            }
-            break;
-         }
-         case divider:
-         {
-            if (symbol_ == '[' || symbol_ == ']' || symbol_ == '(' || symbol_ == ')' ||
-               symbol_ == ';' || symbol_ == '.' || symbol_ == ',' || symbol_ == ':')
-            {
-               chars += symbol_;
-               t = id;
-               switch(symbol_)
-               {
-                  case '[': 
-                  {
-                     t = left_square_paren;
-                     break;
-                  }
-                  case ']':
-                  {
-                     t = right_square_paren;
-                     break;
-                  }
-                  case '(': 
-                  {
-                     t = left_round_paren;
-                     break;
-                  }
-                  case ')':
-                  {
-                     t = right_round_paren;
-                     break;
-                  }
-                  case ';':
-                  {
-                     t = semicolon;
-                     break;
-                  }
-                  case '.':
-                  {
-                     t = dot;
-                     break;
-                  }
-                  case ',':
-                  {
-                     t = comma;
-                     break;
-                  }
-                  case ':': 
-                  {
-                     t = colon;
-                     break;
-                  }
-               }
-               return output(t, chars, false);
-            }
-            isread_ = true;
-            state_ = quotation;
+               pos_ = eol + 1;
+            ++line_;
+            chars.clear();
+            state_ = start;
             break;
          }
-         case quotation:
+         case act_quotation:
          {
-            if (symbol_ == '\"' || symbol_ == '\'')
+            size_t l = line_, c = col_ - 2;
+            local_symbol = read_char();
+            ++col_;
+            chars += symbol_;
+            while (local_symbol != '\"' && local_symbol != '\'')
             {
-               size_t l = line_, c = col_ - 2;
-               local_symbol = fgetc(input_);
+               if (eof_)
+                  error("Found unclosed quotation ", Token(strng, intern(std::string(1, symbol_)), l, c));
+               chars += char_table.lower[(unsigned char)local_symbol];
+               local_symbol = read_char();
                ++col_;
-               chars += symbol_;
-               while (local_symbol != '\"' && local_symbol != '\'')
-               {
-                  if (feof(input_))
-                     error("Found unclosed quotation ", Token(strng, &symbol_, l, c));
-                  chars += local_symbol;
-                  local_symbol = fgetc(input_);
-                  ++col_;
-               }
-               chars += symbol_;
-               return output(strng, chars, false);
             }
-            state_ = errorSymbol;
-            break;
+            chars += symbol_;
+            return output(strng, chars, false);
          }
-         case errorSymbol: 
+         case act_error_symbol:
          {
-            error("Undefined symbol ", Token(error_lex, &symbol_));
+            ++col_;
+            symbol_ = read_char();
+            error("Undefined symbol ", Token(error_lex, intern(std::string(1, symbol_))));
             break;
          }
       }
-      if (isread_) 
-         chars = "";
-      else
-         chars += symbol_;
    }
-   return current_ = Token(error_lex, "", 0);
-}
\ No newline at end of file
+   return current_ = Token(error_lex, intern(""), 0);
+}
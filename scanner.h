@@ -1,37 +1,162 @@
 #pragma once
 #ifndef COMPILER_SCANNER_H_
 #define COMPILER_SCANNER_H_
+#include <vector>
+#include <sstream>
+#include <atomic>
+#include <mutex>
+#include <memory>
 #include "token.h"
 
 enum States 
 {
-   start, greaterOperator_1, smallerOperator_1, greaterOperator_2, smallerOperator_2,
-   divider, id_1, id_2, numDigit_1, numDigit_2, numDot, numDigitAfterDot,
-   numExponent, numSign, numDigitAfterExp, equal_st, slashComment,
-   arithmeticOperator, assignmentOperator, comment, commentCurlyBrackets,
-   commentRoundBracketBegin, commentRoundBracketEnd, errorSymbol, quotation,
+   start, id_st, numDigit, numDot, numDigitAfterDot, numExponent, numSign, numDigitAfterExp,
+   greaterOperator, smallerOperator, assignmentOperator, slashComment, commentRoundBracketBegin, states_count,
+};
+
+enum CharClasses
+{
+   cc_other, cc_blank, cc_newline, cc_letter, cc_exponent, cc_digit, cc_underscore, cc_dot, cc_equal,
+   cc_greater, cc_lesser, cc_colon, cc_plus, cc_minus, cc_star, cc_slash, cc_curly_bracket, cc_left_round,
+   cc_right_round, cc_left_square, cc_right_square, cc_semicolon, cc_comma, cc_quotation, cc_eof, classes_count,
+};
+
+enum Actions
+{
+   act_shift, act_skip, act_newline, act_emit, act_shift_emit, act_back_emit, act_dot_dot, act_dot_error,
+   act_curly_comment, act_round_comment, act_slash_comment, act_quotation, act_error_symbol,
+};
+
+class TokenStream
+{
+   std::vector<signed char> kinds_;
+   std::vector<char> keywords_;
+   std::vector<const std::string *> strings_;
+   std::vector<unsigned> lines_, cols_;
+   std::vector<double> values_;
+public:
+   void reserve(size_t n);
+   void resize(size_t n);
+   void push(const Token &t);
+   void copy(size_t at, const TokenStream &from, size_t count, size_t line_offset,
+             const std::unordered_map<const std::string *, const std::string *> &strings);
+   void splice(size_t first, size_t last, const TokenStream &with, long line_shift);
+   bool same(size_t i, const TokenStream &other, size_t j) const;
+   Token get(size_t i) const { return Token((LexemeType)kinds_[i], strings_[i], lines_[i], cols_[i], keywords_[i] != 0); }
+   LexemeType kind(size_t i) const { return (LexemeType)kinds_[i]; }
+   double value(size_t i) const { return values_[i]; }
+   size_t size() const { return kinds_.size(); }
+};
+
+//A run of source lexed as a unit: its length in bytes, tokens and lines.
+struct Segment
+{
+   size_t bytes, tokens, lines;
+};
+
+//Tokens [first, old_end) of the previous stream became [first, new_end).
+struct TokenEdit
+{
+   size_t first, old_end, new_end;
+};
+
+//Where an error is and what it is. col is 0 when only the line is known.
+struct Diagnostic
+{
+   size_t line, col;
+   std::string message;
+};
+
+//Thrown on the first error; message is the text the compiler writes for it.
+struct CompileError
+{
+   std::string message;
+   Diagnostic where;
+};
+
+//A bounded ring that carries tokens from one lexing thread to one parsing thread. Neither
+//side locks: each moves only its own index and reads the other's, and waits by yielding.
+class TokenRing
+{
+   static const size_t capacity = 1 << 12;
+   std::vector<Token> slots_;
+   alignas(64) std::atomic<size_t> head_;
+   alignas(64) std::atomic<size_t> tail_;
+   size_t seen_head_;
+   std::atomic<bool> closed_, stopped_;
+   bool wait_for(size_t count);
+public:
+   //Lookahead may see this many tokens past the next one.
+   static const size_t max_ahead = capacity - 1;
+   TokenRing(): slots_(capacity), head_(0), tail_(0), seen_head_(0), closed_(false), stopped_(false) {}
+   bool push(const Token &t);
+   void close();
+   bool pop(Token &t);
+   bool peek(size_t k, Token &t);
+   void stop();
 };
 
 class Scanner
 {
-   FILE *input_;
-   std::ofstream &output_;
+   struct Pipe;
+   std::vector<char> buffer_;
+   const char *pos_, *end_;
+   bool eof_;
    char symbol_;
    int state_;
    size_t line_, col_;
    Token current_;
+   StringPool pool_;
+   StringPool *strings_;
+   std::mutex *strings_lock_;
    bool isread_;
+   TokenStream tokens_;
+   const TokenStream *stream_;
+   size_t cursor_;
+   bool batched_, tokenizing_;
+   std::string lex_error_;
+   Token lex_error_token_;
+   std::vector<Segment> segments_;
+   std::unique_ptr<Pipe> pipe_;
+   bool piped_end_;
+   void read_file(FILE *inp);
+   void lex_chunks(const std::vector<const char *> &bounds, unsigned threads);
    const Token &output(LexemeType type, std::string &chars, bool isread);
+   const Token &lex();
+   bool ended_clean(bool last) const;
+   char read_char();
+   void unread_char();
+   void skip_blank_run();
+   void feed(TokenRing &ring);
+   const Token &take();
 public:
-   Scanner(FILE *inp, std::ofstream &out): input_(inp), output_(out), state_(0), line_(1), col_(1), isread_(false) {}
+   explicit Scanner(FILE *inp);
+   Scanner(const char *begin, const char *end);
+   Scanner(const Scanner &source, size_t position);
    const Token &get() const;
    const Token &next();
+   //Chunks shorter than min_chunk bytes are not worth a thread of their own.
+   static const size_t default_chunk = 1 << 18;
+   void tokenize(unsigned threads = 1, size_t min_chunk = default_chunk);
+   void tokenize_for_edits(unsigned threads = 1);
+   bool update(FILE *inp, TokenEdit &edit);
+   void pipeline();
+   void seek(size_t i);
+   size_t position() const;
+   bool lexed_clean() const;
+   unsigned long long hash_tokens(size_t first, size_t last, unsigned long long hash) const;
+   LexemeType peek(size_t k = 1) const;
+   int get_int_value() const;
+   double get_double_value() const;
+   const std::string *intern(const std::string &s);
    int is_eof() const;
    bool operator ==(int t);
    bool operator !=(int t);
+   bool is_batched() const { return batched_; }
+   void fail(const Diagnostic &where, const std::string &text);
    void error(const std::string &mes, const Token &token1, const Token &token2 = Token(), int code = 0);
    void type_match_error(const std::string &t1, const std::string &t2, size_t line);
    void require_token(LexemeType t, const std::string &s);
-   ~Scanner() {}
+   ~Scanner();
 };
 #endif
\ No newline at end of file
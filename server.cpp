@@ -0,0 +1,349 @@
+#include "server.h"
+#include "batch.h"
+#include "hash.h"
+#include <thread>
+#ifdef _WIN32
+#include <winsock2.h>
+#include <afunix.h>
+#pragma comment(lib, "ws2_32.lib")
+typedef SOCKET socket_t;
+#define close_socket closesocket
+#define SHUT_RDWR SD_BOTH
+#else
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+typedef int socket_t;
+static const socket_t INVALID_SOCKET = -1;
+#define close_socket close
+#endif
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+static bool start_sockets()
+{
+#ifdef _WIN32
+   WSADATA data;
+   return WSAStartup(MAKEWORD(2, 2), &data) == 0;
+#else
+   return true;
+#endif
+}
+
+static bool socket_address(const std::string &path, sockaddr_un &address)
+{
+   memset(&address, 0, sizeof(address));
+   if (path.size() >= sizeof(address.sun_path))
+      return false;
+   address.sun_family = AF_UNIX;
+   memcpy(address.sun_path, path.c_str(), path.size());
+   return true;
+}
+
+static socket_t connect_to(const std::string &path)
+{
+   sockaddr_un address;
+   if (!socket_address(path, address))
+      return INVALID_SOCKET;
+   socket_t s = socket(AF_UNIX, SOCK_STREAM, 0);
+   if (s != INVALID_SOCKET && connect(s, (sockaddr *)&address, sizeof(address)) != 0)
+   {
+      close_socket(s);
+      return INVALID_SOCKET;
+   }
+   return s;
+}
+
+//A connection, read through a buffer so that a header line costs one call at most.
+class Channel
+{
+   socket_t socket_;
+   std::vector<char> buffer_;
+   size_t begin_, end_;
+   bool fill();
+public:
+   Channel(socket_t s): socket_(s), buffer_(64 * 1024), begin_(0), end_(0) {}
+   ~Channel() { close_socket(socket_); }
+   bool read_line(std::string &line);
+   bool read(std::string &data, size_t size);
+   bool write(const std::string &data);
+};
+
+bool Channel::fill()
+{
+   int n = recv(socket_, buffer_.data(), (int)buffer_.size(), 0);
+   begin_ = 0;
+   end_ = n > 0 ? n : 0;
+   return n > 0;
+}
+
+bool Channel::read_line(std::string &line)
+{
+   static const size_t longest = 256;
+   line.clear();
+   for (;;)
+   {
+      const char *first = buffer_.data() + begin_, *last = buffer_.data() + end_;
+      const char *newline = std::find(first, last, '\n');
+      line.append(first, newline);
+      begin_ = newline - buffer_.data();
+      if (newline != last)
+      {
+         ++begin_;
+         return true;
+      }
+      if (line.size() > longest || !fill())
+         return false;
+   }
+}
+
+bool Channel::read(std::string &data, size_t size)
+{
+   size_t buffered = std::min(size, end_ - begin_);
+   data.assign(buffer_.data() + begin_, buffered);
+   begin_ += buffered;
+   data.resize(size);
+   for (size_t got = buffered; got < size;)
+   {
+      int n = recv(socket_, &data[got], (int)std::min<size_t>(size - got, 1 << 30), 0);
+      if (n <= 0)
+         return false;
+      got += n;
+   }
+   return true;
+}
+
+bool Channel::write(const std::string &data)
+{
+   for (size_t sent = 0; sent < data.size();)
+   {
+      int n = send(socket_, data.data() + sent, (int)std::min<size_t>(data.size() - sent, 1 << 30), MSG_NOSIGNAL);
+      if (n <= 0)
+         return false;
+      sent += n;
+   }
+   return true;
+}
+
+bool ResultCache::find(unsigned long long hash, const std::string &key, CompileResult &result)
+{
+   std::lock_guard<std::mutex> lock(mutex_);
+   auto it = index_.find(hash);
+   if (it == index_.end() || it->second->key != key)
+      return false;
+   entries_.splice(entries_.begin(), entries_, it->second);
+   result = it->second->result;
+   return true;
+}
+
+void ResultCache::insert(unsigned long long hash, const std::string &key, const CompileResult &result)
+{
+   size_t size = key.size() + result.output.size();
+   if (size > capacity_)
+      return;
+   std::lock_guard<std::mutex> lock(mutex_);
+   auto it = index_.find(hash);
+   if (it != index_.end())
+   {
+      //The same source compiled on two threads at once, or two keys with one hash.
+      size_ -= it->second->key.size() + it->second->result.output.size();
+      entries_.erase(it->second);
+      index_.erase(it);
+   }
+   while (size_ + size > capacity_)
+   {
+      Entry &oldest = entries_.back();
+      size_ -= oldest.key.size() + oldest.result.output.size();
+      index_.erase(oldest.hash);
+      entries_.pop_back();
+   }
+   Entry entry = {hash, key, result};
+   entries_.push_front(entry);
+   index_[hash] = entries_.begin();
+   size_ += size;
+}
+
+Server::Server(const std::string &path, unsigned threads, size_t cache_bytes, size_t max_source): path_(path), threads_(std::max(threads, 1u)),
+   max_source_(max_source), cache_(cache_bytes), requests_(0), hits_(0), stopping_(false), listener_(0) {}
+
+//Answers one request; false once the connection is to be closed.
+bool Server::answer(Channel &channel, Compiler &compiler)
+{
+   std::string line;
+   if (!channel.read_line(line))
+      return false;
+   if (line == "stop")
+   {
+      channel.write("stopped\n");
+      stop();
+      return false;
+   }
+   std::istringstream header(line);
+   std::string flag, length;
+   size_t name_length, source_length = 0;
+   CompileOptions options;
+   if (!(header >> flag >> name_length >> length) || !compile_mode(flag, options.mode))
+      return false;
+   if (length != "-" && !(std::istringstream(length) >> source_length))
+      return false;
+   //The lengths come from the client: past the limits nothing is read, and the connection
+   //is closed after the answer.
+   static const size_t longest_name = 4096;
+   if (name_length > longest_name || source_length > max_source_)
+   {
+      static const std::string message = "Request too large";
+      std::ostringstream reply;
+      reply << "error compiled " << message.size() << '\n' << message;
+      channel.write(reply.str());
+      return false;
+   }
+   if (!channel.read(options.name, name_length))
+      return false;
+   std::string source;
+   if (length != "-" && !channel.read(source, source_length))
+      return false;
+   ++requests_;
+
+   CompileResult result;
+   bool cached = false;
+   if (length == "-" && !read_source(options.name, source))
+   {
+      result.ok = false;
+      result.output = "Error opening file";
+   }
+   else
+   {
+      //Only a token listing shows the name.
+      std::string key = flag + (options.mode == mode_lex ? options.name : std::string()) + '\0' + source;
+      unsigned long long hash = fnv1a(key.data(), key.size());
+      cached = cache_.find(hash, key, result);
+      if (cached)
+         ++hits_;
+      else
+      {
+         result = compiler.compile(source, options);
+         cache_.insert(hash, key, result);
+      }
+   }
+   std::ostringstream reply;
+   reply << (result.ok ? "ok " : "error ") << (cached ? "cached " : "compiled ") << result.output.size() << '\n' << result.output;
+   return channel.write(reply.str());
+}
+
+//Keeps the set of open connections, so that a stop can end those waiting for a request.
+//False when the server is stopping and the connection is not to be served.
+bool Server::opened(intptr_t s, bool open)
+{
+   std::lock_guard<std::mutex> lock(open_mutex_);
+   if (!open)
+      open_.erase(s);
+   else if (!stopping_)
+      open_.insert(s);
+   return !stopping_;
+}
+
+//Ends the open connections and wakes the workers waiting in accept.
+void Server::stop()
+{
+   {
+      std::lock_guard<std::mutex> lock(open_mutex_);
+      stopping_ = true;
+      for each (auto s in open_)
+         shutdown((socket_t)s, SHUT_RDWR);
+   }
+   for (unsigned t = 1; t < threads_; ++t)
+   {
+      socket_t s = connect_to(path_);
+      if (s != INVALID_SOCKET)
+         close_socket(s);
+   }
+}
+
+void Server::serve()
+{
+   Compiler compiler;
+   while (!stopping_)
+   {
+      socket_t s = accept((socket_t)listener_, nullptr, nullptr);
+      if (s == INVALID_SOCKET)
+         continue;
+      Channel channel(s);
+      //A request that fails in some other way ends its own connection, not the server.
+      try
+      {
+         if (opened(s, true))
+            while (answer(channel, compiler));
+      }
+      catch (const std::exception &)
+      {
+      }
+      opened(s, false);
+   }
+}
+
+bool Server::run()
+{
+   sockaddr_un address;
+   if (!start_sockets() || !socket_address(path_, address))
+   {
+      std::cout << "Error opening socket " << path_ << std::endl;
+      return false;
+   }
+   socket_t listener = socket(AF_UNIX, SOCK_STREAM, 0);
+   remove(path_.c_str());
+   if (listener == INVALID_SOCKET || bind(listener, (sockaddr *)&address, sizeof(address)) != 0 || listen(listener, SOMAXCONN) != 0)
+   {
+      if (listener != INVALID_SOCKET)
+         close_socket(listener);
+      std::cout << "Error opening socket " << path_ << std::endl;
+      return false;
+   }
+   listener_ = (intptr_t)listener;
+   std::cout << "listening on " << path_ << std::endl;
+   std::vector<std::thread> workers;
+   for (unsigned t = 1; t < threads_; ++t)
+      workers.emplace_back(&Server::serve, this);
+   serve();
+   for each (auto &w in workers)
+      w.join();
+   close_socket(listener);
+   remove(path_.c_str());
+   std::cout << requests_ << " requests, " << hits_ << " from the cache" << std::endl;
+   return true;
+}
+
+bool run_client(const std::string &path, const std::string &mode, const std::vector<std::string> &inputs)
+{
+   socket_t s = start_sockets() ? connect_to(path) : INVALID_SOCKET;
+   if (s == INVALID_SOCKET)
+   {
+      std::cout << "Error connecting to " << path << std::endl;
+      return false;
+   }
+   Channel channel(s);
+   std::string line;
+   if (mode.empty())
+      return channel.write("stop\n") && channel.read_line(line);
+   for each (const auto &input in inputs)
+   {
+      std::string source, output, status, how;
+      size_t length;
+      if (!read_source(input, source))
+      {
+         std::cout << "Error opening file" << std::endl;
+         continue;
+      }
+      std::ostringstream request;
+      request << mode << ' ' << input.size() << ' ' << source.size() << '\n' << input << source;
+      if (!channel.write(request.str()) || !channel.read_line(line) || !(std::istringstream(line) >> status >> how >> length)
+         || !channel.read(output, length))
+      {
+         std::cout << "Error talking to " << path << std::endl;
+         return false;
+      }
+      std::ofstream file(output_name(input), std::ios::out);
+      file << output;
+   }
+   return true;
+}
@@ -0,0 +1,66 @@
+#pragma once
+#ifndef COMPILER_SERVER_H_
+#define COMPILER_SERVER_H_
+#include "compiler.h"
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <set>
+#include <unordered_map>
+
+//Results of earlier compilations by their content: the mode, the name a token listing
+//starts with and the source. Past capacity bytes the least recently used go first.
+class ResultCache
+{
+   struct Entry
+   {
+      unsigned long long hash;
+      std::string key;
+      CompileResult result;
+   };
+   size_t capacity_, size_;
+   std::list<Entry> entries_;
+   std::unordered_map<unsigned long long, std::list<Entry>::iterator> index_;
+   std::mutex mutex_;
+public:
+   ResultCache(size_t capacity): capacity_(capacity), size_(0) {}
+   ~ResultCache() {}
+   bool find(unsigned long long hash, const std::string &key, CompileResult &result);
+   void insert(unsigned long long hash, const std::string &key, const CompileResult &result);
+};
+
+class Channel;
+
+//Compiles for clients on a Unix domain socket until one of them asks it to stop. Each
+//worker thread takes connections with a compiler of its own; the cache is shared.
+//A request is a line "<-l|-p|-g|-o> <name length> <source length>" with the name and the
+//source after it, or with "-" for the length to have the server read the named file.
+//The answer is a line "<ok|error> <cached|compiled> <length>" and the output. The line
+//"stop" stops the server. A request with a name over 4096 bytes or a source over
+//max_source bytes is answered with an error and its connection closed.
+class Server
+{
+   std::string path_;
+   unsigned threads_;
+   size_t max_source_;
+   ResultCache cache_;
+   std::atomic<size_t> requests_, hits_;
+   std::atomic<bool> stopping_;
+   intptr_t listener_;
+   std::set<intptr_t> open_;
+   std::mutex open_mutex_;
+   bool opened(intptr_t s, bool open);
+   void stop();
+   void serve();
+   bool answer(Channel &channel, Compiler &compiler);
+public:
+   Server(const std::string &path, unsigned threads, size_t cache_bytes, size_t max_source);
+   ~Server() {}
+   bool run();
+};
+
+//Compiles the inputs on the server at path and writes each output next to its input, as
+//the compiler does on its own. An empty mode stops the server instead.
+bool run_client(const std::string &path, const std::string &mode, const std::vector<std::string> &inputs);
+
+#endif
@@ -1,258 +1,257 @@
 #include "statement.h"
 
-void Block::push_stmt(const std::shared_ptr<Statement> &s)
-{
-   body_.push_back(s);
-}
-
-void Block::print(std::ofstream &output, int depth)
+SynObj *Block::print_step(std::ostream &output, int depth, int &step, int &child_depth)
 {
    int i;
-   for(i = 0; i < depth; i++)
-      output << ' ';
-   output << "begin" << std::endl;
-   for each(const auto& it in body_)
-      it->print(output, depth + 5);
+   if (step == 0)
+   {
+      for(i = 0; i < depth; i++)
+         output << ' ';
+      output << "begin" << std::endl;
+   }
+   if ((size_t)step < body_.size())
+   {
+      child_depth = depth + 5;
+      return body_[step++];
+   }
    for(i = 0; i < depth; i++) 
       output << ' ';
    output << "end\n";
+   return nullptr;
 }
 
-void Block::generate(const std::shared_ptr<Generator> &gen)
+SynObj *Block::generate_step(const std::shared_ptr<Generator> &gen, int &step)
 {
-   for each(const auto& it in body_)
-      it->generate(gen);
+   return (size_t)step < body_.size() ? body_[step++] : nullptr;
 }
 
-void ExprStmt::print(std::ofstream &output, int depth)
+SynObj *ExprStmt::print_step(std::ostream &output, int depth, int &step, int &child_depth)
 {
-   et_->print(output, depth);
+   return step++ ? nullptr : et_;
 }
 
-void ExprStmt::generate(const std::shared_ptr<Generator> &gen)
+SynObj *ExprStmt::generate_step(const std::shared_ptr<Generator> &gen, int &step)
 {
-   et_->generate(gen);
+   return step++ ? nullptr : et_;
 }
 
-void BreakStmt::print(std::ofstream &output, int depth)
+SynObj *BreakStmt::print_step(std::ostream &output, int depth, int &step, int &child_depth)
 {
    for(int i = 0; i < depth; i++)
       output << ' ';
    output << "break\n";
+   return nullptr;
 }
 
-void BreakStmt::generate(const std::shared_ptr<Generator> &gen)
+SynObj *BreakStmt::generate_step(const std::shared_ptr<Generator> &gen, int &step)
 {
    if (gen->is_cycle())
       gen->push(Instruction(cmd_jmp, op_label, gen->get_end_of_cycle()));
+   return nullptr;
 }
 
-void ContinueStmt::print(std::ofstream &output, int depth)
+SynObj *ContinueStmt::print_step(std::ostream &output, int depth, int &step, int &child_depth)
 {
    for(int i = 0; i < depth; i++)
       output << ' ';
    output << "continue\n";
+   return nullptr;
 }
 
-void ContinueStmt::generate(const std::shared_ptr<Generator> &gen)
+SynObj *ContinueStmt::generate_step(const std::shared_ptr<Generator> &gen, int &step)
 {
    if (gen->is_cycle())
       gen->push(Instruction(cmd_jmp, op_label, gen->get_begin_of_cycle()));
+   return nullptr;
 }
 
-void WhileStmt::print(std::ofstream &output, int depth)
-{
-   for(int i = 0; i < depth; i++)
-      output << ' ';
-
-   output << "while\n";
-   expr_->print(output, depth);
-
-   for(int i = 0; i < depth; i++)
-      output<<' ';
-
-   output << "do\n";
-   stmt_->print(output, depth + 5);
-}
-
-void WhileStmt::generate(const std::shared_ptr<Generator> &gen)
+SynObj *WhileStmt::print_step(std::ostream &output, int depth, int &step, int &child_depth)
 {
-   std::string label_begin = gen->generate_label();
-   std::string label_end = gen->generate_label();
-   std::string tmp1, tmp2;
-
-	gen->push_label(label_begin);
-
-   if (gen->is_cycle())
+   switch (step++)
    {
-      tmp1 = gen->get_begin_of_cycle();
-      tmp2 = gen->get_end_of_cycle();
+      case 0:
+         for(int i = 0; i < depth; i++)
+            output << ' ';
+
+         output << "while\n";
+         return expr_;
+      case 1:
+         for(int i = 0; i < depth; i++)
+            output<<' ';
+
+         output << "do\n";
+         child_depth = depth + 5;
+         return stmt_;
    }
-
-   gen->set_cycle(true);
-   gen->set_cycle_begin(label_begin);
-   gen->set_cycle_end(label_end);
-
-   expr_->generate(gen);
-   gen->generate_pop_test();
-   gen->push(Instruction(cmd_jz, op_label, label_end));
-
-   stmt_->generate(gen);   
-   gen->push(Instruction(cmd_jmp, op_label, label_begin));
-   gen->push_label(label_end);
-
-   if (tmp1.length() && tmp2.length())
-   {
-      gen->set_cycle_begin(tmp1);
-      gen->set_cycle_end(tmp2);
-   }
-   else
-      gen->set_cycle(false);
+   return nullptr;
 }
 
-void RepeatStmt::print(std::ofstream &output, int depth)
+//The condition is tested after the body, which it jumps back to, as a for loop does:
+//an iteration takes one branch.
+SynObj *WhileStmt::generate_step(const std::shared_ptr<Generator> &gen, int &step)
 {
-   for(int i = 0; i < depth; ++i) 
-      output << ' ';
-
-   output << "repeat\n";
-   stmt_->print(output, depth + 5);
-
-   for(int i = 0; i < depth; ++i) 
-      output << ' ';
-
-   output << "until\n";
-   expr_->print(output, depth);
+   switch (step++)
+   {
+      case 0:
+         label_begin_ = gen->generate_label();
+         label_condition_ = gen->generate_label();
+         label_end_ = gen->generate_label();
+         gen->push(Instruction(cmd_jmp, op_label, label_condition_));
+         gen->push_align();
+         gen->push_label(label_begin_);
+         gen->push_cycle(label_condition_, label_end_);
+         return stmt_;
+      case 1:
+         gen->push_label(label_condition_);
+         return expr_;
+   }
+   gen->generate_branch(label_begin_, true);
+   gen->push_label(label_end_);
+   gen->pop_cycle();
+   return nullptr;
 }
 
-void RepeatStmt::generate(const std::shared_ptr<Generator> &gen)
+SynObj *RepeatStmt::print_step(std::ostream &output, int depth, int &step, int &child_depth)
 {
-	std::string label_begin = gen->generate_label();
-	std::string label_condition = gen->generate_label();
-   std::string label_end = gen->generate_label();
-   std::string tmp1, tmp2;
-
-	gen->push_label(label_begin);
-
-   if (gen->is_cycle())
+   switch (step++)
    {
-      tmp1 = gen->get_begin_of_cycle();
-      tmp2 = gen->get_end_of_cycle();
+      case 0:
+         for(int i = 0; i < depth; ++i) 
+            output << ' ';
+
+         output << "repeat\n";
+         child_depth = depth + 5;
+         return stmt_;
+      case 1:
+         for(int i = 0; i < depth; ++i) 
+            output << ' ';
+
+         output << "until\n";
+         return expr_;
    }
+   return nullptr;
+}
 
-	gen->set_cycle(true);
-	gen->set_cycle_begin(label_begin);
-	gen->set_cycle_end(label_end);
-
-	stmt_->generate(gen);
-	gen->push_label(label_condition);
-	expr_->generate(gen);
-
-	gen->generate_pop_test();
-	gen->push(Instruction(cmd_jz, op_label, label_begin));
-	gen->push_label(label_end);
-
-   if (tmp1.length() && tmp2.length())
+SynObj *RepeatStmt::generate_step(const std::shared_ptr<Generator> &gen, int &step)
+{
+   switch (step++)
    {
-      gen->set_cycle_begin(tmp1);
-      gen->set_cycle_end(tmp2);
+      case 0:
+         label_begin_ = gen->generate_label();
+         label_condition_ = gen->generate_label();
+         label_end_ = gen->generate_label();
+         gen->push_align();
+         gen->push_label(label_begin_);
+         gen->push_cycle(label_begin_, label_end_);
+         return stmt_;
+      case 1:
+         gen->push_label(label_condition_);
+         return expr_;
    }
-   else
-      gen->set_cycle(false);
+   gen->generate_branch(label_begin_);
+   gen->push_label(label_end_);
+   gen->pop_cycle();
+   return nullptr;
 }
 
-void IfStmt::print(std::ofstream &output, int depth)
+SynObj *IfStmt::print_step(std::ostream &output, int depth, int &step, int &child_depth)
 {
-   for(int i = 0; i < depth; ++i) 
-      output << ' ';
-
-   output << "if\n";
-   condition_->print(output, depth);
-
-   for(int i = 0; i < depth; ++i)
-      output << ' ';
-
-   output << "then\n";
-   if_stmt_->print(output, depth + 5);
-
-   for(int i = 0; i < depth; ++i) 
-      output << ' ';
-
-   if (else_stmt_) 
-      output << "else\n";
-
-   else_stmt_->print(output, depth + 5);
+   switch (step++)
+   {
+      case 0:
+         for(int i = 0; i < depth; ++i) 
+            output << ' ';
+
+         output << "if\n";
+         return condition_;
+      case 1:
+         for(int i = 0; i < depth; ++i)
+            output << ' ';
+
+         output << "then\n";
+         child_depth = depth + 5;
+         return if_stmt_;
+      case 2:
+         for(int i = 0; i < depth; ++i) 
+            output << ' ';
+
+         if (else_stmt_) 
+            output << "else\n";
+
+         child_depth = depth + 5;
+         return else_stmt_;
+   }
+   return nullptr;
 }
 
-void IfStmt::generate(const std::shared_ptr<Generator> &gen)
+SynObj *IfStmt::generate_step(const std::shared_ptr<Generator> &gen, int &step)
 {
-	condition_->generate(gen);
-
-	std::string label_else = gen->generate_label();
-	std::string label_exit = gen->generate_label();
-
-	gen->generate_pop_test();
-	gen->push(Instruction(cmd_jz, op_label, label_else));
-
-	if_stmt_->generate(gen);
-
-	gen->push(Instruction(cmd_jmp, op_label, label_exit));
-	gen->push_label(label_else);
-
-	else_stmt_->generate(gen);
-
-	gen->push_label(label_exit);
+   switch (step++)
+   {
+      case 0:
+         return condition_;
+      case 1:
+         label_else_ = gen->generate_label();
+         label_exit_ = gen->generate_label();
+         gen->generate_branch(label_else_);
+         return if_stmt_;
+      case 2:
+         gen->push(Instruction(cmd_jmp, op_label, label_exit_));
+         gen->push_label(label_else_);
+         if (else_stmt_)
+            return else_stmt_;
+   }
+   gen->push_label(label_exit_);
+   return nullptr;
 }
 
-void ForStmt::print(std::ofstream &output, int depth)
+SynObj *ForStmt::print_step(std::ostream &output, int depth, int &step, int &child_depth)
 {
-   for(int i = 0; i < depth; ++i)
-      output << ' ';
-
-   output << "for\n";
-   expr1_->print(output, depth);
-
-   for(int i = 0; i < depth; ++i)
-      output << ' ';
-
-   output << t_.get_string() << '\n';
-   expr2_->print(output, depth);
-
-   for(int i = 0; i < depth; ++i)
-      output << ' ';
-
-   output << "do\n";
-   stmt_->print(output, depth);
+   switch (step++)
+   {
+      case 0:
+         for(int i = 0; i < depth; ++i)
+            output << ' ';
+
+         output << "for\n";
+         return expr1_;
+      case 1:
+         for(int i = 0; i < depth; ++i)
+            output << ' ';
+
+         output << t_.get_string() << '\n';
+         return expr2_;
+      case 2:
+         for(int i = 0; i < depth; ++i)
+            output << ' ';
+
+         output << "do\n";
+         return stmt_;
+   }
+   return nullptr;
 }
 
-void ForStmt::generate(const std::shared_ptr<Generator> &gen)
+SynObj *ForStmt::generate_step(const std::shared_ptr<Generator> &gen, int &step)
 {
-   std::string	label_begin = gen->generate_label();
-   std::string label_end = gen->generate_label();
-   std::string label_condition = gen->generate_label();
-   std::string label_iter = gen->generate_label();
-   std::string tmp1, tmp2;
-
-   expr2_->generate(gen);
-   expr1_->generate(gen);
-
-   gen->push(Instruction(cmd_push, op_register, "esi"));
-   gen->push(Instruction(cmd_jmp, op_label, label_condition));
-
-   if (gen->is_cycle())
+   switch (step++)
    {
-      tmp1 = gen->get_begin_of_cycle();
-      tmp2 = gen->get_end_of_cycle();
+      case 0:
+         label_begin_ = gen->generate_label();
+         label_end_ = gen->generate_label();
+         label_condition_ = gen->generate_label();
+         label_iter_ = gen->generate_label();
+         return expr2_;
+      case 1:
+         return expr1_;
+      case 2:
+         gen->push(Instruction(cmd_push, op_register, "esi"));
+         gen->push(Instruction(cmd_jmp, op_label, label_condition_));
+         gen->push_align();
+         gen->push_label(label_begin_);
+         gen->push_cycle(label_iter_, label_end_);
+         return stmt_;
    }
-
-   gen->push_label(label_begin);
-   gen->set_cycle(true);
-   gen->set_cycle_begin(label_iter);
-   gen->set_cycle_end(label_end);
-
-   stmt_->generate(gen);
-
-   gen->push_label(label_iter);
+   gen->push_label(label_iter_);
    gen->push(Instruction(cmd_mov, op_register, "esi", op_memory, "[esp]"));
    
    if (t_.type() == to_stmt)
@@ -260,102 +259,105 @@ void ForStmt::generate(const std::shared_ptr<Generator> &gen)
    else 
       gen->push(Instruction(cmd_dec, op_memory, "dword ptr [esi]"));
    
-   gen->push_label(label_condition);
+   gen->push_label(label_condition_);
    gen->push(Instruction(cmd_mov, op_register, "eax", op_memory, "dword ptr [esi]"));
    gen->push(Instruction(cmd_cmp, op_register, "eax", op_memory, "dword ptr [esp + 4]"));
 
    if (t_.type() == to_stmt)
-      gen->push(Instruction(cmd_jle, op_label, label_begin));
+      gen->push(Instruction(cmd_jle, op_label, label_begin_));
    else 
-      gen->push(Instruction(cmd_jge, op_label, label_begin));
+      gen->push(Instruction(cmd_jge, op_label, label_begin_));
 
-   gen->push_label(label_end);
+   gen->push_label(label_end_);
    gen->push(Instruction(cmd_add, op_register, "esp", op_immediate, "8"));
-
-   if (tmp1.length() && tmp2.length())
-   {
-      gen->set_cycle_begin(tmp1);
-      gen->set_cycle_end(tmp2);
-   }
-   else
-      gen->set_cycle(false);
-}
-
-WriteCall::WriteCall(const std::list<std::shared_ptr<Expr>> &expr_list, bool l) : ln_(l)
-{
-   for each(const auto& it in expr_list)
-      args_.push_back(it);
+   gen->pop_cycle();
+   return nullptr;
 }
 
-void WriteCall::print(std::ofstream &output, int depth) 
+SynObj *WriteCall::print_step(std::ostream &output, int depth, int &step, int &child_depth) 
 {
-   for(int i = 0; i < depth; ++i)
-      output << ' ';
-   output << "write" << (ln_ ? "ln" : "") << "\n"; 
-   for each(const auto& it in args_)
-      it->print(output, depth + 5);
+   if (step == 0)
+   {
+      for(int i = 0; i < depth; ++i)
+         output << ' ';
+      output << "write" << (ln_ ? "ln" : "") << "\n"; 
+   }
+   child_depth = depth + 5;
+   return (size_t)step < args_.size() ? args_[step++] : nullptr;
 }
 
-void WriteCall::generate(const std::shared_ptr<Generator> &gen)
+//Prints an argument: a variable directly, anything else from the value generated for it.
+static void generate_write_arg(const std::shared_ptr<Generator> &gen, Expr *it)
 {
-   for each(const auto& it in args_)
-      switch(it->get_type()->get_sym_type())
-      {
-         case sym_int:
-            if (it->get_syn_type() == syn_var)
-            {
-               gen->push(Instruction(cmd_call, op_memory, "printf, offset int_frmt, v_" + it->get_string()));
-               gen->push(Instruction(cmd_add, op_register, "esp", op_immediate, "8"));
-            }
-            else
+   switch(it->get_type()->get_sym_type())
+   {
+      case sym_int:
+         if (it->get_syn_type() == syn_var)
+         {
+            gen->push(Instruction(cmd_call, op_memory, "printf, offset int_frmt, v_" + it->get_string()));
+            gen->push(Instruction(cmd_add, op_register, "esp", op_immediate, "8"));
+         }
+         else
+         {
+            it->pop_val(gen);
+            if (it->is_string())
             {
-               it->generate(gen);
-               it->pop_val(gen);
-               if (it->is_string())
-               {
-                  gen->push(Instruction(cmd_call, op_memory, "printf, esi"));
-                  gen->push(Instruction(cmd_add, op_register, "esp", op_immediate, "4"));
-               }
-               else 
-               {
-                  gen->push(Instruction(cmd_call, op_memory, "printf, offset int_frmt, eax"));
-                  gen->push(Instruction(cmd_add, op_register, "esp", op_immediate, "8"));
-               }
+               gen->push(Instruction(cmd_call, op_memory, "printf, esi"));
+               gen->push(Instruction(cmd_add, op_register, "esp", op_immediate, "4"));
             }
-            break;
-         default:
-            if (it->get_syn_type() == syn_var)
-               gen->push(Instruction(cmd_call, op_memory, "printf, offset double_frmt, v_" + it->get_string()));
-            else
+            else 
             {
-               it->generate(gen);
-               gen->push(Instruction(cmd_mov, op_register, "eax", op_immediate, "offset double_buff"));
-               gen->push(Instruction(cmd_pop, op_immediate, "qword ptr [eax]"));
-               gen->push(Instruction(cmd_call, op_memory, "printf, offset double_frmt, double_buff"));
+               gen->push(Instruction(cmd_call, op_memory, "printf, offset int_frmt, eax"));
+               gen->push(Instruction(cmd_add, op_register, "esp", op_immediate, "8"));
             }
-            gen->push(Instruction(cmd_add, op_register, "esp", op_immediate, "12"));
-            break;
+         }
+         break;
+      default:
+         if (it->get_syn_type() == syn_var)
+            gen->push(Instruction(cmd_call, op_memory, "printf, offset double_frmt, v_" + it->get_string()));
+         else
+         {
+            gen->push(Instruction(cmd_mov, op_register, "eax", op_immediate, "offset double_buff"));
+            gen->push(Instruction(cmd_pop, op_immediate, "qword ptr [eax]"));
+            gen->push(Instruction(cmd_call, op_memory, "printf, offset double_frmt, double_buff"));
+         }
+         gen->push(Instruction(cmd_add, op_register, "esp", op_immediate, "12"));
+         break;
+   }
+}
+
+//Step 2k reaches argument k; step 2k + 1 prints it once its value has been generated.
+SynObj *WriteCall::generate_step(const std::shared_ptr<Generator> &gen, int &step)
+{
+   while ((size_t)step < 2 * args_.size())
+   {
+      Expr *it = args_[step / 2];
+      if (step % 2 == 0 && it->get_syn_type() != syn_var)
+      {
+         ++step;
+         return it;
       }
+      generate_write_arg(gen, it);
+      step = step / 2 * 2 + 2;
+   }
    if (ln_)
    {
       gen->push(Instruction(cmd_call, op_memory, "printf, offset new_line"));
       gen->push(Instruction(cmd_add, op_register, "esp", op_immediate, "4"));
    }
+   return nullptr;
 }
 
-ReadCall::ReadCall(const std::list<std::shared_ptr<Expr>> &expr_list, bool l) : ln_(l)
-{
-   for each(const auto& it in expr_list)
-      args_.push_back(it);
-}
-
-void ReadCall::print(std::ofstream &output, int depth)
+SynObj *ReadCall::print_step(std::ostream &output, int depth, int &step, int &child_depth)
 {
-   for(int i = 0; i < depth; ++i)
-      output << ' ';
-   output << "read" << (ln_ ? "ln" : "") << "\n";
-   for each(const auto& it in args_)
-      it->print(output, depth + 5);
+   if (step == 0)
+   {
+      for(int i = 0; i < depth; ++i)
+         output << ' ';
+      output << "read" << (ln_ ? "ln" : "") << "\n";
+   }
+   child_depth = depth + 5;
+   return (size_t)step < args_.size() ? args_[step++] : nullptr;
 }
 
 size_t SymProc::get_size_args()
@@ -371,23 +373,17 @@ size_t SymProc::get_size_args()
    return argsize;
 }
 
-std::shared_ptr<SynVar> SymProc::get_arg(size_t num)
+SynVar *SymProc::get_arg(size_t num)
 {
-   if(num < args.size())
-   {
-      auto it = args.begin();
-      for(size_t count = 0; it != args.end(), count != num; ++it, ++count);
-      return *it;
-   }
-   return nullptr;
+   return num < args.size() ? args[num] : nullptr;
 }
 
-const std::list<std::shared_ptr<SynVar>> &SymProc::get_arg_list()
+const NodeList<SynVar *> &SymProc::get_arg_list()
 {
    return args;
 }
 
-void SymProc::set_block(const std::shared_ptr<Statement> &pb)
+void SymProc::set_block(Statement *pb)
 {
    block_ = pb;
 }
@@ -407,43 +403,39 @@ void SymProc::generate(const std::shared_ptr<Generator> &gen)
    gen->push_string("pr_" + name_ + " endp\n");
 }
 
-FunCall::FunCall(const std::list<std::shared_ptr<Expr>> &lar, const Token &n, const std::shared_ptr<SymProc> &st): Expr(std::make_shared<SymType>()), name_(n), type_(st)
-{
-   arg_ = lar;
-}
-
-void FunCall::print(std::ofstream &output, int depth)
-{
-   for(int i = 0; i < depth; ++i)
-      output << ' ';
-   output << name_.get_string() << '\n';
-   for each(const auto& it in arg_)
-      it->print(output, depth + 5);
-}
+FunCall::FunCall(const NodeList<Expr *> &lar, const Token &n, SymProc *st): Expr(no_type()), arg_(lar), name_(n), type_(st) {}
 
-void FunCall::generate_base(const std::shared_ptr<Generator> &gen)
+SynObj *FunCall::print_step(std::ostream &output, int depth, int &step, int &child_depth)
 {
-   gen->push(Instruction(cmd_sub, op_register,"esp", op_immediate, type_->get_size_ret_value()));
-   auto i = type_->get_arg_list().begin();   
-   for each (auto j in arg_)
+   if (step == 0)
    {
-      if ((*i)->get_sym_var()->is_var_arg())
-         j->generate_lvalue(gen);
-      else 
-         j->generate(gen);
-      ++i;
+      for(int i = 0; i < depth; ++i)
+         output << ' ';
+      output << name_.get_string() << '\n';
    }
-   gen->push(Instruction(cmd_call, op_memory, "pr_" + name_.get_string()));
+   child_depth = depth + 5;
+   return (size_t)step < arg_.size() ? arg_[step++] : nullptr;
 }
 
 void FunCall::pop_val(const std::shared_ptr<Generator> &gen)
 {
    if (type_->get_size_ret_value() == 4)
-      gen->push(Instruction(cmd_pop, op_register, "eax"));
+      gen->pop_value(op_register, "eax");
 }
 
-void FunCall::generate(const std::shared_ptr<Generator> &gen)
+//Step k reaches argument k; an argument passed by reference is generated as an address.
+SynObj *FunCall::generate_step(const std::shared_ptr<Generator> &gen, int &step)
 {
-   generate_base(gen);
+   if (step == 0)
+      gen->push(Instruction(cmd_sub, op_register,"esp", op_immediate, type_->get_size_ret_value()));
+   while ((size_t)step < arg_.size())
+   {
+      Expr *arg = arg_[step];
+      if (!type_->get_arg_list()[step++]->get_sym_var()->is_var_arg())
+         return arg;
+      arg->generate_lvalue(gen);
+   }
+   gen->push(Instruction(cmd_call, op_memory, "pr_" + name_.get_string()));
    gen->push(Instruction(cmd_add, op_register, "esp", op_immediate, type_->get_size_args()));
+   return nullptr;
 }
\ No newline at end of file
@@ -6,9 +6,9 @@
 class Statement: public SynObj
 {
 protected:
-   std::shared_ptr<Statement> stmt_;
+   Statement *stmt_;
 public:
-   Statement(const std::shared_ptr<Statement> &s): stmt_(s) {}
+   Statement(Statement *s): stmt_(s) {}
    Statement() {}
    virtual ~Statement() {}
    virtual bool is_break_or_continue() { return false; }
@@ -16,23 +16,24 @@ public:
 
 class Block: public Statement
 {
-   std::list<std::shared_ptr<Statement>> body_;
+   NodeList<Statement *> body_;
 public:
-   Block(): Statement() {}
+   Block(const NodeList<Statement *> &body): Statement(), body_(body) {}
    ~Block() {}
-   void push_stmt(const std::shared_ptr<Statement> &s);
-   void print(std::ofstream &output, int depth);
-   void generate(const std::shared_ptr<Generator> &gen);
+   SynObj *print_step(std::ostream &output, int depth, int &step, int &child_depth);
+   SynObj *generate_step(const std::shared_ptr<Generator> &gen, int &step);
+   SynObj *lower_step(IrBuilder &ir, int &step);
 };
 
 class ExprStmt: public Statement 
 {
-   std::shared_ptr<Expr> et_;
+   Expr *et_;
 public:
-   ExprStmt(const std::shared_ptr<Expr> &e): et_(e) {}
+   ExprStmt(Expr *e): et_(e) {}
    ~ExprStmt() {}
-   void print(std::ofstream &output, int depth);
-   void generate(const std::shared_ptr<Generator> &gen);
+   SynObj *print_step(std::ostream &output, int depth, int &step, int &child_depth);
+   SynObj *generate_step(const std::shared_ptr<Generator> &gen, int &step);
+   SynObj *lower_step(IrBuilder &ir, int &step);
 };
 
 class BreakStmt: public Statement 
@@ -40,8 +41,9 @@ class BreakStmt: public Statement
 public:
    BreakStmt() {}
    ~BreakStmt() {}
-   void print(std::ofstream &output, int depth);
-   void generate(const std::shared_ptr<Generator> &gen);
+   SynObj *print_step(std::ostream &output, int depth, int &step, int &child_depth);
+   SynObj *generate_step(const std::shared_ptr<Generator> &gen, int &step);
+   SynObj *lower_step(IrBuilder &ir, int &step);
    bool is_break_or_continue() { return true; }
 };
 
@@ -50,142 +52,156 @@ class ContinueStmt: public Statement
 public:
    ContinueStmt() {}
    ~ContinueStmt() {}
-   void print(std::ofstream &output, int depth);
-   void generate(const std::shared_ptr<Generator> &gen);
+   SynObj *print_step(std::ostream &output, int depth, int &step, int &child_depth);
+   SynObj *generate_step(const std::shared_ptr<Generator> &gen, int &step);
+   SynObj *lower_step(IrBuilder &ir, int &step);
    bool is_break_or_continue() { return true; }
 };
 
 class WhileStmt: public Statement 
 {
-   std::shared_ptr<Expr> expr_;
-   std::shared_ptr<Statement> stmt_;
+   Expr *expr_;
+   Statement *stmt_;
+   std::string label_begin_, label_condition_, label_end_;
 public:
-   WhileStmt(const std::shared_ptr<Expr> &e, const std::shared_ptr<Statement> &s): expr_(e), stmt_(s) {}
+   WhileStmt(Expr *e, Statement *s): expr_(e), stmt_(s) { e->set_condition(); }
    ~WhileStmt() {}
-   void print(std::ofstream &output, int depth);
-   void generate(const std::shared_ptr<Generator> &gen);
+   SynObj *print_step(std::ostream &output, int depth, int &step, int &child_depth);
+   SynObj *generate_step(const std::shared_ptr<Generator> &gen, int &step);
+   SynObj *lower_step(IrBuilder &ir, int &step);
 };
 
 class RepeatStmt: public Statement 
 {
-   std::shared_ptr<Expr> expr_;
-   std::shared_ptr<Statement> stmt_;
+   Expr *expr_;
+   Statement *stmt_;
+   std::string label_begin_, label_condition_, label_end_;
 public:
-   RepeatStmt(const std::shared_ptr<Expr> &e, const std::shared_ptr<Statement> &s): expr_(e), stmt_(s) {}
+   RepeatStmt(Expr *e, Statement *s): expr_(e), stmt_(s) { e->set_condition(); }
    ~RepeatStmt() {}
-   void print(std::ofstream &output, int depth);
-   void generate(const std::shared_ptr<Generator> &gen);
+   SynObj *print_step(std::ostream &output, int depth, int &step, int &child_depth);
+   SynObj *generate_step(const std::shared_ptr<Generator> &gen, int &step);
+   SynObj *lower_step(IrBuilder &ir, int &step);
 };
 
 class IfStmt: public Statement 
 {
-   std::shared_ptr<Expr> condition_;
-   std::shared_ptr<Statement> if_stmt_, else_stmt_;
+   Expr *condition_;
+   Statement *if_stmt_, *else_stmt_;
+   std::string label_else_, label_exit_;
 public:
-   IfStmt(const std::shared_ptr<Expr> &e, const std::shared_ptr<Statement> &s1, const std::shared_ptr<Statement> &s2):
-      condition_(e), if_stmt_(s1), else_stmt_(s2) {}
+   IfStmt(Expr *e, Statement *s1, Statement *s2):
+      condition_(e), if_stmt_(s1), else_stmt_(s2) { e->set_condition(); }
    ~IfStmt() {}
-   void print(std::ofstream &output, int depth);
-   void generate(const std::shared_ptr<Generator> &gen);
+   SynObj *print_step(std::ostream &output, int depth, int &step, int &child_depth);
+   SynObj *generate_step(const std::shared_ptr<Generator> &gen, int &step);
+   SynObj *lower_step(IrBuilder &ir, int &step);
 };
 
 class EmptyStmt: public Statement 
 {
 public:
    EmptyStmt() {}
-   void print(std::ofstream &output, int depth) {}
+   SynObj *print_step(std::ostream &output, int depth, int &step, int &child_depth) { return nullptr; }
    ~EmptyStmt() {}
-   void generate(const std::shared_ptr<Generator> &gen) {}
-
+   SynObj *generate_step(const std::shared_ptr<Generator> &gen, int &step) { return nullptr; }
+   SynObj *lower_step(IrBuilder &ir, int &step) { return nullptr; }
 };
 
 class ForStmt: public Statement 
 {
-   std::shared_ptr<Expr> expr1_, expr2_;
-   std::shared_ptr<Statement> stmt_;
+   Expr *expr1_, *expr2_;
+   Statement *stmt_;
    Token t_, it_;
+   std::string label_begin_, label_end_, label_condition_, label_iter_;
    void generate_iter(const std::shared_ptr<Generator> &gen);
    void generate_cond(const std::shared_ptr<Generator> &gen);
 public:
-   ForStmt(const std::shared_ptr<Expr> &e1, const std::shared_ptr<Expr> &e2, const Token &t, const Token &it, const std::shared_ptr<Statement> &s):
+   ForStmt(Expr *e1, Expr *e2, const Token &t, const Token &it, Statement *s):
       expr1_(e1), expr2_(e2), t_(t), it_(it), stmt_(s) {}
    ~ForStmt() {}
-   void print(std::ofstream &output, int depth);
-   void generate(const std::shared_ptr<Generator> &gen);
+   SynObj *print_step(std::ostream &output, int depth, int &step, int &child_depth);
+   SynObj *generate_step(const std::shared_ptr<Generator> &gen, int &step);
+   SynObj *lower_step(IrBuilder &ir, int &step);
 };
 
 class WriteCall: public Statement 
 {
-   std::list<std::shared_ptr<Expr>> args_;
+   NodeList<Expr *> args_;
    bool ln_;
 public:
-   WriteCall(const std::list<std::shared_ptr<Expr>> &expr_list, bool l);
+   WriteCall(const NodeList<Expr *> &expr_list, bool l): args_(expr_list), ln_(l) {}
    ~WriteCall() {}
-   void print(std::ofstream &output, int depth);
-   void generate(const std::shared_ptr<Generator> &gen);
+   SynObj *print_step(std::ostream &output, int depth, int &step, int &child_depth);
+   SynObj *generate_step(const std::shared_ptr<Generator> &gen, int &step);
+   SynObj *lower_step(IrBuilder &ir, int &step);
 };
 
 class ReadCall: public Statement
 {
-   std::list<std::shared_ptr<Expr> > args_;
+   NodeList<Expr *> args_;
    bool ln_;
 public:
-   ReadCall(const std::list<std::shared_ptr<Expr>> &expr_list, bool l);
+   ReadCall(const NodeList<Expr *> &expr_list, bool l): args_(expr_list), ln_(l) {}
    ~ReadCall() {}
-   void print(std::ofstream &output, int depth);
-   void generate(const std::shared_ptr<Generator> &gen) {}
+   SynObj *print_step(std::ostream &output, int depth, int &step, int &child_depth);
+   SynObj *generate_step(const std::shared_ptr<Generator> &gen, int &step) { return nullptr; }
+   SynObj *lower_step(IrBuilder &ir, int &step) { return nullptr; }
 };
 
 class SymProc: public Symbol
 {
 protected:
-   std::shared_ptr<Statement> block_;
-   std::shared_ptr<SymTable> params_;
-   std::list<std::shared_ptr<SynVar>> args;
+   Statement *block_;
+   SymTable *params_;
+   NodeList<SynVar *> args;
    int lsize;
 public:
-   SymProc(const std::string &n, const std::shared_ptr<SymTable> &st, std::list<std::shared_ptr<SynVar>> farg = std::list<std::shared_ptr<SynVar>>::list(), int sz = 0):
+   SymProc(const std::string &n, SymTable *st, const NodeList<SynVar *> &farg = NodeList<SynVar *>(), int sz = 0):
       Symbol(n), params_(st), args(farg), lsize(sz) {}
    ~SymProc() {}
    size_t get_size_args();
    virtual size_t get_size_ret_value() { return 0; }
    int get_size_local_args() { return lsize; }
-   std::shared_ptr<SynVar> get_arg(size_t num);
-   virtual const std::list<std::shared_ptr<SynVar>> &get_arg_list();
-   virtual std::shared_ptr<SymType> get_type() const { return std::make_shared<SymType>(); }
+   Statement *get_block() const { return block_; }
+   SymTable *get_local_table() const { return params_; }
+   SynVar *get_arg(size_t num);
+   virtual const NodeList<SynVar *> &get_arg_list();
+   virtual SymType *get_type() const { return no_type(); }
    bool is_proc() const { return true; }
-   void set_block(const std::shared_ptr<Statement> &pb);
-   void print_block(std::ofstream &output) { block_->print(output, 5); }
-   void print_local_table(std::ofstream &output) { params_->print_var_table(output, true); }
+   void set_block(Statement *pb);
+   void print_block(std::ostream &output) { block_->print(output, 5); }
+   void print_local_table(std::ostream &output) { params_->print_var_table(output, true); }
    void generate(const std::shared_ptr<Generator> &gen);
    SymTypes get_sym_type() const { return sym_proc; }
 };
 
 class SymFunc: public SymProc 
 {
-   std::shared_ptr<SymType> type_;
+   SymType *type_;
 public:
-   SymFunc(const std::string &n, const std::shared_ptr<SymTable> &smt, const std::list<std::shared_ptr<SynVar>> &farg,
-      const std::shared_ptr<SymType> &st, int sz = 0): SymProc(n, smt, farg, sz), type_(st) {}
+   SymFunc(const std::string &n, SymTable *smt, const NodeList<SynVar *> &farg,
+      SymType *st, int sz = 0): SymProc(n, smt, farg, sz), type_(st) {}
    size_t get_size_ret_value() { return type_->get_size(); }
-   const std::list<std::shared_ptr<SynVar>> &get_arg_list() { return args; }
-   std::shared_ptr<SymType> get_type() const { return type_; }
+   const NodeList<SynVar *> &get_arg_list() { return args; }
+   SymType *get_type() const { return type_; }
    ~SymFunc() {}
 };
 
 class FunCall: public Expr 
 {
-   std::list<std::shared_ptr<Expr>> arg_;
+   NodeList<Expr *> arg_;
    Token name_;
-   std::shared_ptr<SymProc> type_;
-   void generate_base(const std::shared_ptr<Generator> &gen);
+   SymProc *type_;
 public:
-   FunCall(const std::list<std::shared_ptr<Expr>> &lar, const Token &n, const std::shared_ptr<SymProc> &st);
+   FunCall(const NodeList<Expr *> &lar, const Token &n, SymProc *st);
    ~FunCall() {}
-   void print(std::ofstream &output, int depth);
-   std::shared_ptr<SymType> get_type() const { return type_->get_type(); }
-   void generate(const std::shared_ptr<Generator> &gen);
+   SynObj *print_step(std::ostream &output, int depth, int &step, int &child_depth);
+   SymType *get_type() const { return type_->get_type(); }
+   SynObj *generate_step(const std::shared_ptr<Generator> &gen, int &step);
+   SynObj *lower_step(IrBuilder &ir, int &step);
    void pop_val(const std::shared_ptr<Generator> &gen);
+   int get_need() const { return call_need; }
 };
 
 #endif
@@ -1,23 +1,115 @@
 #include "symbol.h"
 #include <boost/math/special_functions/modf.hpp>
+#include <algorithm>
 
-std::shared_ptr<Symbol> SymTable::p_find(const Token &key)
+//Slots hold an entry index plus one, 0 marking a free slot. Erased entries stay in
+//place without a symbol until the next rehash drops them.
+size_t SymTable::slot(const std::string *key) const
 {
-   return p_find(key.get_string());
+   size_t mask = slots_.size() - 1;
+   size_t i = (size_t)(((unsigned long long)(size_t)key >> 3) * 0x9E3779B97F4A7C15ull >> 32) & mask;
+   while (slots_[i] != 0 && entries_[slots_[i] - 1].first != key)
+      i = (i + 1) & mask;
+   return i;
 }
 
-std::shared_ptr<Symbol> SymTable::p_find(const std::string &key)
+void SymTable::rehash(size_t capacity)
 {
-   auto it = table_.find(key);
-   if (it != table_.end())
-      return (*it).second;
+   if (erased_)
+   {
+      size_t n = 0;
+      for (size_t i = 0; i < entries_.size(); ++i)
+         if (entries_[i].second != nullptr)
+            entries_[n++] = entries_[i];
+      entries_.resize(n);
+      erased_ = false;
+   }
+   slots_.assign(capacity, 0);
+   for (size_t i = 0; i < entries_.size(); ++i)
+      slots_[slot(entries_[i].first)] = (unsigned)i + 1;
+}
+
+void SymTable::insert(const std::string *key, Symbol *symb)
+{
+   if ((entries_.size() + 1) * 2 > slots_.size())
+   {
+      size_t capacity = slots_.empty() ? 8 : slots_.size();
+      while ((size_ + 1) * 4 > capacity)
+         capacity *= 2;
+      rehash(capacity);
+   }
+   size_t i = slot(key);
+   if (slots_[i] != 0)
+   {
+      Entry &e = entries_[slots_[i] - 1];
+      size_ += e.second == nullptr;
+      e.second = symb;
+   }
+   else
+   {
+      entries_.push_back(Entry(key, symb));
+      slots_[i] = (unsigned)entries_.size();
+      ++size_;
+   }
+   sorted_valid_ = false;
+}
+
+void SymTable::erase(const std::string *key)
+{
+   if (slots_.empty())
+      return;
+   size_t i = slot(key);
+   if (slots_[i] == 0 || entries_[slots_[i] - 1].second == nullptr)
+      return;
+   entries_[slots_[i] - 1].second = nullptr;
+   --size_;
+   erased_ = true;
+   sorted_valid_ = false;
+}
+
+Symbol *SymTable::p_find(const std::string *key) const
+{
+   if (slots_.empty())
+      return nullptr;
+   size_t i = slot(key);
+   return slots_[i] != 0 ? entries_[slots_[i] - 1].second : nullptr;
+}
+
+//Looks through this scope and then the ones around it; scope is set to the table the
+//symbol was found in.
+Symbol *SymTable::lookup(const std::string *key, SymTable *&scope)
+{
+   for (scope = this; scope != nullptr; scope = scope->outer_)
+   {
+      auto s = scope->p_find(key);
+      if (s)
+         return s;
+   }
    return nullptr;
 }
 
-void SymTable::print_var_table(std::ofstream &output, bool is_block)
+const std::vector<SymTable::Entry> &SymTable::in_order()
+{
+   if (erased_)
+      rehash(slots_.size());
+   return entries_;
+}
+
+const std::vector<SymTable::Entry> &SymTable::by_name()
+{
+   if (!sorted_valid_)
+   {
+      sorted_ = in_order();
+      std::sort(sorted_.begin(), sorted_.end(), [](const Entry &a, const Entry &b) { return *a.first < *b.first; });
+      sorted_valid_ = true;
+   }
+   return sorted_;
+}
+
+void SymTable::print_var_table(std::ostream &output, bool is_block)
 {
    output << "\n";
-   for each(const auto& it in table_)
+   for each(const auto& it in by_name())
    {
       if (is_block)
          output << "     ";
@@ -27,15 +119,15 @@ void SymTable::print_var_table(std::ofstream &output, bool is_block)
          {
             if (it.second->is_proc())
             {
-               output << it.first << "\t" << ((it.second->get_name() == "") ? "void" : it.second->get_type()->get_name()) << "\n";
+               output << *it.first << "\t" << ((it.second->get_name() == "") ? "void" : it.second->get_type()->get_name()) << "\n";
                it.second->print_local_table(output);
                it.second->print_block(output);
             }
             else if (it.second->get_type()->get_name() == "")
-               output << it.first << "\tvoid\n";
+               output << *it.first << "\tvoid\n";
             else if (it.second->get_type()->get_name() == "array")
             {
-               std::string mes = it.first;
+               std::string mes = *it.first;
                auto t = it.second->get_type();
                while (t->get_sym_type() == sym_array)
                {
@@ -48,23 +140,23 @@ void SymTable::print_var_table(std::ofstream &output, bool is_block)
                output << mes << "\n";
             }
             else if (it.second->get_type()->get_name() == "range")
-               output << it.first << "\t" << it.second->get_type()->get_name() << "from " << it.second->get_type()->get_left() << "to " << it.second->get_type()->get_right() << "\n";
+               output << *it.first << "\t" << it.second->get_type()->get_name() << "from " << it.second->get_type()->get_left() << "to " << it.second->get_type()->get_right() << "\n";
             else
-               output << it.first << "\t" << it.second->get_type()->get_name() << "\n";
+               output << *it.first << "\t" << it.second->get_type()->get_name() << "\n";
          }
          else
          {
             if(it.second->get_sym_type() == sym_record)
             {
-               output << it.first << "\t" << "record\n";
+               output << *it.first << "\t" << "record\n";
                it.second->get_sub_table()->print_var_table(output, true);
                output << "end\n";
             }
             else if (it.second->get_sym_type() == sym_array)
-               output << it.first << "\tarray of " << it.second->get_element_type()->get_name() << "[" << it.second->get_size() << "]\n";
-            else if (it.first == "integer")
+               output << *it.first << "\tarray of " << it.second->get_element_type()->get_name() << "[" << it.second->get_size() << "]\n";
+            else if (*it.first == "integer")
                output << "integer\tinteger\n";
-            else if (it.first == "double")
+            else if (*it.first == "double")
                output << "double\tdouble\n";
             else if (it.second->get_sym_type() == sym_int)
                output << it.second->get_name() << "\tinteger" << "\n";
@@ -72,7 +164,7 @@ void SymTable::print_var_table(std::ofstream &output, bool is_block)
                output << it.second->get_name() << "\tdouble" << "\n";
             else if (it.second->is_proc())
             {
-               output << it.first << "\t" << ((it.second->get_name() == "") ? "void" : it.second->get_type()->get_name());
+               output << *it.first << "\t" << ((it.second->get_name() == "") ? "void" : it.second->get_type()->get_name());
                it.second->print_local_table(output);
                it.second->print_block(output);
             }
@@ -83,8 +175,11 @@ void SymTable::print_var_table(std::ofstream &output, bool is_block)
    }
 }
 
+//A variable starts on its own size, up to that of a double: it may follow a string, and a
+//load or store across a line of the cache costs as much as a few.
 void SymVar::generate(const std::shared_ptr<Generator> &gen)
 {
+   gen->push_string(type_->get_size() % sizeof(double) ? "\talign 4\n" : "\talign 8\n");
    std::string str = "\tv_" + name_ + " ";
    gen->push_string(str);
    type_->generate(gen);
@@ -99,55 +194,45 @@ void SymConst::generate(const std::shared_ptr<Generator> &gen)
       gen->push_const_decl("dc_" + tmp, " dq " + value_ + "\n");
 }
 
-size_t SymArray::get_number_element()
-{
-   if(element_type_->get_sym_type() == sym_double)
-      return size_ * 2;
-   if (element_type_->get_sym_type() == sym_int)
-      return size_;
-   return element_type_->get_number();
-}
-
-std::shared_ptr<SymType> SymArray::get_element_k_type(size_t k) const 
+SymArray::SymArray(const std::string &n, SymType *s, size_t t): SymType(n), element_type_(s), size_(t)
 {
-   if (k == 1)
-      return element_type_;
-   auto st = element_type_;
-   for (size_t i = 1; i < k; ++i)
-      st = st->get_type();
-   return st;
+   bytes_ = size_ * element_type_->get_size();
+   number_ = size_ * (element_type_->get_size() / sizeof(size_t));
+   if (element_type_->get_sym_type() == sym_double)
+      number_element_ = size_ * 2;
+   else if (element_type_->get_sym_type() == sym_int)
+      number_element_ = size_;
+   else
+      number_element_ = element_type_->get_number();
+   for (auto st = element_type_; ; st = st->get_type())
+   {
+      dims_.push_back(st);
+      strides_.push_back(st->get_size());
+      if (st->get_sym_type() != sym_array)
+         break;
+   }
 }
 
-size_t SymArray::get_element_size(size_t k) const
+SymStruct::SymStruct(const std::string &n, SymTable *st): SymType(n), fields_(st), size_(0)
 {
-   if (k == 1)
-      return element_type_->get_size();
-   auto st = element_type_;
-   for (size_t i = 1; i < k; ++i)
-      st = st->get_type();
-   return st->get_size();
+   for each(const auto& it in fields_->in_order())
+      size_ += it.second->get_type()->get_size();
 }
 
-std::shared_ptr<SymType> SymArray::get_element_type() const
+SymType *no_type()
 {
-   if (element_type_->get_sym_type() == sym_array)
-      return element_type_->get_element_type();
-   return element_type_;
+   static SymType type;
+   return &type;
 }
 
-size_t SymStruct::get_size()
+SymType *literal_int_type()
 {
-   size_t size = 0;
-   for each(const auto& it in fields_->get_table())
-      size += it.second->get_type()->get_size();
-   return size;
+   static Int type("integer");
+   return &type;
 }
 
-void SymTable::generate(const std::shared_ptr<Generator> &gen)
+SymType *literal_double_type()
 {
-   for each(const auto& it in table_)
-   {
-      if(it.second->is_used())
-         it.second->generate(gen);
-   }
+   static Double type("double");
+   return &type;
 }
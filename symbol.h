@@ -17,24 +17,25 @@ class Symbol
 {
 protected:
    std::string name_;
-   bool used_;
+   size_t used_;
 public:
-   Symbol(const std::string &n = "", bool u = false): name_(n), used_(u) {}
+   Symbol(const std::string &n = "", bool u = false): name_(n), used_(u ? 1 : 0) {}
    virtual ~Symbol(){}
    virtual std::string get_name() const { return name_; }
    bool operator ==(Symbol s) { return (name_ == s.name_); }
    virtual bool is_proc() const { return false; }
-   virtual void print_block(std::ofstream &output) { return; }
-   virtual void print_local_table(std::ofstream &output) { return; }
+   virtual void print_block(std::ostream &output) { return; }
+   virtual void print_local_table(std::ostream &output) { return; }
    virtual SymTypes get_sym_type() const  { return sym_none; }
    virtual size_t get_size() { return 0; }
-   virtual std::shared_ptr<SymType> get_type() const { return nullptr; }
-   virtual std::shared_ptr<SymTable> get_sub_table() const { return nullptr; }
-   virtual std::shared_ptr<SymType> get_element_type() const { return nullptr; }
-   virtual std::shared_ptr<SymType> get_element_i_type(int i) const { return nullptr; }
+   virtual SymType *get_type() const { return nullptr; }
+   virtual SymTable *get_sub_table() const { return nullptr; }
+   virtual SymType *get_element_type() const { return nullptr; }
+   virtual SymType *get_element_i_type(int i) const { return nullptr; }
    virtual void generate(const std::shared_ptr<Generator> &gen) {};
-   void set_used() { used_ = true; }
-   bool is_used() { return used_; }
+   void set_used() { ++used_; }
+   void release() { --used_; }
+   bool is_used() { return used_ != 0; }
 };
 
 class SymType: public Symbol 
@@ -43,7 +44,7 @@ public:
    SymType(const std::string &n = ""): Symbol(n) {}
    ~SymType(){}
     virtual size_t get_element_size(size_t k) const { return 0; }
-    virtual std::shared_ptr<SymType> get_element_k_type(size_t k) const { return nullptr; }
+    virtual SymType *get_element_k_type(size_t k) const { return nullptr; }
     void set_name(const std::string &n) { name_ = n; }
     virtual int get_left() const { return 0; }
     virtual int get_right() const { return 0; }
@@ -51,38 +52,52 @@ public:
     virtual size_t get_number_element() { return 0; }
 };
 
+//Keyed by interned spellings: two keys name the same symbol exactly when they are the
+//same pointer, so a lookup hashes the address and never compares characters. Entries
+//are kept in the order they were declared; by_name() gives the order the listing and the
+//data section have always been written in. A table may sit inside an outer scope.
 class SymTable
 {
-protected:
-   std::map<std::string, std::shared_ptr<Symbol>> table_; 
 public:
-   SymTable() {}
+   typedef std::pair<const std::string *, Symbol *> Entry;
+private:
+   std::vector<Entry> entries_;
+   std::vector<unsigned> slots_;
+   std::vector<Entry> sorted_;
+   size_t size_;
+   bool erased_, sorted_valid_;
+   SymTable *outer_;
+   size_t slot(const std::string *key) const;
+   void rehash(size_t capacity);
+public:
+   SymTable(SymTable *outer = nullptr): size_(0), erased_(false), sorted_valid_(true), outer_(outer) {}
    ~SymTable() {}
-   void insert(const std::shared_ptr<Symbol> &symb) { table_[symb->get_name()] = symb; }
-   void insert(const std::string &key, const std::shared_ptr<Symbol> &symb) { table_[key] = symb; }
-   void insert(const Token &key, const std::shared_ptr<Symbol> &symb) { table_[key.get_string()] = symb; }
-   void erase(const std::string &key) { table_.erase(key); }
-   size_t find(const Token &key) { return table_.count(key.get_string()); }
-   size_t find(const std::string &key) { return table_.count(key); }
-   std::map<std::string, std::shared_ptr<Symbol>> &get_table() { return table_; }
-   std::shared_ptr<Symbol> p_find(const Token &key);
-   std::shared_ptr<Symbol> p_find(const std::string &key);
-   void print_var_table(std::ofstream &output, bool is_block = false);
-   void generate(const std::shared_ptr<Generator> &gen);
+   void insert(const std::string *key, Symbol *symb);
+   void insert(const Token &key, Symbol *symb) { insert(&key.get_string(), symb); }
+   void erase(const std::string *key);
+   bool find(const std::string *key) const { return p_find(key) != nullptr; }
+   bool find(const Token &key) const { return find(&key.get_string()); }
+   Symbol *p_find(const std::string *key) const;
+   Symbol *p_find(const Token &key) const { return p_find(&key.get_string()); }
+   Symbol *lookup(const std::string *key, SymTable *&scope);
+   bool empty() const { return size_ == 0; }
+   const std::vector<Entry> &in_order();
+   const std::vector<Entry> &by_name();
+   void print_var_table(std::ostream &output, bool is_block = false);
 };
 
 class SymVar: public Symbol 
 {
-   std::shared_ptr<SymType> type_;
+   SymType *type_;
    int offset_;
    bool global_, var_arg_;
 public:
-   SymVar(const std::string &n, const std::shared_ptr<SymType> &t, int os = 0, bool gl = true, bool isv = false):
+   SymVar(const std::string &n, SymType *t, int os = 0, bool gl = true, bool isv = false):
       Symbol(n), type_(t), offset_(os), global_(gl), var_arg_(isv) {}
    ~SymVar() {}
-   std::shared_ptr<SymType> get_type() const { return type_; }
-   std::shared_ptr<SymType> get_element_type() const { return type_->get_element_type(); }
-   std::shared_ptr<SymType> get_element_k_type(size_t k) { return type_->get_element_k_type(k); }
+   SymType *get_type() const { return type_; }
+   SymType *get_element_type() const { return type_->get_element_type(); }
+   SymType *get_element_k_type(size_t k) { return type_->get_element_k_type(k); }
    bool is_global() { return global_; }
    bool is_var_arg() { return var_arg_; }
    int get_offset() { return offset_; }
@@ -125,34 +140,40 @@ public:
    void generate(const std::shared_ptr<Generator> &gen) { gen->push_string("\tdq ?\n"); }
 };
 
+//A type is complete once it is made, so the layout is worked out in the constructor:
+//dims_[k - 1] is the type an index k deep reaches and strides_[k - 1] its size.
 class SymArray: public SymType 
 {
    size_t size_;
-   std::shared_ptr<SymType> element_type_;
+   SymType *element_type_;
+   size_t bytes_, number_, number_element_;
+   std::vector<SymType *> dims_;
+   std::vector<size_t> strides_;
 public:
-   SymArray(const std::string &n, const std::shared_ptr<SymType> &s, size_t t = 0): SymType(n), element_type_(s), size_(t) {}
+   SymArray(const std::string &n, SymType *s, size_t t = 0);
    ~SymArray() {}
-   std::shared_ptr<SymType> get_element_type() const ;
-   size_t get_element_size(size_t k) const;
-   std::shared_ptr<SymType> get_element_k_type(size_t k) const;
-   std::shared_ptr<SymType> get_type() const { return element_type_; }
-   size_t get_number() { return size_ * (element_type_->get_size() / sizeof(size_t)); }
-   size_t get_number_element();
+   SymType *get_element_type() const { return dims_.back(); }
+   size_t get_element_size(size_t k) const { return strides_[k - 1]; }
+   SymType *get_element_k_type(size_t k) const { return k <= dims_.size() ? dims_[k - 1] : nullptr; }
+   SymType *get_type() const { return element_type_; }
+   size_t get_number() { return number_; }
+   size_t get_number_element() { return number_element_; }
    SymTypes get_sym_type() const  { return sym_array; }
-   size_t get_size() { return size_ * element_type_->get_size(); }
+   size_t get_size() { return bytes_; }
    std::string get_name() const { return name_;   }
    void generate(const std::shared_ptr<Generator> &gen) { gen->push_string("\tdb " + boost::lexical_cast<std::string>(get_size()) + " dup(?)\n"); }
 };
 
 class SymStruct: public SymType 
 {
-   std::shared_ptr<SymTable> fields_;
+   SymTable *fields_;
+   size_t size_;
 public:
-   SymStruct(const std::string &n, const std::shared_ptr<SymTable> &st): SymType(n), fields_(st) {}
+   SymStruct(const std::string &n, SymTable *st);
    ~SymStruct() {}
-   std::shared_ptr<SymTable> get_sub_table() const { return fields_; }
+   SymTable *get_sub_table() const { return fields_; }
    SymTypes get_sym_type() const  { return sym_record; }
-   size_t get_size();
+   size_t get_size() { return size_; }
    std::string get_name() const { return name_; }
    size_t get_number() { return get_size()/sizeof(size_t); }
    void generate(const std::shared_ptr<Generator> &gen) { gen->push_string("\tdb " + boost::lexical_cast<std::string>(get_size()) + " dup(?)\n"); }
@@ -163,13 +184,21 @@ class SymConst: public Symbol
 {
    std::string value_;
    int const_num_;
-   std::shared_ptr<SymType> const_type_;
+   SymType *const_type_;
 public:
-   SymConst(int k, const std::string &s, const std::shared_ptr<SymType> &st): const_num_(k), value_(s), const_type_(st) {set_used();}
+   SymConst(int k, const std::string &s, SymType *st): const_num_(k), value_(s), const_type_(st) {set_used();}
    ~SymConst() {}
-   std::shared_ptr<SymType> get_type() const { return const_type_; }
+   SymType *get_type() const { return const_type_; }
    std::string get_name() const { return const_type_->get_name(); }
+   int get_number() const { return const_num_; }
+   void set_number(int k) { const_num_ = k; }
    void generate(const std::shared_ptr<Generator> &gen);
 };
 
+//Types owned by no declaration: the placeholder of untyped expressions and procedures,
+//and the types of literal constants. They are shared and never renamed.
+SymType *no_type();
+SymType *literal_int_type();
+SymType *literal_double_type();
+
 #endif
\ No newline at end of file
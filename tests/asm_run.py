@@ -0,0 +1,169 @@
+# Runs the code the compiler generates: its MASM listing is rewritten for the GNU
+# assembler, linked with asm_runtime.c into a 32-bit static executable and run. Needs
+# "as --32", "ld -m elf_i386" and "gcc -m32 -c"; no 32-bit C library.
+# usage: python3 asm_run.py <compiler> <-g|-o> <file.pas>   (prints what the program prints)
+import os
+import re
+import shutil
+import subprocess
+import sys
+import tempfile
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+DATA = re.compile(r"^\s*(\w+)\s+(db|dd|dq)\s+(.*)$")
+
+
+def split_args(text):
+    """Splits at the commas outside quotes."""
+    args, cur, quote = [], "", None
+    for c in text:
+        if quote:
+            cur += c
+            if c == quote:
+                quote = None
+        elif c in "'\"":
+            quote = c
+            cur += c
+        elif c == ",":
+            args.append(cur.strip())
+            cur = ""
+        else:
+            cur += c
+    if cur.strip():
+        args.append(cur.strip())
+    return args
+
+
+def data_lines(name, kind, rest):
+    out = ["%s:" % name]
+    if kind == "dd":
+        out.append("   .long 0")
+    elif kind == "dq":
+        out.append("   .double %s" % ("0" if rest.strip() == "?" else rest.strip()))
+    else:
+        for item in split_args(rest):
+            m = re.match(r"(\d+) dup\(\?\)", item)
+            if m:
+                out.append("   .fill %s, 1, 0" % m.group(1))
+            elif item[0] in "'\"":
+                body = item[1:-1]
+                if body:
+                    out.append("   .byte %s" % ", ".join(str(ord(c)) for c in body))
+            elif item.lower().endswith("h"):
+                out.append("   .byte %d" % int(item[:-1], 16))
+            else:
+                out.append("   .byte %s" % item)
+    return out
+
+
+def high_half(operand):
+    """The second dword of a qword operand."""
+    operand = operand.replace("qword ptr", "dword ptr")
+    if operand.endswith("]"):
+        return operand[:-1] + " + 4]"
+    return operand + "+4"
+
+
+def translate(asm):
+    lines = asm.split("\n")
+    sizes = {}
+    for line in lines:
+        m = DATA.match(line)
+        if m:
+            sizes[m.group(1)] = m.group(2)
+    out = [".intel_syntax noprefix", ".text", ".globl _start"]
+    # Data goes to a section of its own: stores next to code would be taken for code that
+    # modifies itself, which slows the code down by a lot.
+    data = [".data"]
+    for i, line in enumerate(lines):
+        s = line.strip()
+        if not s or s.startswith("end start") or s.endswith(" endp"):
+            continue
+        if s.startswith("include") and "start.inc" in s:
+            out.append("_start:")
+            continue
+        if s.startswith("include") and "end.inc" in s:
+            out.append("   call rt_exit")
+            continue
+        m = DATA.match(line)
+        if m:
+            data += data_lines(*m.groups())
+            continue
+        if s.endswith(" proc near"):
+            out.append(s.split()[0] + ":")
+            continue
+        if s.endswith(":"):
+            out.append(s)
+            continue
+        if s.startswith("align "):
+            # An align before a variable is one of the data.
+            ahead = next((x for x in lines[i + 1:] if x.strip()), "")
+            (data if DATA.match(ahead) else out).append("   .balign " + s[6:].strip())
+            continue
+        if s.startswith("rep "):
+            out.append("   rep " + s[4:].strip())
+            continue
+        parts = s.split(None, 1)
+        cmd, ops = parts[0], parts[1] if len(parts) > 1 else ""
+        if cmd == "call" and "," in ops:
+            args = split_args(ops)
+            for a in reversed(args[1:]):
+                if a.startswith("offset ") or re.match(r"^e[a-z]{2}$", a):
+                    out.append("   push %s" % a)
+                elif sizes.get(a) == "dq":
+                    out.append("   push dword ptr %s+4" % a)
+                    out.append("   push dword ptr %s" % a)
+                else:
+                    out.append("   push dword ptr %s" % a)
+            out.append("   call %s" % args[0])
+        elif cmd == "push" and "qword ptr" in ops:
+            out.append("   push %s" % high_half(ops))
+            out.append("   push %s" % ops.replace("qword ptr", "dword ptr"))
+        elif cmd == "pop" and "qword ptr" in ops:
+            out.append("   pop %s" % ops.replace("qword ptr", "dword ptr"))
+            out.append("   pop %s" % high_half(ops))
+        else:
+            out.append("   %s %s" % (cmd, ops))
+    return "\n".join(out + data) + "\n"
+
+
+def build(asm_text, exe, work):
+    runtime = os.path.join(work, "asm_runtime.o")
+    if not os.path.exists(runtime):
+        subprocess.run(["gcc", "-m32", "-O2", "-msse2", "-mfpmath=sse", "-ffreestanding", "-fno-pic", "-fno-stack-protector", "-c",
+                        os.path.join(HERE, "asm_runtime.c"), "-o", runtime], check=True)
+    src, obj = exe + ".s", exe + ".o"
+    with open(src, "w") as f:
+        f.write(translate(asm_text))
+    for command in (["as", "--32", src, "-o", obj], ["ld", "-m", "elf_i386", "-N", "-e", "_start", obj, runtime, "-o", exe]):
+        p = subprocess.run(command, capture_output=True, text=True)
+        if p.returncode:
+            raise RuntimeError("%s failed on %s:\n%s" % (command[0], src, p.stderr))
+
+
+def compile_and_run(compiler, mode, source, work, name="f", timeout=20):
+    """Compiles source with mode and runs it: (compiler output file, program output)."""
+    pas = os.path.join(work, name + ".pas")
+    with open(pas, "w") as f:
+        f.write(source)
+    subprocess.run([compiler, mode, name + ".pas"], cwd=work, capture_output=True, timeout=60)
+    with open(os.path.join(work, name + ".asm")) as f:
+        asm = f.read()
+    exe = os.path.join(work, name + mode.replace("-", "_"))
+    build(asm, exe, work)
+    p = subprocess.run([exe], capture_output=True, timeout=timeout)
+    return asm, p.stdout.decode("latin-1") + ("" if p.returncode == 0 else "<exit %d>" % p.returncode)
+
+
+def main():
+    compiler = os.path.abspath(sys.argv[1])
+    work = tempfile.mkdtemp()
+    try:
+        with open(sys.argv[3]) as f:
+            print(compile_and_run(compiler, sys.argv[2], f.read(), work)[1], end="")
+    finally:
+        shutil.rmtree(work)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,100 @@
+/* The little of the C library that generated programs call, for running them on Linux
+   as 32-bit static executables (see asm_run.py). printf knows %d, %f and %s; the output
+   is buffered and written when the program ends. */
+#include <stdarg.h>
+
+static char out[1 << 20];
+static int used;
+
+static void put(char c)
+{
+   if (used < (int)sizeof(out))
+      out[used++] = c;
+}
+
+/* 32-bit arithmetic only: there is no libgcc for 64-bit division. */
+static void put_unsigned(unsigned n, int width)
+{
+   char digits[12];
+   int k = 0;
+   do
+      digits[k++] = (char)('0' + n % 10);
+   while ((n /= 10) || k < width);
+   while (k)
+      put(digits[--k]);
+}
+
+static void put_double(double d)
+{
+   if (d != d)
+   {
+      put('n'); put('a'); put('n');
+      return;
+   }
+   if (d < 0)
+   {
+      put('-');
+      d = -d;
+   }
+   if (d >= 1e18)
+   {
+      put('i'); put('n'); put('f');
+      return;
+   }
+   d += 0.0000005;
+   unsigned high = (unsigned)(d / 1e9);
+   double low = d - (double)high * 1e9;
+   unsigned whole = (unsigned)low;
+   if (high)
+      put_unsigned(high, 0);
+   put_unsigned(whole, high ? 9 : 0);
+   put('.');
+   put_unsigned((unsigned)((low - whole) * 1e6), 6);
+}
+
+int printf(const char *format, ...)
+{
+   va_list args;
+   va_start(args, format);
+   for (const char *p = format; *p; ++p)
+   {
+      if (*p != '%' || !p[1])
+      {
+         put(*p);
+         continue;
+      }
+      switch (*++p)
+      {
+         case 'd':
+         {
+            int n = va_arg(args, int);
+            if (n < 0)
+               put('-');
+            put_unsigned(n < 0 ? 0u - (unsigned)n : (unsigned)n, 0);
+            break;
+         }
+         case 'f':
+            put_double(va_arg(args, double));
+            break;
+         case 's':
+            for (const char *s = va_arg(args, const char *); *s; ++s)
+               put(*s);
+            break;
+         default:
+            put(*p);
+      }
+   }
+   va_end(args);
+   return 0;
+}
+
+void rt_exit(void)
+{
+   for (int done = 0, n; done < used; done += n)
+   {
+      __asm__ volatile("int $0x80" : "=a"(n) : "a"(4), "b"(1), "c"(out + done), "d"(used - done) : "memory");
+      if (n <= 0)
+         break;
+   }
+   __asm__ volatile("int $0x80" : : "a"(1), "b"(0));
+}
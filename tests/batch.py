@@ -0,0 +1,56 @@
+# Differential test of batch compilation: generated programs (some with errors) are
+# compiled one at a time, then all at once from the command line and from an @response
+# file on 1 and 4 threads. Every file must give the same output either way, errors too.
+# usage: python3 batch.py <compiler> [programs=60] [first seed=0]
+import os
+import shutil
+import subprocess
+import sys
+import tempfile
+
+from gen_program import gen_program
+
+
+def read(path):
+    with open(path, "rb") as f:
+        return f.read()
+
+
+def main():
+    compiler = os.path.abspath(sys.argv[1])
+    count = int(sys.argv[2]) if len(sys.argv) > 2 else 60
+    first = int(sys.argv[3]) if len(sys.argv) > 3 else 0
+    work = tempfile.mkdtemp()
+    names = ["f%d.pas" % seed for seed in range(first, first + count)]
+    bad = 0
+    try:
+        for name, seed in zip(names, range(first, first + count)):
+            with open(os.path.join(work, name), "w") as f:
+                f.write(gen_program(seed))
+        with open(os.path.join(work, "all.txt"), "w") as f:
+            f.write("\n".join(names) + "\n")
+        for mode in ("-l", "-p", "-g", "-o"):
+            single = {}
+            for name in names:
+                subprocess.run([compiler, mode, name], cwd=work, capture_output=True, timeout=30)
+                single[name] = read(os.path.join(work, name[:-3] + "asm"))
+            for args in (names + ["-j", "1"], ["@all.txt", "-j", "4"]):
+                p = subprocess.run([compiler, mode] + args, cwd=work, capture_output=True, timeout=300, text=True)
+                report = p.stdout.splitlines()
+                if len(report) != count + 1 or not report[-1].startswith("%d files" % count):
+                    bad += 1
+                    print("%s %s: bad report %r" % (mode, args[-3], report[-1:]))
+                    continue
+                for name, line in zip(names, report):
+                    batch = read(os.path.join(work, name[:-3] + "asm"))
+                    if batch != single[name] or (": compiled in " in line) != (b"Error" not in batch):
+                        bad += 1
+                        print("%s %s %s differs (%s)" % (mode, " ".join(args[-2:]), name, line))
+    finally:
+        shutil.rmtree(work)
+    print("%d differences in %d programs" % (bad, count))
+    return 1 if bad else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,57 @@
+//Allocation benchmark: add this file to the compiler build next to main.cpp.
+//Every operator new is counted, and at exit the count, the bytes asked for
+//and the peak resident set are printed to stderr, e.g.
+//   compiler -g big.pas        (big.pas from tests/gen_bench.py 20000)
+//   ALLOC new=1234 bytes=5678 peak=9012kB
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <atomic>
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <sys/resource.h>
+#endif
+
+static std::atomic<size_t> new_count(0), new_bytes(0);
+
+static void *counted(size_t size)
+{
+   ++new_count;
+   new_bytes += size;
+   void *p = malloc(size ? size : 1);
+   if (p == nullptr)
+      throw std::bad_alloc();
+   return p;
+}
+
+void *operator new(size_t size) { return counted(size); }
+void *operator new[](size_t size) { return counted(size); }
+void operator delete(void *p) noexcept { free(p); }
+void operator delete[](void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+void operator delete[](void *p, size_t) noexcept { free(p); }
+
+static size_t peak_kb()
+{
+#ifdef _WIN32
+   PROCESS_MEMORY_COUNTERS counters;
+   GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters));
+   return counters.PeakWorkingSetSize / 1024;
+#else
+   rusage usage;
+   getrusage(RUSAGE_SELF, &usage);
+   return (size_t)usage.ru_maxrss;
+#endif
+}
+
+//Destroyed at exit, so a run that stops at an error is reported too.
+static struct AllocReport
+{
+   ~AllocReport()
+   {
+      fprintf(stderr, "ALLOC new=%zu bytes=%zu peak=%zukB\n", (size_t)new_count, (size_t)new_bytes, peak_kb());
+   }
+} report;
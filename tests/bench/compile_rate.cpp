@@ -0,0 +1,55 @@
+//Library benchmark and reentrancy check: build with the compiler sources in place of
+//main.cpp, then run it on some programs (tests/gen_program.py makes them):
+//   compile_rate <-l|-p|-g|-o> <threads> <rounds> f1.pas f2.pas ...
+//Every thread compiles every file each round with a compiler of its own, and each output
+//has to match the first one made for that file. The compilations a second are reported.
+#include "compiler.h"
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <thread>
+
+int main(int argc, char **argv)
+{
+   CompileMode mode;
+   if (argc < 5 || !compile_mode(argv[1], mode))
+   {
+      std::cout << "usage: compile_rate <-l|-p|-g|-o> <threads> <rounds> <file.pas>..." << std::endl;
+      return 1;
+   }
+   unsigned threads = std::max(atoi(argv[2]), 1);
+   int rounds = atoi(argv[3]);
+   std::vector<std::string> sources(argv + 4, argv + argc), expected(sources.size());
+   std::vector<CompileOptions> options(sources.size(), CompileOptions(mode));
+   Compiler first;
+   for (size_t i = 0; i < sources.size(); ++i)
+   {
+      options[i].name = sources[i];
+      if (!read_source(argv[4 + i], sources[i]))
+      {
+         std::cout << "Error opening file " << argv[4 + i] << std::endl;
+         return 1;
+      }
+      expected[i] = first.compile(sources[i], options[i]).output;
+   }
+   std::atomic<size_t> differences(0);
+   auto start = std::chrono::steady_clock::now();
+   auto work = [&]()
+   {
+      Compiler compiler;
+      for (int r = 0; r < rounds; ++r)
+         for (size_t i = 0; i < sources.size(); ++i)
+            if (compiler.compile(sources[i], options[i]).output != expected[i])
+               ++differences;
+   };
+   std::vector<std::thread> workers;
+   for (unsigned t = 1; t < threads; ++t)
+      workers.emplace_back(work);
+   work();
+   for each (auto &w in workers)
+      w.join();
+   double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+   size_t count = threads * rounds * sources.size();
+   printf("%zu compilations, %zu differences, %.1f ms, %.0f a second\n", count, (size_t)differences, seconds * 1e3, count / seconds);
+   return differences ? 1 : 0;
+}
@@ -0,0 +1,204 @@
+# How fast the code of -g and of -o runs: small kernels (loops over globals and arrays,
+# calls, locals of a function, doubles, division, expressions over several values live at
+# once, expressions deeper on the left than on the right, loops and ifs on comparisons) are
+# compiled both ways and run through asm_run.py; both have to print the same, and the best
+# time of each is reported.
+# usage: python3 kernel_speed.py <compiler> [runs]
+import os
+import shutil
+import subprocess
+import sys
+import tempfile
+import time
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), ".."))
+from asm_run import build
+
+KERNELS = {
+    "arith": """var r: integer;
+function mix(n: integer): integer;
+var i, a, b, c, s: integer;
+begin
+   s := 0;
+   a := 3;
+   b := 5;
+   c := 7;
+   for i := 1 to n do
+   begin
+      a := (((a * 7) + (b xor i)) and 65535);
+      b := (((b + (a * c)) - (i and 255)) and 65535);
+      c := (((c xor (a + b)) + 1) and 1023);
+      s := ((s + ((a + b) * c)) and 1048575);
+   end;
+   result := s;
+end;
+begin
+   r := mix(20000000);
+   writeln(r);
+end.
+""",
+    "tree": """var r: integer;
+function tree(n: integer): integer;
+var i, a, b, c, d, s: integer;
+begin
+   s := 0;
+   a := 3;
+   b := 5;
+   c := 7;
+   d := 11;
+   for i := 1 to n do
+   begin
+      a := ((((a - b) * (c - d)) + ((a xor c) * (b or d))) - (i and 255)) and 65535;
+      b := ((((b - c) * (d - a)) - ((b and i) * (c xor a))) + (a - c)) and 65535;
+      s := (s + ((((a - d) * (b - c)) xor ((a + c) * (b - d))) - (s and 7))) and 1048575;
+   end;
+   result := s;
+end;
+begin
+   r := tree(10000000);
+   writeln(r);
+end.
+""",
+    "branches": """var i, n, total: integer;
+begin
+   total := 0;
+   i := 1;
+   while i < 100000 do
+   begin
+      n := i;
+      while n <> 1 do
+      begin
+         if (n and 1) = 0 then
+            n := n div 2
+         else
+            n := ((3 * n) + 1);
+         total := (total + 1);
+      end;
+      i := (i + 1);
+   end;
+   writeln(total);
+end.
+""",
+    "loop": """var i, s: integer;
+begin
+   s := 0;
+   for i := 1 to 30000000 do
+      s := (s + ((i * 3) and 7));
+   writeln(s);
+end.
+""",
+    "sieve": """var flags: array[1..50000] of integer;
+var i, j, k, count, round: integer;
+begin
+   for round := 1 to 40 do
+   begin
+      for i := 1 to 50000 do
+         flags[i] := 1;
+      count := 0;
+      for i := 2 to 50000 do
+         if (flags[i] = 1) then
+         begin
+            count := (count + 1);
+            j := (i + i);
+            while (j <= 50000) do
+            begin
+               flags[j] := 0;
+               j := (j + i);
+            end;
+         end;
+   end;
+   writeln(count);
+end.
+""",
+    "calls": """var i, s: integer;
+function step(x: integer): integer;
+begin
+   result := (((x * x) + 7) and 1023);
+end;
+begin
+   s := 0;
+   for i := 1 to 5000000 do
+      s := (s + step(i));
+   writeln(s);
+end.
+""",
+    "locals": """var r: integer;
+function work(n: integer): integer;
+var i, s, t: integer;
+begin
+   s := 0;
+   t := 1;
+   for i := 1 to n do
+   begin
+      if ((i and 3) = 0) then
+         s := (s + i)
+      else
+         s := (s - t);
+      t := ((t * 5) and 255);
+   end;
+   result := s;
+end;
+begin
+   r := work(30000000);
+   writeln(r);
+end.
+""",
+    "doubles": """var i: integer;
+var d, e: double;
+begin
+   d := 0.0;
+   e := 1.5;
+   for i := 1 to 10000000 do
+   begin
+      d := ((d * 0.5) + e);
+      e := (e + 0.25);
+   end;
+   writeln(d);
+end.
+""",
+    "division": """var i, s: integer;
+begin
+   s := 0;
+   for i := 1 to 10000000 do
+      s := (s + ((i div 7) mod 16));
+   writeln(s);
+end.
+""",
+}
+
+
+def main():
+    compiler = os.path.abspath(sys.argv[1])
+    runs = int(sys.argv[2]) if len(sys.argv) > 2 else 3
+    work = tempfile.mkdtemp()
+    failed = 0
+    try:
+        print("%-10s %10s %10s %8s" % ("kernel", "-g ms", "-o ms", "speedup"))
+        for name, source in sorted(KERNELS.items()):
+            with open(os.path.join(work, name + ".pas"), "w") as f:
+                f.write(source)
+            best, outputs = {}, {}
+            for mode in ("-g", "-o"):
+                subprocess.run([compiler, mode, name + ".pas"], cwd=work, capture_output=True, timeout=60)
+                with open(os.path.join(work, name + ".asm")) as f:
+                    asm = f.read()
+                exe = os.path.join(work, name + mode.replace("-", "_"))
+                build(asm, exe, work)
+                for _ in range(runs):
+                    start = time.perf_counter()
+                    p = subprocess.run([exe], capture_output=True, timeout=120)
+                    elapsed = time.perf_counter() - start
+                    best[mode] = min(best.get(mode, elapsed), elapsed)
+                outputs[mode] = p.stdout
+            if outputs["-g"] != outputs["-o"]:
+                failed += 1
+                print("%s prints %r with -g and %r with -o" % (name, outputs["-g"], outputs["-o"]))
+                continue
+            print("%-10s %10.1f %10.1f %7.2fx" % (name, best["-g"] * 1000, best["-o"] * 1000, best["-g"] / best["-o"]))
+    finally:
+        shutil.rmtree(work)
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
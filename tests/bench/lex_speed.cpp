@@ -0,0 +1,44 @@
+//Lexer throughput benchmark: build with the compiler sources in place of main.cpp,
+//then run it on a large program (tests/gen_bench.py 20000 > big.pas):
+//   lex_speed big.pas [runs]
+//The best of the runs is reported as tokens, milliseconds and MB/s of source.
+#include "scanner.h"
+#include <chrono>
+#include <cstdlib>
+
+int main(int argc, char **argv)
+{
+   if (argc < 2)
+   {
+      std::cout << "usage: lex_speed <file.pas> [runs]" << std::endl;
+      return 1;
+   }
+   int runs = argc > 2 ? atoi(argv[2]) : 5;
+   double best = 0;
+   size_t tokens = 0, bytes = 0;
+   for (int r = 0; r < runs; ++r)
+   {
+      FILE *input = _fsopen(argv[1], "r", _SH_DENYWR);
+      if (input == nullptr)
+      {
+         std::cout << "Error opening file" << std::endl;
+         return 1;
+      }
+      _fseeki64(input, 0, SEEK_END);
+      bytes = (size_t)_ftelli64(input);
+      rewind(input);
+      auto start = std::chrono::steady_clock::now();
+      Scanner scanner(input);
+      tokens = 0;
+      while (!scanner.is_eof())
+      {
+         scanner.next();
+         ++tokens;
+      }
+      double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+      if (r == 0 || seconds < best)
+         best = seconds;
+      fclose(input);
+   }
+   printf("%zu tokens, %.1f ms, %.1f MB/s\n", tokens, best * 1e3, bytes / best / 1e6);
+}
@@ -0,0 +1,48 @@
+//Parser benchmark: build with the compiler sources in place of main.cpp, then run it
+//on a program of many globals and functions (tests/gen_bench.py --symbols 5000 3000
+//> syms.pas) or on any other program:
+//   parse_speed syms.pas [runs]
+//Every run lexes and parses the file into a tree and symbol tables, and generates
+//nothing. The best of the runs is reported in milliseconds.
+#include "parser.h"
+#include <chrono>
+#include <cstdlib>
+#include <sstream>
+
+int main(int argc, char **argv)
+{
+   if (argc < 2)
+   {
+      std::cout << "usage: parse_speed <file.pas> [runs]" << std::endl;
+      return 1;
+   }
+   int runs = argc > 2 ? atoi(argv[2]) : 5;
+   double best = 0;
+   for (int r = 0; r < runs; ++r)
+   {
+      FILE *input = _fsopen(argv[1], "r", _SH_DENYWR);
+      if (input == nullptr)
+      {
+         std::cout << "Error opening file" << std::endl;
+         return 1;
+      }
+      std::ostringstream output;
+      auto start = std::chrono::steady_clock::now();
+      Scanner scanner(input);
+      fclose(input);
+      Parser parser(scanner, output);
+      try
+      {
+         parser.parse();
+      }
+      catch (const CompileError &e)
+      {
+         std::cout << e.message;
+         return 1;
+      }
+      double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+      if (r == 0 || seconds < best)
+         best = seconds;
+   }
+   printf("%.1f ms\n", best * 1e3);
+}
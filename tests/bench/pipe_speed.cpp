@@ -0,0 +1,47 @@
+//Lexer pipeline benchmark: build with the compiler sources in place of main.cpp, then
+//run it on a large program (tests/gen_bench.py 20000 > big.pas):
+//   pipe_speed <-p|-g|-o> big.pas [runs]
+//The file is compiled with the lexer on the parser's thread and on a thread of its own.
+//The best wall-clock time of the runs is reported for each, and the outputs must match.
+#include "compiler.h"
+#include <chrono>
+#include <cstdlib>
+
+static double best_time(const std::string &source, const CompileOptions &options, int runs, std::string &output)
+{
+   double best = 0;
+   for (int r = 0; r < runs; ++r)
+   {
+      auto start = std::chrono::steady_clock::now();
+      output = Compiler().compile(source, options).output;
+      double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+      if (r == 0 || seconds < best)
+         best = seconds;
+   }
+   return best;
+}
+
+int main(int argc, char **argv)
+{
+   CompileMode mode;
+   std::string source;
+   if (argc < 3 || !compile_mode(argv[1], mode) || mode == mode_lex)
+   {
+      std::cout << "usage: pipe_speed <-p|-g|-o> <file.pas> [runs]" << std::endl;
+      return 1;
+   }
+   if (!read_source(argv[2], source))
+   {
+      std::cout << "Error opening file" << std::endl;
+      return 1;
+   }
+   int runs = argc > 3 ? atoi(argv[3]) : 5;
+   CompileOptions options(mode);
+   std::string serial, piped;
+   double one = best_time(source, options, runs, serial);
+   options.pipeline = true;
+   double two = best_time(source, options, runs, piped);
+   printf("one thread %.1f ms, pipelined %.1f ms, %.2fx%s\n", one * 1e3, two * 1e3, one / two,
+          serial == piped ? "" : ", outputs differ");
+   return serial == piped ? 0 : 1;
+}
@@ -0,0 +1,47 @@
+//Streaming against batched lexing: build with the compiler sources in place of
+//main.cpp, then run it on a large program (tests/gen_bench.py 20000 > big.pas):
+//   stream_speed big.pas [runs]
+//Each of -p and -g compiles the file with tokens lexed as the parser reads them and
+//with all of them lexed up front (-b), in turns. The best of the runs is reported.
+#include "compiler.h"
+#include <chrono>
+#include <cstdlib>
+
+int main(int argc, char **argv)
+{
+   std::string source;
+   if (argc < 2)
+   {
+      std::cout << "usage: stream_speed <file.pas> [runs]" << std::endl;
+      return 1;
+   }
+   if (!read_source(argv[1], source))
+   {
+      std::cout << "Error opening file " << argv[1] << std::endl;
+      return 1;
+   }
+   int runs = argc > 2 ? atoi(argv[2]) : 3;
+   const CompileMode modes[] = { mode_parse, mode_generate };
+   for each (auto mode in modes)
+   {
+      double best[2] = { 0, 0 };
+      for (int r = 0; r < runs; ++r)
+         for (int batched = 0; batched < 2; ++batched)
+         {
+            CompileOptions options(mode);
+            options.tokenize = batched != 0;
+            Compiler compiler;
+            auto start = std::chrono::steady_clock::now();
+            CompileResult result = compiler.compile(source, options);
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            if (!result.ok)
+            {
+               std::cout << result.output;
+               return 1;
+            }
+            if (r == 0 || seconds < best[batched])
+               best[batched] = seconds;
+         }
+      printf("%s: streaming %.1f ms, batched %.1f ms\n", mode == mode_parse ? "-p" : "-g", best[0] * 1e3, best[1] * 1e3);
+   }
+}
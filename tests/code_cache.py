@@ -0,0 +1,69 @@
+# Differential test of the procedure code cache: generated programs and edits of them (a
+# statement added to one body, a double constant added ahead of the others, the record
+# fields swapped) are compiled with -g and -o, on one thread and on two, into one cache
+# directory. Every output must be the one compiled without the cache, and a last pass in
+# check mode must find no cached code that differs from the code generated again.
+# usage: python3 code_cache.py <compiler> [programs=20] [first seed=0]
+import os
+import random
+import re
+import shutil
+import subprocess
+import sys
+import tempfile
+
+from gen_program import gen_program
+
+
+def variants(seed):
+    base = gen_program(seed, valid=True)
+    r = random.Random(seed)
+    lines = base.split("\n")
+    begins = [i for i, line in enumerate(lines) if line == "begin"]
+    edited = list(lines)
+    edited.insert(r.choice(begins[:-1]) + 1, "   g0 := g0 + 1;")
+    shifted = list(lines)
+    shifted.insert(begins[0] + 1, "   d0 := 7.5;")
+    return [base, "\n".join(edited), "\n".join(shifted),
+            base.replace("fa: integer; fb: double;", "fb: double; fa: integer;")]
+
+
+def run(compiler, work, args):
+    p = subprocess.run([compiler] + args, cwd=work, capture_output=True, timeout=60, text=True)
+    with open(os.path.join(work, "f.asm"), "rb") as f:
+        return f.read(), p.stdout
+
+
+def main():
+    compiler = os.path.abspath(sys.argv[1])
+    count = int(sys.argv[2]) if len(sys.argv) > 2 else 20
+    first = int(sys.argv[3]) if len(sys.argv) > 3 else 0
+    work = tempfile.mkdtemp()
+    bad = hits = misses = 0
+    try:
+        for check in (False, True):
+            for seed in range(first, first + count):
+                for v, source in enumerate(variants(seed)):
+                    with open(os.path.join(work, "f.pas"), "w") as f:
+                        f.write(source)
+                    for mode in ("-g", "-o"):
+                        plain = run(compiler, work, [mode, "f.pas"])[0]
+                        for threads in ("1", "2"):
+                            args = [mode, "f.pas", "-j", threads, "--cache", "cache"] + (["--check"] if check else [])
+                            out, report = run(compiler, work, args)
+                            m = re.search(r"(\d+) hits, (\d+) misses(, (\d+) mismatches)?", report)
+                            if out != plain or not m or (check and m.group(4) != "0"):
+                                bad += 1
+                                print("seed %d variant %d %s -j %s%s differs: %s" % (seed, v, mode, threads, " --check" if check else "", report.strip()))
+                            elif not check:
+                                hits += int(m.group(1))
+                                misses += int(m.group(2))
+    finally:
+        shutil.rmtree(work)
+    print("%d hits, %d misses" % (hits, misses))
+    print("%d differences in %d programs" % (bad, count))
+    return 1 if bad else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,60 @@
+# Writes a large well-formed program for the benchmarks: n functions with
+# loops, conditions and array accesses, and a main block that calls each one.
+# usage: python3 gen_bench.py <functions> > big.pas   (20000 gives ~320k lines)
+# With --symbols it writes a program of many globals and functions instead, each
+# function 30 statements over random globals, parameters, locals and earlier functions,
+# to time the symbol tables with:
+#        python3 gen_bench.py --symbols <globals> <functions> > syms.pas
+import random
+import sys
+
+
+def symbols(globals_, functions):
+    r = random.Random(globals_ * 7919 + functions)
+    out = ["var %s: integer;" % ", ".join("v%d" % i for i in range(k, min(k + 20, globals_)))
+           for k in range(0, globals_, 20)]
+    for i in range(functions):
+        names = ["x", "y", "l0", "l1", "l2", "l3"]
+        out.append("function P%d(x: integer; y: integer): integer;\nvar l0, l1, l2, l3: integer;\nbegin" % i)
+        for _ in range(30):
+            operand = lambda: r.choice(names) if r.randrange(2) else "v%d" % r.randrange(globals_)
+            value = "%s + %s * %d" % (operand(), operand(), r.randrange(1, 9))
+            if i and r.randrange(4) == 0:
+                value = "P%d(%s, %s) - %s" % (r.randrange(i), operand(), operand(), operand())
+            target = r.choice(names[2:]) if r.randrange(2) else "v%d" % r.randrange(globals_)
+            out.append("   %s := %s;" % (target, value))
+        out.append("   result := l0 + v%d;\nend;" % r.randrange(globals_))
+    out.append("begin")
+    for i in range(0, functions, max(functions // 100, 1)):
+        out.append("   v0 := v0 + P%d(v0, %d);" % (i, i))
+    out.append("   writeln(v0);\nend.")
+    return out
+
+
+if sys.argv[1] == "--symbols":
+    print("\n".join(symbols(int(sys.argv[2]), int(sys.argv[3]))))
+    sys.exit(0)
+n = int(sys.argv[1])
+out = []
+out.append("{ ============================================================\n  generated benchmark program\n  ============================================================ }")
+out.append("var g0, g1, g2, g3: integer;\n    gd: double;\n    ga: array [1..100] of integer;")
+for i in range(n):
+    out.append("(* procedure %d *)\nfunction F%d(x: integer; y: integer): integer;\nvar t, u: integer;\nbegin" % (i, i))
+    out.append("      // body of F%d" % i)
+    out.append("      t := x * %d + y - (x div 2);" % (i % 7 + 1))
+    out.append("      u := 0;")
+    out.append("      while u < %d do" % (i % 5 + 3))
+    out.append("      begin")
+    out.append("         u := u + 1;")
+    out.append("         if (t > 100) and (u <> 2) then t := t - 100 else t := t + u * 3;")
+    out.append("      end;")
+    out.append("      ga[u] := t mod 17;")
+    out.append("      result := t + ga[u];")
+    out.append("end;")
+out.append("begin")
+out.append("   g0 := 0; gd := 0.5;")
+for i in range(n):
+    out.append("   g0 := g0 + F%d(g0, %d);" % (i, i))
+out.append("   writeln(g0);")
+out.append("end.")
+print("\n".join(out))
@@ -0,0 +1,21 @@
+# Random lexer input: identifiers, numbers, operators, comments and strings that span
+# lines, and (in every fourth file) unterminated comments, strings and bad characters.
+# usage: python3 gen_lex.py <seed> > f.pas
+import random
+import sys
+
+pieces = ["abc", "x1", "12", "3.5", "1.5e3", "1..10", ":=", ":", "=", "<=", "+", "-", "*", "/", "(", ")", "[", "]",
+          ";", ";\n", "x := 1;\n", ",", ".", "{ c\n x\n }", "(* c\n * d *)", "// line\n", "// a/b\n", " ", "\n", "\n",
+          "\t", "'Str'", "'multi\nline\nstr'", "Begin", "END", "div", "{ banner\n/ slash\n\n}", "(*\n\n\n*)", "  ",
+          "\n    "]
+broken = ["2.e", "7.", "@", "'unclosed", "{ unclosed", "(* unclosed"]
+
+
+def gen_lex(seed):
+    r = random.Random(seed)
+    ps = pieces + broken if seed % 4 == 0 else pieces
+    return "".join(r.choice(ps) + r.choice(["", " ", "\n"]) for _ in range(r.randint(5, 400)))
+
+
+if __name__ == "__main__":
+    sys.stdout.write(gen_lex(int(sys.argv[1])))
@@ -0,0 +1,90 @@
+# Random programs of several procedures and functions (with recursive calls, doubles,
+# strings, records and arrays) for the parallel parsing test. The programs compile as
+# generated; most seeds then get one to three tokens dropped, duplicated or replaced, so
+# that error paths are covered too.
+# usage: python3 gen_program.py <seed> [--valid] > f.pas
+import random
+import sys
+
+
+def gen_program(seed, valid=False, P=12):
+    r = random.Random(seed)
+    G = 6
+    out = ["type rec = record fa: integer; fb: double; end;",
+           "var " + ", ".join("g%d" % i for i in range(G)) + ": integer;",
+           "var d0, d1: double;", "var arr: array[1..10] of integer;", "var rr: rec;"]
+    procs = []
+    def expr(locs, depth=0):
+        k = r.randrange(12)
+        if depth > 2 or k < 3:
+            return r.choice(locs + ["g%d" % r.randrange(G), str(r.randrange(9)), "arr[%d]" % r.randint(1, 10), "rr.fa"])
+        if k == 3: return "(%s div %d)" % (expr(locs, depth + 1), r.randint(1, 9))
+        if k == 4: return "-(%s)" % expr(locs, depth + 1)
+        if k == 5: return "%s + %s" % (expr(locs, depth + 1), expr(locs, depth + 1))
+        if k == 6: return "%s * %s" % (expr(locs, depth + 1), expr(locs, depth + 1))
+        if k == 7: return "(%s - %s)" % (expr(locs, depth + 1), expr(locs, depth + 1))
+        funcs = [f for f in procs if f[2]]
+        if k == 8 and funcs:
+            name, nargs, _ = r.choice(funcs)
+            if nargs: return "%s(%s)" % (name, ", ".join(expr(locs, depth + 1) for _ in range(nargs)))
+        return str(r.randrange(100))
+    def dexpr(locs):
+        k = r.randrange(6)
+        if k == 0: return "%d.5 + %d.25" % (r.randrange(9), r.randrange(9))
+        if k == 1: return "d0 + 1.5 + 2.5"
+        if k == 2: return "-%d.75" % r.randrange(9)
+        if k == 3: return "%d.5 * d1" % r.randrange(9)
+        if k == 4: return "%d + %d.5" % (r.randrange(9), r.randrange(9))
+        return "d1"
+    def stmts(locs, n, depth=0):
+        s = []
+        for _ in range(n):
+            k = r.randrange(12)
+            if k < 3: s.append("%s := %s;" % (r.choice(locs + ["g0", "g1"]), expr(locs)))
+            elif k == 3: s.append("d0 := %s;" % dexpr(locs))
+            elif k == 4: s.append("writeln('s%d', %s);" % (r.randrange(99), expr(locs)))
+            elif k == 5 and depth < 2: s.append("if (%s < %s) then begin %s end;" % (expr(locs), expr(locs), " ".join(stmts(locs, 2, depth + 1))))
+            elif k == 6 and depth < 2: s.append("while (%s > %s) do begin %s end;" % (expr(locs), expr(locs), " ".join(stmts(locs, 2, depth + 1))))
+            elif k == 7: s.append("if 1.5 < 2.5 then g2 := 1;")
+            elif k == 8: s.append("write(%d.5 < %d.5);" % (r.randrange(4), r.randrange(4)))
+            elif k == 9: s.append("rr.fb := %s;" % dexpr(locs))
+            else: s.append("arr[%d] := %s;" % (r.randint(1, 10), expr(locs)))
+        return s
+    for p in range(P):
+        nargs = r.randrange(3)
+        args = ["a%d" % i for i in range(nargs)]
+        name = "p%d" % p
+        is_func = r.random() < 0.5
+        if is_func:
+            out.append("function %s%s: integer;" % (name, "(" + "; ".join("%s: integer" % a for a in args) + ")" if args else ""))
+            locs = args + ["result", "l0"]
+        else:
+            out.append("procedure %s%s;" % (name, "(" + "; ".join("%s: integer" % a for a in args) + ")" if args else ""))
+            locs = args + ["l0"]
+        out.append("var l0: integer;")
+        out.append("begin")
+        procs.append((name, nargs, is_func))
+        out += ["   " + x for x in stmts(locs, r.randint(1, 8))]
+        out.append("end;")
+        if r.random() < 0.3:
+            out.append("var h%d: integer;" % p)
+    out.append("begin")
+    out += ["   " + x for x in stmts([], 6)]
+    out.append("end.")
+    src = "\n".join(out) + "\n"
+    if r.random() < 0.6 and not valid:
+        toks = src.split(" ")
+        for _ in range(r.randint(1, 3)):
+            i = r.randrange(len(toks))
+            m = r.randrange(5)
+            if m == 0: toks[i] = ""
+            elif m == 1: toks[i] = "end"
+            elif m == 2: toks[i] = "begin"
+            elif m == 3: toks[i] = r.choice(["h3", "p11", "zz", "'unterminated", "@", "1.5", "g9"])
+            else: toks[i] = toks[i] + ";"
+        src = " ".join(toks)
+    return src
+
+
+if __name__ == "__main__":
+    sys.stdout.write(gen_program(int(sys.argv[1]), "--valid" in sys.argv))
@@ -0,0 +1,467 @@
+# Runs random programs compiled with -o, whose code is selected from the IR, and checks
+# what they print against what a model of the program in Python prints. The programs
+# terminate, read no variable before it is set, compute with doubles exactly (halves and
+# quarters only) and divide by what is never 0; every body has to be lowered to the IR,
+# which -i shows, and has to verify.
+# usage: python3 ir_exec.py <compiler> [count]
+import os
+import random
+import shutil
+import subprocess
+import sys
+import tempfile
+
+from asm_run import compile_and_run
+
+
+def wrap(v):
+    v &= 0xFFFFFFFF
+    return v - (1 << 32) if v & 0x80000000 else v
+
+
+def int_div(a, b):
+    q = abs(a) // abs(b)
+    return wrap(q if (a < 0) == (b < 0) else -q)
+
+
+def int_mod(a, b):
+    return wrap(a - int_div(a, b) * b)
+
+
+def format_double(d):
+    """What printf of asm_runtime.c prints for %f, step by step in doubles."""
+    if d != d:
+        return "nan"
+    sign = ""
+    if d < 0:
+        sign, d = "-", -d
+    if d >= 1e18:
+        return sign + "inf"
+    d += 0.0000005
+    high = int(d / 1e9)
+    low = d - float(high) * 1e9
+    whole = int(low)
+    text = (str(high) + str(whole).zfill(9)) if high else str(whole)
+    return sign + text + "." + str(int((low - whole) * 1e6)).zfill(6)
+
+
+def is_constant(x):
+    return x[0] == "c" or (x[0] == "neg" and is_constant(x[1])) or (x[0] == "bin" and is_constant(x[2]) and is_constant(x[3]))
+
+
+class Break(Exception):
+    pass
+
+
+class Continue(Exception):
+    pass
+
+
+INT_OPS = {
+    "+": lambda a, b: wrap(a + b),
+    "-": lambda a, b: wrap(a - b),
+    "*": lambda a, b: wrap(a * b),
+    "div": int_div,
+    "mod": int_mod,
+    "and": lambda a, b: a & b,
+    "or": lambda a, b: a | b,
+    "xor": lambda a, b: a ^ b,
+}
+DOUBLE_OPS = {"+": lambda a, b: a + b, "-": lambda a, b: a - b, "*": lambda a, b: a * b}
+# The parser folds and, or and xor of constants as if they were of booleans.
+LOGICAL = {"and": lambda a, b: int(a and b), "or": lambda a, b: int(a or b), "xor": lambda a, b: int(a != b)}
+RELATIONS = {"<": lambda a, b: a < b, "<=": lambda a, b: a <= b, ">": lambda a, b: a > b,
+             ">=": lambda a, b: a >= b, "=": lambda a, b: a == b, "<>": lambda a, b: a != b}
+
+
+class Program:
+    """A random program as text and as a model that runs it."""
+
+    def __init__(self, seed):
+        self.r = random.Random(seed)
+        self.funcs = []   # (name, int params, locals, body, result expression)
+        self.dfuncs = []  # (name, result expression of x: double and n: integer)
+        self.procs = []   # (name, var param, value param, body)
+
+    # Expressions are tuples; ints and doubles have kinds of their own.
+    def int_expr(self, scope, depth=0):
+        r = self.r
+        k = r.randrange(14)
+        if depth > 2 or k < 4:
+            leaves = [("c", r.randrange(100)), ("g", "g%d" % r.randrange(4)), ("arr", ("c", r.randint(1, 8))),
+                      ("rfa",), ("ra", ("c", r.randint(1, 4)))]
+            leaves += [("v", v) for v in scope["ints"]]
+            return r.choice(leaves)
+        sub = lambda: self.int_expr(scope, depth + 1)
+        if k < 9:
+            op = r.choice(["+", "-", "*", "and", "or", "xor", "+", "-"])
+            return ("bin", op, sub(), sub())
+        if k == 9:
+            op = r.choice(["div", "mod"])
+            divisor = ("c", r.randint(1, 9)) if r.random() < 0.6 else ("bin", "+", ("bin", "and", sub(), ("c", 7)), ("c", 1))
+            if r.random() < 0.2:
+                divisor = ("neg", divisor)
+            return ("bin", op, sub(), divisor)
+        if k == 10:
+            return ("neg", sub())
+        if k == 11:
+            return ("arr", self.index(sub(), 8))
+        if k == 12 and scope["arrays"]:
+            return ("la", self.index(sub(), 4))
+        if k == 13 and self.funcs and scope["calls"]:
+            name, params = r.choice(self.funcs)[:2]
+            return ("call", name, [sub() for _ in params])
+        return ("ra", self.index(sub(), 4))
+
+    def index(self, e, n):
+        return ("bin", "+", ("bin", "and", e, ("c", n - 1)), ("c", 1))
+
+    def double_expr(self, scope, depth=0):
+        r = self.r
+        k = r.randrange(8)
+        if depth > 2 or k < 3:
+            return r.choice([("dc", r.randrange(40) / 4.0), ("dg", "d%d" % r.randrange(2)), ("rfb",)] +
+                            [("dv", v) for v in scope.get("doubles", [])])
+        sub = lambda: self.double_expr(scope, depth + 1)
+        if k < 5:
+            return ("dbin", r.choice(["+", "-"]), sub(), sub())
+        if k == 5:
+            return ("dbin", "*", sub(), ("dc", r.choice([0.5, 2.0, 1.5, 0.25])))
+        if k == 6:
+            return ("dbin", r.choice(["+", "-"]), sub(), ("bin", "mod", self.int_expr(scope, 2), ("c", 64)))
+        if self.dfuncs and scope["calls"]:
+            return ("dcall", r.choice(self.dfuncs)[0], sub(), ("bin", "mod", self.int_expr(scope, 2), ("c", 16)))
+        return ("dneg", sub())
+
+    def condition(self, scope):
+        op = self.r.choice(list(RELATIONS))
+        if self.r.random() < 0.25:
+            return ("rel", op, self.double_expr(scope), self.double_expr(scope))
+        return ("rel", op, self.int_expr(scope), self.int_expr(scope))
+
+    def target(self, scope, pure):
+        r = self.r
+        targets = [("v", v) for v in scope["ints"] if v not in scope["fixed"]]
+        if not pure:
+            targets += [("g", "g%d" % r.randrange(4)), ("arr", self.index(self.int_expr(scope), 8)), ("rfa",),
+                        ("ra", self.index(self.int_expr(scope), 4))]
+        if scope["arrays"]:
+            targets.append(("la", self.index(self.int_expr(scope), 4)))
+        return r.choice(targets)
+
+    def stmts(self, scope, n, depth, loops, pure):
+        r = self.r
+        body = []
+        for _ in range(n):
+            k = r.randrange(16)
+            if k < 5:
+                body.append(("assign", self.target(scope, pure), self.int_expr(scope)))
+            elif k == 5 and not pure:
+                body.append(("assign", r.choice([("dg", "d%d" % r.randrange(2)), ("rfb",)]), self.double_expr(scope)))
+            elif k == 6 and not pure:
+                items = []
+                for _ in range(r.randint(1, 3)):
+                    kind = r.randrange(3)
+                    items.append(("i", self.int_expr(scope)) if kind == 0 else ("d", self.double_expr(scope)) if kind == 1
+                                 else ("s", "s%d" % r.randrange(50)))
+                body.append(("write", items, r.random() < 0.7))
+            elif k == 7 and depth < 3:
+                body.append(("if", self.condition(scope), self.stmts(scope, r.randint(1, 3), depth + 1, loops, pure),
+                             self.stmts(scope, r.randint(0, 2), depth + 1, loops, pure)))
+            elif k in (8, 9, 10) and depth < 3 and len(loops) < 3:
+                var = "%s%d" % ("ci"[k == 9], len(loops))
+                fixed = dict(scope, fixed=scope["fixed"] | {var})
+                kind = ("while", "for", "repeat")[k - 8]
+                inner = self.stmts(fixed, r.randint(1, 3), depth + 1, loops + [kind], pure)
+                if kind == "for":
+                    lo = ("bin", "and", self.int_expr(scope), ("c", 3))
+                    hi = ("bin", "+", ("bin", "and", self.int_expr(scope), ("c", 3)), ("c", 1))
+                    body.append(("for", var, lo, hi, r.random() < 0.3, inner))
+                else:
+                    body.append((kind, var, r.randint(1, 4), inner))
+            elif k == 11 and loops:
+                jump = ("break",) if loops[-1] == "repeat" or r.random() < 0.5 else ("continue",)
+                body.append(("if", self.condition(scope), [jump], []))
+            elif k == 12 and self.procs and not pure:
+                name = r.choice(self.procs)[0]
+                var = r.choice([("g", "g%d" % r.randrange(4)), ("arr", self.index(self.int_expr(scope), 8))] +
+                               [("v", v) for v in scope["ints"] if v not in scope["fixed"]])
+                body.append(("pcall", name, var, self.int_expr(scope)))
+            else:
+                body.append(("assign", self.target(scope, pure), self.int_expr(scope)))
+        return body
+
+    def generate(self):
+        r = self.r
+        for f in range(r.randint(1, 3)):
+            params = ["a%d" % i for i in range(r.randint(1, 3))]
+            local_vars = ["t0", "t1", "c0", "c1", "c2", "i0", "i1", "i2"]
+            scope = {"ints": params + ["t0", "t1", "c0", "c1", "c2", "i0", "i1", "i2"], "arrays": True, "calls": True,
+                     "fixed": {"c0", "c1", "c2", "i0", "i1", "i2"}}
+            body = self.stmts(scope, r.randint(2, 5), 0, [], True)
+            self.funcs.append(("f%d" % f, params, local_vars, body, self.int_expr(scope)))
+        for f in range(r.randint(0, 2)):
+            scope = {"ints": ["n"], "doubles": ["x"], "arrays": False, "calls": False, "fixed": set()}
+            self.dfuncs.append(("h%d" % f, ("dbin", "+", ("dbin", "*", self.double_expr(scope), ("dc", 0.5)), ("v", "n"))))
+        for p in range(r.randint(0, 2)):
+            scope = {"ints": ["x", "y", "c0", "c1", "c2", "i0", "i1", "i2"], "arrays": False, "calls": True,
+                     "fixed": {"c0", "c1", "c2", "i0", "i1", "i2"}}
+            self.procs.append(("q%d" % p, "x", "y", self.stmts(scope, r.randint(1, 4), 0, [], False)))
+        scope = {"ints": ["c0", "c1", "c2", "i0", "i1", "i2"], "arrays": False, "calls": True,
+                 "fixed": {"c0", "c1", "c2", "i0", "i1", "i2"}}
+        self.main = self.stmts(scope, r.randint(6, 14), 0, [], False)
+        last = ([("i", ("g", "g%d" % g)) for g in range(4)] + [("d", ("dg", "d0")), ("d", ("dg", "d1"))]
+                + [("i", ("arr", ("c", k))) for k in range(1, 9)] + [("i", ("rfa",)), ("d", ("rfb",))])
+        self.main.append(("write", [item for x in last for item in (x, ("s", " "))], True))
+
+    # The text of the program.
+    def e(self, x):
+        kind = x[0]
+        if kind in ("c", "dc"):
+            return str(x[1])
+        if kind in ("g", "v", "dg", "dv"):
+            return x[1]
+        if kind == "arr":
+            return "arr[%s]" % self.e(x[1])
+        if kind == "la":
+            return "la[%s]" % self.e(x[1])
+        if kind == "ra":
+            return "ra[%s].fa" % self.e(x[1])
+        if kind == "rfa":
+            return "rr.fa"
+        if kind == "rfb":
+            return "rr.fb"
+        if kind in ("bin", "dbin", "rel"):
+            return "(%s %s %s)" % (self.e(x[2]), x[1], self.e(x[3]))
+        if kind in ("neg", "dneg"):
+            return "-(%s)" % self.e(x[1])
+        if kind == "call":
+            return "%s(%s)" % (x[1], ", ".join(self.e(a) for a in x[2]))
+        if kind == "dcall":
+            return "%s(%s, %s)" % (x[1], self.e(x[2]), self.e(x[3]))
+        raise ValueError(kind)
+
+    def s(self, x, indent):
+        pad = "   " * indent
+        kind = x[0]
+        if kind == "assign":
+            return [pad + "%s := %s;" % (self.e(x[1]), self.e(x[2]))]
+        if kind == "write":
+            items = ["'%s'" % i[1] if i[0] == "s" else self.e(i[1]) for i in x[1]]
+            return [pad + "%s(%s);" % ("writeln" if x[2] else "write", ", ".join(items))]
+        if kind == "if":
+            lines = [pad + "if %s then" % self.e(x[1]), pad + "begin"] + self.block(x[2], indent + 1) + [pad + "end"]
+            if x[3]:
+                lines += [pad + "else", pad + "begin"] + self.block(x[3], indent + 1) + [pad + "end"]
+            lines[-1] += ";"
+            return lines
+        if kind == "while":
+            return ([pad + "%s := 0;" % x[1], pad + "while (%s < %d) do" % (x[1], x[2]), pad + "begin",
+                     pad + "   %s := (%s + 1);" % (x[1], x[1])] + self.block(x[3], indent + 1) + [pad + "end;"])
+        if kind == "repeat":
+            return ([pad + "%s := 0;" % x[1], pad + "repeat", pad + "   %s := (%s + 1);" % (x[1], x[1])]
+                    + self.block(x[3], indent + 1) + [pad + "until (%s >= %d);" % (x[1], x[2])])
+        if kind == "for":
+            lo, hi = (x[3], x[2]) if x[4] else (x[2], x[3])
+            return ([pad + "for %s := %s %s %s do" % (x[1], self.e(lo), "downto" if x[4] else "to", self.e(hi)), pad + "begin"]
+                    + self.block(x[5], indent + 1) + [pad + "end;"])
+        if kind in ("break", "continue"):
+            return [pad + kind + ";"]
+        if kind == "pcall":
+            return [pad + "%s(%s, %s);" % (x[1], self.e(x[2]), self.e(x[3]))]
+        raise ValueError(kind)
+
+    def block(self, body, indent):
+        return [line for x in body for line in self.s(x, indent)]
+
+    def text(self):
+        lines = ["type rec = record fa: integer; fb: double; end;",
+                 "var g0, g1, g2, g3, c0, c1, c2, i0, i1, i2: integer;", "var d0, d1: double;",
+                 "var arr: array[1..8] of integer;", "var ra: array[1..4] of rec;", "var rr: rec;"]
+        for name, params, local_vars, body, result in self.funcs:
+            lines.append("function %s(%s): integer;" % (name, "; ".join("%s: integer" % a for a in params)))
+            lines += ["var %s: integer;" % ", ".join(local_vars), "    la: array[1..4] of integer;", "begin"]
+            lines += ["   %s := 0;" % v for v in local_vars] + ["   la[%d] := %d;" % (k, k * 3) for k in range(1, 5)]
+            lines += self.block(body, 1) + ["   %s := %s;" % (self.r.choice(["result", name]), self.e(result)), "end;"]
+        for name, result in self.dfuncs:
+            lines += ["function %s(x: double; n: integer): double;" % name, "begin",
+                      "   result := %s;" % self.e(result), "end;"]
+        for name, var, value, body in self.procs:
+            lines += ["procedure %s(var %s: integer; %s: integer);" % (name, var, value),
+                      "var c0, c1, c2, i0, i1, i2: integer;", "begin"]
+            lines += ["   %s := 0;" % v for v in ("c0", "c1", "c2", "i0", "i1", "i2")]
+            lines += self.block(body, 1) + ["   %s := (%s + %s);" % (var, var, value), "end;"]
+        lines += ["begin"] + self.block(self.main, 1) + ["end."]
+        return "\n".join(lines) + "\n"
+
+    # The model: frames map names to values; a var parameter maps to the cell it stands for.
+    def run(self):
+        self.mem = {"g%d" % k: 0 for k in range(4)}
+        self.mem.update({v: 0 for v in ("c0", "c1", "c2", "i0", "i1", "i2")})
+        self.mem.update({"d0": 0.0, "d1": 0.0, "rfa": 0, "rfb": 0.0})
+        self.mem.update({("arr", k): 0 for k in range(1, 9)})
+        self.mem.update({("ra", k): 0 for k in range(1, 5)})
+        self.frames = [{}]
+        self.out = []
+        self.exec_block(self.main)
+        return "".join(self.out)
+
+    def cell(self, x):
+        kind = x[0]
+        if kind in ("g", "dg"):
+            return self.mem, x[1]
+        if kind == "dv":
+            return self.frames[-1], x[1]
+        if kind == "v":
+            frame = self.frames[-1]
+            if x[1] in frame:
+                ref = frame[x[1]]
+                return ref if isinstance(ref, tuple) else (frame, x[1])
+            return self.mem, x[1]
+        if kind in ("arr", "ra"):
+            return self.mem, (kind, self.ev(x[1]))
+        if kind == "la":
+            return self.frames[-1], ("la", self.ev(x[1]))
+        if kind in ("rfa", "rfb"):
+            return self.mem, kind
+        raise ValueError(kind)
+
+    def ev(self, x):
+        kind = x[0]
+        if kind in ("c", "dc"):
+            return x[1]
+        if kind in ("g", "v", "dg", "dv", "arr", "la", "ra", "rfa", "rfb"):
+            place, key = self.cell(x)
+            return place[key]
+        if kind == "bin" and x[1] in LOGICAL and is_constant(x[2]) and is_constant(x[3]):
+            return LOGICAL[x[1]](self.ev(x[2]) != 0, self.ev(x[3]) != 0)
+        if kind == "bin":
+            return INT_OPS[x[1]](self.ev(x[2]), self.ev(x[3]))
+        if kind == "dbin":
+            return DOUBLE_OPS[x[1]](float(self.ev(x[2])), float(self.ev(x[3])))
+        if kind == "neg":
+            return wrap(-self.ev(x[1]))
+        if kind == "dneg":
+            return -self.ev(x[1])
+        if kind == "rel":
+            a, b = self.ev(x[2]), self.ev(x[3])
+            return RELATIONS[x[1]](a, b)
+        if kind == "call":
+            name, params, local_vars, body, result = next(f for f in self.funcs if f[0] == x[1])
+            frame = dict(zip(params, [self.ev(a) for a in x[2]]))
+            frame.update({v: 0 for v in local_vars})
+            frame.update({("la", k): k * 3 for k in range(1, 5)})
+            self.frames.append(frame)
+            self.exec_block(body)
+            value = self.ev(result)
+            self.frames.pop()
+            return value
+        if kind == "dcall":
+            result = next(f[1] for f in self.dfuncs if f[0] == x[1])
+            x_value, n = float(self.ev(x[2])), self.ev(x[3])
+            self.frames.append({"x": x_value, "n": n})
+            value = self.ev(result)
+            self.frames.pop()
+            return value
+        raise ValueError(kind)
+
+    def exec_block(self, body):
+        for x in body:
+            self.ex(x)
+
+    def loop_body(self, body):
+        try:
+            self.exec_block(body)
+        except Continue:
+            pass
+
+    def ex(self, x):
+        kind = x[0]
+        if kind == "assign":
+            value = self.ev(x[2])
+            place, key = self.cell(x[1])
+            place[key] = float(value) if x[1][0] in ("dg", "rfb") else value
+        elif kind == "write":
+            for item in x[1]:
+                self.out.append(item[1] if item[0] == "s" else str(self.ev(item[1])) if item[0] == "i"
+                                else format_double(float(self.ev(item[1]))))
+            if x[2]:
+                self.out.append("\r\n")
+        elif kind == "if":
+            self.exec_block(x[2] if self.ev(x[1]) else x[3])
+        elif kind in ("while", "repeat"):
+            place, key = self.cell(("v", x[1]))
+            place[key] = 0
+            try:
+                while True:
+                    if kind == "while" and not place[key] < x[2]:
+                        break
+                    place[key] += 1
+                    self.loop_body(x[3])
+                    if kind == "repeat" and place[key] >= x[2]:
+                        break
+            except Break:
+                pass
+        elif kind == "for":
+            place, key = self.cell(("v", x[1]))
+            down = x[4]
+            limit = self.ev(x[2]) if down else self.ev(x[3])
+            place[key] = self.ev(x[3]) if down else self.ev(x[2])
+            try:
+                while (place[key] >= limit) if down else (place[key] <= limit):
+                    self.loop_body(x[5])
+                    place[key] += -1 if down else 1
+            except Break:
+                pass
+        elif kind == "break":
+            raise Break()
+        elif kind == "continue":
+            raise Continue()
+        elif kind == "pcall":
+            name, var, value, body = next(p for p in self.procs if p[0] == x[1])
+            ref = self.cell(x[2])
+            frame = {var: ref, value: self.ev(x[3])}
+            frame.update({v: 0 for v in ("c0", "c1", "c2", "i0", "i1", "i2")})
+            self.frames.append(frame)
+            self.exec_block(body)
+            self.ex(("assign", ("v", var), ("bin", "+", ("v", var), ("v", value))))
+            self.frames.pop()
+
+
+def main():
+    compiler = os.path.abspath(sys.argv[1])
+    count = int(sys.argv[2]) if len(sys.argv) > 2 else 200
+    work = tempfile.mkdtemp()
+    failed = 0
+    try:
+        for seed in range(count):
+            program = Program(seed)
+            program.generate()
+            source = program.text()
+            expected = program.run()
+            with open(os.path.join(work, "f.pas"), "w") as f:
+                f.write(source)
+            _, output = compile_and_run(compiler, "-o", source, work)
+            problem = None
+            if output != expected:
+                problem = "prints\n%r\ninstead of\n%r" % (output[:300], expected[:300])
+            else:
+                subprocess.run([compiler, "-i", "f.pas"], cwd=work, capture_output=True, timeout=60)
+                with open(os.path.join(work, "f.asm")) as f:
+                    listing = f.read()
+                if "not lowered" in listing or "does not verify" in listing:
+                    problem = "has IR that " + ("is not lowered" if "not lowered" in listing else "does not verify")
+            if problem:
+                failed += 1
+                name = os.path.join(work, "..", "ir_exec_%d.pas" % seed)
+                with open(name, "w") as f:
+                    f.write(source)
+                print("seed %d %s (kept in %s)" % (seed, problem, os.path.abspath(name)))
+    finally:
+        shutil.rmtree(work)
+    print("%d of %d programs differ" % (failed, count))
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,42 @@
+# Differential test of the chunked lexer: every generated file is lexed by one thread
+# (-l f.pas -b) and in 2, 3 and 7 forced chunks (-l f.pas -j N); the token listings and
+# exit codes must be identical.
+# usage: python3 lex_chunks.py <compiler> [files=500] [first seed=0]
+import os
+import shutil
+import subprocess
+import sys
+import tempfile
+
+from gen_lex import gen_lex
+
+
+def lex(compiler, work, flags):
+    p = subprocess.run([compiler, "-l", "f.pas"] + flags, cwd=work, capture_output=True, timeout=30)
+    with open(os.path.join(work, "f.asm"), "rb") as f:
+        return p.returncode, f.read()
+
+
+def main():
+    compiler = os.path.abspath(sys.argv[1])
+    count = int(sys.argv[2]) if len(sys.argv) > 2 else 500
+    first = int(sys.argv[3]) if len(sys.argv) > 3 else 0
+    work = tempfile.mkdtemp()
+    bad = 0
+    try:
+        for seed in range(first, first + count):
+            with open(os.path.join(work, "f.pas"), "w") as f:
+                f.write(gen_lex(seed))
+            serial = lex(compiler, work, ["-b"])
+            differs = [n for n in ("2", "3", "7") if lex(compiler, work, ["-j", n]) != serial]
+            if differs:
+                bad += 1
+                print("seed %d differs with -j %s" % (seed, ", ".join(differs)))
+    finally:
+        shutil.rmtree(work)
+    print("%d of %d files differ" % (bad, count))
+    return 1 if bad else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,59 @@
+# Stress test of binary operator parsing (Parser::parse_binary) and of operator chain
+# code generation (generate_chain): assignments with 10^5 operators in a row, 10^5
+# unary minuses and 10^4 nested parentheses must compile in -g and -o mode without
+# running out of stack, and a thousand of each must print in -p mode.
+# usage: python3 operator_stress.py <compiler>
+import os
+import random
+import shutil
+import subprocess
+import sys
+import tempfile
+
+
+def program(names, expr):
+    return "var %s: integer;\nbegin\n   a := %s;\nend.\n" % (", ".join(names), expr)
+
+
+def inputs(n):
+    r = random.Random(1)
+    ops = ["+", "-", "*", "div", "mod", "and", "or", "xor"]
+    mixed = "a" + "".join(" %s %s" % (r.choice(ops), r.choice("abc123456789")) for _ in range(n))
+    return {
+        "plus": program("abc", "a" + " + b" * n),
+        "mixed": program("abc", mixed),
+        "unary": program("ab", "- " * n + "b"),
+        "paren": program("ab", "(" * (n // 10) + "b" + " + 1)" * (n // 10)),
+    }
+
+
+def main():
+    compiler = os.path.abspath(sys.argv[1])
+    work = tempfile.mkdtemp()
+    failed = 0
+    try:
+        # The tree listing indents each level further, so -p output grows with the square
+        # of the depth; it gets inputs a hundred times smaller.
+        for modes, n in ((("-g", "-o"), 10 ** 5), (("-p",), 10 ** 3)):
+            for name, source in sorted(inputs(n).items()):
+                with open(os.path.join(work, name + ".pas"), "w") as f:
+                    f.write(source)
+                for mode in modes:
+                    p = subprocess.run([compiler, mode, name + ".pas"], cwd=work, capture_output=True, timeout=120)
+                    with open(os.path.join(work, name + ".asm")) as f:
+                        output = f.read()
+                    ok = p.returncode == 0 and output and "Error" not in output
+                    # Every '+ b' of the sum is one add, folded or not.
+                    if ok and name == "plus" and mode == "-g":
+                        ok = sum(1 for line in output.splitlines() if line.lstrip().startswith("add")) == n
+                    if not ok:
+                        failed += 1
+                        print("%s %s failed with exit code %d" % (name, mode, p.returncode))
+    finally:
+        shutil.rmtree(work)
+    print("%d failed" % failed)
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
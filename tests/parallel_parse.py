@@ -0,0 +1,45 @@
+# Differential test of parallel parsing and code generation: each generated program is
+# compiled in -p, -g and -o mode on one thread (-b) and on 2 and 4 threads (-j N); the
+# output files and exit codes must be identical.
+# usage: python3 parallel_parse.py <compiler> [programs=300] [first seed=0]
+import os
+import shutil
+import subprocess
+import sys
+import tempfile
+
+from gen_program import gen_program
+
+
+def compile(compiler, work, mode, flags):
+    p = subprocess.run([compiler, mode, "f.pas"] + flags, cwd=work, capture_output=True, timeout=30)
+    with open(os.path.join(work, "f.asm"), "rb") as f:
+        return p.returncode, f.read()
+
+
+def main():
+    compiler = os.path.abspath(sys.argv[1])
+    count = int(sys.argv[2]) if len(sys.argv) > 2 else 300
+    first = int(sys.argv[3]) if len(sys.argv) > 3 else 0
+    work = tempfile.mkdtemp()
+    bad = 0
+    try:
+        for seed in range(first, first + count):
+            with open(os.path.join(work, "f.pas"), "w") as f:
+                f.write(gen_program(seed))
+            differs = []
+            for mode in ("-p", "-g", "-o"):
+                serial = compile(compiler, work, mode, ["-b"])
+                differs += ["%s -j %s" % (mode, n) for n in ("2", "4")
+                            if compile(compiler, work, mode, ["-j", n]) != serial]
+            if differs:
+                bad += 1
+                print("seed %d differs with %s" % (seed, ", ".join(differs)))
+    finally:
+        shutil.rmtree(work)
+    print("%d of %d programs differ" % (bad, count))
+    return 1 if bad else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,46 @@
+# Differential test of the lexer pipeline: generated programs (some with errors) are
+# compiled with -l, -p and -g by the streaming lexer, and again with --pipe, where the
+# lexer runs on a thread of its own. Lexer stress files (unclosed comments and strings,
+# bad symbols) are listed and parsed the same way. Outputs, error lines and columns
+# included, must be identical.
+# usage: python3 pipeline.py <compiler> [programs=200] [first seed=0]
+import os
+import shutil
+import subprocess
+import sys
+import tempfile
+
+from gen_lex import gen_lex
+from gen_program import gen_program
+
+
+def run(compiler, work, args):
+    p = subprocess.run([compiler] + args, cwd=work, capture_output=True, timeout=30)
+    with open(os.path.join(work, "f.asm"), "rb") as f:
+        return p.returncode, f.read()
+
+
+def main():
+    compiler = os.path.abspath(sys.argv[1])
+    count = int(sys.argv[2]) if len(sys.argv) > 2 else 200
+    first = int(sys.argv[3]) if len(sys.argv) > 3 else 0
+    work = tempfile.mkdtemp()
+    bad = 0
+    try:
+        for seed in range(first, first + count):
+            for kind, source, modes in (("program", gen_program(seed), ("-l", "-p", "-g")),
+                                        ("lexer file", gen_lex(seed), ("-l", "-p"))):
+                with open(os.path.join(work, "f.pas"), "w") as f:
+                    f.write(source)
+                for mode in modes:
+                    if run(compiler, work, [mode, "f.pas"]) != run(compiler, work, [mode, "f.pas", "--pipe"]):
+                        bad += 1
+                        print("seed %d %s differs with %s --pipe" % (seed, kind, mode))
+    finally:
+        shutil.rmtree(work)
+    print("%d differences in %d seeds" % (bad, count))
+    return 1 if bad else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,149 @@
+# Differential test of the compile server: generated programs (some with errors) are
+# compiled one at a time, then through a server on a Unix socket in a temporary directory,
+# from the client and from several connections at once, and again from its cache. Every
+# output must be the same, and a request too large to read must not stop the server. The
+# time of a cached request is reported.
+# usage: python3 server.py <compiler> [programs=40] [first seed=0]
+import os
+import shutil
+import socket
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+
+from gen_program import gen_program
+
+
+def read(path):
+    with open(path, "rb") as f:
+        return f.read()
+
+
+class Connection:
+    def __init__(self, path):
+        self.sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        self.sock.connect(path)
+        self.data = b""
+
+    def take(self, n):
+        while len(self.data) < n:
+            chunk = self.sock.recv(65536)
+            if not chunk:
+                raise EOFError
+            self.data += chunk
+        out, self.data = self.data[:n], self.data[n:]
+        return out
+
+    def line(self):
+        while b"\n" not in self.data:
+            chunk = self.sock.recv(65536)
+            if not chunk:
+                raise EOFError
+            self.data += chunk
+        out, self.data = self.data.split(b"\n", 1)
+        return out.decode()
+
+    def compile(self, mode, name, source=None):
+        if source is None:
+            head = "%s %d -\n" % (mode, len(name))
+            self.sock.sendall(head.encode() + name.encode())
+        else:
+            head = "%s %d %d\n" % (mode, len(name), len(source))
+            self.sock.sendall(head.encode() + name.encode() + source)
+        status, how, length = self.line().split()
+        return status, how, self.take(int(length))
+
+
+def main():
+    compiler = os.path.abspath(sys.argv[1])
+    count = int(sys.argv[2]) if len(sys.argv) > 2 else 40
+    first = int(sys.argv[3]) if len(sys.argv) > 3 else 0
+    work = tempfile.mkdtemp()
+    path = os.path.join(work, "compiler.sock")
+    names = ["f%d.pas" % seed for seed in range(first, first + count)]
+    bad = 0
+    server = None
+    try:
+        for name, seed in zip(names, range(first, first + count)):
+            with open(os.path.join(work, name), "w") as f:
+                f.write(gen_program(seed))
+        single = {}
+        for mode in ("-l", "-p", "-g", "-o"):
+            for name in names:
+                subprocess.run([compiler, mode, name], cwd=work, capture_output=True, timeout=30)
+                single[mode, name] = read(os.path.join(work, name[:-3] + "asm"))
+        server = subprocess.Popen([compiler, "--server", path, "-j", "3"], cwd=work, stdout=subprocess.PIPE, text=True)
+        server.stdout.readline()
+
+        for mode in ("-l", "-p", "-g", "-o"):
+            subprocess.run([compiler, "--client", path, mode] + names, cwd=work, capture_output=True, timeout=60)
+            for name in names:
+                if read(os.path.join(work, name[:-3] + "asm")) != single[mode, name]:
+                    bad += 1
+                    print("client %s %s differs" % (mode, name))
+
+        def connection(mode, errors):
+            c = Connection(path)
+            for name in names:
+                source = read(os.path.join(work, name))
+                for how_expected, args in (("cached", (source,)), ("cached", ())):
+                    status, how, output = c.compile(mode, name, *args)
+                    if output != single[mode, name] or how != how_expected or (status == "ok") != (b"Error" not in output):
+                        errors.append("%s %s %s %s differs" % (mode, name, status, how))
+        errors = []
+        threads = [threading.Thread(target=connection, args=(mode, errors)) for mode in ("-l", "-p", "-g", "-o")]
+        for t in threads:
+            t.start()
+        for t in threads:
+            t.join()
+        for e in errors:
+            print(e)
+        bad += len(errors)
+
+        c = Connection(path)
+        source = read(os.path.join(work, names[0]))
+        start = time.perf_counter()
+        for _ in range(1000):
+            c.compile("-g", names[0], source)
+        us = (time.perf_counter() - start) * 1e3
+        status, how, output = c.compile("-g", "missing.pas")
+        if status != "error" or output != b"Error opening file":
+            bad += 1
+            print("missing file: %s %s %r" % (status, how, output))
+        print("cached request: %.1f us" % us)
+
+        # Lengths past the limits are refused before anything is read, and only that
+        # connection is closed.
+        for head in ("-g 999999999999999999 -\n", "-g 5 999999999999999999\n"):
+            c = Connection(path)
+            c.sock.sendall(head.encode())
+            try:
+                status, how, length = c.line().split()
+                output = c.take(int(length))
+            except (EOFError, ValueError):
+                status, output = "closed", b""
+            if status != "error" or output != b"Request too large":
+                bad += 1
+                print("%r: %s %r" % (head, status, output))
+            try:
+                output = Connection(path).compile("-g", names[0], source)[2]
+            except (OSError, EOFError):
+                output = None
+            if output != single["-g", names[0]]:
+                bad += 1
+                print("no answer after %r" % head)
+                break
+    finally:
+        if server is not None:
+            subprocess.run([compiler, "--client", path, "--stop"], cwd=work, capture_output=True, timeout=30)
+            report = server.communicate(timeout=30)[0].strip()
+            print(report)
+        shutil.rmtree(work)
+    print("%d differences in %d programs" % (bad, count))
+    return 1 if bad else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,193 @@
+# Runs random integer programs compiled with -g, whose operand stack is kept in registers
+# as far as it can be, and checks what they print against a model in Python. The programs
+# keep to what -g compiles right: global integers and an array, no unary plus, no
+# division by a constant and a comparison only as a condition. Expressions of globals
+# also have to compile without a push or a pop.
+# usage: python3 stack_cache.py <compiler> [count]
+import os
+import random
+import shutil
+import subprocess
+import sys
+import tempfile
+
+from asm_run import compile_and_run
+from ir_exec import INT_OPS, RELATIONS, is_constant, wrap
+
+NAMES = ["g0", "g1", "g2", "g3"]
+# The second needs four registers with its right operand generated first, as arithmetic
+# generates it, and two with its left operand first.
+EXPRESSIONS = ["(b + c) * (b - c) div (c or 1)", "(((a - b) * (c - d)) + ((e - a) * (b - c))) - (d - e)"]
+
+
+class Program:
+    """A random program of integers as text and as a model that runs it."""
+
+    def __init__(self, seed):
+        self.r = random.Random(seed)
+
+    def leaf(self):
+        r = self.r
+        k = r.randrange(5)
+        if k == 0:
+            return ("c", r.randrange(100))
+        if k == 1:
+            return ("arr", self.index())
+        return ("g", r.choice(NAMES))
+
+    # An operation has a variable on one side at least: the parser folds and, or and xor
+    # of constants as if they were of booleans, and -g shifts to divide by a power of two.
+    def expr(self, depth=0):
+        r = self.r
+        k = r.randrange(10)
+        if depth > 3 or k < 3:
+            return self.leaf()
+        if k == 3:
+            return ("neg", self.expr(depth + 1))
+        if k == 4:
+            return ("bin", r.choice(["div", "mod"]), self.expr(depth + 1), ("bin", "+", ("bin", "and", ("g", r.choice(NAMES)), ("c", 7)), ("c", 1)))
+        left, right = self.expr(depth + 1), self.expr(depth + 1)
+        if is_constant(left) and is_constant(right):
+            right = ("g", r.choice(NAMES))
+        return ("bin", r.choice(["+", "-", "*", "and", "or", "xor"]), left, right)
+
+    def index(self):
+        return ("bin", "+", ("bin", "and", ("g", self.r.choice(NAMES)), ("c", 7)), ("c", 1))
+
+    def condition(self):
+        return ("rel", self.r.choice(list(RELATIONS)), self.expr(1), self.expr(1))
+
+    def stmts(self, n, depth, loops):
+        r = self.r
+        body = []
+        for _ in range(n):
+            k = r.randrange(10)
+            if k < 5 or depth > 1:
+                target = ("g", r.choice(NAMES)) if r.randrange(3) else ("arr", self.index())
+                body.append(("set", target, self.expr()))
+            elif k < 7:
+                body.append(("if", self.condition(), self.stmts(2, depth + 1, loops), self.stmts(r.randrange(2), depth + 1, loops)))
+            elif k < 9 and loops < 2:
+                counter = "c%d" % loops
+                body.append(("while", counter, r.randint(1, 4), self.stmts(2, depth + 1, loops + 1)))
+            else:
+                body.append(("write", self.expr()))
+        return body
+
+    def generate(self):
+        self.body = [("set", ("g", g), ("c", self.r.randrange(-50, 50))) for g in NAMES]
+        self.body += [("set", ("arr", ("c", i)), ("c", self.r.randrange(100))) for i in range(1, 9)]
+        self.body += self.stmts(8, 0, 0)
+        self.body += [("write", ("g", g)) for g in NAMES]
+
+    def e(self, x):
+        if x[0] == "c":
+            return str(x[1])
+        if x[0] == "g":
+            return x[1]
+        if x[0] == "arr":
+            return "arr[%s]" % self.e(x[1])
+        if x[0] == "neg":
+            return "-(%s)" % self.e(x[1])
+        return "(%s %s %s)" % (self.e(x[2]), x[1], self.e(x[3]))
+
+    def s(self, x, indent):
+        pad = " " * indent
+        if x[0] == "set":
+            return "%s%s := %s;\n" % (pad, self.e(x[1]), self.e(x[2]))
+        if x[0] == "write":
+            return "%swriteln(%s);\n" % (pad, self.e(x[1]))
+        if x[0] == "if":
+            text = "%sif %s then\n%s" % (pad, self.e(x[1]), self.block(x[2], indent))
+            if x[3]:
+                text += "%selse\n%s" % (pad, self.block(x[3], indent))
+            return text[:-1] + ";\n"
+        counter = x[1]
+        return "%s%s := 0;\n%swhile %s < %d do\n%sbegin\n%s   %s := %s + 1;\n%s%send;\n" % (
+            pad, counter, pad, counter, x[2], pad, pad, counter, counter,
+            "".join(self.s(y, indent + 3) for y in x[3]), pad)
+
+    def block(self, body, indent):
+        pad = " " * indent
+        return "%sbegin\n%s%send\n" % (pad, "".join(self.s(y, indent + 3) for y in body), pad)
+
+    def text(self):
+        return ("var %s, c0, c1: integer;\nvar arr: array[1..8] of integer;\nbegin\n%send.\n"
+                % (", ".join(NAMES), "".join(self.s(x, 3) for x in self.body)))
+
+    def run(self):
+        self.vars = {"arr": [0] * 9}
+        self.out = []
+        for x in self.body:
+            self.ex(x)
+        return "".join(self.out)
+
+    def ev(self, x):
+        if x[0] == "c":
+            return x[1]
+        if x[0] == "g":
+            return self.vars[x[1]]
+        if x[0] == "arr":
+            return self.vars["arr"][self.ev(x[1])]
+        if x[0] == "neg":
+            return wrap(-self.ev(x[1]))
+        if x[0] == "rel":
+            return RELATIONS[x[1]](self.ev(x[2]), self.ev(x[3]))
+        return INT_OPS[x[1]](self.ev(x[2]), self.ev(x[3]))
+
+    def ex(self, x):
+        if x[0] == "set":
+            value = self.ev(x[2])
+            if x[1][0] == "g":
+                self.vars[x[1][1]] = value
+            else:
+                self.vars["arr"][self.ev(x[1][1])] = value
+        elif x[0] == "write":
+            self.out.append("%d\n" % self.ev(x[1]))
+        elif x[0] == "if":
+            for y in x[2] if self.ev(x[1]) else x[3]:
+                self.ex(y)
+        else:
+            for _ in range(x[2]):
+                for y in x[3]:
+                    self.ex(y)
+
+
+def main():
+    compiler = os.path.abspath(sys.argv[1])
+    count = int(sys.argv[2]) if len(sys.argv) > 2 else 200
+    work = tempfile.mkdtemp()
+    failed = 0
+    try:
+        for expr in EXPRESSIONS:
+            with open(os.path.join(work, "f.pas"), "w") as f:
+                f.write("var a, b, c, d, e: integer;\nbegin\n   a := %s;\nend.\n" % expr)
+            subprocess.run([compiler, "-g", "f.pas"], cwd=work, capture_output=True, timeout=60)
+            with open(os.path.join(work, "f.asm")) as f:
+                listing = f.read()
+            stack = [line for line in listing.splitlines() if line.split()[:1] in (["push"], ["pop"])]
+            if stack:
+                failed += 1
+                print("%s goes through the stack:\n%s" % (expr, "\n".join(stack)))
+        for seed in range(count):
+            program = Program(seed)
+            program.generate()
+            source = program.text()
+            expected = program.run()
+            _, output = compile_and_run(compiler, "-g", source, work)
+            # -g ends a line of writeln as MS-DOS does.
+            output = output.replace("\r\n", "\n")
+            if output != expected:
+                failed += 1
+                name = os.path.join(work, "..", "stack_cache_%d.pas" % seed)
+                with open(name, "w") as f:
+                    f.write(source)
+                print("seed %d prints\n%r\ninstead of\n%r\n(kept in %s)" % (seed, output[:300], expected[:300], os.path.abspath(name)))
+    finally:
+        shutil.rmtree(work)
+    print("%d of %d programs differ" % (failed, count))
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -1,13 +1,66 @@
 #include "token.h"
+#include <cstring>
+#include <charconv>
 
-Token::Token(const Token &t)
+static constexpr Keyword keywords[] =
 {
-   str_ = t.str_;
-   type_ = t.type_;
-   line_ = t.line_;
-   col_ = t.col_;
+   {"and", 3, and_op, true}, {"array", 5, array_decl, true}, {"begin", 5, begin_stmt, true},
+   {"break", 5, break_stmt, true}, {"const", 5, id, true}, {"continue", 8, continue_stmt, true},
+   {"div", 3, div_op, true}, {"do", 2, do_stmt, true}, {"downto", 6, downto_stmt, true},
+   {"else", 4, else_stmt, true}, {"end", 3, end_stmt, true}, {"file", 4, id, true},
+   {"for", 3, for_stmt, true}, {"function", 8, function_decl, true}, {"if", 2, if_stmt, true},
+   {"in", 2, id, true}, {"mod", 3, mod_op, true}, {"nil", 3, id, true},
+   {"not", 3, not_op, true}, {"of", 2, of_decl, true}, {"or", 2, or_op, true},
+   {"procedure", 9, procedure_decl, true}, {"program", 7, id, true}, {"record", 6, rec_decl, true},
+   {"repeat", 6, repeat_stmt, true}, {"set", 3, id, true}, {"then", 4, then_stmt, true},
+   {"to", 2, to_stmt, true}, {"until", 5, until_stmt, true}, {"uses", 4, id, true},
+   {"var", 3, var_decl, true}, {"while", 5, while_stmt, true}, {"with", 4, id, true},
+   {"xor", 3, xor_op, true}, {"type", 4, type_decl, false}, {"integer", 7, integer_decl, false},
+   {"double", 6, double_decl, false}, {"write", 5, write_stmt, false}, {"writeln", 7, writeln_stmt, false},
+   {"read", 4, read_stmt, false}, {"readln", 6, readln_stmt, false},
+};
+
+constexpr size_t keywords_count = sizeof(keywords) / sizeof(keywords[0]);
+constexpr size_t keyword_hash_size = 128;
+
+constexpr size_t keyword_hash(const char *s, size_t length)
+{
+   return ((unsigned char)s[0] + (unsigned char)s[1] * 11 + (unsigned char)s[length - 1] * 13 + length) & (keyword_hash_size - 1);
+}
+
+struct KeywordHash
+{
+   signed char slots[keyword_hash_size];
+   bool perfect;
+   constexpr KeywordHash(const Keyword *k, size_t n): slots(), perfect(true)
+   {
+      for (size_t i = 0; i < keyword_hash_size; ++i)
+         slots[i] = -1;
+      for (size_t i = 0; i < n; ++i)
+      {
+         size_t h = keyword_hash(k[i].name, k[i].length);
+         if (slots[h] != -1)
+            perfect = false;
+         slots[h] = (signed char)i;
+      }
+   }
+};
+
+static constexpr KeywordHash keyword_slots(keywords, keywords_count);
+static_assert(keyword_slots.perfect, "keyword hash has collisions");
+
+const Keyword *find_keyword(const char *s, size_t length)
+{
+   if (length < 2 || length > 9)
+      return nullptr;
+   int i = keyword_slots.slots[keyword_hash(s, length)];
+   if (i < 0 || keywords[i].length != length || memcmp(keywords[i].name, s, length))
+      return nullptr;
+   return &keywords[i];
 }
 
+const std::string Token::empty_;
+
 size_t Token::get_line() const
 {
    return line_;
@@ -18,41 +71,61 @@ size_t Token::get_col() const
    return col_;
 }
 
+std::unordered_map<const std::string *, const std::string *> StringPool::absorb(StringPool &other)
+{
+   std::unordered_map<const std::string *, const std::string *> moved;
+   strings_.merge(other.strings_);
+   for each (auto &s in other.strings_)
+      moved[&s] = &*strings_.find(s);
+   return moved;
+}
+
+bool parse_int(const std::string &s, int &value)
+{
+   const char *end = s.c_str() + strlen(s.c_str());
+   auto res = std::from_chars(s.c_str(), end, value);
+   return res.ec == std::errc() && res.ptr == end;
+}
+
+bool parse_double(const std::string &s, double &value)
+{
+   const char *end = s.c_str() + strlen(s.c_str());
+   auto res = std::from_chars(s.c_str(), end, value);
+   return res.ec == std::errc() && res.ptr == end;
+}
+
 int Token::get_int_value() const
 {
-   return boost::lexical_cast<int>(str_.c_str());
+   int value;
+   return parse_int(*str_, value) ? value : boost::lexical_cast<int>(str_->c_str());
 }
 
 double Token::get_double_value() const 
 {
-   return boost::lexical_cast<double>(str_.c_str());
+   double value;
+   return parse_double(*str_, value) ? value : boost::lexical_cast<double>(str_->c_str());
 }
 
 const std::string& Token::get_string() const 
 {
-   return str_;
+   return *str_;
 }
 
 LexemeType Token::type() const
 {
-   return type_;
+   return (LexemeType)(signed char)type_;
 }
 
 bool Token::is_keyword() const
 {
-   for(int i = 0; i < 33; ++i)
-   {
-      if(str_ == keywords[i])
-         return true;
-   }
-   return false;
+   return keyword_;
 }
 
-void Token::print(std::ofstream &output)
+void Token::print(std::ostream &output)
 {
    if (line_ && col_)
       output << std::endl << line_ << " " << col_ << " ";
-   switch (type_)
+   switch (type())
    {
       case id:
       case begin_stmt:
@@ -75,17 +148,17 @@ void Token::print(std::ofstream &output)
             output << "keyword ";
          else
             output << "identifier ";
-         output << str_ << " " << str_ << std::endl;
+         output << *str_ << " " << *str_ << std::endl;
          break;
       case inum:
-         output << "int " << str_ << " ";
-         if(str_.size() > 10)
+         output << "int " << *str_ << " ";
+         if(str_->size() > 10)
             output << "OUT OF RANGE";
          else
             output << get_int_value();
          break;
       case dnum:
-         output << "double " << str_ << " " << get_double_value();
+         output << "double " << *str_ << " " << get_double_value();
          break;
       case right_square_paren:
       case left_square_paren:
@@ -95,7 +168,7 @@ void Token::print(std::ofstream &output)
       case semicolon:
       case dot:
       case comma:
-         output << "divider " << str_ << " " << str_;
+         output << "divider " << *str_ << " " << *str_;
          break;
       case plus_op:
       case minus_op:
@@ -113,10 +186,10 @@ void Token::print(std::ofstream &output)
       case and_op:
       case mod_op:
       case not_op:
-         output << "op " << str_ << " " << str_;
+         output << "op " << *str_ << " " << *str_;
          break;
       case strng:
-         output << "string " << str_ << " " << str_;
+         output << "string " << *str_ << " " << *str_;
          break;         
    }
 }
@@ -2,6 +2,8 @@
 #ifndef COMPILER_TOKEN_H_
 #define COMPILER_TOKEN_H_
 #include <string>
+#include <unordered_set>
+#include <unordered_map>
 #include <iostream>
 #include <fstream>
 #include <boost/lexical_cast.hpp>
@@ -15,27 +17,40 @@ enum LexemeType
    downto_stmt, type_decl, var_decl, procedure_decl, function_decl, integer_decl, double_decl, array_decl, rec_decl, of_decl, error_lex = -1, 
 };
 
-static std::string keywords[34] = 
-{  
-   "and", "array", "begin", "break", "const", "continue",
-   "div", "do", "downto", "else", "end", "file", "for", 
-   "function", "if", "in", "mod", "nil", "not", "of",
-   "or", "procedure", "program", "record", "repeat",
-   "set", "then", "to", "until", "uses", "var", "while",
-   "with", "xor",
+struct Keyword
+{
+   const char *name;
+   size_t length;
+   LexemeType type;
+   bool reserved;
+};
+
+const Keyword *find_keyword(const char *s, size_t length);
+bool parse_int(const std::string &s, int &value);
+bool parse_double(const std::string &s, double &value);
+
+class StringPool
+{
+   std::unordered_set<std::string> strings_;
+public:
+   const std::string *intern(const std::string &s) { return &*strings_.insert(s).first; }
+   //Takes over the strings of other without moving them; returns where the ones already here went.
+   std::unordered_map<const std::string *, const std::string *> absorb(StringPool &other);
 };
 
 class Token
 {
-   LexemeType type_;
-   size_t line_, col_;
-   std::string str_;
+   static const std::string empty_;
+   const std::string *str_;
+   unsigned line_;
+   //Columns past max_col (about 8.4 million) are stored as max_col.
+   unsigned type_ : 8, keyword_ : 1, col_ : 23;
 public:
-   Token() {};
-   Token(LexemeType t, std::string s = std::string(), size_t l = 1, size_t c = 0): type_(t), str_(s), line_(l), col_(c) {}
-   Token(LexemeType t, const char *s = "", size_t l = 1, size_t c = 0): type_(t), str_(s), line_(l), col_(c) {}
-   Token(const Token &t);
-   void print(std::ofstream &output);
+   static const unsigned max_col = (1u << 23) - 1;
+   Token(): str_(&empty_), line_(1), type_((unsigned char)error_lex), keyword_(false), col_(0) {}
+   Token(LexemeType t, const std::string *s, size_t l = 1, size_t c = 0, bool k = false):
+      str_(s), line_((unsigned)l), type_((unsigned char)t), keyword_(k), col_(c < max_col ? (unsigned)c : max_col) {}
+   void print(std::ostream &output);
    LexemeType type() const;
    bool is_keyword() const;
    const std::string& get_string() const;
@@ -43,7 +58,6 @@ public:
    double get_double_value() const;
    size_t get_line() const;
    size_t get_col() const;
-   ~Token() {}
 };
 
 #endif
\ No newline at end of file
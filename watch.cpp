@@ -0,0 +1,104 @@
+#include "watch.h"
+#include "hash.h"
+#include <sys/stat.h>
+#include <ctime>
+#include <chrono>
+#include <thread>
+
+Watcher::Watcher(const std::string &input, const std::string &output, bool opt):
+   input_name_(input), output_name_(output), optimize_(opt), built_(false), hashed_(false), mtime_(-1), size_(-1), hash_(0) {}
+
+//FNV-1a over the file contents.
+static bool hash_file(const std::string &name, unsigned long long &hash)
+{
+   FILE *input = _fsopen(name.c_str(), "rb", _SH_DENYWR);
+   if (input == nullptr)
+      return false;
+   char buffer[64 * 1024];
+   size_t n;
+   hash = fnv_basis;
+   while ((n = fread(buffer, 1, sizeof(buffer), input)) > 0)
+      hash = fnv1a(buffer, n, hash);
+   fclose(input);
+   return true;
+}
+
+bool Watcher::changed()
+{
+   struct _stat64 st;
+   if (_stat64(input_name_.c_str(), &st) != 0)
+      return false;
+   //A save in the same second as the last one can keep both the time stamp and the size,
+   //so while the stamp is that recent the contents decide.
+   if (st.st_mtime == mtime_ && st.st_size == size_ && time(nullptr) - st.st_mtime > 2)
+      return false;
+   unsigned long long hash;
+   if (!hash_file(input_name_, hash))
+      return false;
+   mtime_ = st.st_mtime;
+   size_ = st.st_size;
+   if (hashed_ && hash == hash_)
+      return false;
+   hashed_ = true;
+   hash_ = hash;
+   return true;
+}
+
+void Watcher::rebuild()
+{
+   built_ = false;
+   parser_.reset(new Parser(*scan_, output_, true));
+   gen_ = std::make_shared<Generator>();
+   scan_->seek(0);
+   parser_->generate(gen_);
+   built_ = true;
+}
+
+void Watcher::compile()
+{
+   FILE *input = _fsopen(input_name_.c_str(), "r", _SH_DENYWR);
+   if (input == nullptr)
+   {
+      std::cout << "Error opening file" << std::endl;
+      return;
+   }
+   auto start = std::chrono::steady_clock::now();
+   output_.open(output_name_, std::ios::out);
+   TokenEdit edit;
+   bool relexed = scan_ && scan_->update(input, edit);
+   if (!relexed)
+   {
+      scan_.reset(new Scanner(input));
+      scan_->tokenize_for_edits(std::thread::hardware_concurrency());
+   }
+   fclose(input);
+
+   bool partial = relexed && built_ && parser_->update(edit, gen_);
+   try
+   {
+      if (!partial)
+         rebuild();
+      if (optimize_)
+         gen_->copy()->write_to_file(output_, true);
+      else
+         parser_->write_to_file(output_);
+   }
+   catch (const CompileError &e)
+   {
+      output_ << e.message;
+      std::cout << e.message << std::endl;
+   }
+   output_.close();
+   auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+   std::cout << output_name_ << (partial ? ": updated in " : ": compiled in ") << ms << " ms" << std::endl;
+}
+
+void Watcher::run()
+{
+   for (;;)
+   {
+      if (changed())
+         compile();
+      std::this_thread::sleep_for(std::chrono::milliseconds(100));
+   }
+}
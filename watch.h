@@ -0,0 +1,28 @@
+#pragma once
+#ifndef COMPILER_WATCH_H_
+#define COMPILER_WATCH_H_
+#include "parser.h"
+
+//Recompiles a source file whenever it changes. The token stream, symbol tables, procedure
+//bodies and generated code stay in memory between compilations, and an edit inside one
+//procedure body is lexed, parsed and generated again on its own.
+class Watcher
+{
+   std::string input_name_, output_name_;
+   bool optimize_, built_, hashed_;
+   long long mtime_, size_;
+   unsigned long long hash_;
+   std::ofstream output_;
+   std::unique_ptr<Scanner> scan_;
+   std::unique_ptr<Parser> parser_;
+   std::shared_ptr<Generator> gen_;
+   bool changed();
+   void compile();
+   void rebuild();
+public:
+   Watcher(const std::string &input, const std::string &output, bool opt);
+   ~Watcher() {}
+   void run();
+};
+
+#endif